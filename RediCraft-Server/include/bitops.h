@@ -0,0 +1,70 @@
+/*
+ * bitops.h
+ * author: Андрій Будильников
+ */
+
+#ifndef REDICRAFT_BITOPS_H
+#define REDICRAFT_BITOPS_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Kernels behind the bitmap commands, which treat a string as bits with bit
+// 0 the most significant bit of its first byte, as Redis does, and behind
+// HyperLogLog merges.
+//
+// Each kernel exists twice: a portable version working on 64-bit words and
+// an AVX2 version working on 32-byte vectors (popcount by nibble lookup
+// with vpshufb). The AVX2 set is compiled on x86 whatever the build flags
+// and picked at run time only if the CPU has AVX2, so one binary runs
+// everywhere and is fast where it can be.
+namespace bitops {
+
+enum class Op {
+    AND,
+    OR,
+    XOR
+};
+
+struct Kernels {
+    const char* name;
+    // Number of set bits in data[0, size)
+    uint64_t (*popcount)(const unsigned char* data, size_t size);
+    // dst[i] = dst[i] op src[i] for i < size
+    void (*combine)(Op op, unsigned char* dst, const unsigned char* src, size_t size);
+    // dst[i] = ~src[i] for i < size; dst may be src
+    void (*invert)(unsigned char* dst, const unsigned char* src, size_t size);
+    // Index of the first byte that is not `skip`, or size if there is none
+    size_t (*find_other_byte)(const unsigned char* data, size_t size, unsigned char skip);
+    // dst[i] = max(dst[i], src[i]) for i < size
+    void (*max_bytes)(unsigned char* dst, const unsigned char* src, size_t size);
+};
+
+// The portable set, always available
+const Kernels& portable_kernels();
+// The fastest set this CPU supports, chosen on first use
+const Kernels& kernels();
+
+inline uint64_t popcount(const unsigned char* data, size_t size) {
+    return kernels().popcount(data, size);
+}
+
+// Bit position of the first bit equal to `bit` in data[0, size), or -1
+inline long long find_bit(const unsigned char* data, size_t size, bool bit) {
+    // A byte of all the other bit holds none of the wanted ones
+    size_t byte = kernels().find_other_byte(data, size, bit ? 0x00 : 0xFF);
+    if (byte == size) {
+        return -1;
+    }
+    unsigned value = bit ? data[byte] : static_cast<unsigned char>(~data[byte]);
+    int offset = 0;
+    while ((value & 0x80) == 0) {
+        value <<= 1;
+        offset++;
+    }
+    return static_cast<long long>(byte) * 8 + offset;
+}
+
+} // namespace bitops
+
+#endif // REDICRAFT_BITOPS_H
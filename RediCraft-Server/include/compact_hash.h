@@ -0,0 +1,218 @@
+/*
+ * compact_hash.h
+ * author: Андрій Будильников
+ */
+
+#ifndef REDICRAFT_COMPACT_HASH_H
+#define REDICRAFT_COMPACT_HASH_H
+
+#include "flat_hash_map.h"
+#include "listpack.h"
+#include "heap_usage.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <variant>
+
+// When a hash moves from the packed encoding to the hash table
+struct HashLimits {
+    // Hashes stay packed in a ListPack up to this many fields, as long as no
+    // field or value is longer than max_listpack_value bytes
+    size_t max_listpack_entries = 128;
+    size_t max_listpack_value = 64;
+};
+
+// Field/value map that starts out packed and becomes a real table when it
+// grows:
+//
+//   LISTPACK  - field and value entries alternate in one buffer; lookups
+//               scan it linearly, which for a few dozen short fields is as
+//               fast as hashing and stays within a few cache lines
+//   HASHTABLE - FlatHashMap, once the hash outgrows the limits above
+//
+// A hash that shrinks keeps its current encoding.
+class CompactHash {
+public:
+    enum class Encoding {
+        LISTPACK,
+        HASHTABLE
+    };
+
+    using Table = FlatHashMap<std::string, std::string>;
+
+    Encoding encoding() const { return static_cast<Encoding>(data_.index()); }
+
+    size_t size() const {
+        if (encoding() == Encoding::LISTPACK) {
+            return std::get<ListPack>(data_).size() / 2;
+        }
+        return std::get<Table>(data_).size();
+    }
+    bool empty() const { return size() == 0; }
+
+    bool contains(const std::string& field) const {
+        if (encoding() == Encoding::LISTPACK) {
+            const ListPack& pack = std::get<ListPack>(data_);
+            return find_field(pack, field) != pack.end_offset();
+        }
+        return std::get<Table>(data_).contains(field);
+    }
+
+    bool get(const std::string& field, std::string& value) const {
+        std::string_view found;
+        if (!find(field, found)) {
+            return false;
+        }
+        value.assign(found);
+        return true;
+    }
+
+    // Like get(), without copying; the view is valid until the hash changes
+    bool find(const std::string& field, std::string_view& value) const {
+        if (encoding() == Encoding::LISTPACK) {
+            const ListPack& pack = std::get<ListPack>(data_);
+            size_t offset = find_field(pack, field);
+            if (offset == pack.end_offset()) {
+                return false;
+            }
+            value = pack.get(pack.next(offset));
+            return true;
+        }
+        const Table& table = std::get<Table>(data_);
+        auto it = table.find(field);
+        if (it == table.end()) {
+            return false;
+        }
+        value = it->second;
+        return true;
+    }
+
+    // Returns true if the field is new, false if an existing value was replaced
+    bool set(const std::string& field, const std::string& value, const HashLimits& limits) {
+        if (encoding() == Encoding::LISTPACK) {
+            ListPack& pack = std::get<ListPack>(data_);
+            bool fits = field.size() <= limits.max_listpack_value && value.size() <= limits.max_listpack_value;
+            size_t offset = find_field(pack, field);
+            if (offset != pack.end_offset()) {
+                if (fits) {
+                    pack.replace(pack.next(offset), value);
+                    return false;
+                }
+            } else if (fits && pack.size() / 2 < limits.max_listpack_entries) {
+                pack.push_back(field);
+                pack.push_back(value);
+                return true;
+            }
+            convert_to_table();
+        }
+        auto result = std::get<Table>(data_).try_emplace(field);
+        if (result.second) {
+            table_strings_ += heap_bytes(result.first->first);
+        } else {
+            table_strings_ -= heap_bytes(result.first->second);
+        }
+        result.first->second = value;
+        table_strings_ += heap_bytes(result.first->second);
+        return result.second;
+    }
+
+    // Returns false if the field was not present
+    bool erase(const std::string& field) {
+        if (encoding() == Encoding::LISTPACK) {
+            ListPack& pack = std::get<ListPack>(data_);
+            size_t offset = find_field(pack, field);
+            if (offset == pack.end_offset()) {
+                return false;
+            }
+            pack.erase(offset); // field
+            pack.erase(offset); // its value, which moved up to the same offset
+            return true;
+        }
+        Table& table = std::get<Table>(data_);
+        auto it = table.find(field);
+        if (it == table.end()) {
+            return false;
+        }
+        table_strings_ -= heap_bytes(it->first) + heap_bytes(it->second);
+        table.erase(it);
+        return true;
+    }
+
+    // Heap bytes owned by the hash
+    size_t memory_usage() const {
+        if (encoding() == Encoding::LISTPACK) {
+            return std::get<ListPack>(data_).memory_usage();
+        }
+        return heap_block_size(std::get<Table>(data_).allocated_bytes()) + table_strings_;
+    }
+
+    // Drops spare capacity left by growing the packed encoding; worth
+    // calling once after a batch of writes
+    void shrink_to_fit() {
+        if (encoding() == Encoding::LISTPACK) {
+            std::get<ListPack>(data_).shrink_to_fit();
+        }
+    }
+
+    // Calls f(std::string_view field, std::string_view value) for every
+    // field, in no particular order
+    template <typename F>
+    void for_each(F&& f) const {
+        if (encoding() == Encoding::LISTPACK) {
+            const ListPack& pack = std::get<ListPack>(data_);
+            for (size_t offset = pack.begin_offset(); offset != pack.end_offset();) {
+                size_t value_offset = pack.next(offset);
+                f(pack.get(offset), pack.get(value_offset));
+                offset = pack.next(value_offset);
+            }
+            return;
+        }
+        for (const auto& pair : std::get<Table>(data_)) {
+            f(std::string_view(pair.first), std::string_view(pair.second));
+        }
+    }
+
+    // One step of an HSCAN: a packed hash is visited whole and the walk
+    // ends (returns 0); a table visits one home, see FlatHashTable::scan()
+    template <typename F>
+    uint64_t scan(uint64_t cursor, F&& f) const {
+        if (encoding() == Encoding::LISTPACK) {
+            for_each(f);
+            return 0;
+        }
+        return std::get<Table>(data_).scan(cursor, [&f](const std::pair<std::string, std::string>& pair) {
+            f(std::string_view(pair.first), std::string_view(pair.second));
+        });
+    }
+
+private:
+    // Offset of the field entry, or end_offset(); values are skipped so a
+    // value equal to the field name never matches
+    static size_t find_field(const ListPack& pack, std::string_view field) {
+        for (size_t offset = pack.begin_offset(); offset != pack.end_offset();) {
+            if (pack.get(offset) == field) {
+                return offset;
+            }
+            offset = pack.next(pack.next(offset));
+        }
+        return pack.end_offset();
+    }
+
+    void convert_to_table() {
+        Table table;
+        table.reserve(size() + 1);
+        table_strings_ = 0;
+        for_each([this, &table](std::string_view field, std::string_view value) {
+            auto it = table.emplace(std::string(field), std::string(value)).first;
+            table_strings_ += heap_bytes(it->first) + heap_bytes(it->second);
+        });
+        data_ = std::move(table);
+    }
+
+    std::variant<ListPack, Table> data_;
+    // Heap bytes of the fields and values once the hash is a table
+    size_t table_strings_ = 0;
+};
+
+#endif // REDICRAFT_COMPACT_HASH_H
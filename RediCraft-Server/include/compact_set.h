@@ -0,0 +1,252 @@
+/*
+ * compact_set.h
+ * author: Андрій Будильников
+ */
+
+#ifndef REDICRAFT_COMPACT_SET_H
+#define REDICRAFT_COMPACT_SET_H
+
+#include "flat_hash_map.h"
+#include "intset.h"
+#include "listpack.h"
+#include "heap_usage.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <variant>
+
+// When a set moves from a compact encoding to the hash table
+struct SetLimits {
+    // Sets holding only integers use an IntSet up to this many members
+    size_t max_intset_entries = 512;
+    // Other sets stay packed in a ListPack up to this many members, as long
+    // as no member is longer than max_listpack_value bytes
+    size_t max_listpack_entries = 128;
+    size_t max_listpack_value = 64;
+};
+
+// Set of strings that picks its representation by content and size:
+//
+//   INTSET    - sorted integer array, for sets of integers
+//   LISTPACK  - members packed into one buffer and scanned linearly
+//   HASHTABLE - FlatHashSet, once the set outgrows the limits above
+//
+// Conversions only go towards HASHTABLE; a set that shrinks keeps its
+// current encoding. Members read back exactly as they were added, since
+// only canonical integer strings are stored as integers.
+class CompactSet {
+public:
+    enum class Encoding {
+        INTSET,
+        LISTPACK,
+        HASHTABLE
+    };
+
+    using Table = FlatHashSet<std::string>;
+
+    Encoding encoding() const { return static_cast<Encoding>(data_.index()); }
+
+    size_t size() const {
+        switch (encoding()) {
+            case Encoding::INTSET:
+                return std::get<IntSet>(data_).size();
+            case Encoding::LISTPACK:
+                return std::get<ListPack>(data_).size();
+            default:
+                return std::get<Table>(data_).size();
+        }
+    }
+    bool empty() const { return size() == 0; }
+
+    bool contains(const std::string& member) const {
+        switch (encoding()) {
+            case Encoding::INTSET: {
+                long long value;
+                return string_to_int64(member, value) && std::get<IntSet>(data_).contains(value);
+            }
+            case Encoding::LISTPACK: {
+                const ListPack& pack = std::get<ListPack>(data_);
+                return pack.find(member) != pack.end_offset();
+            }
+            default:
+                return std::get<Table>(data_).contains(member);
+        }
+    }
+
+    // Returns false if the member was already present
+    bool insert(const std::string& member, const SetLimits& limits) {
+        if (empty() && encoding() == Encoding::INTSET) {
+            // The first member decides where a new set starts
+            long long value;
+            if (!string_to_int64(member, value) || limits.max_intset_entries == 0) {
+                convert(fits_listpack(member, 1, limits) ? Encoding::LISTPACK : Encoding::HASHTABLE);
+            }
+        }
+
+        switch (encoding()) {
+            case Encoding::INTSET: {
+                long long value;
+                if (string_to_int64(member, value)) {
+                    IntSet& ints = std::get<IntSet>(data_);
+                    if (ints.contains(value)) {
+                        return false;
+                    }
+                    if (ints.size() < limits.max_intset_entries) {
+                        return ints.insert(value);
+                    }
+                    convert(Encoding::HASHTABLE);
+                } else {
+                    if (contains(member)) {
+                        return false;
+                    }
+                    convert(fits_listpack(member, size() + 1, limits) ? Encoding::LISTPACK : Encoding::HASHTABLE);
+                }
+                return insert(member, limits);
+            }
+            case Encoding::LISTPACK: {
+                ListPack& pack = std::get<ListPack>(data_);
+                if (pack.find(member) != pack.end_offset()) {
+                    return false;
+                }
+                if (fits_listpack(member, pack.size() + 1, limits)) {
+                    pack.push_back(member);
+                    return true;
+                }
+                convert(Encoding::HASHTABLE);
+                return insert_into_table(member);
+            }
+            default:
+                return insert_into_table(member);
+        }
+    }
+
+    // Returns false if the member was not present
+    bool erase(const std::string& member) {
+        switch (encoding()) {
+            case Encoding::INTSET: {
+                long long value;
+                return string_to_int64(member, value) && std::get<IntSet>(data_).erase(value);
+            }
+            case Encoding::LISTPACK: {
+                ListPack& pack = std::get<ListPack>(data_);
+                size_t offset = pack.find(member);
+                if (offset == pack.end_offset()) {
+                    return false;
+                }
+                pack.erase(offset);
+                return true;
+            }
+            default: {
+                Table& table = std::get<Table>(data_);
+                auto it = table.find(member);
+                if (it == table.end()) {
+                    return false;
+                }
+                table_strings_ -= heap_bytes(*it);
+                table.erase(it);
+                return true;
+            }
+        }
+    }
+
+    // Heap bytes owned by the set
+    size_t memory_usage() const {
+        switch (encoding()) {
+            case Encoding::INTSET:
+                return std::get<IntSet>(data_).memory_usage();
+            case Encoding::LISTPACK:
+                return std::get<ListPack>(data_).memory_usage();
+            default:
+                return heap_block_size(std::get<Table>(data_).allocated_bytes()) + table_strings_;
+        }
+    }
+
+    // Drops spare capacity left by growing a compact encoding; worth calling
+    // once after a batch of inserts
+    void shrink_to_fit() {
+        switch (encoding()) {
+            case Encoding::INTSET:
+                std::get<IntSet>(data_).shrink_to_fit();
+                break;
+            case Encoding::LISTPACK:
+                std::get<ListPack>(data_).shrink_to_fit();
+                break;
+            default:
+                break;
+        }
+    }
+
+    // Calls f(std::string_view) for every member, in no particular order
+    template <typename F>
+    void for_each(F&& f) const {
+        switch (encoding()) {
+            case Encoding::INTSET: {
+                const IntSet& ints = std::get<IntSet>(data_);
+                for (size_t i = 0; i < ints.size(); ++i) {
+                    std::string text = std::to_string(ints.at(i));
+                    f(std::string_view(text));
+                }
+                break;
+            }
+            case Encoding::LISTPACK:
+                for (std::string_view member : std::get<ListPack>(data_)) {
+                    f(member);
+                }
+                break;
+            default:
+                for (const auto& member : std::get<Table>(data_)) {
+                    f(std::string_view(member));
+                }
+                break;
+        }
+    }
+
+    // One step of an SSCAN: packed sets are visited whole and the walk ends
+    // (returns 0); a table visits one home, see FlatHashTable::scan()
+    template <typename F>
+    uint64_t scan(uint64_t cursor, F&& f) const {
+        if (encoding() != Encoding::HASHTABLE) {
+            for_each(f);
+            return 0;
+        }
+        return std::get<Table>(data_).scan(cursor, [&f](const std::string& member) {
+            f(std::string_view(member));
+        });
+    }
+
+private:
+    static bool fits_listpack(const std::string& member, size_t new_size, const SetLimits& limits) {
+        return new_size <= limits.max_listpack_entries && member.size() <= limits.max_listpack_value;
+    }
+
+    void convert(Encoding target) {
+        if (target == Encoding::LISTPACK) {
+            ListPack pack;
+            for_each([&pack](std::string_view member) { pack.push_back(member); });
+            data_ = std::move(pack);
+        } else {
+            Table table;
+            table.reserve(size() + 1);
+            table_strings_ = 0;
+            for_each([this, &table](std::string_view member) {
+                table_strings_ += heap_bytes(*table.insert(std::string(member)).first);
+            });
+            data_ = std::move(table);
+        }
+    }
+
+    bool insert_into_table(const std::string& member) {
+        auto result = std::get<Table>(data_).insert(member);
+        if (result.second) {
+            table_strings_ += heap_bytes(*result.first);
+        }
+        return result.second;
+    }
+
+    std::variant<IntSet, ListPack, Table> data_;
+    // Heap bytes of the members once the set is a table
+    size_t table_strings_ = 0;
+};
+
+#endif // REDICRAFT_COMPACT_SET_H
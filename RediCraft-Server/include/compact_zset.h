@@ -0,0 +1,323 @@
+/*
+ * compact_zset.h
+ * author: Андрій Будильников
+ */
+
+#ifndef REDICRAFT_COMPACT_ZSET_H
+#define REDICRAFT_COMPACT_ZSET_H
+
+#include "flat_hash_map.h"
+#include "listpack.h"
+#include "skiplist.h"
+#include "heap_usage.h"
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <variant>
+
+// When a sorted set moves from the packed encoding to the skiplist
+struct ZSetLimits {
+    // Sorted sets stay packed in a ListPack up to this many members, as long
+    // as no member is longer than max_listpack_value bytes
+    size_t max_listpack_entries = 128;
+    size_t max_listpack_value = 64;
+};
+
+// Members with scores, kept in (score, member) order:
+//
+//   LISTPACK - member and score entries alternate in one buffer, in order;
+//              every operation is a linear scan, which for a small
+//              leaderboard stays within a few cache lines
+//   SKIPLIST - a ZSkipList for order and rank, plus a hash index from
+//              member to its node for O(1) score lookups; the index keys
+//              view the member bytes inside the nodes. Kept behind a
+//              pointer so every Value stays as small as a packed one.
+//
+// Scores are stored as the raw 8 bytes of the double, so they read back
+// exactly and compare without parsing. A sorted set that shrinks keeps its
+// current encoding.
+class CompactZSet {
+public:
+    enum class Encoding {
+        LISTPACK,
+        SKIPLIST
+    };
+
+    CompactZSet() = default;
+    CompactZSet(const CompactZSet& other) : data_(ListPack()) {
+        if (other.encoding() == Encoding::LISTPACK) {
+            data_ = std::get<ListPack>(other.data_);
+            return;
+        }
+        // The index views the other set's nodes, so it is rebuilt
+        data_ = std::make_unique<SkipList>();
+        SkipList& list = skiplist();
+        list.index.reserve(other.size());
+        other.for_each([&list](std::string_view member, double score) {
+            ZSkipList::Node* node = list.nodes.insert(score, member);
+            list.index.try_emplace(node->member(), node);
+        });
+    }
+    CompactZSet(CompactZSet&&) = default;
+    CompactZSet& operator=(const CompactZSet& other) {
+        if (this != &other) {
+            *this = CompactZSet(other);
+        }
+        return *this;
+    }
+    CompactZSet& operator=(CompactZSet&&) = default;
+
+    Encoding encoding() const { return static_cast<Encoding>(data_.index()); }
+
+    size_t size() const {
+        if (encoding() == Encoding::LISTPACK) {
+            return std::get<ListPack>(data_).size() / 2;
+        }
+        return skiplist().nodes.size();
+    }
+    bool empty() const { return size() == 0; }
+
+    bool score(std::string_view member, double& score) const {
+        if (encoding() == Encoding::LISTPACK) {
+            const ListPack& pack = std::get<ListPack>(data_);
+            size_t offset = find_member(pack, member);
+            if (offset == pack.end_offset()) {
+                return false;
+            }
+            score = read_score(pack, pack.next(offset));
+            return true;
+        }
+        const SkipList& list = skiplist();
+        auto it = list.index.find(member);
+        if (it == list.index.end()) {
+            return false;
+        }
+        score = it->second->score;
+        return true;
+    }
+
+    // Adds the member or moves it to a new score; returns true if it is new
+    bool add(std::string_view member, double score, const ZSetLimits& limits) {
+        if (encoding() == Encoding::LISTPACK) {
+            ListPack& pack = std::get<ListPack>(data_);
+            size_t offset = find_member(pack, member);
+            bool is_new = offset == pack.end_offset();
+            if (!is_new) {
+                if (read_score(pack, pack.next(offset)) == score) {
+                    return false;
+                }
+                pack.erase(offset);
+                pack.erase(offset);
+            }
+            if (member.size() <= limits.max_listpack_value && pack.size() / 2 < limits.max_listpack_entries) {
+                insert_sorted(pack, member, score);
+                return is_new;
+            }
+            convert_to_skiplist();
+            SkipList& list = skiplist();
+            ZSkipList::Node* node = list.nodes.insert(score, member);
+            list.index.try_emplace(node->member(), node);
+            return is_new;
+        }
+        SkipList& list = skiplist();
+        auto it = list.index.find(member);
+        if (it == list.index.end()) {
+            ZSkipList::Node* node = list.nodes.insert(score, member);
+            list.index.try_emplace(node->member(), node);
+            return true;
+        }
+        ZSkipList::Node* node = it->second;
+        if (node->score != score) {
+            ZSkipList::Node* moved = list.nodes.update_score(node, score);
+            if (moved != node) {
+                // The old key viewed the freed node
+                list.index.erase(it);
+                list.index.try_emplace(moved->member(), moved);
+            }
+        }
+        return false;
+    }
+
+    // Returns false if the member was not present
+    bool erase(std::string_view member) {
+        if (encoding() == Encoding::LISTPACK) {
+            ListPack& pack = std::get<ListPack>(data_);
+            size_t offset = find_member(pack, member);
+            if (offset == pack.end_offset()) {
+                return false;
+            }
+            pack.erase(offset); // member
+            pack.erase(offset); // its score, which moved up to the same offset
+            return true;
+        }
+        SkipList& list = skiplist();
+        auto it = list.index.find(member);
+        if (it == list.index.end()) {
+            return false;
+        }
+        ZSkipList::Node* node = it->second;
+        list.index.erase(it);
+        list.nodes.erase(node->score, node->member());
+        return true;
+    }
+
+    // 0-based position in ascending order (descending with reverse), or -1
+    long long rank(std::string_view member, bool reverse) const {
+        long long position = -1;
+        if (encoding() == Encoding::LISTPACK) {
+            const ListPack& pack = std::get<ListPack>(data_);
+            long long index = 0;
+            for (size_t offset = pack.begin_offset(); offset != pack.end_offset(); ++index) {
+                if (pack.get(offset) == member) {
+                    position = index;
+                    break;
+                }
+                offset = pack.next(pack.next(offset));
+            }
+        } else {
+            const SkipList& list = skiplist();
+            auto it = list.index.find(member);
+            if (it != list.index.end()) {
+                position = static_cast<long long>(list.nodes.rank(it->second->score, it->second->member())) - 1;
+            }
+        }
+        if (position < 0) {
+            return -1;
+        }
+        return reverse ? static_cast<long long>(size()) - 1 - position : position;
+    }
+
+    // Calls f(std::string_view member, double score) for the members at
+    // 0-based positions first..last (inclusive, both within size()), in
+    // ascending order, or descending when reverse counts positions from the
+    // highest score
+    template <typename F>
+    void for_range(size_t first, size_t last, bool reverse, F&& f) const {
+        if (encoding() == Encoding::LISTPACK) {
+            const ListPack& pack = std::get<ListPack>(data_);
+            size_t count = size();
+            size_t start = reverse ? count - 1 - last : first;
+            size_t end = reverse ? count - 1 - first : last;
+            if (!reverse) {
+                size_t offset = skip_pairs(pack, pack.begin_offset(), start);
+                for (size_t i = start; i <= end; ++i) {
+                    size_t score_offset = pack.next(offset);
+                    f(pack.get(offset), read_score(pack, score_offset));
+                    offset = pack.next(score_offset);
+                }
+                return;
+            }
+            // Walk back from the end: the pair at `end` first
+            size_t offset = pack.end_offset();
+            for (size_t i = count; i > end + 1; --i) {
+                offset = pack.prev(pack.prev(offset));
+            }
+            for (size_t i = end + 1; i > start; --i) {
+                size_t score_offset = pack.prev(offset);
+                size_t member_offset = pack.prev(score_offset);
+                f(pack.get(member_offset), read_score(pack, score_offset));
+                offset = member_offset;
+            }
+            return;
+        }
+        const ZSkipList& nodes = skiplist().nodes;
+        size_t count = nodes.size();
+        ZSkipList::Node* node = nodes.at_rank(reverse ? count - first : first + 1);
+        for (size_t i = first; i <= last && node; ++i) {
+            f(node->member(), node->score);
+            node = reverse ? node->prev() : node->next();
+        }
+    }
+
+    // Calls f(std::string_view member, double score) for every member in
+    // ascending order
+    template <typename F>
+    void for_each(F&& f) const {
+        if (!empty()) {
+            for_range(0, size() - 1, false, f);
+        }
+    }
+
+    // Heap bytes owned by the sorted set
+    size_t memory_usage() const {
+        if (encoding() == Encoding::LISTPACK) {
+            return std::get<ListPack>(data_).memory_usage();
+        }
+        const SkipList& list = skiplist();
+        return heap_block_size(sizeof(SkipList)) + list.nodes.memory_usage() +
+               heap_block_size(list.index.allocated_bytes());
+    }
+
+    // Drops spare capacity left by growing the packed encoding
+    void shrink_to_fit() {
+        if (encoding() == Encoding::LISTPACK) {
+            std::get<ListPack>(data_).shrink_to_fit();
+        }
+    }
+
+private:
+    struct SkipList {
+        ZSkipList nodes;
+        FlatHashMap<std::string_view, ZSkipList::Node*> index;
+    };
+
+    SkipList& skiplist() { return *std::get<std::unique_ptr<SkipList>>(data_); }
+    const SkipList& skiplist() const { return *std::get<std::unique_ptr<SkipList>>(data_); }
+
+    static double read_score(const ListPack& pack, size_t offset) {
+        std::string_view bytes = pack.get(offset);
+        double score;
+        std::memcpy(&score, bytes.data(), sizeof(score));
+        return score;
+    }
+
+    // Offset of the member entry, or end_offset(); scores are skipped
+    static size_t find_member(const ListPack& pack, std::string_view member) {
+        for (size_t offset = pack.begin_offset(); offset != pack.end_offset();) {
+            if (pack.get(offset) == member) {
+                return offset;
+            }
+            offset = pack.next(pack.next(offset));
+        }
+        return pack.end_offset();
+    }
+
+    static size_t skip_pairs(const ListPack& pack, size_t offset, size_t pairs) {
+        for (size_t i = 0; i < pairs; ++i) {
+            offset = pack.next(pack.next(offset));
+        }
+        return offset;
+    }
+
+    static void insert_sorted(ListPack& pack, std::string_view member, double score) {
+        size_t offset = pack.begin_offset();
+        while (offset != pack.end_offset()) {
+            size_t score_offset = pack.next(offset);
+            double other = read_score(pack, score_offset);
+            if (score < other || (score == other && member < pack.get(offset))) {
+                break;
+            }
+            offset = pack.next(score_offset);
+        }
+        char bytes[sizeof(score)];
+        std::memcpy(bytes, &score, sizeof(score));
+        offset = pack.insert(offset, member);
+        pack.insert(pack.next(offset), std::string_view(bytes, sizeof(bytes)));
+    }
+
+    void convert_to_skiplist() {
+        auto list = std::make_unique<SkipList>();
+        list->index.reserve(size() + 1);
+        for_each([&list](std::string_view member, double score) {
+            ZSkipList::Node* node = list->nodes.insert(score, member);
+            list->index.try_emplace(node->member(), node);
+        });
+        data_ = std::move(list);
+    }
+
+    std::variant<ListPack, std::unique_ptr<SkipList>> data_;
+};
+
+#endif // REDICRAFT_COMPACT_ZSET_H
@@ -32,6 +32,21 @@ public:
     bool isPersistenceEnabled() const;
     std::string getPersistenceFile() const;
     int getPersistenceInterval() const; // in seconds
+    int getStorageShards() const; // 0 = pick from hardware threads
+    
+    // Compact encoding limits for small values
+    int getSetMaxIntsetEntries() const;
+    int getSetMaxListpackEntries() const;
+    int getSetMaxListpackValue() const; // in bytes
+    int getHashMaxListpackEntries() const;
+    int getHashMaxListpackValue() const; // in bytes
+    int getZsetMaxListpackEntries() const;
+    int getZsetMaxListpackValue() const; // in bytes
+    int getHllSparseMaxBytes() const;
+    
+    // Memory limit and what to evict when it is reached
+    long long getMaxMemory() const; // in bytes, 0 = no limit
+    std::string getMaxMemoryPolicy() const;
     
     // Replication configuration
     bool isReplicationEnabled() const;
@@ -51,6 +66,17 @@ public:
     void setPersistenceEnabled(bool enabled);
     void setPersistenceFile(const std::string& filename);
     void setPersistenceInterval(int interval);
+    void setStorageShards(int shards);
+    void setSetMaxIntsetEntries(int entries);
+    void setSetMaxListpackEntries(int entries);
+    void setSetMaxListpackValue(int bytes);
+    void setHashMaxListpackEntries(int entries);
+    void setHashMaxListpackValue(int bytes);
+    void setZsetMaxListpackEntries(int entries);
+    void setZsetMaxListpackValue(int bytes);
+    void setHllSparseMaxBytes(int bytes);
+    void setMaxMemory(long long bytes);
+    void setMaxMemoryPolicy(const std::string& policy);
     
     // Set replication configuration
     void setReplicationEnabled(bool enabled);
@@ -70,6 +96,17 @@ private:
     bool persistence_enabled_;
     std::string persistence_file_;
     int persistence_interval_;
+    int storage_shards_;
+    int set_max_intset_entries_;
+    int set_max_listpack_entries_;
+    int set_max_listpack_value_;
+    int hash_max_listpack_entries_;
+    int hash_max_listpack_value_;
+    int zset_max_listpack_entries_;
+    int zset_max_listpack_value_;
+    int hll_sparse_max_bytes_;
+    long long max_memory_;
+    std::string max_memory_policy_;
     
     // Replication settings
     bool replication_enabled_;
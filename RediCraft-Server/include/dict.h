@@ -0,0 +1,282 @@
+/*
+ * dict.h
+ * author: Андрій Будильников
+ */
+
+#ifndef REDICRAFT_DICT_H
+#define REDICRAFT_DICT_H
+
+#include "flat_hash_map.h"
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <utility>
+
+// Hash map that grows without stopping the world.
+//
+// A FlatHashMap that runs out of room rehashes every element at once, which
+// holds the caller's lock for as long as it takes to move the whole table.
+// Dict instead keeps two tables while it grows: new elements go into the
+// larger table, and every mutating call moves a few slots across from the
+// old one. rehash_step() lets an idle timer finish the move early. Lookups
+// check both tables, so const lookups never modify the dict and are safe
+// under a shared lock.
+//
+// Like FlatHashMap, any mutating call may move elements and invalidates
+// pointers, references and iterators.
+template <typename Key, typename Value, typename Hash = std::hash<Key>, typename KeyEqual = std::equal_to<Key>>
+class Dict {
+public:
+    using Table = FlatHashMap<Key, Value, Hash, KeyEqual>;
+    using key_type = Key;
+    using mapped_type = Value;
+    using value_type = typename Table::value_type;
+    using size_type = size_t;
+
+    // Slots of the old table visited per mutating call while rehashing
+    static constexpr size_t kRehashSlotsPerStep = 32;
+    // Tables this small are cheaper to copy in one go
+    static constexpr size_t kMinIncrementalCapacity = 1023;
+
+    template <bool IsConst>
+    class basic_iterator {
+        friend class Dict;
+        using TableIterator = typename std::conditional<IsConst, typename Table::const_iterator,
+                                                        typename Table::iterator>::type;
+        using TablePtr = typename std::conditional<IsConst, const Table*, Table*>::type;
+
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = typename Dict::value_type;
+        using difference_type = std::ptrdiff_t;
+        using reference = typename std::iterator_traits<TableIterator>::reference;
+        using pointer = typename std::iterator_traits<TableIterator>::pointer;
+
+        basic_iterator() = default;
+        template <bool WasConst, typename = typename std::enable_if<IsConst && !WasConst>::type>
+        basic_iterator(const basic_iterator<WasConst>& other)
+            : it_(other.it_), in_old_(other.in_old_), main_(other.main_) {}
+
+        reference operator*() const { return *it_; }
+        pointer operator->() const { return &*it_; }
+
+        basic_iterator& operator++() {
+            ++it_;
+            advance_past_old();
+            return *this;
+        }
+        basic_iterator operator++(int) {
+            basic_iterator copy = *this;
+            ++*this;
+            return copy;
+        }
+
+        bool operator==(const basic_iterator& other) const { return it_ == other.it_ && in_old_ == other.in_old_; }
+        bool operator!=(const basic_iterator& other) const { return !(*this == other); }
+
+    private:
+        template <bool>
+        friend class basic_iterator;
+
+        basic_iterator(TableIterator it, bool in_old, TablePtr main)
+            : it_(it), in_old_(in_old), main_(main) {
+            advance_past_old();
+        }
+
+        // The old table is walked first, then the main one
+        void advance_past_old() {
+            if (in_old_ && it_ == TableIterator()) {
+                in_old_ = false;
+                it_ = main_->begin();
+            }
+        }
+
+        TableIterator it_;
+        bool in_old_ = false;
+        TablePtr main_ = nullptr;
+    };
+
+    using iterator = basic_iterator<false>;
+    using const_iterator = basic_iterator<true>;
+
+    iterator begin() { return iterator(old_.begin(), true, &main_); }
+    iterator end() { return iterator(main_.end(), false, &main_); }
+    const_iterator begin() const { return const_iterator(old_.begin(), true, &main_); }
+    const_iterator end() const { return const_iterator(main_.end(), false, &main_); }
+
+    size_t size() const { return main_.size() + old_.size(); }
+    bool empty() const { return size() == 0; }
+    size_t capacity() const { return main_.capacity() + old_.capacity(); }
+    size_t allocated_bytes() const { return main_.allocated_bytes() + old_.allocated_bytes(); }
+    bool is_rehashing() const { return old_.capacity() != 0; }
+
+    void clear() {
+        main_.clear();
+        old_.clear();
+        rehash_index_ = 0;
+    }
+
+    const_iterator find(const Key& key) const {
+        if (is_rehashing()) {
+            auto it = old_.find(key);
+            if (it != old_.end()) {
+                return const_iterator(it, true, &main_);
+            }
+        }
+        return const_iterator(main_.find(key), false, &main_);
+    }
+
+    iterator find(const Key& key) {
+        rehash_step(kRehashSlotsPerStep);
+        if (is_rehashing()) {
+            auto it = old_.find(key);
+            if (it != old_.end()) {
+                return iterator(it, true, &main_);
+            }
+        }
+        return iterator(main_.find(key), false, &main_);
+    }
+
+    // A pseudo-random element chosen by `seed`, or nullptr if the dict is
+    // empty. It scans forward from a random slot to the next full one, so
+    // elements after a run of empty slots come up more often; good enough
+    // for sampling, not for anything that needs a uniform pick.
+    const value_type* sample(size_t seed) const {
+        if (empty()) {
+            return nullptr;
+        }
+        // Pick a table in proportion to its share of the elements
+        const Table& table = seed % size() < old_.size() ? old_ : main_;
+        size_t capacity = table.capacity();
+        size_t start = (seed / 7) % capacity;
+        for (size_t i = 0; i < capacity; ++i) {
+            size_t index = start + i < capacity ? start + i : start + i - capacity;
+            if (table.full_at(index)) {
+                return &table.slot_at(index);
+            }
+        }
+        return nullptr;
+    }
+
+    // One step of a SCAN over both tables; see FlatHashTable::scan(). While
+    // rehashing, the home at `cursor` in the smaller table is visited along
+    // with every home of the larger table that folds onto it, so the walk
+    // keeps its guarantees while elements move across.
+    template <typename F>
+    uint64_t scan(uint64_t cursor, F&& f) const {
+        if (!is_rehashing() || main_.capacity() == 0) {
+            const Table& table = is_rehashing() ? old_ : main_;
+            return table.scan(cursor, f);
+        }
+        const Table& small = old_.capacity() < main_.capacity() ? old_ : main_;
+        const Table& large = old_.capacity() < main_.capacity() ? main_ : old_;
+        uint64_t small_mask = small.capacity();
+        uint64_t large_mask = large.capacity();
+        small.for_each_at_home(static_cast<size_t>(cursor), f);
+        do {
+            large.for_each_at_home(static_cast<size_t>(cursor), f);
+            cursor = flat_hash_detail::next_scan_cursor(cursor, large_mask);
+        } while (cursor & (small_mask ^ large_mask));
+        return cursor;
+    }
+
+    size_t count(const Key& key) const { return find(key) == end() ? 0 : 1; }
+    bool contains(const Key& key) const { return count(key) != 0; }
+
+    template <typename K, typename... Args>
+    std::pair<iterator, bool> try_emplace(K&& key, Args&&... args) {
+        auto it = find(key);
+        if (it != end()) {
+            return {it, false};
+        }
+        prepare_insert();
+        auto result = main_.try_emplace(std::forward<K>(key), std::forward<Args>(args)...);
+        return {iterator(result.first, false, &main_), true};
+    }
+
+    Value& operator[](const Key& key) { return try_emplace(key).first->second; }
+    Value& operator[](Key&& key) { return try_emplace(std::move(key)).first->second; }
+
+    size_t erase(const Key& key) {
+        auto it = find(key);
+        if (it == end()) {
+            return 0;
+        }
+        erase(it);
+        return 1;
+    }
+
+    void erase(iterator it) {
+        if (it.in_old_) {
+            old_.erase(typename Table::const_iterator(it.it_));
+        } else {
+            main_.erase(typename Table::const_iterator(it.it_));
+            maybe_shrink();
+        }
+    }
+
+    // Moves up to `slots` slots of the old table into the main one. Returns
+    // true while there is rehashing work left.
+    bool rehash_step(size_t slots) {
+        if (!is_rehashing()) {
+            return false;
+        }
+        size_t capacity = old_.capacity();
+        size_t end = rehash_index_ + slots < capacity ? rehash_index_ + slots : capacity;
+        for (; rehash_index_ < end; ++rehash_index_) {
+            if (old_.full_at(rehash_index_)) {
+                main_.insert_unique(std::move(old_.slot_at(rehash_index_)));
+                old_.erase_index(rehash_index_);
+            }
+        }
+        if (rehash_index_ >= capacity || old_.empty()) {
+            old_.clear();
+            rehash_index_ = 0;
+            return false;
+        }
+        return true;
+    }
+
+private:
+    // Makes sure the main table can take one more element without running
+    // its own stop-the-world rehash
+    void prepare_insert() {
+        if (main_.growth_left() > 0) {
+            return;
+        }
+        if (is_rehashing()) {
+            // The new table filled up before the old one drained; this needs
+            // far more inserts than steps, so finishing the move is rare
+            while (rehash_step(main_.capacity())) {
+            }
+        }
+        size_t capacity = main_.capacity();
+        if (capacity < kMinIncrementalCapacity) {
+            // Let the table grow in place
+            return;
+        }
+        // Mostly tombstones: rebuild at the same size, otherwise double
+        start_rehash(main_.size() * 32 <= capacity * 25 ? main_.size() * 2 : capacity * 2);
+    }
+
+    void maybe_shrink() {
+        // Give memory back after mass deletes (e.g. a wave of expired keys)
+        size_t capacity = main_.capacity();
+        if (!is_rehashing() && capacity > kMinIncrementalCapacity && main_.size() * 16 < capacity) {
+            start_rehash(main_.size() * 2);
+        }
+    }
+
+    void start_rehash(size_t target_size) {
+        old_ = std::move(main_);
+        main_ = Table();
+        main_.reserve(target_size);
+        rehash_index_ = 0;
+    }
+
+    Table main_;
+    Table old_;
+    size_t rehash_index_ = 0;
+};
+
+#endif // REDICRAFT_DICT_H
@@ -0,0 +1,122 @@
+/*
+ * eviction.h
+ * author: Андрій Будильников
+ */
+
+#ifndef REDICRAFT_EVICTION_H
+#define REDICRAFT_EVICTION_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// What Storage does once used memory passes maxmemory
+enum class EvictionPolicy {
+    NOEVICTION,   // refuse writes that could add memory
+    ALLKEYS_LRU,  // evict the least recently used of a few sampled keys
+    ALLKEYS_LFU,  // evict the least frequently used of a few sampled keys
+    VOLATILE_TTL  // evict the key with a TTL that expires soonest
+};
+
+// Accepts the Redis names ("allkeys-lru" and so on)
+inline bool parse_eviction_policy(const std::string& name, EvictionPolicy& policy) {
+    if (name == "noeviction") {
+        policy = EvictionPolicy::NOEVICTION;
+    } else if (name == "allkeys-lru") {
+        policy = EvictionPolicy::ALLKEYS_LRU;
+    } else if (name == "allkeys-lfu") {
+        policy = EvictionPolicy::ALLKEYS_LFU;
+    } else if (name == "volatile-ttl") {
+        policy = EvictionPolicy::VOLATILE_TTL;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+inline const char* eviction_policy_name(EvictionPolicy policy) {
+    switch (policy) {
+        case EvictionPolicy::ALLKEYS_LRU:
+            return "allkeys-lru";
+        case EvictionPolicy::ALLKEYS_LFU:
+            return "allkeys-lfu";
+        case EvictionPolicy::VOLATILE_TTL:
+            return "volatile-ttl";
+        default:
+            return "noeviction";
+    }
+}
+
+// 24 bits of access history kept in every value, read the same way Redis
+// reads its robj lru field:
+//
+//   LRU - the coarse clock (seconds, wrapping) of the last access
+//   LFU - 16 bits of minutes of the last decay, then an 8-bit logarithmic
+//         access counter
+//
+// Readers update it under a shared lock, so it is an atomic. Nothing
+// synchronises on it, so callers pass std::memory_order_relaxed and a read
+// pays for no fence; a lost update only makes the estimate slightly worse.
+class AccessStamp {
+public:
+    AccessStamp() = default;
+    AccessStamp(const AccessStamp& other) : bits_(other.load(std::memory_order_relaxed)) {}
+    AccessStamp& operator=(const AccessStamp& other) {
+        store(other.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        return *this;
+    }
+
+    uint32_t load(std::memory_order order) const { return bits_.load(order); }
+    void store(uint32_t bits, std::memory_order order) { bits_.store(bits, order); }
+
+private:
+    std::atomic<uint32_t> bits_{0};
+};
+
+namespace lru {
+
+constexpr uint32_t kClockMask = (1u << 24) - 1;
+
+// Seconds since the last access, allowing for one wrap of the 24-bit clock
+inline uint32_t idle_time(uint32_t stamp, uint32_t clock) {
+    return (clock - stamp) & kClockMask;
+}
+
+} // namespace lru
+
+namespace lfu {
+
+// New keys start with a small count so they are not evicted before they
+// have had a chance to be read
+constexpr uint32_t kInitialCounter = 5;
+// Higher factors need more hits to reach the top of the counter; with 10 it
+// saturates around a million accesses
+constexpr double kLogFactor = 10;
+
+inline uint32_t counter(uint32_t stamp) { return stamp & 0xFF; }
+
+inline uint32_t make(uint32_t minutes, uint32_t counter) {
+    return ((minutes & 0xFFFF) << 8) | counter;
+}
+
+// The counter drops by one for every minute the key went unread
+inline uint32_t decayed_counter(uint32_t stamp, uint32_t minutes) {
+    uint32_t elapsed = (minutes - (stamp >> 8)) & 0xFFFF;
+    uint32_t count = counter(stamp);
+    return elapsed >= count ? 0 : count - elapsed;
+}
+
+// Bumps the counter with probability 1 / ((count - initial) * factor + 1),
+// so it grows roughly with the logarithm of the hit count. `random` is
+// uniform in [0, 1).
+inline uint32_t increment(uint32_t count, double random) {
+    if (count == 255) {
+        return count;
+    }
+    double base = count > kInitialCounter ? count - kInitialCounter : 0;
+    return random < 1.0 / (base * kLogFactor + 1) ? count + 1 : count;
+}
+
+} // namespace lfu
+
+#endif // REDICRAFT_EVICTION_H
@@ -0,0 +1,810 @@
+/*
+ * flat_hash_map.h
+ * author: Андрій Будильников
+ */
+
+#ifndef REDICRAFT_FLAT_HASH_MAP_H
+#define REDICRAFT_FLAT_HASH_MAP_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define REDICRAFT_FLAT_HASH_SSE2 1
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+#define REDICRAFT_FLAT_HASH_AVX2 1
+#include <immintrin.h>
+#endif
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// Open-addressing hash tables in the style of Swiss tables.
+//
+// Every slot has a one-byte control word: empty, deleted, or the low 7 bits
+// of the element's hash. Lookups load a whole group of control bytes at once
+// (16 with SSE2, 32 with AVX2, 8 with the portable fallback) and compare the
+// 7-bit hash against all of them with a couple of instructions, so a probe
+// touches the slot array only for likely matches. Elements live inline in one
+// flat allocation; there is no node per entry.
+namespace flat_hash_detail {
+
+using ctrl_t = int8_t;
+
+constexpr ctrl_t kEmpty = -128;   // 0b10000000
+constexpr ctrl_t kDeleted = -2;   // 0b11111110
+constexpr ctrl_t kSentinel = -1;  // 0b11111111, marks the end of the control array
+
+inline bool is_full(ctrl_t c) { return c >= 0; }
+
+inline unsigned count_trailing_zeros(uint64_t x) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward64(&index, x);
+    return static_cast<unsigned>(index);
+#else
+    return static_cast<unsigned>(__builtin_ctzll(x));
+#endif
+}
+
+inline unsigned count_leading_zeros(uint64_t x) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanReverse64(&index, x);
+    return 63 - static_cast<unsigned>(index);
+#else
+    return static_cast<unsigned>(__builtin_clzll(x));
+#endif
+}
+
+// Mixes the user hash so both the 7-bit tag and the probe start are well
+// distributed even for weak hashes such as std::hash on integers
+inline uint64_t mix_hash(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+inline size_t h1(uint64_t hash) { return static_cast<size_t>(hash >> 7); }
+inline ctrl_t h2(uint64_t hash) { return static_cast<ctrl_t>(hash & 0x7F); }
+
+// Set of matching positions inside a group. Each position is represented by
+// 1 << Shift bits so the SIMD and SWAR groups can share the iteration code.
+template <unsigned Width, unsigned Shift>
+class BitMask {
+public:
+    explicit BitMask(uint64_t mask) : mask_(mask) {}
+
+    explicit operator bool() const { return mask_ != 0; }
+    unsigned lowest() const { return count_trailing_zeros(mask_) >> Shift; }
+    unsigned trailing_zeros() const { return count_trailing_zeros(mask_) >> Shift; }
+    unsigned leading_zeros() const {
+        constexpr unsigned total_bits = Width << Shift;
+        constexpr unsigned extra_bits = 64 - total_bits;
+        return (count_leading_zeros(mask_ << extra_bits)) >> Shift;
+    }
+
+    BitMask& operator++() {
+        mask_ &= (mask_ - 1);
+        return *this;
+    }
+    unsigned operator*() const { return lowest(); }
+    BitMask begin() const { return *this; }
+    BitMask end() const { return BitMask(0); }
+    bool operator!=(const BitMask& other) const { return mask_ != other.mask_; }
+
+private:
+    uint64_t mask_;
+};
+
+#if defined(REDICRAFT_FLAT_HASH_AVX2)
+
+struct Group {
+    static constexpr size_t kWidth = 32;
+
+    explicit Group(const ctrl_t* pos) {
+        ctrl = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pos));
+    }
+
+    BitMask<kWidth, 0> match(ctrl_t hash) const {
+        __m256i match = _mm256_set1_epi8(hash);
+        return BitMask<kWidth, 0>(static_cast<uint32_t>(
+            _mm256_movemask_epi8(_mm256_cmpeq_epi8(match, ctrl))));
+    }
+
+    BitMask<kWidth, 0> match_empty() const {
+        return match(kEmpty);
+    }
+
+    BitMask<kWidth, 0> match_empty_or_deleted() const {
+        __m256i special = _mm256_set1_epi8(kSentinel);
+        return BitMask<kWidth, 0>(static_cast<uint32_t>(
+            _mm256_movemask_epi8(_mm256_cmpgt_epi8(special, ctrl))));
+    }
+
+    __m256i ctrl;
+};
+
+#elif defined(REDICRAFT_FLAT_HASH_SSE2)
+
+struct Group {
+    static constexpr size_t kWidth = 16;
+
+    explicit Group(const ctrl_t* pos) {
+        ctrl = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pos));
+    }
+
+    BitMask<kWidth, 0> match(ctrl_t hash) const {
+        __m128i match = _mm_set1_epi8(hash);
+        return BitMask<kWidth, 0>(static_cast<uint32_t>(
+            _mm_movemask_epi8(_mm_cmpeq_epi8(match, ctrl))));
+    }
+
+    BitMask<kWidth, 0> match_empty() const {
+        return match(kEmpty);
+    }
+
+    BitMask<kWidth, 0> match_empty_or_deleted() const {
+        __m128i special = _mm_set1_epi8(kSentinel);
+        return BitMask<kWidth, 0>(static_cast<uint32_t>(
+            _mm_movemask_epi8(_mm_cmpgt_epi8(special, ctrl))));
+    }
+
+    __m128i ctrl;
+};
+
+#else
+
+// Portable fallback that treats eight control bytes as one 64-bit word
+struct Group {
+    static constexpr size_t kWidth = 8;
+
+    explicit Group(const ctrl_t* pos) {
+        std::memcpy(&ctrl, pos, sizeof(ctrl));
+    }
+
+    BitMask<kWidth, 3> match(ctrl_t hash) const {
+        constexpr uint64_t lsbs = 0x0101010101010101ULL;
+        constexpr uint64_t msbs = 0x8080808080808080ULL;
+        uint64_t x = ctrl ^ (lsbs * static_cast<uint8_t>(hash));
+        return BitMask<kWidth, 3>((x - lsbs) & ~x & msbs);
+    }
+
+    BitMask<kWidth, 3> match_empty() const {
+        constexpr uint64_t msbs = 0x8080808080808080ULL;
+        return BitMask<kWidth, 3>((ctrl & ~(ctrl << 6)) & msbs);
+    }
+
+    BitMask<kWidth, 3> match_empty_or_deleted() const {
+        constexpr uint64_t msbs = 0x8080808080808080ULL;
+        return BitMask<kWidth, 3>((ctrl & ~(ctrl << 7)) & msbs);
+    }
+
+    uint64_t ctrl;
+};
+
+#endif
+
+constexpr size_t kWidth = Group::kWidth;
+constexpr size_t kClonedBytes = kWidth - 1;
+
+// Triangular probing over groups; visits every group once when the
+// capacity is a power of two minus one
+class ProbeSeq {
+public:
+    ProbeSeq(size_t hash, size_t mask) : mask_(mask), offset_(hash & mask), index_(0) {}
+
+    size_t offset() const { return offset_; }
+    size_t offset(size_t i) const { return (offset_ + i) & mask_; }
+    size_t index() const { return index_; }
+
+    void next() {
+        index_ += kWidth;
+        offset_ += index_;
+        offset_ &= mask_;
+    }
+
+private:
+    size_t mask_;
+    size_t offset_;
+    size_t index_;
+};
+
+inline size_t capacity_to_growth(size_t capacity) {
+    size_t growth = capacity - capacity / 8;
+    // A table whose groups may all be full would never end a probe
+    if (capacity >= kClonedBytes && growth == capacity) {
+        growth = capacity - 1;
+    }
+    return growth;
+}
+
+inline uint64_t reverse_bits(uint64_t x) {
+    x = ((x >> 1) & 0x5555555555555555ULL) | ((x & 0x5555555555555555ULL) << 1);
+    x = ((x >> 2) & 0x3333333333333333ULL) | ((x & 0x3333333333333333ULL) << 2);
+    x = ((x >> 4) & 0x0F0F0F0F0F0F0F0FULL) | ((x & 0x0F0F0F0F0F0F0F0FULL) << 4);
+    x = ((x >> 8) & 0x00FF00FF00FF00FFULL) | ((x & 0x00FF00FF00FF00FFULL) << 8);
+    x = ((x >> 16) & 0x0000FFFF0000FFFFULL) | ((x & 0x0000FFFF0000FFFFULL) << 16);
+    return (x >> 32) | (x << 32);
+}
+
+// The scan cursor after `cursor` for a table whose capacity is `mask`:
+// the masked bits are incremented from the top down (reverse binary), and
+// 0 comes back once every position has been visited
+inline uint64_t next_scan_cursor(uint64_t cursor, uint64_t mask) {
+    cursor |= ~mask;
+    cursor = reverse_bits(cursor);
+    cursor++;
+    return reverse_bits(cursor);
+}
+
+inline size_t normalize_capacity(size_t n) {
+    // Capacities are always 2^k - 1 so "& capacity" works as the probe mask
+    size_t capacity = 1;
+    while (capacity < n) {
+        capacity = capacity * 2 + 1;
+    }
+    return capacity;
+}
+
+inline size_t growth_to_capacity(size_t growth) {
+    return normalize_capacity(growth + (growth + 6) / 7);
+}
+
+struct MapKeyOf {
+    template <typename Pair>
+    static const auto& get(const Pair& slot) { return slot.first; }
+};
+
+struct SetKeyOf {
+    template <typename Key>
+    static const Key& get(const Key& slot) { return slot; }
+};
+
+} // namespace flat_hash_detail
+
+// Shared implementation of FlatHashMap and FlatHashSet. Slot is the stored
+// element (std::pair<K, V> for maps, K for sets) and KeyOf extracts its key.
+// Keys must not be modified through iterators.
+template <typename Key, typename Slot, typename KeyOf, typename Hash, typename KeyEqual>
+class FlatHashTable {
+    static_assert(alignof(Slot) <= alignof(std::max_align_t), "over-aligned slots are not supported");
+
+protected:
+    using ctrl_t = flat_hash_detail::ctrl_t;
+
+public:
+    using key_type = Key;
+    using value_type = Slot;
+    using size_type = size_t;
+    using hasher = Hash;
+    using key_equal = KeyEqual;
+
+    template <bool IsConst>
+    class basic_iterator {
+        friend class FlatHashTable;
+
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = Slot;
+        using difference_type = std::ptrdiff_t;
+        using reference = typename std::conditional<IsConst, const Slot&, Slot&>::type;
+        using pointer = typename std::conditional<IsConst, const Slot*, Slot*>::type;
+
+        basic_iterator() : ctrl_(nullptr), slot_(nullptr) {}
+        // Allow iterator -> const_iterator
+        template <bool WasConst, typename = typename std::enable_if<IsConst && !WasConst>::type>
+        basic_iterator(const basic_iterator<WasConst>& other) : ctrl_(other.ctrl_), slot_(other.slot_) {}
+
+        reference operator*() const { return *slot_; }
+        pointer operator->() const { return slot_; }
+
+        basic_iterator& operator++() {
+            ++ctrl_;
+            ++slot_;
+            skip_empty();
+            return *this;
+        }
+        basic_iterator operator++(int) {
+            basic_iterator copy = *this;
+            ++*this;
+            return copy;
+        }
+
+        bool operator==(const basic_iterator& other) const { return ctrl_ == other.ctrl_; }
+        bool operator!=(const basic_iterator& other) const { return ctrl_ != other.ctrl_; }
+
+    private:
+        template <bool>
+        friend class basic_iterator;
+
+        basic_iterator(const ctrl_t* ctrl, pointer slot) : ctrl_(ctrl), slot_(slot) {
+            skip_empty();
+        }
+
+        void skip_empty() {
+            // The sentinel stops the scan at the end of the table
+            while (ctrl_ && !flat_hash_detail::is_full(*ctrl_) && *ctrl_ != flat_hash_detail::kSentinel) {
+                ++ctrl_;
+                ++slot_;
+            }
+            if (ctrl_ && *ctrl_ == flat_hash_detail::kSentinel) {
+                ctrl_ = nullptr;
+                slot_ = nullptr;
+            }
+        }
+
+        const ctrl_t* ctrl_;
+        pointer slot_;
+    };
+
+    using iterator = basic_iterator<false>;
+    using const_iterator = basic_iterator<true>;
+
+    FlatHashTable() = default;
+
+    FlatHashTable(const FlatHashTable& other) {
+        reserve(other.size());
+        for (const auto& slot : other) {
+            insert_unique(slot);
+        }
+    }
+
+    FlatHashTable(FlatHashTable&& other) noexcept
+        : ctrl_(other.ctrl_), slots_(other.slots_), capacity_(other.capacity_),
+          size_(other.size_), growth_left_(other.growth_left_) {
+        other.reset_to_empty();
+    }
+
+    FlatHashTable& operator=(const FlatHashTable& other) {
+        if (this != &other) {
+            FlatHashTable copy(other);
+            swap(copy);
+        }
+        return *this;
+    }
+
+    FlatHashTable& operator=(FlatHashTable&& other) noexcept {
+        if (this != &other) {
+            destroy();
+            ctrl_ = other.ctrl_;
+            slots_ = other.slots_;
+            capacity_ = other.capacity_;
+            size_ = other.size_;
+            growth_left_ = other.growth_left_;
+            other.reset_to_empty();
+        }
+        return *this;
+    }
+
+    ~FlatHashTable() { destroy(); }
+
+    void swap(FlatHashTable& other) noexcept {
+        std::swap(ctrl_, other.ctrl_);
+        std::swap(slots_, other.slots_);
+        std::swap(capacity_, other.capacity_);
+        std::swap(size_, other.size_);
+        std::swap(growth_left_, other.growth_left_);
+    }
+
+    iterator begin() { return capacity_ ? iterator(ctrl_, slots_) : end(); }
+    iterator end() { return iterator(); }
+    const_iterator begin() const { return capacity_ ? const_iterator(ctrl_, slots_) : end(); }
+    const_iterator end() const { return const_iterator(); }
+    const_iterator cbegin() const { return begin(); }
+    const_iterator cend() const { return end(); }
+
+    bool empty() const { return size_ == 0; }
+    size_t size() const { return size_; }
+    size_t capacity() const { return capacity_; }
+    // Bytes of the table's own allocation (control bytes and slots), not
+    // counting memory the elements own
+    size_t allocated_bytes() const {
+        return capacity_ ? slot_offset(capacity_) + capacity_ * sizeof(Slot) : 0;
+    }
+
+    void clear() {
+        destroy();
+        reset_to_empty();
+    }
+
+    // Makes room for n elements without further growth
+    void reserve(size_t n) {
+        if (n > size_ + growth_left_) {
+            resize(flat_hash_detail::growth_to_capacity(n));
+        }
+    }
+
+    iterator find(const Key& key) {
+        size_t index = find_index(key);
+        return index == npos ? end() : iterator_at(index);
+    }
+
+    const_iterator find(const Key& key) const {
+        size_t index = find_index(key);
+        return index == npos ? end() : const_iterator(iterator_at(index));
+    }
+
+    size_t count(const Key& key) const { return find_index(key) == npos ? 0 : 1; }
+    bool contains(const Key& key) const { return find_index(key) != npos; }
+
+    size_t erase(const Key& key) {
+        size_t index = find_index(key);
+        if (index == npos) {
+            return 0;
+        }
+        erase_at(index);
+        return 1;
+    }
+
+    void erase(const_iterator it) {
+        erase_at(static_cast<size_t>(it.ctrl_ - ctrl_));
+    }
+
+    // Erases the element and returns an iterator to the next one
+    iterator erase(iterator it) {
+        size_t index = static_cast<size_t>(it.ctrl_ - ctrl_);
+        erase_at(index);
+        return iterator(ctrl_ + index + 1, slots_ + index + 1);
+    }
+
+    // Slot-level access for containers that move elements between tables
+    // themselves (see Dict). Indexes run from 0 to capacity() - 1.
+    size_t growth_left() const { return growth_left_; }
+    bool full_at(size_t index) const { return flat_hash_detail::is_full(ctrl_[index]); }
+    Slot& slot_at(size_t index) { return slots_[index]; }
+    const Slot& slot_at(size_t index) const { return slots_[index]; }
+    void erase_index(size_t index) { erase_at(index); }
+
+    // Calls f(slot) for every element whose home, the slot its probe
+    // sequence starts from, is `home` (modulo the capacity). The walk is
+    // the one a lookup takes, so it ends at the first group with an empty
+    // slot. An element stays on its home's probe sequence until it is
+    // erased, however the slots around it change.
+    template <typename F>
+    void for_each_at_home(size_t home, F&& f) const {
+        using namespace flat_hash_detail;
+        if (capacity_ == 0) {
+            return;
+        }
+        home &= capacity_;
+        // A group is wider than the smallest tables; count each slot once
+        size_t width = capacity_ + 1 < kWidth ? capacity_ + 1 : kWidth;
+        ProbeSeq seq(home, capacity_);
+        while (true) {
+            Group group(ctrl_ + seq.offset());
+            for (size_t i = 0; i < width; ++i) {
+                size_t index = seq.offset(i);
+                if (is_full(ctrl_[index]) && (h1(hash_of(KeyOf::get(slots_[index]))) & capacity_) == home) {
+                    f(slots_[index]);
+                }
+            }
+            if (group.match_empty()) {
+                return;
+            }
+            seq.next();
+        }
+    }
+
+    // One step of a SCAN: visits the elements of the home at `cursor` and
+    // returns the cursor of the next one, or 0 after the last. Homes are
+    // visited in reverse binary order, as in Redis' dictScan, so an element
+    // present for the whole walk is visited at least once even if the table
+    // grows or shrinks between steps; some may be visited twice.
+    template <typename F>
+    uint64_t scan(uint64_t cursor, F&& f) const {
+        if (capacity_ == 0) {
+            return 0;
+        }
+        for_each_at_home(static_cast<size_t>(cursor), f);
+        return flat_hash_detail::next_scan_cursor(cursor, capacity_);
+    }
+
+    // Inserts an element whose key is known to be absent, skipping the lookup
+    template <typename Arg>
+    void insert_unique(Arg&& slot) {
+        size_t index = prepare_insert(hash_of(KeyOf::get(slot)));
+        construct_at(index, std::forward<Arg>(slot));
+    }
+
+protected:
+    static constexpr size_t npos = static_cast<size_t>(-1);
+
+    static uint64_t hash_of(const Key& key) {
+        return flat_hash_detail::mix_hash(static_cast<uint64_t>(Hash{}(key)));
+    }
+
+    iterator iterator_at(size_t index) const {
+        iterator it;
+        it.ctrl_ = ctrl_ + index;
+        it.slot_ = slots_ + index;
+        return it;
+    }
+
+    size_t find_index(const Key& key) const {
+        if (capacity_ == 0) {
+            return npos;
+        }
+        uint64_t hash = hash_of(key);
+        flat_hash_detail::ProbeSeq seq(flat_hash_detail::h1(hash), capacity_);
+        while (true) {
+            flat_hash_detail::Group group(ctrl_ + seq.offset());
+            for (unsigned i : group.match(flat_hash_detail::h2(hash))) {
+                size_t index = seq.offset(i);
+                if (KeyEqual{}(KeyOf::get(slots_[index]), key)) {
+                    return index;
+                }
+            }
+            if (group.match_empty()) {
+                return npos;
+            }
+            seq.next();
+        }
+    }
+
+    // Finds the slot for key, claiming a free one if it is absent. Returns
+    // the index and whether the slot is new; new slots are left unconstructed.
+    std::pair<size_t, bool> find_or_prepare_insert(const Key& key) {
+        size_t index = find_index(key);
+        if (index != npos) {
+            return {index, false};
+        }
+        return {prepare_insert(hash_of(key)), true};
+    }
+
+    size_t prepare_insert(uint64_t hash) {
+        if (growth_left_ == 0) {
+            grow();
+        }
+        size_t index = find_first_non_full(hash);
+        if (ctrl_[index] == flat_hash_detail::kEmpty) {
+            growth_left_--;
+        }
+        set_ctrl(index, flat_hash_detail::h2(hash));
+        size_++;
+        return index;
+    }
+
+    template <typename... Args>
+    void construct_at(size_t index, Args&&... args) {
+        ::new (static_cast<void*>(slots_ + index)) Slot(std::forward<Args>(args)...);
+    }
+
+    void erase_at(size_t index) {
+        using flat_hash_detail::Group;
+        using flat_hash_detail::kWidth;
+
+        slots_[index].~Slot();
+        size_--;
+
+        // If no probe sequence can have passed this slot while the group
+        // around it was full, it can go back to empty instead of a tombstone
+        size_t index_before = (index - kWidth) & capacity_;
+        auto empty_after = Group(ctrl_ + index).match_empty();
+        auto empty_before = Group(ctrl_ + index_before).match_empty();
+        bool was_never_full = empty_before && empty_after &&
+            static_cast<size_t>(empty_after.trailing_zeros() + empty_before.leading_zeros()) < kWidth;
+
+        set_ctrl(index, was_never_full ? flat_hash_detail::kEmpty : flat_hash_detail::kDeleted);
+        if (was_never_full) {
+            growth_left_++;
+        }
+    }
+
+    ctrl_t* ctrl_ = nullptr;
+    Slot* slots_ = nullptr;
+    size_t capacity_ = 0;
+    size_t size_ = 0;
+    size_t growth_left_ = 0;
+
+private:
+    size_t find_first_non_full(uint64_t hash) const {
+        if (capacity_ < flat_hash_detail::kClonedBytes) {
+            // Small tables fit in one group; scan the real slots only
+            for (size_t i = 0; i < capacity_; ++i) {
+                if (!flat_hash_detail::is_full(ctrl_[i])) {
+                    return i;
+                }
+            }
+        }
+        flat_hash_detail::ProbeSeq seq(flat_hash_detail::h1(hash), capacity_);
+        while (true) {
+            flat_hash_detail::Group group(ctrl_ + seq.offset());
+            auto mask = group.match_empty_or_deleted();
+            if (mask) {
+                return seq.offset(mask.lowest());
+            }
+            seq.next();
+        }
+    }
+
+    void set_ctrl(size_t index, ctrl_t h) {
+        ctrl_[index] = h;
+        // Mirror the first bytes after the sentinel so a group load that
+        // starts near the end of the table wraps around
+        if (index < flat_hash_detail::kClonedBytes) {
+            ctrl_[capacity_ + 1 + index] = h;
+        }
+    }
+
+    void grow() {
+        if (capacity_ == 0) {
+            resize(1);
+        } else if (size_ * 32 <= capacity_ * 25) {
+            // Mostly tombstones: rebuild at the same size to reclaim them
+            resize(capacity_);
+        } else {
+            resize(capacity_ * 2 + 1);
+        }
+    }
+
+    static size_t ctrl_bytes(size_t capacity) {
+        return capacity + 1 + flat_hash_detail::kClonedBytes;
+    }
+
+    static size_t slot_offset(size_t capacity) {
+        size_t align = alignof(Slot);
+        return (ctrl_bytes(capacity) + align - 1) & ~(align - 1);
+    }
+
+    void resize(size_t new_capacity) {
+        ctrl_t* old_ctrl = ctrl_;
+        Slot* old_slots = slots_;
+        size_t old_capacity = capacity_;
+
+        // Control bytes and slots share one allocation
+        size_t bytes = slot_offset(new_capacity) + new_capacity * sizeof(Slot);
+        char* memory = static_cast<char*>(::operator new(bytes));
+        ctrl_ = reinterpret_cast<ctrl_t*>(memory);
+        slots_ = reinterpret_cast<Slot*>(memory + slot_offset(new_capacity));
+        capacity_ = new_capacity;
+        std::memset(ctrl_, static_cast<uint8_t>(flat_hash_detail::kEmpty), ctrl_bytes(new_capacity));
+        ctrl_[new_capacity] = flat_hash_detail::kSentinel;
+        growth_left_ = flat_hash_detail::capacity_to_growth(new_capacity) - size_;
+
+        if (old_ctrl) {
+            for (size_t i = 0; i < old_capacity; ++i) {
+                if (flat_hash_detail::is_full(old_ctrl[i])) {
+                    size_t index = prepare_insert_no_grow(hash_of(KeyOf::get(old_slots[i])));
+                    construct_at(index, std::move(old_slots[i]));
+                    old_slots[i].~Slot();
+                }
+            }
+            deallocate(old_ctrl, old_capacity);
+        }
+    }
+
+    size_t prepare_insert_no_grow(uint64_t hash) {
+        size_t index = find_first_non_full(hash);
+        set_ctrl(index, flat_hash_detail::h2(hash));
+        return index;
+    }
+
+    static void deallocate(ctrl_t* ctrl, size_t) {
+        ::operator delete(static_cast<void*>(ctrl));
+    }
+
+    void destroy() {
+        if (!ctrl_) {
+            return;
+        }
+        if (!std::is_trivially_destructible<Slot>::value) {
+            for (size_t i = 0; i < capacity_; ++i) {
+                if (flat_hash_detail::is_full(ctrl_[i])) {
+                    slots_[i].~Slot();
+                }
+            }
+        }
+        deallocate(ctrl_, capacity_);
+    }
+
+    void reset_to_empty() {
+        ctrl_ = nullptr;
+        slots_ = nullptr;
+        capacity_ = 0;
+        size_ = 0;
+        growth_left_ = 0;
+    }
+};
+
+template <typename Key, typename Value, typename Hash = std::hash<Key>, typename KeyEqual = std::equal_to<Key>>
+class FlatHashMap : public FlatHashTable<Key, std::pair<Key, Value>, flat_hash_detail::MapKeyOf, Hash, KeyEqual> {
+    using Base = FlatHashTable<Key, std::pair<Key, Value>, flat_hash_detail::MapKeyOf, Hash, KeyEqual>;
+
+public:
+    using mapped_type = Value;
+    using typename Base::iterator;
+    using typename Base::const_iterator;
+
+    FlatHashMap() = default;
+    FlatHashMap(std::initializer_list<std::pair<Key, Value>> init) {
+        this->reserve(init.size());
+        for (const auto& pair : init) {
+            insert(pair);
+        }
+    }
+
+    template <typename K, typename... Args>
+    std::pair<iterator, bool> try_emplace(K&& key, Args&&... args) {
+        auto result = this->find_or_prepare_insert(key);
+        if (result.second) {
+            this->construct_at(result.first, std::piecewise_construct,
+                               std::forward_as_tuple(std::forward<K>(key)),
+                               std::forward_as_tuple(std::forward<Args>(args)...));
+        }
+        return {this->iterator_at(result.first), result.second};
+    }
+
+    template <typename K, typename V>
+    std::pair<iterator, bool> emplace(K&& key, V&& value) {
+        return try_emplace(std::forward<K>(key), std::forward<V>(value));
+    }
+
+    std::pair<iterator, bool> insert(const std::pair<Key, Value>& pair) {
+        return try_emplace(pair.first, pair.second);
+    }
+
+    template <typename InputIt>
+    void insert(InputIt first, InputIt last) {
+        for (; first != last; ++first) {
+            try_emplace(first->first, first->second);
+        }
+    }
+
+    template <typename K, typename V>
+    std::pair<iterator, bool> insert_or_assign(K&& key, V&& value) {
+        auto result = try_emplace(std::forward<K>(key), std::forward<V>(value));
+        if (!result.second) {
+            result.first->second = std::forward<V>(value);
+        }
+        return result;
+    }
+
+    Value& operator[](const Key& key) { return try_emplace(key).first->second; }
+    Value& operator[](Key&& key) { return try_emplace(std::move(key)).first->second; }
+};
+
+template <typename Key, typename Hash = std::hash<Key>, typename KeyEqual = std::equal_to<Key>>
+class FlatHashSet : public FlatHashTable<Key, Key, flat_hash_detail::SetKeyOf, Hash, KeyEqual> {
+    using Base = FlatHashTable<Key, Key, flat_hash_detail::SetKeyOf, Hash, KeyEqual>;
+
+public:
+    using typename Base::iterator;
+    using typename Base::const_iterator;
+
+    FlatHashSet() = default;
+    FlatHashSet(std::initializer_list<Key> init) {
+        this->reserve(init.size());
+        for (const auto& key : init) {
+            insert(key);
+        }
+    }
+
+    template <typename K>
+    std::pair<iterator, bool> insert(K&& key) {
+        auto result = this->find_or_prepare_insert(key);
+        if (result.second) {
+            this->construct_at(result.first, std::forward<K>(key));
+        }
+        return {this->iterator_at(result.first), result.second};
+    }
+
+    template <typename K>
+    std::pair<iterator, bool> emplace(K&& key) {
+        return insert(std::forward<K>(key));
+    }
+};
+
+#endif // REDICRAFT_FLAT_HASH_MAP_H
@@ -0,0 +1,100 @@
+/*
+ * glob.h
+ * author: Андрій Будильников
+ */
+
+#ifndef REDICRAFT_GLOB_H
+#define REDICRAFT_GLOB_H
+
+#include <cstddef>
+#include <string_view>
+
+namespace glob_detail {
+
+// Matches one character against the token at pattern[p] (?, [...], \x or
+// a literal) and stores where the next token starts in `next`
+inline bool match_one(std::string_view pattern, size_t p, char c, size_t& next) {
+    if (pattern[p] == '?') {
+        next = p + 1;
+        return true;
+    }
+    if (pattern[p] == '\\' && p + 1 < pattern.size()) {
+        next = p + 2;
+        return pattern[p + 1] == c;
+    }
+    if (pattern[p] != '[') {
+        next = p + 1;
+        return pattern[p] == c;
+    }
+
+    // A class: [abc], [a-z], [^abc]; an unclosed one runs to the end
+    size_t i = p + 1;
+    bool negate = i < pattern.size() && pattern[i] == '^';
+    if (negate) {
+        i++;
+    }
+    bool matched = false;
+    while (i < pattern.size() && pattern[i] != ']') {
+        if (pattern[i] == '\\' && i + 1 < pattern.size()) {
+            matched = matched || pattern[i + 1] == c;
+            i += 2;
+        } else if (i + 2 < pattern.size() && pattern[i + 1] == '-' && pattern[i + 2] != ']') {
+            unsigned char low = static_cast<unsigned char>(pattern[i]);
+            unsigned char high = static_cast<unsigned char>(pattern[i + 2]);
+            if (low > high) {
+                unsigned char swap = low;
+                low = high;
+                high = swap;
+            }
+            unsigned char u = static_cast<unsigned char>(c);
+            matched = matched || (u >= low && u <= high);
+            i += 3;
+        } else {
+            matched = matched || pattern[i] == c;
+            i++;
+        }
+    }
+    next = i < pattern.size() ? i + 1 : i;
+    return matched != negate;
+}
+
+} // namespace glob_detail
+
+// Glob-style matching as in Redis' KEYS and SCAN MATCH: * matches any run
+// of characters, ? any one character, [abc], [a-z] and [^abc] one
+// character of (or not of) a set, and \ makes the next character literal.
+//
+// Runs in O(pattern * text) at worst: on a mismatch only the most recent *
+// is retried one character further on, which is enough since every other
+// token matches exactly one character.
+inline bool glob_match(std::string_view pattern, std::string_view text) {
+    const size_t npos = std::string_view::npos;
+    size_t p = 0;
+    size_t t = 0;
+    size_t star = npos;
+    size_t star_text = 0;
+    while (t < text.size()) {
+        if (p < pattern.size() && pattern[p] == '*') {
+            star = ++p;
+            star_text = t;
+            continue;
+        }
+        size_t next;
+        if (p < pattern.size() && glob_detail::match_one(pattern, p, text[t], next)) {
+            p = next;
+            t++;
+            continue;
+        }
+        if (star == npos) {
+            return false;
+        }
+        p = star;
+        t = ++star_text;
+    }
+    while (p < pattern.size() && pattern[p] == '*') {
+        p++;
+    }
+    return p == pattern.size();
+}
+
+#endif // REDICRAFT_GLOB_H
@@ -0,0 +1,39 @@
+/*
+ * heap_usage.h
+ * author: Андрій Будильников
+ */
+
+#ifndef REDICRAFT_HEAP_USAGE_H
+#define REDICRAFT_HEAP_USAGE_H
+
+#include <cstddef>
+#include <string>
+
+// Helpers for estimating how much heap memory a value really costs, used by
+// the memory accounting in Storage.
+
+// Size of a heap block as the allocator sees it: the request plus an 8-byte
+// header, rounded up to 16 bytes (glibc malloc and most others work this way)
+inline size_t heap_block_size(size_t requested) {
+    return requested == 0 ? 0 : (requested + 8 + 15) & ~static_cast<size_t>(15);
+}
+
+// Heap bytes behind a std::string; short strings live inside the object
+// itself (small string optimization) and cost nothing extra
+inline size_t heap_bytes(const std::string& s) {
+    const char* data = s.data();
+    const char* self = reinterpret_cast<const char*>(&s);
+    if (data >= self && data < self + sizeof(s)) {
+        return 0;
+    }
+    return heap_block_size(s.capacity() + 1);
+}
+
+// Heap bytes of a freshly copied string of the given length, which has no
+// spare capacity
+inline size_t string_heap_bytes(size_t length) {
+    static const size_t sso_capacity = std::string().capacity();
+    return length <= sso_capacity ? 0 : heap_block_size(length + 1);
+}
+
+#endif // REDICRAFT_HEAP_USAGE_H
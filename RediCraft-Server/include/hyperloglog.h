@@ -0,0 +1,351 @@
+/*
+ * hyperloglog.h
+ * author: Андрій Будильников
+ */
+
+#ifndef REDICRAFT_HYPERLOGLOG_H
+#define REDICRAFT_HYPERLOGLOG_H
+
+#include "bitops.h"
+#include "heap_usage.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <string_view>
+#include <vector>
+
+// When a HyperLogLog moves from the sparse encoding to the dense one
+struct HyperLogLogLimits {
+    // Stays sparse while its non-zero registers take at most this many
+    // bytes, 4 per register
+    size_t max_sparse_bytes = 3000;
+};
+
+namespace hll_detail {
+
+// MurmurHash64A, the hash Redis uses for HyperLogLog, so the registers do
+// not depend on the standard library's hash
+inline uint64_t murmur64a(std::string_view data, uint64_t seed) {
+    const uint64_t m = 0xc6a4a7935bd1e995ULL;
+    const int r = 47;
+    uint64_t h = seed ^ (data.size() * m);
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(data.data());
+    const unsigned char* end = p + (data.size() & ~static_cast<size_t>(7));
+    for (; p != end; p += 8) {
+        uint64_t k;
+        std::memcpy(&k, p, sizeof(k));
+        k *= m;
+        k ^= k >> r;
+        k *= m;
+        h ^= k;
+        h *= m;
+    }
+    switch (data.size() & 7) {
+        case 7: h ^= static_cast<uint64_t>(p[6]) << 48; [[fallthrough]];
+        case 6: h ^= static_cast<uint64_t>(p[5]) << 40; [[fallthrough]];
+        case 5: h ^= static_cast<uint64_t>(p[4]) << 32; [[fallthrough]];
+        case 4: h ^= static_cast<uint64_t>(p[3]) << 24; [[fallthrough]];
+        case 3: h ^= static_cast<uint64_t>(p[2]) << 16; [[fallthrough]];
+        case 2: h ^= static_cast<uint64_t>(p[1]) << 8; [[fallthrough]];
+        case 1:
+            h ^= static_cast<uint64_t>(p[0]);
+            h *= m;
+    }
+    h ^= h >> r;
+    h *= m;
+    h ^= h >> r;
+    return h;
+}
+
+} // namespace hll_detail
+
+// Approximate count of distinct elements in bounded memory, as a Redis
+// HyperLogLog: 16384 registers (precision 14), each holding the longest run
+// of zero bits seen in the hashes that picked it, for a standard error of
+// 0.81% at any cardinality.
+//
+//   SPARSE - only the non-zero registers, as sorted (index, value) entries
+//            of 4 bytes; a counter that has seen a few hundred elements
+//            costs a few hundred bytes
+//   DENSE  - all registers packed at 6 bits each, 12 KB whatever the count
+//
+// The estimate uses Ertl's improved estimator (the one Redis uses) and is
+// cached until a register changes; readers holding a shared lock may fill
+// the cache, so it is atomic.
+class HyperLogLog {
+public:
+    static constexpr int kPrecision = 14;
+    static constexpr size_t kRegisters = static_cast<size_t>(1) << kPrecision;
+    static constexpr size_t kDenseBytes = kRegisters * 6 / 8;
+    // Largest register value: the hash bits left after the index, plus one
+    static constexpr int kMaxRank = 64 - kPrecision + 1;
+
+    enum class Encoding {
+        SPARSE,
+        DENSE
+    };
+
+    HyperLogLog() = default;
+    HyperLogLog(const HyperLogLog& other)
+        : entries_(other.entries_)
+        , dense_(other.dense_)
+        , cached_count_(other.cached_count_.load(std::memory_order_relaxed)) {}
+    HyperLogLog(HyperLogLog&& other) noexcept
+        : entries_(std::move(other.entries_))
+        , dense_(std::move(other.dense_))
+        , cached_count_(other.cached_count_.load(std::memory_order_relaxed)) {}
+    HyperLogLog& operator=(const HyperLogLog& other) {
+        entries_ = other.entries_;
+        dense_ = other.dense_;
+        cached_count_.store(other.cached_count_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        return *this;
+    }
+    HyperLogLog& operator=(HyperLogLog&& other) noexcept {
+        entries_ = std::move(other.entries_);
+        dense_ = std::move(other.dense_);
+        cached_count_.store(other.cached_count_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        return *this;
+    }
+
+    Encoding encoding() const { return dense_.empty() ? Encoding::SPARSE : Encoding::DENSE; }
+
+    // Returns true if a register changed, so the estimate may have
+    bool add(std::string_view element, const HyperLogLogLimits& limits) {
+        uint64_t hash = hll_detail::murmur64a(element, 0xadc83b19ULL);
+        size_t index = static_cast<size_t>(hash & (kRegisters - 1));
+        // A sentinel bit caps the run at kMaxRank
+        uint64_t rest = (hash >> kPrecision) | (static_cast<uint64_t>(1) << (64 - kPrecision));
+        uint8_t rank = 1;
+        while ((rest & 1) == 0) {
+            rank++;
+            rest >>= 1;
+        }
+        return raise(index, rank, limits);
+    }
+
+    // Sets a register to value if that is higher; returns true if it was
+    bool raise(size_t index, uint8_t value, const HyperLogLogLimits& limits) {
+        if (encoding() == Encoding::DENSE) {
+            if (dense_get(index) >= value) {
+                return false;
+            }
+            dense_set(index, value);
+            invalidate();
+            return true;
+        }
+        uint32_t key = static_cast<uint32_t>(index) << 8;
+        auto it = std::lower_bound(entries_.begin(), entries_.end(), key);
+        if (it != entries_.end() && (*it >> 8) == index) {
+            if ((*it & 0xFF) >= value) {
+                return false;
+            }
+            *it = key | value;
+        } else if ((entries_.size() + 1) * sizeof(uint32_t) <= limits.max_sparse_bytes) {
+            entries_.insert(it, key | value);
+        } else {
+            convert_to_dense();
+            dense_set(index, value);
+        }
+        invalidate();
+        return true;
+    }
+
+    uint64_t count() const {
+        uint64_t cached = cached_count_.load(std::memory_order_relaxed);
+        if (cached != kNoCount) {
+            return cached;
+        }
+        int histogram[kMaxRank + 1] = {};
+        if (encoding() == Encoding::DENSE) {
+            const unsigned char* p = dense_.data();
+            for (size_t i = 0; i < kDenseBytes; i += 3) {
+                histogram[p[i] & 63]++;
+                histogram[(p[i] >> 6) | ((p[i + 1] & 15) << 2)]++;
+                histogram[(p[i + 1] >> 4) | ((p[i + 2] & 3) << 4)]++;
+                histogram[p[i + 2] >> 2]++;
+            }
+        } else {
+            histogram[0] = static_cast<int>(kRegisters - entries_.size());
+            for (uint32_t entry : entries_) {
+                histogram[entry & 0xFF]++;
+            }
+        }
+        uint64_t count = estimate(histogram);
+        cached_count_.store(count, std::memory_order_relaxed);
+        return count;
+    }
+
+    // Raises each of kRegisters bytes in `registers`, one per register, to
+    // this HyperLogLog's register if that is higher
+    void max_into(unsigned char* registers) const {
+        if (encoding() == Encoding::SPARSE) {
+            for (uint32_t entry : entries_) {
+                unsigned char& target = registers[entry >> 8];
+                target = std::max(target, static_cast<unsigned char>(entry & 0xFF));
+            }
+            return;
+        }
+        unsigned char unpacked[kRegisters];
+        unpack(unpacked);
+        bitops::kernels().max_bytes(registers, unpacked, kRegisters);
+    }
+
+    // Replaces every register with the kRegisters bytes of `registers`
+    void assign(const unsigned char* registers, const HyperLogLogLimits& limits) {
+        size_t nonzero = kRegisters - static_cast<size_t>(std::count(registers, registers + kRegisters, 0));
+        invalidate();
+        if (nonzero * sizeof(uint32_t) <= limits.max_sparse_bytes) {
+            dense_ = std::vector<unsigned char>();
+            entries_.clear();
+            entries_.reserve(nonzero);
+            for (size_t i = 0; i < kRegisters; ++i) {
+                if (registers[i] != 0) {
+                    entries_.push_back(static_cast<uint32_t>(i) << 8 | registers[i]);
+                }
+            }
+            return;
+        }
+        entries_ = std::vector<uint32_t>();
+        dense_.assign(kDenseBytes, 0);
+        unsigned char* p = dense_.data();
+        for (size_t i = 0, r = 0; i < kDenseBytes; i += 3, r += 4) {
+            p[i] = static_cast<unsigned char>(registers[r] | (registers[r + 1] << 6));
+            p[i + 1] = static_cast<unsigned char>((registers[r + 1] >> 2) | (registers[r + 2] << 4));
+            p[i + 2] = static_cast<unsigned char>((registers[r + 2] >> 4) | (registers[r + 3] << 2));
+        }
+    }
+
+    // Estimate for kRegisters bytes of registers, as count() makes it
+    static uint64_t estimate(const unsigned char* registers) {
+        int histogram[kMaxRank + 1] = {};
+        for (size_t i = 0; i < kRegisters; ++i) {
+            histogram[registers[i]]++;
+        }
+        return estimate(histogram);
+    }
+
+    // Calls f(size_t index, uint8_t value) for every non-zero register, in
+    // index order
+    template <typename F>
+    void for_each_register(F&& f) const {
+        if (encoding() == Encoding::SPARSE) {
+            for (uint32_t entry : entries_) {
+                f(static_cast<size_t>(entry >> 8), static_cast<uint8_t>(entry & 0xFF));
+            }
+            return;
+        }
+        for (size_t i = 0; i < kRegisters; ++i) {
+            uint8_t value = dense_get(i);
+            if (value != 0) {
+                f(i, value);
+            }
+        }
+    }
+
+    // Heap bytes owned by the HyperLogLog
+    size_t memory_usage() const {
+        return heap_block_size(entries_.capacity() * sizeof(uint32_t)) + heap_block_size(dense_.capacity());
+    }
+
+private:
+    static constexpr uint64_t kNoCount = std::numeric_limits<uint64_t>::max();
+
+    // Register i takes bits 6i to 6i + 5 of the dense bytes, lowest first
+    uint8_t dense_get(size_t index) const {
+        size_t byte = index * 6 / 8;
+        unsigned shift = static_cast<unsigned>(index * 6 % 8);
+        unsigned value = dense_[byte] >> shift;
+        if (shift > 2) {
+            value |= static_cast<unsigned>(dense_[byte + 1]) << (8 - shift);
+        }
+        return static_cast<uint8_t>(value & 63);
+    }
+
+    void dense_set(size_t index, uint8_t value) {
+        size_t byte = index * 6 / 8;
+        unsigned shift = static_cast<unsigned>(index * 6 % 8);
+        dense_[byte] = static_cast<unsigned char>((dense_[byte] & ~(63u << shift)) | (static_cast<unsigned>(value) << shift));
+        if (shift > 2) {
+            unsigned high = 8 - shift;
+            dense_[byte + 1] = static_cast<unsigned char>((dense_[byte + 1] & ~(63u >> high)) | (value >> high));
+        }
+    }
+
+    void unpack(unsigned char* registers) const {
+        const unsigned char* p = dense_.data();
+        for (size_t i = 0, r = 0; i < kDenseBytes; i += 3, r += 4) {
+            registers[r] = p[i] & 63;
+            registers[r + 1] = static_cast<unsigned char>((p[i] >> 6) | ((p[i + 1] & 15) << 2));
+            registers[r + 2] = static_cast<unsigned char>((p[i + 1] >> 4) | ((p[i + 2] & 3) << 4));
+            registers[r + 3] = p[i + 2] >> 2;
+        }
+    }
+
+    void convert_to_dense() {
+        dense_.assign(kDenseBytes, 0);
+        for (uint32_t entry : entries_) {
+            dense_set(entry >> 8, static_cast<uint8_t>(entry & 0xFF));
+        }
+        entries_ = std::vector<uint32_t>();
+    }
+
+    void invalidate() { cached_count_.store(kNoCount, std::memory_order_relaxed); }
+
+    // Ertl, "New cardinality estimation algorithms for HyperLogLog
+    // sketches" (2017): exact at small counts without the linear counting
+    // switch-over of the original estimator
+    static uint64_t estimate(const int* histogram) {
+        const double m = static_cast<double>(kRegisters);
+        double z = m * tau((m - histogram[kMaxRank]) / m);
+        for (int k = kMaxRank - 1; k >= 1; --k) {
+            z += histogram[k];
+            z *= 0.5;
+        }
+        z += m * sigma(histogram[0] / m);
+        const double alpha_inf = 0.721347520444481703680;
+        return static_cast<uint64_t>(std::llround(alpha_inf * m * m / z));
+    }
+
+    static double sigma(double x) {
+        if (x == 1.0) {
+            return std::numeric_limits<double>::infinity();
+        }
+        double y = 1.0;
+        double z = x;
+        double previous;
+        do {
+            x *= x;
+            previous = z;
+            z += x * y;
+            y += y;
+        } while (previous != z);
+        return z;
+    }
+
+    static double tau(double x) {
+        if (x == 0.0 || x == 1.0) {
+            return 0.0;
+        }
+        double y = 1.0;
+        double z = 1.0 - x;
+        double previous;
+        do {
+            x = std::sqrt(x);
+            previous = z;
+            y *= 0.5;
+            z -= (1.0 - x) * (1.0 - x) * y;
+        } while (previous != z);
+        return z / 3.0;
+    }
+
+    // Sorted by index; (index << 8) | value
+    std::vector<uint32_t> entries_;
+    std::vector<unsigned char> dense_;
+    mutable std::atomic<uint64_t> cached_count_{kNoCount};
+};
+
+#endif // REDICRAFT_HYPERLOGLOG_H
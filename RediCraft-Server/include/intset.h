@@ -0,0 +1,194 @@
+/*
+ * intset.h
+ * author: Андрій Будильников
+ */
+
+#ifndef REDICRAFT_INTSET_H
+#define REDICRAFT_INTSET_H
+
+#include "heap_usage.h"
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Parses s if it is exactly how std::to_string would print a long long (no
+// spaces, plus sign or leading zeros), so storing the number instead of the
+// text never changes what a client reads back
+inline bool string_to_int64(std::string_view s, long long& result) {
+    // 20 characters fit "-9223372036854775808"
+    if (s.empty() || s.size() > 20) {
+        return false;
+    }
+    size_t i = 0;
+    bool negative = s[0] == '-';
+    if (negative) {
+        i = 1;
+        if (s.size() == 1) {
+            return false;
+        }
+    }
+    if (s[i] == '0' && (s.size() > i + 1 || negative)) {
+        return false; // leading zero or "-0"
+    }
+
+    // Accumulate as a negative number so LLONG_MIN fits
+    long long value = 0;
+    for (; i < s.size(); ++i) {
+        if (s[i] < '0' || s[i] > '9') {
+            return false;
+        }
+        int digit = s[i] - '0';
+        if (value < (std::numeric_limits<long long>::min() + digit) / 10) {
+            return false;
+        }
+        value = value * 10 - digit;
+    }
+    if (!negative) {
+        if (value == std::numeric_limits<long long>::min()) {
+            return false;
+        }
+        value = -value;
+    }
+    result = value;
+    return true;
+}
+
+// Sorted array of distinct integers, stored 2, 4 or 8 bytes wide depending
+// on the largest magnitude in the set. The width only grows: adding one
+// value that needs more bytes re-encodes the whole array once. Lookups are
+// a binary search over a buffer that fits in a few cache lines.
+class IntSet {
+public:
+    size_t size() const { return data_.size() / width_; }
+    bool empty() const { return data_.empty(); }
+    size_t width() const { return width_; }
+    // Heap bytes owned by the set, including unused capacity
+    size_t memory_usage() const { return heap_block_size(data_.capacity()); }
+    void shrink_to_fit() { data_.shrink_to_fit(); }
+
+    int64_t at(size_t index) const {
+        const uint8_t* p = data_.data() + index * width_;
+        switch (width_) {
+            case 2: {
+                int16_t v;
+                std::memcpy(&v, p, sizeof(v));
+                return v;
+            }
+            case 4: {
+                int32_t v;
+                std::memcpy(&v, p, sizeof(v));
+                return v;
+            }
+            default: {
+                int64_t v;
+                std::memcpy(&v, p, sizeof(v));
+                return v;
+            }
+        }
+    }
+
+    bool contains(int64_t value) const {
+        if (width_for(value) > width_) {
+            return false;
+        }
+        size_t index;
+        return search(value, index);
+    }
+
+    // Returns false if the value was already present
+    bool insert(int64_t value) {
+        size_t needed = width_for(value);
+        if (needed > width_) {
+            upgrade(needed);
+        }
+        size_t index;
+        if (search(value, index)) {
+            return false;
+        }
+        data_.insert(data_.begin() + static_cast<std::ptrdiff_t>(index * width_), width_, 0);
+        store(index, value);
+        return true;
+    }
+
+    bool erase(int64_t value) {
+        if (width_for(value) > width_) {
+            return false;
+        }
+        size_t index;
+        if (!search(value, index)) {
+            return false;
+        }
+        auto first = data_.begin() + static_cast<std::ptrdiff_t>(index * width_);
+        data_.erase(first, first + static_cast<std::ptrdiff_t>(width_));
+        return true;
+    }
+
+private:
+    static size_t width_for(int64_t value) {
+        if (value >= std::numeric_limits<int16_t>::min() && value <= std::numeric_limits<int16_t>::max()) {
+            return 2;
+        }
+        if (value >= std::numeric_limits<int32_t>::min() && value <= std::numeric_limits<int32_t>::max()) {
+            return 4;
+        }
+        return 8;
+    }
+
+    // Finds value, or the index it would be inserted at
+    bool search(int64_t value, size_t& index) const {
+        size_t low = 0;
+        size_t high = size();
+        while (low < high) {
+            size_t mid = low + (high - low) / 2;
+            int64_t current = at(mid);
+            if (current < value) {
+                low = mid + 1;
+            } else if (current > value) {
+                high = mid;
+            } else {
+                index = mid;
+                return true;
+            }
+        }
+        index = low;
+        return false;
+    }
+
+    void store(size_t index, int64_t value) {
+        uint8_t* p = data_.data() + index * width_;
+        switch (width_) {
+            case 2: {
+                int16_t v = static_cast<int16_t>(value);
+                std::memcpy(p, &v, sizeof(v));
+                break;
+            }
+            case 4: {
+                int32_t v = static_cast<int32_t>(value);
+                std::memcpy(p, &v, sizeof(v));
+                break;
+            }
+            default:
+                std::memcpy(p, &value, sizeof(value));
+                break;
+        }
+    }
+
+    void upgrade(size_t width) {
+        IntSet wider;
+        wider.width_ = width;
+        wider.data_.resize(size() * width);
+        for (size_t i = 0; i < size(); ++i) {
+            wider.store(i, at(i));
+        }
+        *this = std::move(wider);
+    }
+
+    std::vector<uint8_t> data_;
+    size_t width_ = 2;
+};
+
+#endif // REDICRAFT_INTSET_H
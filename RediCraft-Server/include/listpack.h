@@ -0,0 +1,229 @@
+/*
+ * listpack.h
+ * author: Андрій Будильников
+ */
+
+#ifndef REDICRAFT_LISTPACK_H
+#define REDICRAFT_LISTPACK_H
+
+#include "heap_usage.h"
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <string>
+#include <string_view>
+
+// A sequence of strings packed into one contiguous buffer.
+//
+// Each entry is stored as
+//
+//     <length varint> <bytes> <backlen>
+//
+// where backlen is the size of the first two parts written as a varint with
+// its bytes reversed, so the buffer can be walked in both directions. A
+// 5-byte string costs 7 bytes instead of a 32-byte std::string plus a heap
+// node, and scanning a small pack touches a handful of cache lines.
+//
+// Entries are addressed by byte offset: begin_offset() is the first entry,
+// end_offset() is one past the last, and next()/prev() step between them.
+// Inserting or erasing moves everything after the offset, so packs are
+// meant to stay small (a few KB); bigger containers chain several packs or
+// switch to a real table.
+class ListPack {
+public:
+    size_t size() const { return count_; }
+    bool empty() const { return count_ == 0; }
+    // Bytes of packed data, not counting unused capacity
+    size_t bytes() const { return buf_.size(); }
+    size_t capacity() const { return buf_.capacity(); }
+    // Heap bytes owned by the pack
+    size_t memory_usage() const { return heap_bytes(buf_); }
+    void shrink_to_fit() { buf_.shrink_to_fit(); }
+
+    void clear() {
+        buf_.clear();
+        count_ = 0;
+    }
+
+    size_t begin_offset() const { return 0; }
+    size_t end_offset() const { return buf_.size(); }
+
+    size_t next(size_t offset) const {
+        size_t length;
+        size_t header = read_varint(offset, length);
+        size_t body = header + length;
+        return offset + body + varint_size(body);
+    }
+
+    size_t prev(size_t offset) const {
+        size_t body = 0;
+        size_t shift = 0;
+        size_t pos = offset;
+        uint8_t byte;
+        do {
+            byte = static_cast<uint8_t>(buf_[--pos]);
+            body |= static_cast<size_t>(byte & 0x7F) << shift;
+            shift += 7;
+        } while (byte & 0x80);
+        return pos - body;
+    }
+
+    std::string_view get(size_t offset) const {
+        size_t length;
+        size_t header = read_varint(offset, length);
+        return std::string_view(buf_.data() + offset + header, length);
+    }
+
+    // Total bytes an entry holding `length` bytes of data takes up
+    static size_t entry_size(size_t length) {
+        size_t body = varint_size(length) + length;
+        return body + varint_size(body);
+    }
+
+    // Inserts before the entry at offset and returns the new entry's offset
+    size_t insert(size_t offset, std::string_view value) {
+        size_t header = varint_size(value.size());
+        size_t body = header + value.size();
+        size_t total = body + varint_size(body);
+
+        buf_.insert(offset, total, '\0');
+        char* out = &buf_[offset];
+        write_varint(out, value.size());
+        if (!value.empty()) {
+            std::char_traits<char>::copy(out + header, value.data(), value.size());
+        }
+        // Reversed, so prev() can read it from the end
+        char* back = out + total;
+        size_t remaining = body;
+        do {
+            uint8_t byte = static_cast<uint8_t>(remaining & 0x7F);
+            remaining >>= 7;
+            if (remaining) {
+                byte |= 0x80;
+            }
+            *--back = static_cast<char>(byte);
+        } while (remaining);
+
+        count_++;
+        return offset;
+    }
+
+    // Erases the entry at offset; the following entry moves to offset
+    void erase(size_t offset) {
+        buf_.erase(offset, next(offset) - offset);
+        count_--;
+    }
+
+    // Replaces the entry at offset in place and returns its offset
+    size_t replace(size_t offset, std::string_view value) {
+        size_t length;
+        size_t header = read_varint(offset, length);
+        if (length == value.size()) {
+            if (!value.empty()) {
+                std::char_traits<char>::copy(&buf_[offset + header], value.data(), value.size());
+            }
+            return offset;
+        }
+        erase(offset);
+        return insert(offset, value);
+    }
+
+    void push_back(std::string_view value) { insert(buf_.size(), value); }
+    void push_front(std::string_view value) { insert(0, value); }
+
+    std::string_view front() const { return get(0); }
+    std::string_view back() const { return get(prev(buf_.size())); }
+
+    std::string pop_front() {
+        std::string value(front());
+        erase(0);
+        return value;
+    }
+
+    std::string pop_back() {
+        size_t offset = prev(buf_.size());
+        std::string value(get(offset));
+        erase(offset);
+        return value;
+    }
+
+    // Offset of the first entry equal to value, or end_offset()
+    size_t find(std::string_view value) const {
+        for (size_t offset = 0; offset < buf_.size(); offset = next(offset)) {
+            if (get(offset) == value) {
+                return offset;
+            }
+        }
+        return buf_.size();
+    }
+
+    class const_iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = std::string_view;
+        using difference_type = std::ptrdiff_t;
+        using reference = std::string_view;
+        using pointer = const std::string_view*;
+
+        const_iterator() = default;
+        const_iterator(const ListPack* pack, size_t offset) : pack_(pack), offset_(offset) {}
+
+        std::string_view operator*() const { return pack_->get(offset_); }
+        const_iterator& operator++() {
+            offset_ = pack_->next(offset_);
+            return *this;
+        }
+        const_iterator operator++(int) {
+            const_iterator copy = *this;
+            ++*this;
+            return copy;
+        }
+        bool operator==(const const_iterator& other) const { return offset_ == other.offset_; }
+        bool operator!=(const const_iterator& other) const { return offset_ != other.offset_; }
+        size_t offset() const { return offset_; }
+
+    private:
+        const ListPack* pack_ = nullptr;
+        size_t offset_ = 0;
+    };
+
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, buf_.size()); }
+
+private:
+    static size_t varint_size(size_t value) {
+        size_t size = 1;
+        while (value >= 0x80) {
+            value >>= 7;
+            size++;
+        }
+        return size;
+    }
+
+    static void write_varint(char* out, size_t value) {
+        while (value >= 0x80) {
+            *out++ = static_cast<char>((value & 0x7F) | 0x80);
+            value >>= 7;
+        }
+        *out = static_cast<char>(value);
+    }
+
+    // Reads the varint at offset into value and returns its size in bytes
+    size_t read_varint(size_t offset, size_t& value) const {
+        value = 0;
+        size_t shift = 0;
+        size_t pos = offset;
+        uint8_t byte;
+        do {
+            byte = static_cast<uint8_t>(buf_[pos++]);
+            value |= static_cast<size_t>(byte & 0x7F) << shift;
+            shift += 7;
+        } while (byte & 0x80);
+        return pos - offset;
+    }
+
+    std::string buf_;
+    uint32_t count_ = 0;
+};
+
+#endif // REDICRAFT_LISTPACK_H
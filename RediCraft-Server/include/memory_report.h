@@ -0,0 +1,139 @@
+/*
+ * memory_report.h
+ * author: Андрій Будильников
+ */
+
+#ifndef REDICRAFT_MEMORY_REPORT_H
+#define REDICRAFT_MEMORY_REPORT_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Where memory goes, estimated from a random sample of keys. Sizes are
+// scaled from the sample to the whole keyspace, so small groups are rough;
+// the biggest keys are the largest ones the sample happened to hit.
+struct MemoryReport {
+    struct Group {
+        std::string name;
+        size_t sampled_keys = 0;
+        size_t sampled_bytes = 0;
+        // Scaled to the keyspace size when the report was made
+        size_t estimated_keys = 0;
+        size_t estimated_bytes = 0;
+    };
+
+    struct BigKey {
+        std::string key;
+        std::string type;
+        size_t bytes = 0;
+        size_t elements = 0; // length for strings, size for containers
+    };
+
+    size_t samples = 0;
+    size_t keys = 0;
+    // By value type and by key family (the key up to its first ':', so
+    // "player:Sparky:info" counts towards "player"), largest first
+    std::vector<Group> types;
+    std::vector<Group> families;
+    std::vector<BigKey> biggest;
+};
+
+// Builds a MemoryReport one sampled key at a time
+class MemorySampler {
+public:
+    // Distinct families tracked per report; the rest share one group so a
+    // keyspace without a prefix scheme cannot blow up the sampler
+    static constexpr size_t kMaxFamilies = 64;
+    static constexpr size_t kMaxBigKeys = 10;
+
+    size_t samples() const { return samples_; }
+
+    void add(const std::string& key, const char* type, size_t bytes, size_t elements) {
+        samples_++;
+        add_to(types_[type], bytes);
+
+        size_t colon = key.find(':');
+        std::string family = colon == std::string::npos ? "(no prefix)" : key.substr(0, colon);
+        auto it = families_.find(family);
+        if (it == families_.end() && families_.size() >= kMaxFamilies) {
+            it = families_.emplace("(other)", Sample()).first;
+        } else if (it == families_.end()) {
+            it = families_.emplace(std::move(family), Sample()).first;
+        }
+        add_to(it->second, bytes);
+
+        add_big_key(key, type, bytes, elements);
+    }
+
+    // Scales the sample to `keys` keys and starts over
+    MemoryReport finish(size_t keys) {
+        MemoryReport report;
+        report.samples = samples_;
+        report.keys = keys;
+        report.types = groups(types_, keys);
+        report.families = groups(families_, keys);
+        report.biggest = std::move(biggest_);
+        *this = MemorySampler();
+        return report;
+    }
+
+private:
+    struct Sample {
+        size_t keys = 0;
+        size_t bytes = 0;
+    };
+
+    static void add_to(Sample& sample, size_t bytes) {
+        sample.keys++;
+        sample.bytes += bytes;
+    }
+
+    void add_big_key(const std::string& key, const char* type, size_t bytes, size_t elements) {
+        // Sampling with replacement finds the same big key again and again
+        auto same = std::find_if(biggest_.begin(), biggest_.end(),
+                                 [&key](const MemoryReport::BigKey& big) { return big.key == key; });
+        if (same != biggest_.end()) {
+            biggest_.erase(same);
+        } else if (biggest_.size() == kMaxBigKeys && biggest_.back().bytes >= bytes) {
+            return;
+        } else if (biggest_.size() == kMaxBigKeys) {
+            biggest_.pop_back();
+        }
+        auto pos = std::find_if(biggest_.begin(), biggest_.end(),
+                                [bytes](const MemoryReport::BigKey& big) { return big.bytes < bytes; });
+        biggest_.insert(pos, MemoryReport::BigKey{key, type, bytes, elements});
+    }
+
+    template <typename Map>
+    std::vector<MemoryReport::Group> groups(const Map& samples, size_t keys) const {
+        std::vector<MemoryReport::Group> result;
+        for (const auto& pair : samples) {
+            MemoryReport::Group group;
+            group.name = pair.first;
+            group.sampled_keys = pair.second.keys;
+            group.sampled_bytes = pair.second.bytes;
+            if (samples_ > 0) {
+                double scale = static_cast<double>(keys) / static_cast<double>(samples_);
+                group.estimated_keys = static_cast<size_t>(pair.second.keys * scale + 0.5);
+                group.estimated_bytes = static_cast<size_t>(pair.second.bytes * scale + 0.5);
+            }
+            result.push_back(std::move(group));
+        }
+        std::sort(result.begin(), result.end(), [](const MemoryReport::Group& a, const MemoryReport::Group& b) {
+            return a.estimated_bytes > b.estimated_bytes;
+        });
+        return result;
+    }
+
+    size_t samples_ = 0;
+    std::unordered_map<std::string, Sample> types_;
+    std::unordered_map<std::string, Sample> families_;
+    // Largest first
+    std::vector<MemoryReport::BigKey> biggest_;
+};
+
+#endif // REDICRAFT_MEMORY_REPORT_H
@@ -13,22 +13,81 @@ enum class CommandType {
     PING,
     SET,
     GET,
+    MGET,
+    MSET,
+    MSETNX,
     INCR,
     DECR,
     INCRBY,
+    SETBIT,
+    GETBIT,
+    BITCOUNT,
+    BITPOS,
+    BITOP,
     HSET,
     HGET,
     HGETALL,
+    HMGET,
+    HMSET,
+    HINCRBY,
+    HINCRBYFLOAT,
+    HDEL,
+    HLEN,
+    HEXISTS,
     LPUSH,
+    RPUSH,
+    LPOP,
     RPOP,
+    BLPOP,
+    BRPOP,
+    LLEN,
     LRANGE,
     EXPIRE,
     TTL,
+    PEXPIRE,
+    PTTL,
     SADD,
     SMEMBERS,
     SREM,
     SISMEMBER,
     SCARD,
+    ZADD,
+    ZINCRBY,
+    ZSCORE,
+    ZRANK,
+    ZREVRANK,
+    ZRANGE,
+    ZREVRANGE,
+    ZREM,
+    ZCARD,
+    PFADD,
+    PFCOUNT,
+    PFMERGE,
+    SPADD,
+    SPREM,
+    SPPOS,
+    SPCARD,
+    SPRADIUS,
+    SPBOX,
+    XADD,
+    XLEN,
+    XRANGE,
+    XREAD,
+    SUBSCRIBE,
+    UNSUBSCRIBE,
+    PSUBSCRIBE,
+    PUNSUBSCRIBE,
+    PUBLISH,
+    SCAN,
+    HSCAN,
+    SSCAN,
+    MULTI,
+    EXEC,
+    DISCARD,
+    WATCH,
+    UNWATCH,
+    INFO,
+    MEMORY,
     UNKNOWN
 };
 
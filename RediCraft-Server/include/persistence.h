@@ -27,13 +27,8 @@ public:
     // Save data to file (blocking)
     bool saveToFile(const std::string& filename);
     
-    // Create a snapshot of current data for persistence
-    std::tuple<
-        std::unordered_map<std::string, Storage::DataItem>,
-        std::unordered_map<std::string, Storage::HashItem>,
-        std::unordered_map<std::string, Storage::ListItem>,
-        std::unordered_map<std::string, Storage::SetItem>
-    > createSnapshot();
+    // A copy of the keyspace as it stood at one moment
+    std::unordered_map<std::string, Storage::Value> createSnapshot();
     
     // Save data to file asynchronously (non-blocking)
     std::future<bool> saveToFileAsync(const std::string& filename);
@@ -54,9 +49,9 @@ private:
     std::atomic<bool> workers_running_;
     
     // Helper methods for serialization
-    std::string serializeStringData(const std::unordered_map<std::string, Storage::DataItem>& data);
-    std::string serializeHashData(const std::unordered_map<std::string, Storage::HashItem>& data);
-    std::string serializeListData(const std::unordered_map<std::string, Storage::ListItem>& data);
+    std::string serializeStringData(const std::unordered_map<std::string, Storage::Value>& data);
+    std::string serializeHashData(const std::unordered_map<std::string, Storage::Value>& data);
+    std::string serializeListData(const std::unordered_map<std::string, Storage::Value>& data);
     
     // Helper methods for deserialization
     void deserializeStringData(const std::string& data);
@@ -0,0 +1,75 @@
+/*
+ * pubsub.h
+ * author: Андрій Будильников
+ */
+
+#ifndef REDICRAFT_PUBSUB_H
+#define REDICRAFT_PUBSUB_H
+
+#include "flat_hash_map.h"
+#include "read_biased_mutex.h"
+#include "shared_string.h"
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Receives the messages published to the channels and patterns it is
+// subscribed to
+class Subscriber {
+public:
+    virtual ~Subscriber() = default;
+
+    // Queues a message, already formatted as the line the client gets.
+    // Called on the publisher's thread with the registry locked, so it must
+    // neither block nor subscribe or unsubscribe.
+    virtual void deliver(const SharedString& message) = 0;
+};
+
+// Who is subscribed to what, shared by every connection.
+//
+// A message is formatted once per publish, into one reference-counted
+// buffer that every subscriber's output queue shares, so fanning it out to
+// a thousand clients costs a thousand reference counts rather than a
+// thousand copies. Pattern subscriptions are kept in a trie keyed by the
+// literal text before each pattern's first wildcard: a publish walks the
+// channel name down the trie and only tries the patterns on that path, so
+// "chat.lobby.*" is never matched against a "trade.*" message however many
+// such patterns there are. Publishing only reads the registry, so
+// publishers on different threads do not contend.
+class PubSub {
+public:
+    // Each returns false if the subscriber already was, or was not,
+    // subscribed
+    bool subscribe(Subscriber* subscriber, const std::string& channel);
+    bool unsubscribe(Subscriber* subscriber, const std::string& channel);
+    bool psubscribe(Subscriber* subscriber, const std::string& pattern);
+    bool punsubscribe(Subscriber* subscriber, const std::string& pattern);
+
+    // Sends message to the subscribers of the channel and of every pattern
+    // matching it; returns how many deliveries were made
+    size_t publish(const std::string& channel, const std::string& message);
+
+private:
+    struct PatternNode {
+        // By the next byte of the literal prefix, sorted
+        std::vector<std::pair<char, std::unique_ptr<PatternNode>>> children;
+        // The patterns whose literal prefix ends here, with their subscribers
+        std::vector<std::pair<std::string, std::vector<Subscriber*>>> patterns;
+    };
+
+    // Length of the text before the first wildcard or escape
+    static size_t literal_prefix(std::string_view pattern);
+    // Removes subscriber from pattern, whose node is below `node` by the
+    // literal prefix from `depth` on; returns whether it was there
+    static bool remove_pattern(PatternNode& node, const std::string& pattern, size_t depth, size_t prefix,
+                               Subscriber* subscriber);
+
+    mutable ReadBiasedMutex mutex_;
+    FlatHashMap<std::string, std::vector<Subscriber*>> channels_;
+    PatternNode patterns_;
+};
+
+#endif // REDICRAFT_PUBSUB_H
@@ -0,0 +1,191 @@
+/*
+ * quicklist.h
+ * author: Андрій Будильников
+ */
+
+#ifndef REDICRAFT_QUICKLIST_H
+#define REDICRAFT_QUICKLIST_H
+
+#include "listpack.h"
+#include "heap_usage.h"
+#include <cstddef>
+#include <iterator>
+#include <list>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// List of strings stored as a doubly linked list of ListPack nodes.
+//
+// Pushes and pops at either end touch only the first or last node, whose
+// size is capped at kMaxNodeBytes, so they are O(1) no matter how long the
+// list is. Per element the cost is a few bytes of framing instead of a
+// std::string each, and a range read skips whole nodes by their counts
+// before decoding anything.
+class QuickList {
+public:
+    // Roughly the size Redis uses for its quicklist nodes (fill -2)
+    static constexpr size_t kMaxNodeBytes = 8192;
+
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    size_t node_count() const { return nodes_.size(); }
+    // Heap bytes owned by the list, kept up to date on every change
+    size_t memory_usage() const { return memory_; }
+
+    void clear() {
+        nodes_.clear();
+        size_ = 0;
+        memory_ = 0;
+    }
+
+    void push_front(std::string_view value) {
+        if (nodes_.empty() || !fits(nodes_.front(), value)) {
+            nodes_.emplace_front();
+            memory_ += node_memory(nodes_.front());
+        }
+        size_t before = node_memory(nodes_.front());
+        nodes_.front().push_front(value);
+        memory_ += node_memory(nodes_.front()) - before;
+        size_++;
+    }
+
+    void push_back(std::string_view value) {
+        if (nodes_.empty() || !fits(nodes_.back(), value)) {
+            nodes_.emplace_back();
+            memory_ += node_memory(nodes_.back());
+        }
+        size_t before = node_memory(nodes_.back());
+        nodes_.back().push_back(value);
+        memory_ += node_memory(nodes_.back()) - before;
+        size_++;
+    }
+
+    // The list must not be empty
+    std::string pop_front() {
+        memory_ -= node_memory(nodes_.front());
+        std::string value = nodes_.front().pop_front();
+        if (nodes_.front().empty()) {
+            nodes_.pop_front();
+        } else {
+            memory_ += node_memory(nodes_.front());
+        }
+        size_--;
+        return value;
+    }
+
+    std::string pop_back() {
+        memory_ -= node_memory(nodes_.back());
+        std::string value = nodes_.back().pop_back();
+        if (nodes_.back().empty()) {
+            nodes_.pop_back();
+        } else {
+            memory_ += node_memory(nodes_.back());
+        }
+        size_--;
+        return value;
+    }
+
+    // Copies elements first..last (inclusive, already clamped to the list)
+    std::vector<std::string> range(size_t first, size_t last) const {
+        std::vector<std::string> result;
+        if (first > last || last >= size_) {
+            return result;
+        }
+        result.reserve(last - first + 1);
+
+        // Skip whole nodes, from whichever end is closer, until the one
+        // holding `first`
+        auto node = nodes_.begin();
+        size_t index = first;
+        if (first < size_ / 2) {
+            while (index >= node->size()) {
+                index -= node->size();
+                ++node;
+            }
+        } else {
+            size_t node_start = size_;
+            node = nodes_.end();
+            do {
+                --node;
+                node_start -= node->size();
+            } while (node_start > first);
+            index = first - node_start;
+        }
+
+        size_t remaining = last - first + 1;
+        size_t offset = node->begin_offset();
+        for (size_t i = 0; i < index; ++i) {
+            offset = node->next(offset);
+        }
+        while (remaining > 0) {
+            if (offset == node->end_offset()) {
+                ++node;
+                offset = node->begin_offset();
+                continue;
+            }
+            result.emplace_back(node->get(offset));
+            offset = node->next(offset);
+            remaining--;
+        }
+        return result;
+    }
+
+    class const_iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = std::string_view;
+        using difference_type = std::ptrdiff_t;
+        using reference = std::string_view;
+        using pointer = const std::string_view*;
+
+        const_iterator() = default;
+
+        std::string_view operator*() const { return node_->get(offset_); }
+        const_iterator& operator++() {
+            offset_ = node_->next(offset_);
+            if (offset_ == node_->end_offset()) {
+                ++node_;
+                offset_ = 0;
+            }
+            return *this;
+        }
+        const_iterator operator++(int) {
+            const_iterator copy = *this;
+            ++*this;
+            return copy;
+        }
+        bool operator==(const const_iterator& other) const {
+            return node_ == other.node_ && offset_ == other.offset_;
+        }
+        bool operator!=(const const_iterator& other) const { return !(*this == other); }
+
+    private:
+        friend class QuickList;
+        // Nodes are never empty, so offset 0 of a valid node is an element
+        explicit const_iterator(std::list<ListPack>::const_iterator node) : node_(node) {}
+
+        std::list<ListPack>::const_iterator node_;
+        size_t offset_ = 0;
+    };
+
+    const_iterator begin() const { return const_iterator(nodes_.begin()); }
+    const_iterator end() const { return const_iterator(nodes_.end()); }
+
+private:
+    // A std::list node holds the pack plus two links
+    static size_t node_memory(const ListPack& node) {
+        return heap_block_size(sizeof(ListPack) + 2 * sizeof(void*)) + node.memory_usage();
+    }
+
+    static bool fits(const ListPack& node, std::string_view value) {
+        // An oversized element still gets a node to itself
+        return node.bytes() + ListPack::entry_size(value.size()) <= kMaxNodeBytes;
+    }
+
+    std::list<ListPack> nodes_;
+    size_t size_ = 0;
+    size_t memory_ = 0;
+};
+
+#endif // REDICRAFT_QUICKLIST_H
@@ -0,0 +1,188 @@
+/*
+ * read_biased_mutex.h
+ * author: Андрій Будильников
+ */
+
+#ifndef REDICRAFT_READ_BIASED_MUTEX_H
+#define REDICRAFT_READ_BIASED_MUTEX_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <shared_mutex>
+#include <thread>
+
+// Reader-writer lock whose readers do not write any shared cache line.
+//
+// Every std::shared_mutex::lock_shared() is an atomic update of the mutex's
+// reader count, so readers on different cores keep stealing that one cache
+// line from each other even when no writer is around. This lock follows
+// BRAVO (Dice and Kogan, USENIX ATC '19): while the lock is read-biased a
+// reader only claims a slot in a global table, picked by hashing the thread
+// and the lock, and the slots are padded so each thread's slot stays in its
+// own core's cache. A writer takes the underlying mutex, turns the bias off
+// and waits until no slot holds the lock any more (a grace period), then
+// proceeds as usual. Readers arriving while the bias is off use the
+// underlying mutex, and one of them turns the bias back on once nine times
+// the grace period has passed. A shard under a steady stream of writes thus
+// behaves like a plain shared_mutex, losing at most a tenth of its time to
+// grace periods, while a read-mostly shard gets reads that scale with cores.
+//
+// Meets the SharedMutex requirements, so std::shared_lock and
+// std::unique_lock work with it. Not recursive.
+class ReadBiasedMutex {
+public:
+    ReadBiasedMutex() = default;
+    ReadBiasedMutex(const ReadBiasedMutex&) = delete;
+    ReadBiasedMutex& operator=(const ReadBiasedMutex&) = delete;
+
+    void lock() {
+        mutex_.lock();
+        if (read_bias_.load(std::memory_order_relaxed)) {
+            revoke_bias();
+        }
+    }
+
+    bool try_lock() {
+        if (!mutex_.try_lock()) {
+            return false;
+        }
+        if (read_bias_.load(std::memory_order_relaxed)) {
+            revoke_bias();
+        }
+        return true;
+    }
+
+    void unlock() { mutex_.unlock(); }
+
+    void lock_shared() {
+        if (!lock_shared_fast()) {
+            mutex_.lock_shared();
+            maybe_restore_bias();
+        }
+    }
+
+    bool try_lock_shared() {
+        if (lock_shared_fast()) {
+            return true;
+        }
+        if (!mutex_.try_lock_shared()) {
+            return false;
+        }
+        maybe_restore_bias();
+        return true;
+    }
+
+    void unlock_shared() {
+        HeldSlots& held = held_slots();
+        for (size_t i = 0; i < held.count; ++i) {
+            if (held.locks[i] == this) {
+                held.slots[i]->owner.store(nullptr, std::memory_order_release);
+                held.count--;
+                held.locks[i] = held.locks[held.count];
+                held.slots[i] = held.slots[held.count];
+                return;
+            }
+        }
+        mutex_.unlock_shared();
+    }
+
+private:
+    static constexpr size_t kSlotCount = 512;
+    // Read locks one thread can hold through slots at the same time
+    static constexpr size_t kMaxHeldSlots = 8;
+    // How long the bias stays off after a grace period, in grace periods
+    static constexpr int64_t kInhibitMultiplier = 9;
+
+    struct alignas(64) Slot {
+        std::atomic<const ReadBiasedMutex*> owner{nullptr};
+    };
+
+    struct HeldSlots {
+        const ReadBiasedMutex* locks[kMaxHeldSlots];
+        Slot* slots[kMaxHeldSlots];
+        size_t count = 0;
+    };
+
+    static Slot* slot_table() {
+        static Slot table[kSlotCount];
+        return table;
+    }
+
+    static HeldSlots& held_slots() {
+        thread_local HeldSlots held;
+        return held;
+    }
+
+    static uint64_t thread_hash() {
+        static std::atomic<uint64_t> next_thread{1};
+        thread_local uint64_t hash = next_thread.fetch_add(1, std::memory_order_relaxed) * 0x9E3779B97F4A7C15ULL;
+        return hash;
+    }
+
+    Slot& slot_for_this_thread() const {
+        uint64_t lock_hash = static_cast<uint64_t>(reinterpret_cast<uintptr_t>(this)) * 0xC2B2AE3D27D4EB4FULL;
+        return slot_table()[((thread_hash() ^ lock_hash) >> 32) & (kSlotCount - 1)];
+    }
+
+    static int64_t now_ticks() {
+        return std::chrono::steady_clock::now().time_since_epoch().count();
+    }
+
+    bool lock_shared_fast() {
+        if (!read_bias_.load(std::memory_order_acquire)) {
+            return false;
+        }
+        HeldSlots& held = held_slots();
+        if (held.count == kMaxHeldSlots) {
+            return false;
+        }
+        Slot& slot = slot_for_this_thread();
+        const ReadBiasedMutex* expected = nullptr;
+        // Another thread hashing to the same slot sends us the slow way
+        if (!slot.owner.compare_exchange_strong(expected, this, std::memory_order_seq_cst)) {
+            return false;
+        }
+        // Pairs with the store in revoke_bias(): either the writer sees our
+        // slot and waits for it, or we see the bias gone and back off
+        if (!read_bias_.load(std::memory_order_seq_cst)) {
+            slot.owner.store(nullptr, std::memory_order_release);
+            return false;
+        }
+        held.locks[held.count] = this;
+        held.slots[held.count] = &slot;
+        held.count++;
+        return true;
+    }
+
+    // Called with mutex_ held exclusively
+    void revoke_bias() {
+        read_bias_.store(false, std::memory_order_seq_cst);
+        int64_t start = now_ticks();
+        Slot* table = slot_table();
+        for (size_t i = 0; i < kSlotCount; ++i) {
+            while (table[i].owner.load(std::memory_order_seq_cst) == this) {
+                std::this_thread::yield();
+            }
+        }
+        int64_t end = now_ticks();
+        inhibit_until_.store(end + (end - start) * kInhibitMultiplier, std::memory_order_relaxed);
+    }
+
+    // Called with mutex_ held shared, so no writer is between revoking the
+    // bias and unlocking
+    void maybe_restore_bias() {
+        if (!read_bias_.load(std::memory_order_relaxed) &&
+            now_ticks() >= inhibit_until_.load(std::memory_order_relaxed)) {
+            read_bias_.store(true, std::memory_order_release);
+        }
+    }
+
+    std::shared_mutex mutex_;
+    std::atomic<bool> read_bias_{true};
+    // steady_clock ticks before which readers leave the bias off
+    std::atomic<int64_t> inhibit_until_{0};
+};
+
+#endif // REDICRAFT_READ_BIASED_MUTEX_H
@@ -14,7 +14,9 @@
 #include <memory>
 #include <thread>
 #include <vector>
+#include <chrono>
 #include "storage.h"
+#include "pubsub.h"
 #include "replication.h"
 #include "cluster.h"
 
@@ -22,7 +24,7 @@ class Config;
 
 class Server {
 public:
-    Server(asio::io_context& io_context, short port);
+    Server(asio::io_context& io_context, const Config& config);
     void start();
     void stop();
     
@@ -38,9 +40,12 @@ public:
 
 private:
     void do_accept();
+    void schedule_cron(std::chrono::milliseconds delay = std::chrono::milliseconds(100));
     
     asio::ip::tcp::acceptor acceptor_;
+    asio::steady_timer cron_timer_;
     std::unique_ptr<Storage> storage_;
+    PubSub pubsub_;
     std::vector<std::thread> threads_;
     
     // Replication support
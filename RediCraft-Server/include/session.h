@@ -7,8 +7,13 @@
 #define REDICRAFT_SESSION_H
 
 #include <array>
+#include <deque>
 #include <memory>
+#include <mutex>
+#include <set>
 #include <string>
+#include <utility>
+#include <vector>
 
 #ifdef ASIO_STANDALONE
 #include <asio.hpp>
@@ -16,23 +21,108 @@
 #include <asio.hpp>
 #endif
 
-class Storage;
+#include "parser.h"
+#include "pubsub.h"
+#include "shared_string.h"
+#include "storage.h"
 
-class Session : public std::enable_shared_from_this<Session> {
+class Session : public std::enable_shared_from_this<Session>, public Subscriber {
 public:
-    Session(asio::ip::tcp::socket socket, Storage& storage);
+    // Messages a subscriber has not read yet past this many bytes get it
+    // disconnected, so one stalled client cannot take the server's memory
+    static constexpr size_t kMaxPendingMessageBytes = 32 * 1024 * 1024;
+    // Likewise for what a client sends while one of its commands is blocked
+    static constexpr size_t kMaxBlockedInputBytes = 1024 * 1024;
+
+    Session(asio::ip::tcp::socket socket, Storage& storage, PubSub& pubsub);
+    ~Session() override;
     void start();
+    void deliver(const SharedString& message) override;
     
 private:
     void do_read();
     void do_write();
+    // Sends the published messages queued so far, unless a write is in
+    // flight; its completion sends them instead
+    void flush_messages();
+    // Runs one read's worth of input and, unless it blocked, sends the reply
+    void handle_input(std::string command);
     void handle_command(const std::string& command);
+    // Runs one command, turning the errors a command can raise into its
+    // reply
+    void run_command(const Command& cmd);
+    void execute_command(const Command& cmd);
+    // MULTI, EXEC, DISCARD, WATCH and UNWATCH
+    void execute_transaction_command(const Command& cmd);
+    void exec_transaction();
+    // Parks the request until one of `keys` is written or timeout_ms passes
+    // (0 waits for ever); cmd then runs again and its reply is sent. No
+    // thread waits, and what the client sends meanwhile runs after the
+    // reply. A blocking pop is not run again: the push that wakes it has
+    // popped its element already.
+    void block_on(const Command& cmd, const std::vector<std::string>& keys, long long timeout_ms,
+                  Storage::BlockedPop pop = Storage::BlockedPop::NONE);
+    // Waits for the client to send something or hang up while blocked
+    void watch_while_blocked(uint64_t generation);
+    void resume_blocked();
+    // Drops the registration and returns it, so the caller can see whether
+    // a push popped an element for it meanwhile
+    std::shared_ptr<Storage::BlockedClient> stop_blocking();
+    // Pushes back the element a push popped for a client that will not get it
+    void give_back(const Storage::BlockedClient& client);
+    // SUBSCRIBE, UNSUBSCRIBE, PSUBSCRIBE and PUNSUBSCRIBE
+    void execute_subscription_command(const Command& cmd);
     
     asio::ip::tcp::socket socket_;
     Storage& storage_;
+    PubSub& pubsub_;
     std::array<char, 1024> data_;
     std::string response_;
+    // Stored values sent as they are instead of being copied into
+    // response_: each goes out just before the byte of response_ at its
+    // offset. The references keep the buffers alive until the write is done.
+    std::vector<std::pair<size_t, SharedString>> response_values_;
+    std::vector<asio::const_buffer> write_buffers_;
     asio::strand<asio::any_io_executor> strand_;
+    // Between MULTI and EXEC commands are queued instead of run; a command
+    // that could not be queued makes EXEC discard the transaction
+    bool in_multi_ = false;
+    bool multi_failed_ = false;
+    std::vector<Command> queued_;
+    std::vector<Storage::WatchedKey> watched_;
+    // The parked command, if any, and its registration with the storage.
+    // The generation tells a timer or socket wait of an earlier block from
+    // the current one.
+    Command blocked_cmd_;
+    std::shared_ptr<Storage::BlockedClient> blocked_;
+    asio::steady_timer block_timer_;
+    uint64_t block_generation_ = 0;
+    bool resuming_ = false;
+    // The blocking pop whose element is in the reply being written, given
+    // back if the write fails
+    std::shared_ptr<Storage::BlockedClient> sending_popped_;
+    // What the client sent while blocked, run once the reply has gone
+    std::deque<std::string> blocked_input_;
+    size_t blocked_input_bytes_ = 0;
+    // Cleared while EXEC runs: commands in a transaction never block
+    bool can_block_ = true;
+    // While a client is subscribed to anything it may only change its
+    // subscriptions and PING
+    std::set<std::string> channels_;
+    std::set<std::string> patterns_;
+    // Published messages not sent yet, queued by publishers on any thread;
+    // each buffer is shared with the other subscribers that got it
+    std::mutex messages_mutex_;
+    std::vector<SharedString> messages_;
+    size_t messages_bytes_ = 0;
+    bool flush_posted_ = false;
+    bool messages_overflowed_ = false;
+    // The messages being written, kept alive until the write is done
+    std::vector<SharedString> sending_;
+    // Replies and messages share the socket one write at a time; a reply
+    // ready while messages are going out waits for them
+    bool writing_ = false;
+    bool reply_waiting_ = false;
 };
 
 #endif // REDICRAFT_SESSION_H
\ No newline at end of file
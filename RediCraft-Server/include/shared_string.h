@@ -0,0 +1,74 @@
+/*
+ * shared_string.h
+ * author: Андрій Будильников
+ */
+
+#ifndef REDICRAFT_SHARED_STRING_H
+#define REDICRAFT_SHARED_STRING_H
+
+#include "heap_usage.h"
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <new>
+#include <string_view>
+#include <utility>
+
+// Immutable string in one reference-counted heap block.
+//
+// Copies share the buffer, so a reader can take a large value out of a
+// shard under its lock at the cost of one atomic increment, drop the lock
+// and hand the bytes to the socket while a writer replaces or deletes the
+// key. The buffer goes away with the last copy. The count is touched on
+// every copy, so this only pays off for values long enough that copying
+// them costs more than the atomic.
+class SharedString {
+public:
+    SharedString() = default;
+
+    explicit SharedString(std::string_view text) {
+        void* memory = ::operator new(sizeof(Header) + text.size());
+        block_ = new (memory) Header();
+        block_->size = text.size();
+        std::memcpy(reinterpret_cast<char*>(block_ + 1), text.data(), text.size());
+    }
+
+    SharedString(const SharedString& other) : block_(other.block_) {
+        if (block_) {
+            block_->refs.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    SharedString(SharedString&& other) noexcept : block_(std::exchange(other.block_, nullptr)) {}
+
+    SharedString& operator=(SharedString other) noexcept {
+        std::swap(block_, other.block_);
+        return *this;
+    }
+
+    ~SharedString() {
+        if (block_ && block_->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            block_->~Header();
+            ::operator delete(block_);
+        }
+    }
+
+    const char* data() const { return block_ ? reinterpret_cast<const char*>(block_ + 1) : ""; }
+    size_t size() const { return block_ ? block_->size : 0; }
+    std::string_view view() const { return std::string_view(data(), size()); }
+    explicit operator bool() const { return block_ != nullptr; }
+
+    // Heap bytes of the shared block; every holder reports the full block
+    size_t memory_usage() const { return block_ ? heap_block_size(sizeof(Header) + block_->size) : 0; }
+
+private:
+    // The bytes follow the header in the same block
+    struct Header {
+        std::atomic<size_t> refs{1};
+        size_t size = 0;
+    };
+
+    Header* block_ = nullptr;
+};
+
+#endif // REDICRAFT_SHARED_STRING_H
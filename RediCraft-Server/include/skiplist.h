@@ -0,0 +1,317 @@
+/*
+ * skiplist.h
+ * author: Андрій Будильников
+ */
+
+#ifndef REDICRAFT_SKIPLIST_H
+#define REDICRAFT_SKIPLIST_H
+
+#include "heap_usage.h"
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <string_view>
+#include <utility>
+
+// Members ordered by (score, member), as in a Redis sorted set.
+//
+// A skiplist in the style of Redis' zskiplist: every node has a random
+// number of levels (each further level with probability 1/4), and each
+// forward link records how many nodes it skips, its span. Adding the spans
+// along a search path gives a node's rank, so insert, erase, rank and
+// lookup by rank all take O(log n) expected time, and a range is a walk
+// along the bottom level from its first node.
+//
+// A node is one heap block holding the score, the links and the member's
+// bytes, so member() views stay valid until that node is erased. The list
+// does not check for duplicate members; CompactZSet keeps the member index.
+class ZSkipList {
+public:
+    static constexpr int kMaxLevel = 32;
+
+    struct Node;
+
+    struct Link {
+        Node* forward;
+        size_t span;
+    };
+
+    struct Node {
+        double score;
+        Node* backward;
+        uint32_t level_count;
+        uint32_t member_size;
+
+        Link* links() { return reinterpret_cast<Link*>(this + 1); }
+        const Link* links() const { return reinterpret_cast<const Link*>(this + 1); }
+        std::string_view member() const {
+            return std::string_view(reinterpret_cast<const char*>(links() + level_count), member_size);
+        }
+        Node* next() const { return links()[0].forward; }
+        Node* prev() const { return backward; }
+    };
+
+    ZSkipList() = default;
+
+    ZSkipList(const ZSkipList& other) {
+        for (const Node* node = other.first(); node; node = node->next()) {
+            insert(node->score, node->member());
+        }
+    }
+
+    ZSkipList(ZSkipList&& other) noexcept
+        : header_(std::exchange(other.header_, nullptr))
+        , tail_(std::exchange(other.tail_, nullptr))
+        , length_(std::exchange(other.length_, 0))
+        , level_(std::exchange(other.level_, 1))
+        , memory_(std::exchange(other.memory_, 0))
+        , random_state_(other.random_state_) {}
+
+    ZSkipList& operator=(ZSkipList other) noexcept {
+        std::swap(header_, other.header_);
+        std::swap(tail_, other.tail_);
+        std::swap(length_, other.length_);
+        std::swap(level_, other.level_);
+        std::swap(memory_, other.memory_);
+        std::swap(random_state_, other.random_state_);
+        return *this;
+    }
+
+    ~ZSkipList() {
+        if (!header_) {
+            return;
+        }
+        Node* node = header_->next();
+        while (node) {
+            Node* next = node->next();
+            free_node(node);
+            node = next;
+        }
+        free_node(header_);
+    }
+
+    size_t size() const { return length_; }
+    bool empty() const { return length_ == 0; }
+    // Heap bytes of every node, the header included
+    size_t memory_usage() const { return memory_; }
+
+    Node* first() const { return header_ ? header_->next() : nullptr; }
+    Node* last() const { return tail_; }
+
+    // (score, member) order
+    static bool less(double score, std::string_view member, const Node* node) {
+        return score < node->score || (score == node->score && member < node->member());
+    }
+
+    // Adds a member that is not in the list yet
+    Node* insert(double score, std::string_view member) {
+        if (!header_) {
+            header_ = allocate_node(kMaxLevel, 0, std::string_view());
+        }
+        Node* update[kMaxLevel];
+        size_t rank[kMaxLevel];
+        Node* x = header_;
+        for (int i = level_ - 1; i >= 0; --i) {
+            rank[i] = i == level_ - 1 ? 0 : rank[i + 1];
+            while (x->links()[i].forward && less_than_node(x->links()[i].forward, score, member)) {
+                rank[i] += x->links()[i].span;
+                x = x->links()[i].forward;
+            }
+            update[i] = x;
+        }
+
+        int level = random_level();
+        if (level > level_) {
+            for (int i = level_; i < level; ++i) {
+                rank[i] = 0;
+                update[i] = header_;
+                update[i]->links()[i].span = length_;
+            }
+            level_ = level;
+        }
+
+        x = allocate_node(level, score, member);
+        for (int i = 0; i < level; ++i) {
+            x->links()[i].forward = update[i]->links()[i].forward;
+            update[i]->links()[i].forward = x;
+            // rank[0] - rank[i] nodes lie between update[i] and x
+            x->links()[i].span = update[i]->links()[i].span - (rank[0] - rank[i]);
+            update[i]->links()[i].span = (rank[0] - rank[i]) + 1;
+        }
+        // Links above the new node's height now pass over one more node
+        for (int i = level; i < level_; ++i) {
+            update[i]->links()[i].span++;
+        }
+
+        x->backward = update[0] == header_ ? nullptr : update[0];
+        if (x->next()) {
+            x->next()->backward = x;
+        } else {
+            tail_ = x;
+        }
+        length_++;
+        return x;
+    }
+
+    // Returns false if no node has this score and member
+    bool erase(double score, std::string_view member) {
+        Node* update[kMaxLevel];
+        Node* x = find_predecessors(score, member, update);
+        if (!x || x->score != score || x->member() != member) {
+            return false;
+        }
+        unlink(x, update);
+        free_node(x);
+        return true;
+    }
+
+    // Moves a node to a new score and returns it; the node may be replaced
+    // by a new one, so the old pointer must not be used afterwards
+    Node* update_score(Node* node, double new_score) {
+        // Still in order where it is: just change the score
+        Node* before = node->backward;
+        Node* after = node->next();
+        if ((!before || before->score < new_score ||
+             (before->score == new_score && before->member() < node->member())) &&
+            (!after || new_score < after->score ||
+             (new_score == after->score && node->member() < after->member()))) {
+            node->score = new_score;
+            return node;
+        }
+        Node* update[kMaxLevel];
+        find_predecessors(node->score, node->member(), update);
+        unlink(node, update);
+        Node* moved = insert(new_score, node->member());
+        free_node(node);
+        return moved;
+    }
+
+    // 1-based rank of the node with this score and member, 0 if there is none
+    size_t rank(double score, std::string_view member) const {
+        if (!header_) {
+            return 0;
+        }
+        size_t rank = 0;
+        const Node* x = header_;
+        for (int i = level_ - 1; i >= 0; --i) {
+            while (x->links()[i].forward && !less(score, member, x->links()[i].forward)) {
+                rank += x->links()[i].span;
+                x = x->links()[i].forward;
+            }
+            if (x != header_ && x->score == score && x->member() == member) {
+                return rank;
+            }
+        }
+        return 0;
+    }
+
+    // Node at a 1-based rank, nullptr past the end
+    Node* at_rank(size_t rank) const {
+        if (!header_ || rank == 0 || rank > length_) {
+            return nullptr;
+        }
+        size_t traversed = 0;
+        Node* x = header_;
+        for (int i = level_ - 1; i >= 0; --i) {
+            while (x->links()[i].forward && traversed + x->links()[i].span <= rank) {
+                traversed += x->links()[i].span;
+                x = x->links()[i].forward;
+            }
+            if (traversed == rank) {
+                return x;
+            }
+        }
+        return nullptr;
+    }
+
+private:
+    static bool less_than_node(const Node* node, double score, std::string_view member) {
+        return node->score < score || (node->score == score && node->member() < member);
+    }
+
+    Node* allocate_node(int level, double score, std::string_view member) {
+        size_t bytes = node_bytes(level, member.size());
+        Node* node = static_cast<Node*>(::operator new(bytes));
+        node->score = score;
+        node->backward = nullptr;
+        node->level_count = static_cast<uint32_t>(level);
+        node->member_size = static_cast<uint32_t>(member.size());
+        for (int i = 0; i < level; ++i) {
+            node->links()[i] = Link{nullptr, 0};
+        }
+        if (!member.empty()) {
+            std::memcpy(reinterpret_cast<char*>(node->links() + level), member.data(), member.size());
+        }
+        memory_ += heap_block_size(bytes);
+        return node;
+    }
+
+    void free_node(Node* node) {
+        memory_ -= heap_block_size(node_bytes(static_cast<int>(node->level_count), node->member_size));
+        ::operator delete(node);
+    }
+
+    static size_t node_bytes(int level, size_t member_size) {
+        return sizeof(Node) + static_cast<size_t>(level) * sizeof(Link) + member_size;
+    }
+
+    // Fills update with the last node before (score, member) on every level
+    // and returns the node after it on the bottom level
+    Node* find_predecessors(double score, std::string_view member, Node** update) const {
+        if (!header_) {
+            return nullptr;
+        }
+        Node* x = header_;
+        for (int i = level_ - 1; i >= 0; --i) {
+            while (x->links()[i].forward && less_than_node(x->links()[i].forward, score, member)) {
+                x = x->links()[i].forward;
+            }
+            update[i] = x;
+        }
+        return x->next();
+    }
+
+    void unlink(Node* x, Node** update) {
+        for (int i = 0; i < level_; ++i) {
+            if (update[i]->links()[i].forward == x) {
+                update[i]->links()[i].span += x->links()[i].span - 1;
+                update[i]->links()[i].forward = x->links()[i].forward;
+            } else {
+                update[i]->links()[i].span--;
+            }
+        }
+        if (x->next()) {
+            x->next()->backward = x->backward;
+        } else {
+            tail_ = x->backward;
+        }
+        while (level_ > 1 && !header_->links()[level_ - 1].forward) {
+            level_--;
+        }
+        length_--;
+    }
+
+    int random_level() {
+        // xorshift64*; two random bits per level give the 1/4 promotion odds
+        random_state_ ^= random_state_ >> 12;
+        random_state_ ^= random_state_ << 25;
+        random_state_ ^= random_state_ >> 27;
+        uint64_t bits = random_state_ * 0x2545F4914F6CDD1DULL;
+        int level = 1;
+        while (level < kMaxLevel && (bits & 3) == 0) {
+            level++;
+            bits >>= 2;
+        }
+        return level;
+    }
+
+    Node* header_ = nullptr;
+    Node* tail_ = nullptr;
+    size_t length_ = 0;
+    int level_ = 1;
+    size_t memory_ = 0;
+    uint64_t random_state_ = 0x9E3779B97F4A7C15ULL;
+};
+
+#endif // REDICRAFT_SKIPLIST_H
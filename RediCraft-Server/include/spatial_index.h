@@ -0,0 +1,375 @@
+/*
+ * spatial_index.h
+ * author: Андрій Будильников
+ */
+
+#ifndef REDICRAFT_SPATIAL_INDEX_H
+#define REDICRAFT_SPATIAL_INDEX_H
+
+#include "flat_hash_map.h"
+#include "heap_usage.h"
+#include "shared_string.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace spatial_detail {
+
+// Morton (Z-order) codes of the horizontal plane: x in the odd bits, z in
+// the even ones. The sign bit is flipped first, so codes sort like the
+// signed coordinates and every point of an x/z box has a code between
+// those of the box's lowest and highest corners.
+inline uint64_t spread_bits(uint32_t value) {
+    uint64_t x = value;
+    x = (x | (x << 16)) & 0x0000FFFF0000FFFFULL;
+    x = (x | (x << 8)) & 0x00FF00FF00FF00FFULL;
+    x = (x | (x << 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    x = (x | (x << 2)) & 0x3333333333333333ULL;
+    x = (x | (x << 1)) & 0x5555555555555555ULL;
+    return x;
+}
+
+inline uint32_t compact_bits(uint64_t x) {
+    x &= 0x5555555555555555ULL;
+    x = (x | (x >> 1)) & 0x3333333333333333ULL;
+    x = (x | (x >> 2)) & 0x0F0F0F0F0F0F0F0FULL;
+    x = (x | (x >> 4)) & 0x00FF00FF00FF00FFULL;
+    x = (x | (x >> 8)) & 0x0000FFFF0000FFFFULL;
+    x = (x | (x >> 16)) & 0x00000000FFFFFFFFULL;
+    return static_cast<uint32_t>(x);
+}
+
+inline uint64_t morton_code(int32_t x, int32_t z) {
+    uint32_t ux = static_cast<uint32_t>(x) ^ 0x80000000u;
+    uint32_t uz = static_cast<uint32_t>(z) ^ 0x80000000u;
+    return (spread_bits(ux) << 1) | spread_bits(uz);
+}
+
+inline int32_t morton_x(uint64_t code) {
+    return static_cast<int32_t>(compact_bits(code >> 1) ^ 0x80000000u);
+}
+
+inline int32_t morton_z(uint64_t code) {
+    return static_cast<int32_t>(compact_bits(code) ^ 0x80000000u);
+}
+
+// The smallest code above `code` inside the box whose lowest and highest
+// corners have codes min and max, for a code between them that is outside
+// the box (BIGMIN in Tropf and Herzog, "Multidimensional Range Search in
+// Dynamically Balanced Trees", 1981). Returns 0 if there is none.
+inline uint64_t next_in_box(uint64_t code, uint64_t min, uint64_t max) {
+    uint64_t result = 0;
+    for (int bit = 63; bit >= 0; --bit) {
+        uint64_t mask = static_cast<uint64_t>(1) << bit;
+        // This bit and the lower bits of the same coordinate
+        uint64_t same = ((bit & 1) ? 0xAAAAAAAAAAAAAAAAULL : 0x5555555555555555ULL) & (mask | (mask - 1));
+        bool c = (code & mask) != 0;
+        bool lo = (min & mask) != 0;
+        bool hi = (max & mask) != 0;
+        if (!c && !lo && hi) {
+            // Either the lower half of the range, bounded by max, or its
+            // upper half from here, the best answer found so far
+            result = (min & ~same) | mask;
+            max = (max & ~same) | (same & ~mask);
+        } else if (!c && lo && hi) {
+            return min;
+        } else if (c && !lo && !hi) {
+            return result;
+        } else if (c && !lo && hi) {
+            min = (min & ~same) | mask;
+        }
+    }
+    return result;
+}
+
+} // namespace spatial_detail
+
+// Members at integer (x, y, z) coordinates, such as entities or block
+// entities of a Minecraft world, with queries by horizontal radius and by
+// box.
+//
+// Entries are kept in Z-order of (x, z) in blocks of up to kBlockEntries,
+// themselves in order: a two-level B-tree that finds a code in two binary
+// searches, adds or moves a member by shifting one block, and reads a run
+// of nearby points from contiguous memory. A box query walks the codes
+// between its corners and, on reaching one outside the box, jumps to the
+// next code inside it, so it reads little more than the points it returns
+// however many points lie around the box. y is filtered while walking; it
+// rarely narrows a Minecraft query much.
+//
+// A hash index from member to its code finds a member's entry for a move
+// or removal. Member names are SharedStrings, so the index can view their
+// bytes wherever the entries move, and copies of the whole index share
+// them. Kept behind a pointer so every Value stays small.
+class SpatialIndex {
+public:
+    struct Point {
+        int32_t x;
+        int32_t y;
+        int32_t z;
+    };
+
+    static constexpr size_t kBlockEntries = 128;
+
+    SpatialIndex() : data_(std::make_unique<Data>()) {}
+    SpatialIndex(const SpatialIndex& other) : data_(std::make_unique<Data>(*other.data_)) {}
+    SpatialIndex(SpatialIndex&&) = default;
+    SpatialIndex& operator=(const SpatialIndex& other) {
+        if (this != &other) {
+            data_ = std::make_unique<Data>(*other.data_);
+        }
+        return *this;
+    }
+    SpatialIndex& operator=(SpatialIndex&&) = default;
+
+    size_t size() const { return data_->members.size(); }
+    bool empty() const { return size() == 0; }
+
+    // Adds the member or moves it; returns true if it is new
+    bool add(std::string_view member, const Point& point) {
+        uint64_t code = spatial_detail::morton_code(point.x, point.z);
+        auto it = data_->members.find(member);
+        if (it != data_->members.end()) {
+            Location& location = it->second;
+            if (location.code == code && location.y == point.y) {
+                return false;
+            }
+            SharedString name = take_entry(location.code, member);
+            location = Location{code, point.y};
+            insert_entry(Entry{code, point.y, std::move(name)});
+            return false;
+        }
+        SharedString name(member);
+        std::string_view view = name.view();
+        data_->member_memory += name.memory_usage();
+        insert_entry(Entry{code, point.y, std::move(name)});
+        data_->members.try_emplace(view, Location{code, point.y});
+        return true;
+    }
+
+    // Returns false if the member was not present
+    bool erase(std::string_view member) {
+        auto it = data_->members.find(member);
+        if (it == data_->members.end()) {
+            return false;
+        }
+        uint64_t code = it->second.code;
+        data_->members.erase(it);
+        SharedString name = take_entry(code, member);
+        data_->member_memory -= name.memory_usage();
+        return true;
+    }
+
+    bool position(std::string_view member, Point& point) const {
+        auto it = data_->members.find(member);
+        if (it == data_->members.end()) {
+            return false;
+        }
+        point = Point{spatial_detail::morton_x(it->second.code), it->second.y,
+                      spatial_detail::morton_z(it->second.code)};
+        return true;
+    }
+
+    // Calls f(std::string_view member, const Point& point) for the members
+    // with min.x <= x <= max.x and the same for y and z, in Z-order, until
+    // f returns false
+    template <typename F>
+    void for_each_in_box(const Point& min, const Point& max, F&& f) const {
+        if (min.x > max.x || min.y > max.y || min.z > max.z) {
+            return;
+        }
+        uint64_t min_code = spatial_detail::morton_code(min.x, min.z);
+        uint64_t max_code = spatial_detail::morton_code(max.x, max.z);
+        const std::vector<Block>& blocks = data_->blocks;
+        Position pos = lower_bound(min_code, Position{0, 0});
+        while (pos.block < blocks.size()) {
+            const Entry& entry = blocks[pos.block].entries[pos.index];
+            if (entry.code > max_code) {
+                return;
+            }
+            int32_t x = spatial_detail::morton_x(entry.code);
+            int32_t z = spatial_detail::morton_z(entry.code);
+            if (x < min.x || x > max.x || z < min.z || z > max.z) {
+                uint64_t next = spatial_detail::next_in_box(entry.code, min_code, max_code);
+                if (next <= entry.code) {
+                    return;
+                }
+                pos = lower_bound(next, pos);
+                continue;
+            }
+            if (entry.y >= min.y && entry.y <= max.y && !f(entry.member.view(), Point{x, entry.y, z})) {
+                return;
+            }
+            if (++pos.index == blocks[pos.block].entries.size()) {
+                pos = Position{pos.block + 1, 0};
+            }
+        }
+    }
+
+    // Calls f(std::string_view member, const Point& point) for the members
+    // whose horizontal distance from (x, z) is at most radius, at any
+    // height, until f returns false
+    template <typename F>
+    void for_each_in_radius(int32_t x, int32_t z, uint32_t radius, F&& f) const {
+        auto clamp = [](int64_t value) {
+            return static_cast<int32_t>(std::max<int64_t>(INT32_MIN, std::min<int64_t>(INT32_MAX, value)));
+        };
+        Point min{clamp(static_cast<int64_t>(x) - radius), INT32_MIN, clamp(static_cast<int64_t>(z) - radius)};
+        Point max{clamp(static_cast<int64_t>(x) + radius), INT32_MAX, clamp(static_cast<int64_t>(z) + radius)};
+        uint64_t limit = static_cast<uint64_t>(radius) * radius;
+        for_each_in_box(min, max, [&](std::string_view member, const Point& point) {
+            // Both offsets are at most radius < 2^32, so each square fits;
+            // their sum may not, hence the subtraction
+            uint64_t dx = static_cast<uint64_t>(std::abs(static_cast<int64_t>(point.x) - x));
+            uint64_t dz = static_cast<uint64_t>(std::abs(static_cast<int64_t>(point.z) - z));
+            if (dz * dz > limit - dx * dx) {
+                return true;
+            }
+            return f(member, point);
+        });
+    }
+
+    // Calls f(std::string_view member, const Point& point) for every member
+    // in Z-order
+    template <typename F>
+    void for_each(F&& f) const {
+        for (const Block& block : data_->blocks) {
+            for (const Entry& entry : block.entries) {
+                f(entry.member.view(), Point{spatial_detail::morton_x(entry.code), entry.y,
+                                             spatial_detail::morton_z(entry.code)});
+            }
+        }
+    }
+
+    // Heap bytes owned by the index
+    size_t memory_usage() const {
+        const Data& data = *data_;
+        return heap_block_size(sizeof(Data)) + heap_block_size(data.blocks.capacity() * sizeof(Block)) +
+               data.entry_memory + data.member_memory + heap_block_size(data.members.allocated_bytes());
+    }
+
+private:
+    struct Entry {
+        uint64_t code;
+        int32_t y;
+        SharedString member;
+    };
+
+    // Entries in code order; members at the same (x, z) in any order
+    struct Block {
+        std::vector<Entry> entries;
+    };
+
+    struct Location {
+        uint64_t code;
+        int32_t y;
+    };
+
+    struct Data {
+        std::vector<Block> blocks;
+        FlatHashMap<std::string_view, Location> members;
+        // Heap bytes of the blocks' entry arrays and of the member names
+        size_t entry_memory = 0;
+        size_t member_memory = 0;
+    };
+
+    struct Position {
+        size_t block;
+        size_t index;
+    };
+
+    static bool entry_less(const Entry& entry, uint64_t code) { return entry.code < code; }
+
+    // First entry with a code of at least `code`, searching from `from`
+    // on; blocks.size() if there is none
+    Position lower_bound(uint64_t code, Position from) const {
+        const std::vector<Block>& blocks = data_->blocks;
+        if (from.block < blocks.size() && blocks[from.block].entries.back().code >= code) {
+            const std::vector<Entry>& entries = blocks[from.block].entries;
+            auto it = std::lower_bound(entries.begin() + static_cast<std::ptrdiff_t>(from.index), entries.end(),
+                                       code, entry_less);
+            return Position{from.block, static_cast<size_t>(it - entries.begin())};
+        }
+        auto block = std::lower_bound(blocks.begin() + static_cast<std::ptrdiff_t>(std::min(from.block, blocks.size())),
+                                      blocks.end(), code,
+                                      [](const Block& b, uint64_t c) { return b.entries.back().code < c; });
+        if (block == blocks.end()) {
+            return Position{blocks.size(), 0};
+        }
+        auto it = std::lower_bound(block->entries.begin(), block->entries.end(), code, entry_less);
+        return Position{static_cast<size_t>(block - blocks.begin()), static_cast<size_t>(it - block->entries.begin())};
+    }
+
+    void insert_entry(Entry entry) {
+        std::vector<Block>& blocks = data_->blocks;
+        if (blocks.empty()) {
+            blocks.emplace_back();
+            blocks.back().entries.push_back(std::move(entry));
+            data_->entry_memory += heap_block_size(sizeof(Entry));
+            return;
+        }
+        // The last block starting at or below the code, or the first one
+        auto after = std::upper_bound(blocks.begin(), blocks.end(), entry.code,
+                                      [](uint64_t c, const Block& b) { return c < b.entries.front().code; });
+        size_t index = after == blocks.begin() ? 0 : static_cast<size_t>(after - blocks.begin()) - 1;
+        std::vector<Entry>* entries = &blocks[index].entries;
+        if (entries->size() == kBlockEntries) {
+            // Split in half; the upper half gets a block of its own
+            Block upper;
+            upper.entries.reserve(kBlockEntries);
+            upper.entries.assign(std::make_move_iterator(entries->begin() + kBlockEntries / 2),
+                                 std::make_move_iterator(entries->end()));
+            entries->erase(entries->begin() + kBlockEntries / 2, entries->end());
+            data_->entry_memory += heap_block_size(kBlockEntries * sizeof(Entry));
+            blocks.insert(blocks.begin() + static_cast<std::ptrdiff_t>(index) + 1, std::move(upper));
+            if (entry.code >= blocks[index + 1].entries.front().code) {
+                index++;
+            }
+            entries = &blocks[index].entries;
+        }
+        size_t before = heap_block_size(entries->capacity() * sizeof(Entry));
+        auto position = std::upper_bound(entries->begin(), entries->end(), entry.code,
+                                         [](uint64_t c, const Entry& e) { return c < e.code; });
+        entries->insert(position, std::move(entry));
+        data_->entry_memory += heap_block_size(entries->capacity() * sizeof(Entry)) - before;
+    }
+
+    // Removes the entry of member, which sits at code, and returns its name
+    SharedString take_entry(uint64_t code, std::string_view member) {
+        std::vector<Block>& blocks = data_->blocks;
+        Position pos = lower_bound(code, Position{0, 0});
+        while (blocks[pos.block].entries[pos.index].member.view() != member) {
+            if (++pos.index == blocks[pos.block].entries.size()) {
+                pos = Position{pos.block + 1, 0};
+            }
+        }
+        std::vector<Entry>& entries = blocks[pos.block].entries;
+        SharedString name = std::move(entries[pos.index].member);
+        entries.erase(entries.begin() + static_cast<std::ptrdiff_t>(pos.index));
+        if (entries.empty()) {
+            data_->entry_memory -= heap_block_size(entries.capacity() * sizeof(Entry));
+            blocks.erase(blocks.begin() + static_cast<std::ptrdiff_t>(pos.block));
+        } else if (pos.block + 1 < blocks.size() &&
+                   entries.size() + blocks[pos.block + 1].entries.size() <= kBlockEntries / 2) {
+            // Two neighbours this empty are merged, so removals cannot
+            // leave a long tail of nearly empty blocks
+            std::vector<Entry>& next = blocks[pos.block + 1].entries;
+            size_t before = heap_block_size(entries.capacity() * sizeof(Entry)) +
+                            heap_block_size(next.capacity() * sizeof(Entry));
+            entries.insert(entries.end(), std::make_move_iterator(next.begin()), std::make_move_iterator(next.end()));
+            size_t after = heap_block_size(entries.capacity() * sizeof(Entry));
+            blocks.erase(blocks.begin() + static_cast<std::ptrdiff_t>(pos.block) + 1);
+            data_->entry_memory = data_->entry_memory + after - before;
+        }
+        return name;
+    }
+
+    std::unique_ptr<Data> data_;
+};
+
+#endif // REDICRAFT_SPATIAL_INDEX_H
@@ -6,96 +6,675 @@
 #ifndef REDICRAFT_STORAGE_H
 #define REDICRAFT_STORAGE_H
 
+#include <algorithm>
 #include <string>
 #include <unordered_map>
 #include <vector>
+#include <memory>
 #include <shared_mutex>
 #include <chrono>
+#include <variant>
+#include <stdexcept>
+#include <cstdint>
+#include <atomic>
+#include <mutex>
+#include <functional>
+#include <string_view>
+#include "flat_hash_map.h"
+#include "dict.h"
+#include "quicklist.h"
+#include "compact_set.h"
+#include "compact_hash.h"
+#include "compact_zset.h"
+#include "hyperloglog.h"
+#include "spatial_index.h"
+#include "stream.h"
+#include "eviction.h"
+#include "memory_report.h"
+#include "read_biased_mutex.h"
+#include "shared_string.h"
+
+// Thrown when a command is run against a key holding another type
+class WrongTypeError : public std::runtime_error {
+public:
+    WrongTypeError()
+        : std::runtime_error("WRONGTYPE Operation against a key holding the wrong kind of value") {}
+};
+
+// Thrown by writes when used memory is over maxmemory and the eviction
+// policy cannot free any
+class OutOfMemoryError : public std::runtime_error {
+public:
+    OutOfMemoryError()
+        : std::runtime_error("OOM command not allowed when used memory > 'maxmemory'") {}
+};
 
 class Storage {
 public:
-    struct DataItem {
-        std::string value;
-        bool has_expiry = false;
-        std::chrono::steady_clock::time_point expiry;
-        
-        DataItem() = default;
-        explicit DataItem(const std::string& val) : value(val) {}
-    };
-    
-    struct HashItem {
-        std::unordered_map<std::string, std::string> fields;
-        bool has_expiry = false;
-        std::chrono::steady_clock::time_point expiry;
+    // The order matches the alternatives of Value::data
+    enum class ValueType {
+        STRING,
+        HASH,
+        LIST,
+        SET,
+        ZSET,
+        HYPERLOGLOG,
+        SPATIAL,
+        STREAM
     };
-    
-    struct ListItem {
-        std::vector<std::string> values;
+
+    using HashFields = CompactHash;
+    using ListValues = QuickList;
+    using SetMembers = CompactSet;
+    using ZSetMembers = CompactZSet;
+
+    // Every key maps to exactly one tagged value holding its type, its
+    // expiry and the payload for that type. Strings have two more encodings
+    // after the container types, both still STRING values: canonical 64-bit
+    // integers are kept as long long so counters never round-trip through
+    // text, and strings of kSharedStringBytes or more are kept as a
+    // SharedString so GET can send them without copying. A string changed
+    // by SETBIT stays a plain std::string whatever its length, so setting
+    // bits one by one never copies the bitmap.
+    // `access` feeds the LRU/LFU eviction policies.
+    struct Value {
+        // Shorter strings are cheaper to copy than to share: the copy fits
+        // in a few cache lines and never bounces a reference count between
+        // the cores reading a hot key
+        static constexpr size_t kSharedStringBytes = 512;
+
+        std::variant<std::string, HashFields, ListValues, SetMembers, ZSetMembers, HyperLogLog, SpatialIndex,
+                     Stream, long long, SharedString> data;
         bool has_expiry = false;
+        mutable AccessStamp access;
         std::chrono::steady_clock::time_point expiry;
+
+        Value() = default;
+        explicit Value(const std::string& val);
+        explicit Value(long long val) : data(val) {}
+
+        ValueType type() const {
+            return data.index() > static_cast<size_t>(ValueType::STREAM) ? ValueType::STRING
+                                                                         : static_cast<ValueType>(data.index());
+        }
+        bool is_integer() const { return std::holds_alternative<long long>(data); }
     };
-    
-    struct SetItem {
-        std::unordered_map<std::string, bool> members; // Using map for O(1) lookup
-        bool has_expiry = false;
-        std::chrono::steady_clock::time_point expiry;
+
+    // Parses s if it is exactly how std::to_string would print a long long
+    // (no spaces, plus sign or leading zeros), so encoding never changes
+    // what GET returns
+    static bool parseInteger(const std::string& s, long long& result);
+    // Parses a finite decimal or exponent number filling all of s
+    static bool parseFloat(std::string_view s, long double& result);
+    // The number rounded to 17 significant digits, without trailing zeros;
+    // large and tiny numbers get an exponent
+    static std::string formatFloat(long double value);
+    // The text of a STRING value, whichever way it is encoded. Throws
+    // WrongTypeError for other types.
+    static std::string stringValue(const Value& value);
+
+    // Called with each field and value of a hash, or each member of a set,
+    // while the shard is locked; the views are only valid during the call
+    using FieldVisitor = std::function<void(std::string_view field, std::string_view value)>;
+    using MemberVisitor = std::function<void(std::string_view member)>;
+    // Called for each requested field in order, with found == false and an
+    // empty value for fields the hash does not have
+    using LookupVisitor = std::function<void(bool found, std::string_view value)>;
+
+    // Size limits for the compact encodings of small values
+    struct EncodingLimits {
+        SetLimits set;
+        HashLimits hash;
+        ZSetLimits zset;
+        HyperLogLogLimits hll;
     };
 
-    Storage();
-    
+    // shard_count is rounded up to a power of two; 0 picks a default
+    // based on the number of hardware threads
+    explicit Storage(size_t shard_count = 0, const EncodingLimits& limits = EncodingLimits());
+
     // String operations
     bool set(const std::string& key, const std::string& value);
     bool get(const std::string& key, std::string& value);
+    // GET without copying long values: a value stored as a SharedString is
+    // returned in `shared` and `value` is left alone, any other is copied
+    // into `value` and `shared` is left empty
+    bool get(const std::string& key, std::string& value, SharedString& shared);
+
+    // Batches. Keys are grouped by shard and each shard is locked once for
+    // all of its keys, so a batch of N keys costs a handful of lock round
+    // trips instead of N.
+    //
+    // MGET result for one key, filled in the same way as by the shared get()
+    struct StringResult {
+        bool found = false;
+        std::string value;
+        SharedString shared;
+    };
+    // Results in the order of `keys`; keys holding other types are reported
+    // missing, as in Redis. Shards are read one after another, so the batch
+    // is consistent per shard but not across shards.
+    std::vector<StringResult> mget(const std::vector<std::string>& keys);
+    // Alternating keys and values (an even number of strings). MSET applies
+    // shard by shard; for a key given twice the last value wins. MSETNX
+    // locks every shard involved at once and sets all the keys only if none
+    // of them exists, returning false otherwise.
+    void mset(const std::vector<std::string>& keys_and_values);
+    bool msetnx(const std::vector<std::string>& keys_and_values);
     long long incr(const std::string& key);
     long long decr(const std::string& key);
     long long incrby(const std::string& key, long long increment);
-    
+
+    // Bitmaps: STRING values read as bits, bit 0 being the most significant
+    // bit of the first byte, as in Redis. Positions in a range count bytes,
+    // or bits with `bits`; negative ones count from the end. The kernels are
+    // in bitops.h.
+    //
+    // Highest offset SETBIT accepts: bitmaps stop at 512 MB
+    static constexpr uint64_t kMaxBitOffset = (512ULL << 23) - 1;
+    // Sets or clears one bit, padding the string with zero bytes up to it,
+    // and returns the bit's old value
+    int setbit(const std::string& key, uint64_t offset, bool bit);
+    int getbit(const std::string& key, uint64_t offset);
+    // Set bits from start to end inclusive
+    long long bitcount(const std::string& key, long long start, long long end, bool bits);
+    // Position of the first bit equal to `bit` from start to end, or -1. A
+    // missing key holds only zeros. When looking for a 0 in a range running
+    // to the end of the string (end_given false), the string counts as
+    // followed by zeros, so a string of ones answers with its length in bits.
+    long long bitpos(const std::string& key, bool bit, long long start, long long end, bool end_given,
+                     bool bits);
+    enum class BitOp {
+        AND,
+        OR,
+        XOR,
+        NOT
+    };
+    // Combines the source strings bit by bit into dest, shorter ones padded
+    // with zeros (NOT reads only the first), and returns dest's new length; an
+    // empty result deletes dest. Runs with every shard involved locked, so
+    // the result is consistent even with concurrent writers.
+    long long bitop(BitOp op, const std::string& dest, const std::vector<std::string>& sources);
+
     // Hash operations
     bool hset(const std::string& key, const std::string& field, const std::string& value);
     bool hget(const std::string& key, const std::string& field, std::string& value);
-    std::unordered_map<std::string, std::string> hgetall(const std::string& key);
-    
+    // Visits nothing if the key does not exist
+    void hgetall(const std::string& key, const FieldVisitor& visit);
+    // Several fields under one lock: HMGET visits every field, found or not;
+    // HMSET takes alternating fields and values and returns how many fields
+    // are new
+    void hmget(const std::string& key, const std::vector<std::string>& fields, const LookupVisitor& visit);
+    long long hmset(const std::string& key, const std::vector<std::string>& fields_and_values);
+    // Atomic in-place updates of a numeric field, which starts from 0 when
+    // it is missing or not a number (as INCRBY does). HINCRBY throws
+    // std::overflow_error past the 64-bit range, HINCRBYFLOAT when the
+    // result is not finite; it returns the new value as stored.
+    long long hincrby(const std::string& key, const std::string& field, long long increment);
+    std::string hincrbyfloat(const std::string& key, const std::string& field, long double increment);
+    // Returns the number of fields removed; the key goes when its last
+    // field does
+    long long hdel(const std::string& key, const std::vector<std::string>& fields);
+    long long hlen(const std::string& key);
+    bool hexists(const std::string& key, const std::string& field);
+    // One step of HSCAN over the fields; see scan()
+    uint64_t hscan(const std::string& key, uint64_t cursor, const std::string& pattern, size_t count,
+                   const FieldVisitor& visit);
+
     // List operations
     long long lpush(const std::string& key, const std::vector<std::string>& values);
+    long long rpush(const std::string& key, const std::vector<std::string>& values);
+    bool lpop(const std::string& key, std::string& value);
     bool rpop(const std::string& key, std::string& value);
+    long long llen(const std::string& key);
     std::vector<std::string> lrange(const std::string& key, long long start, long long end);
-    
+
     // Set operations
     long long sadd(const std::string& key, const std::vector<std::string>& members);
     long long srem(const std::string& key, const std::vector<std::string>& members);
     bool sismember(const std::string& key, const std::string& member);
-    std::unordered_map<std::string, bool> smembers(const std::string& key);
+    void smembers(const std::string& key, const MemberVisitor& visit);
     long long scard(const std::string& key);
-    
-    // Expiration
+    // One step of SSCAN over the members; see scan()
+    uint64_t sscan(const std::string& key, uint64_t cursor, const std::string& pattern, size_t count,
+                   const MemberVisitor& visit);
+
+    // Sorted set operations. Members are ordered by score, then by member
+    // bytes; ranks and ranges count from 0 at the lowest score, or at the
+    // highest with `reverse`.
+    using ScoreVisitor = std::function<void(std::string_view member, double score)>;
+    // Adds members or moves existing ones to new scores; returns how many
+    // are new
+    long long zadd(const std::string& key, const std::vector<std::pair<double, std::string>>& members);
+    // Adds to a member's score (from 0 when it is missing) and returns the
+    // new score; throws std::overflow_error if it would be NaN
+    double zincrby(const std::string& key, const std::string& member, double increment);
+    bool zscore(const std::string& key, const std::string& member, double& score);
+    // False if the key or the member does not exist
+    bool zrank(const std::string& key, const std::string& member, bool reverse, long long& rank);
+    // Visits the members from start to end inclusive; negative indexes
+    // count from the end, as in LRANGE
+    void zrange(const std::string& key, long long start, long long end, bool reverse, const ScoreVisitor& visit);
+    // Returns the number of members removed; the key goes when its last
+    // member does
+    long long zrem(const std::string& key, const std::vector<std::string>& members);
+    long long zcard(const std::string& key);
+    // Shortest text that reads back as the same double ("inf" and "-inf"
+    // for the infinities), used for scores in replies and persistence
+    static std::string formatScore(double score);
+    // A double, or inf/+inf/-inf; NaN is rejected
+    static bool parseScore(std::string_view s, double& score);
+
+    // HyperLogLog: distinct counts within 0.81% in at most 12 KB per key.
+    // Adds elements, creating the key if needed; returns true if the key
+    // was created or its estimate may have changed
+    bool pfadd(const std::string& key, const std::vector<std::string>& elements);
+    // Estimated distinct elements of the union of the keys; missing keys
+    // count as empty. One key returns its cached estimate.
+    uint64_t pfcount(const std::vector<std::string>& keys);
+    // Stores the union of dest (if it exists) and the sources in dest
+    void pfmerge(const std::string& dest, const std::vector<std::string>& sources);
+    // Replaces key with a HyperLogLog holding these HyperLogLog::kRegisters
+    // register values, as persistence saved them
+    void pfrestore(const std::string& key, const unsigned char* registers);
+
+    // Spatial index: members at integer (x, y, z) points, such as entities
+    // or block entities of a world, found by horizontal radius or by box.
+    // Replies visit the matches in Z-order of (x, z) while the shard is
+    // locked, without building a list first.
+    using Point = SpatialIndex::Point;
+    using PointVisitor = std::function<void(std::string_view member, const Point& point)>;
+    // Adds members or moves existing ones to new points; returns how many
+    // are new
+    long long spadd(const std::string& key, const std::vector<std::pair<Point, std::string>>& members);
+    // Returns the number of members removed; the key goes when its last
+    // member does
+    long long sprem(const std::string& key, const std::vector<std::string>& members);
+    bool sppos(const std::string& key, const std::string& member, Point& point);
+    long long spcard(const std::string& key);
+    // Visits up to `count` members (0 for no limit) whose horizontal
+    // distance from (x, z) is at most radius, at any height
+    void spradius(const std::string& key, int32_t x, int32_t z, uint32_t radius, size_t count,
+                  const PointVisitor& visit);
+    // Visits up to `count` members (0 for no limit) inside the box with
+    // corners min and max, both inclusive
+    void spbox(const std::string& key, const Point& min, const Point& max, size_t count, const PointVisitor& visit);
+
+    // Streams: append-only logs of field-value entries with increasing IDs,
+    // read from an ID on.
+    using EntryVisitor =
+        std::function<void(const StreamID& id, const std::vector<std::string_view>& fields_and_values)>;
+    // Appends an entry, creating the stream if needed, then trims it to
+    // maxlen entries unless maxlen is negative (see Stream::trim). With
+    // auto_ms the ID is the current time, or the last ID's if that is later;
+    // with auto_ms or auto_seq the sequence is the next one free at that
+    // time. id is the requested ID and, on return, the one used. Returns
+    // false without adding anything if the ID is not above the last one.
+    bool xadd(const std::string& key, StreamID& id, bool auto_ms, bool auto_seq,
+              const std::vector<std::string>& fields_and_values, long long maxlen, bool approximate);
+    long long xlen(const std::string& key);
+    // Visits the entries from start to end inclusive, oldest first, up to
+    // `count` of them (0 for no limit)
+    void xrange(const std::string& key, const StreamID& start, const StreamID& end, size_t count,
+                const EntryVisitor& visit);
+    // The highest ID the stream has had, 0-0 if the key does not exist
+    StreamID xlastid(const std::string& key);
+
+    // Blocking reads (XREAD BLOCK, BLPOP, BRPOP). A client that found
+    // nothing to read registers a wake-up on the keys it waits for; the
+    // next write adding data to one of them calls it, once, while holding
+    // that key's shard lock, so it must do no more than schedule the client
+    // to read again. The client drops the registration with unblock() when
+    // it stops waiting, woken or not.
+    //
+    // A blocking pop is not woken to race for the element: the push pops
+    // it for the longest waiting client there and then and leaves it in
+    // `popped`, so a push of n elements feeds the first n waiters in the
+    // order they blocked. Read `popped` once unblock() has returned.
+    enum class BlockedPop { NONE, LEFT, RIGHT };
+    struct BlockedClient {
+        std::vector<std::string> keys;
+        std::function<void()> wake;
+        std::atomic<bool> woken{false};
+        BlockedPop pop = BlockedPop::NONE;
+        bool popped = false;
+        std::string popped_key;
+        std::string popped_value;
+    };
+    std::shared_ptr<BlockedClient> block(const std::vector<std::string>& keys, std::function<void()> wake,
+                                         BlockedPop pop = BlockedPop::NONE);
+    void unblock(const std::shared_ptr<BlockedClient>& client);
+
+    // Expiration. A zero or negative timeout deletes the key right away.
     bool expire(const std::string& key, long long seconds);
+    bool pexpire(const std::string& key, long long milliseconds);
     long long ttl(const std::string& key);
-    
+    long long pttl(const std::string& key);
+
+    // Keys removed because their TTL passed, found either by a command
+    // touching them (lazy) or by the background sweep (active)
+    struct ExpiryStats {
+        uint64_t expired_lazy = 0;
+        uint64_t expired_active = 0;
+    };
+    ExpiryStats getExpiryStats() const;
+    size_t size() const;
+
+    // Memory limit. Once the estimated memory use passes max_bytes, writes
+    // that can add memory first evict keys according to the policy, or fail
+    // with OutOfMemoryError under NOEVICTION. 0 means no limit.
+    void setMaxMemory(size_t max_bytes, EvictionPolicy policy);
+    size_t getMaxMemory() const { return max_memory_.load(std::memory_order_relaxed); }
+    EvictionPolicy getEvictionPolicy() const { return policy_.load(std::memory_order_relaxed); }
+    // Heap bytes held by keys, values and the shards' own tables, as the
+    // allocator would see them. Exact per shard; the total lags by up to
+    // kMemoryReportBytes per shard between cron runs.
+    size_t usedMemory() const;
+    uint64_t getEvictedKeys() const { return evicted_keys_.load(std::memory_order_relaxed); }
+
+    // Heap bytes one key costs: its slot in the map, the key, and the
+    // value's buffers and container nodes. Returns false if the key does not
+    // exist. Reading it does not count as an access for LRU/LFU.
+    bool memoryUsage(const std::string& key, size_t& bytes) const;
+    // The latest report of the background memory sampler. cron() samples a
+    // few keys per shard on every run and publishes a new report every
+    // kSamplesPerReport samples; until then the report is empty.
+    MemoryReport getMemoryReport() const;
+
+    // Cursor-based iteration (SCAN, HSCAN, SSCAN). A walk starts at cursor
+    // 0 and passes each returned cursor back in until 0 comes back. Every
+    // key, field or member present for the whole walk is returned at least
+    // once, however the tables grow, shrink or rehash meanwhile; some may be
+    // returned twice. A call looks at about `count` elements, or at most
+    // kScanStepsPerCount times as many table homes when a table is sparse,
+    // and holds one shard lock at a time, so no call stalls other clients
+    // for long. Only names matching the glob `pattern` (see glob_match) are
+    // returned; an empty pattern matches all. A call can return nothing
+    // while the walk goes on.
+    uint64_t scan(uint64_t cursor, const std::string& pattern, size_t count, std::vector<std::string>& keys);
+
+    // Background housekeeping, run periodically by the server. Within the
+    // given time budget it deletes keys whose TTL has passed and finishes
+    // pending incremental rehashes, skipping shards that are busy. Returns
+    // true if it ran out of time with work left over.
+    bool cron(std::chrono::microseconds budget = std::chrono::microseconds(1000));
+
     // Utility
     bool ping();
-    
-    // Data access for persistence and testing
-    const std::unordered_map<std::string, DataItem>& getStringData() const { return string_data_; }
-    const std::unordered_map<std::string, HashItem>& getHashData() const { return hash_data_; }
-    const std::unordered_map<std::string, ListItem>& getListData() const { return list_data_; }
-    const std::unordered_map<std::string, SetItem>& getSetData() const { return set_data_; }
-    
+    size_t getShardCount() const { return shard_count_; }
+    static size_t defaultShardCount();
+
+    // Optimistic transactions (WATCH/MULTI/EXEC). A watched key has a
+    // version that moves on with every write to it, deletion by expiry or
+    // eviction included, so a client can read keys, work out its writes and
+    // have them applied only if none of those keys changed in between.
+    // Versions are only kept while a key is watched; other keys pay nothing.
+    struct WatchedKey {
+        std::string key;
+        uint64_t version;
+    };
+    WatchedKey watch(const std::string& key);
+    // Every watch is dropped exactly once, by unwatch() or by exec()
+    void unwatch(const std::vector<WatchedKey>& watched);
+    // Locks the shards of `keys` and of the watched keys (every shard with
+    // all_shards) exclusively, in index order, and runs body if no watched
+    // key has changed; returns false without running it otherwise. The
+    // commands in body run on this thread and their own locks on those
+    // shards are skipped, so they must not touch keys outside `keys`. Drops
+    // the watches either way. With `writes`, memory is made for the writes
+    // in body once, before any lock is taken, as for a single write: by
+    // evicting, or by throwing OutOfMemoryError with nothing run. The
+    // writes in body then skip the check, so a transaction is never cut
+    // short by it.
+    bool exec(const std::vector<WatchedKey>& watched, const std::vector<std::string>& keys,
+              bool all_shards, bool writes, const std::function<void()>& body);
+
+    // Point-in-time snapshots for saving. Calls visit(key, value) for every
+    // key as the keyspace stood when the call began, while clients go on
+    // reading and writing: writers only wait for every shard to be locked
+    // once at the start. Until the snapshot is done with a shard, the first
+    // write to each of its keys keeps a copy of the value the key had, so
+    // the extra memory is that of the keys written meanwhile plus the key
+    // names of the shard being walked. The walk is a SCAN over each shard;
+    // visit runs a batch of keys at a time with their shard locked shared,
+    // and with no lock for the kept values of keys deleted since the start;
+    // after_batch runs between batches with no lock held, for the caller to
+    // write out what it has. One snapshot runs at a time.
+    using SnapshotVisitor = std::function<void(const std::string& key, const Value& value)>;
+    void snapshot(const SnapshotVisitor& visit, const std::function<void()>& after_batch);
+
+    // A copy of the whole keyspace as it stood at one moment, for
+    // persistence and testing
+    std::unordered_map<std::string, Value> getData();
+
 private:
-    // Data storage with separate mutexes for each type to reduce contention
-    std::unordered_map<std::string, DataItem> string_data_;
-    std::unordered_map<std::string, HashItem> hash_data_;
-    std::unordered_map<std::string, ListItem> list_data_;
-    std::unordered_map<std::string, SetItem> set_data_;
-    
-    // Separate mutexes for each data type to improve concurrency
-    mutable std::shared_mutex string_mutex_;
-    mutable std::shared_mutex hash_mutex_;
-    mutable std::shared_mutex list_mutex_;
-    mutable std::shared_mutex set_mutex_;
-    
+    struct ExpiryEntry {
+        std::chrono::steady_clock::time_point expiry;
+        std::string key;
+
+        // Orders the heap so the earliest expiry is on top
+        bool operator<(const ExpiryEntry& other) const { return expiry > other.expiry; }
+    };
+
+    // Lock of one shard. While exec() runs a transaction it holds the locks
+    // of the shards involved, and the commands it runs lock them again as
+    // usual; on that thread those calls do nothing.
+    class ShardMutex {
+    public:
+        void lock() {
+            if (!held_by_exec()) {
+                mutex_.lock();
+            }
+        }
+        bool try_lock() { return held_by_exec() || mutex_.try_lock(); }
+        void unlock() {
+            if (!held_by_exec()) {
+                mutex_.unlock();
+            }
+        }
+        void lock_shared() {
+            if (!held_by_exec()) {
+                mutex_.lock_shared();
+            }
+        }
+        bool try_lock_shared() { return held_by_exec() || mutex_.try_lock_shared(); }
+        void unlock_shared() {
+            if (!held_by_exec()) {
+                mutex_.unlock_shared();
+            }
+        }
+
+        // Shards this thread holds for a running exec(), in address order,
+        // or nullptr outside one
+        static const std::vector<const ShardMutex*>*& exec_shards() {
+            thread_local const std::vector<const ShardMutex*>* shards = nullptr;
+            return shards;
+        }
+
+    private:
+        bool held_by_exec() const {
+            const std::vector<const ShardMutex*>* shards = exec_shards();
+            return shards && std::binary_search(shards->begin(), shards->end(), this,
+                                                std::less<const ShardMutex*>());
+        }
+
+        ReadBiasedMutex mutex_;
+    };
+
+    // Version of a watched key, and how many watches share the entry
+    struct WatchEntry {
+        uint64_t version = 0;
+        size_t watchers = 0;
+    };
+
+    // A slice of the keyspace. Every key lives in exactly one shard, picked
+    // by hash, so commands on different keys rarely contend on a lock.
+    // The map grows incrementally so a resize never stalls the shard.
+    struct alignas(64) Shard {
+        Dict<std::string, Value> data;
+        // Min-heap of pending expirations, earliest first. Entries are not
+        // removed when a key is deleted or its TTL changes; the sweep skips
+        // any entry that no longer matches the key's current expiry.
+        std::vector<ExpiryEntry> expiry_queue;
+        uint64_t expired_lazy = 0;
+        uint64_t expired_active = 0;
+        // Heap bytes of every key and value in the shard plus its tables,
+        // and how much of that has not yet been added to used_memory_
+        size_t used_memory = 0;
+        size_t table_memory = 0;
+        long long unreported_memory = 0;
+        // Keys somebody is watching; writes only look here when it is not
+        // empty
+        FlatHashMap<std::string, WatchEntry> watched;
+        // Clients blocked on each key, oldest first; writes only look here
+        // when it is not empty
+        FlatHashMap<std::string, std::vector<std::shared_ptr<BlockedClient>>> blocked;
+        // Set while a snapshot has not finished the shard. The value each
+        // key written since the snapshot began had then, or null for a key
+        // that did not exist. A Dict, so that writers keeping values never
+        // wait for it to grow.
+        bool snapshot_pending = false;
+        Dict<std::string, std::unique_ptr<Value>> snapshot_before;
+
+        // Readers of a read-mostly shard do not contend on this lock at
+        // all; see ReadBiasedMutex
+        mutable ShardMutex mutex;
+    };
+
+    // A shard publishes its memory changes once they add up to this much,
+    // so writers do not all hit the same atomic counter
+    static constexpr long long kMemoryReportBytes = 16 * 1024;
+    // Batches up to this many keys are put in shard order by insertion sort
+    static constexpr size_t kSmallBatch = 16;
+    // Table homes a SCAN call may visit per element of its COUNT, so a call
+    // on a sparse table ends after bounded work even if it finds nothing
+    static constexpr size_t kScanStepsPerCount = 10;
+    // Keys looked at per eviction under the LRU and LFU policies
+    static constexpr size_t kEvictionSamples = 5;
+    // Memory sampling: keys looked at per shard lock, and per report
+    static constexpr size_t kSamplesPerLock = 16;
+    static constexpr size_t kSamplesPerReport = 8192;
+    // Keys a snapshot visits per shard lock
+    static constexpr size_t kSnapshotBatch = 256;
+
+    size_t shard_count_;
+    unsigned shard_bits_;
+    EncodingLimits limits_;
+    std::unique_ptr<Shard[]> shards_;
+    // Shard the next cron run starts from, so a tight budget still reaches
+    // every shard over a few runs. Only touched by cron().
+    size_t cron_cursor_ = 0;
+    // Held for the whole of a snapshot; the moment it shows is set with
+    // every shard locked
+    std::mutex snapshot_mutex_;
+    std::chrono::steady_clock::time_point snapshot_time_;
+
+    std::atomic<size_t> max_memory_{0};
+    std::atomic<EvictionPolicy> policy_{EvictionPolicy::NOEVICTION};
+    std::atomic<long long> used_memory_{0};
+    std::atomic<uint64_t> evicted_keys_{0};
+    std::atomic<size_t> evict_cursor_{0};
+    // Seconds since the steady clock's epoch, refreshed by cron(); LRU and
+    // LFU stamps are cut from it so reads never call the clock
+    std::atomic<uint32_t> clock_{0};
+
+    // Report in progress, only touched by cron(), and the last finished one
+    MemorySampler sampler_;
+    MemoryReport memory_report_;
+    mutable std::mutex report_mutex_;
+
+    // Where one key of a batch lives: its shard and its position in the batch
+    struct BatchKey {
+        size_t shard;
+        size_t index;
+    };
+
     // Helper methods
+    size_t shard_index(const std::string& key) const;
+    Shard& shard_for(const std::string& key) const { return shards_[shard_index(key)]; }
+    // Locks the shards of `keys` in index order, shared except for the one
+    // at exclusive_shard (none if it is shard_count_), which is locked
+    // exclusively even if no key lives there
+    void lock_shards(const std::vector<std::string>& keys, size_t exclusive_shard,
+                     std::vector<std::shared_lock<ShardMutex>>& shared_locks,
+                     std::unique_lock<ShardMutex>& exclusive_lock) const;
+    // Every stride-th string of `args` as a key, ordered by shard and then
+    // by position, so a batch can visit each shard once
+    std::vector<BatchKey> group_by_shard(const std::vector<std::string>& args, size_t stride) const;
     bool is_expired(const std::chrono::steady_clock::time_point& expiry) const;
-    void remove_expired(const std::string& key);
+    bool is_live(const Value& value) const { return !value.has_expiry || !is_expired(value.expiry); }
+
+    // Lookup for readers: expired keys are reported missing but left in place
+    const Value* find_live(const Shard& shard, const std::string& key) const;
+    // Lookup for writers: drops the key first if it has expired. Callers must
+    // hold the shard lock exclusively.
+    Value* find_for_write(Shard& shard, const std::string& key);
+    // Gives a value a TTL and queues it for the background sweep. Callers
+    // must hold the shard lock exclusively.
+    void set_expiry(Shard& shard, const std::string& key, Value& value,
+                    std::chrono::steady_clock::time_point expiry);
+    // Deletes up to max_keys keys due at `now` and returns true if more are due
+    bool expire_due(Shard& shard, std::chrono::steady_clock::time_point now, size_t max_keys);
+
+    // Moves the version of a watched key on, and keeps the key's value for
+    // a snapshot in progress; called by every path that writes or deletes a
+    // key, before it does, with the shard locked exclusively
+    void key_written(Shard& shard, const std::string& key);
+    void keep_for_snapshot(Shard& shard, const std::string& key);
+    void drop_watch(Shard& shard, const std::string& key);
+    // Wakes the clients blocked on a key that just got data, popping for
+    // the blocked pops while the list has elements; called with the shard
+    // locked exclusively
+    void wake_blocked(Shard& shard, const std::string& key);
+
+    // Memory accounting. Writers take key_memory() of the key before and
+    // after changing it and pass both to charge(), which also picks up any
+    // change in the shard's tables. erase_key() does both for a removal.
+    // Callers must hold the shard lock exclusively.
+    static size_t key_memory(const std::string& key, const Value& value);
+    void charge(Shard& shard, size_t before, size_t after, bool publish = false);
+    void erase_key(Shard& shard, Dict<std::string, Value>::iterator it);
+    void erase_key(Shard& shard, const std::string& key);
+
+    // Access stamps for the eviction policies
+    void touch(const Value& value) const;
+    uint32_t new_stamp() const;
+    // Inserts an empty value for a key known to be missing
+    Value& create_key(Shard& shard, const std::string& key);
+    // The hash at key for a write, created empty if the key is missing;
+    // `before` receives what the key cost before, for charge(). Callers
+    // must hold the shard lock exclusively.
+    Value& hash_for_write(Shard& shard, const std::string& key, size_t& before);
+    // SET under a shard lock the caller holds exclusively
+    void set_locked(Shard& shard, const std::string& key, const std::string& value);
+    // GET of a looked-up value; false if it is not a string
+    static bool read_string(const Value& value, std::string& text, SharedString& shared);
+    // The bytes of a STRING value, integers printed into scratch; throws
+    // WrongTypeError for other types
+    static std::string_view string_bytes(const Value& value, std::string& scratch);
+
+    // Called by writes before they lock their shard: evicts until used
+    // memory is back under the limit, or throws OutOfMemoryError
+    void reserve_memory();
+    // Evicts one key chosen by the policy; false if there was none to evict
+    bool evict_one(EvictionPolicy policy);
+    bool evict_sampled(Shard& shard, EvictionPolicy policy);
+    bool evict_soonest_expiry(Shard& shard);
+
+    // Feeds a few random keys of every idle shard to sampler_. Takes each
+    // shard lock shared, for kSamplesPerLock keys at most.
+    void sample_memory();
+    // What a key costs on top of key_memory(): its slot in the map
+    static size_t slot_memory();
+    static const char* type_name(ValueType type);
+    // Length of a string value, number of elements of a container
+    static size_t value_elements(const Value& value);
+
+    // Returns the payload of the requested type, or throws WrongTypeError
+    template <typename T>
+    static T& payload(Value& value);
+    template <typename T>
+    static const T& payload(const Value& value);
 };
 
-#endif // REDICRAFT_STORAGE_H
\ No newline at end of file
+#endif // REDICRAFT_STORAGE_H
@@ -0,0 +1,319 @@
+/*
+ * stream.h
+ * author: Андрій Будильников
+ */
+
+#ifndef REDICRAFT_STREAM_H
+#define REDICRAFT_STREAM_H
+
+#include "heap_usage.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Identifies a stream entry: the time it was added in Unix milliseconds and
+// a sequence number telling apart entries added in the same millisecond.
+// Printed as "ms-seq".
+struct StreamID {
+    uint64_t ms = 0;
+    uint64_t seq = 0;
+
+    static constexpr uint64_t kMax = UINT64_MAX;
+
+    bool operator==(const StreamID& other) const { return ms == other.ms && seq == other.seq; }
+    bool operator!=(const StreamID& other) const { return !(*this == other); }
+    bool operator<(const StreamID& other) const { return ms < other.ms || (ms == other.ms && seq < other.seq); }
+    bool operator>(const StreamID& other) const { return other < *this; }
+    bool operator<=(const StreamID& other) const { return !(other < *this); }
+    bool operator>=(const StreamID& other) const { return !(*this < other); }
+
+    bool is_max() const { return ms == kMax && seq == kMax; }
+    // The smallest ID above this one; the largest ID has none
+    StreamID next() const { return seq == kMax ? StreamID{ms + 1, 0} : StreamID{ms, seq + 1}; }
+    // The largest ID below this one; 0-0 has none
+    StreamID prev() const { return seq == 0 ? StreamID{ms - 1, kMax} : StreamID{ms, seq - 1}; }
+
+    std::string to_string() const { return std::to_string(ms) + "-" + std::to_string(seq); }
+
+    // Reads "ms-seq", or "ms" alone with missing_seq as the sequence
+    static bool parse(std::string_view text, uint64_t missing_seq, StreamID& id) {
+        size_t dash = text.find('-');
+        if (!parse_number(text.substr(0, dash), id.ms)) {
+            return false;
+        }
+        if (dash == std::string_view::npos) {
+            id.seq = missing_seq;
+            return true;
+        }
+        return parse_number(text.substr(dash + 1), id.seq);
+    }
+
+    // Digits only, fitting in 64 bits
+    static bool parse_number(std::string_view text, uint64_t& value) {
+        if (text.empty() || text.size() > 20) {
+            return false;
+        }
+        value = 0;
+        for (char c : text) {
+            if (c < '0' || c > '9') {
+                return false;
+            }
+            uint64_t digit = static_cast<uint64_t>(c - '0');
+            if (value > (UINT64_MAX - digit) / 10) {
+                return false;
+            }
+            value = value * 10 + digit;
+        }
+        return true;
+    }
+};
+
+// Append-only log of entries, each an ID above the one before it and a list
+// of field-value pairs, trimmed from the oldest end.
+//
+// Entries are packed into nodes of up to kMaxNodeBytes or kMaxNodeEntries,
+// as Redis does: each is a few varints (the ID as a delta from the node's
+// first ID, the number of strings) followed by the length and bytes of each
+// field and value, so a small event costs its bytes plus a few bytes of
+// framing rather than a std::string per field. Appending touches only the
+// last node and reading from an ID finds its node by binary search, so both
+// are O(log n) however long the stream gets. Trimming drops whole nodes from
+// the front and moves the start of the first one, so it never copies
+// entries. Kept behind a pointer so every Value stays small.
+class Stream {
+public:
+    static constexpr size_t kMaxNodeBytes = 4096;
+    static constexpr size_t kMaxNodeEntries = 128;
+
+    Stream() : data_(std::make_unique<Data>()) {}
+    Stream(const Stream& other) : data_(std::make_unique<Data>(*other.data_)) {}
+    Stream(Stream&&) = default;
+    Stream& operator=(const Stream& other) {
+        if (this != &other) {
+            data_ = std::make_unique<Data>(*other.data_);
+        }
+        return *this;
+    }
+    Stream& operator=(Stream&&) = default;
+
+    size_t size() const { return data_->size; }
+    bool empty() const { return data_->size == 0; }
+    // The highest ID ever added, kept when its entry is trimmed; 0-0 for a
+    // stream that never had one
+    StreamID last_id() const { return data_->last_id; }
+
+    // Appends an entry; id must be above last_id(). fields_and_values holds
+    // fields and values alternately.
+    void append(const StreamID& id, const std::vector<std::string>& fields_and_values) {
+        Data& data = *data_;
+        size_t entry_bytes = varint_size(id.seq) + varint_size(fields_and_values.size()) + 10;
+        for (const std::string& text : fields_and_values) {
+            entry_bytes += varint_size(text.size()) + text.size();
+        }
+        if (data.nodes.size() == data.head || data.nodes.back().count == kMaxNodeEntries ||
+            (data.nodes.back().bytes.size() + entry_bytes > kMaxNodeBytes && data.nodes.back().count > 0)) {
+            if (data.nodes.size() > data.head) {
+                // The full node is read from now on, never appended to
+                std::string& full = data.nodes.back().bytes;
+                data.memory -= heap_bytes(full);
+                full.shrink_to_fit();
+                data.memory += heap_bytes(full);
+            }
+            data.nodes.push_back(Node{id, std::string(), 0, 0});
+        }
+        Node& node = data.nodes.back();
+        size_t before = heap_bytes(node.bytes);
+        // An oversized entry still gets a node to itself
+        node.bytes.reserve(std::max(node.bytes.size() + entry_bytes, std::min(kMaxNodeBytes, 2 * node.bytes.capacity())));
+        write_varint(node.bytes, id.ms - node.first.ms);
+        write_varint(node.bytes, id.ms == node.first.ms ? id.seq - node.first.seq : id.seq);
+        write_varint(node.bytes, fields_and_values.size());
+        for (const std::string& text : fields_and_values) {
+            write_varint(node.bytes, text.size());
+            node.bytes.append(text);
+        }
+        node.count++;
+        data.memory += heap_bytes(node.bytes) - before;
+        data.size++;
+        data.last_id = id;
+    }
+
+    // Removes the oldest entries until at most maxlen are left; with
+    // `approximate`, only whole nodes, so a few more may be left. Returns
+    // the number removed.
+    size_t trim(size_t maxlen, bool approximate) {
+        Data& data = *data_;
+        size_t removed = 0;
+        while (data.size > maxlen) {
+            Node& node = data.nodes[data.head];
+            size_t excess = data.size - maxlen;
+            if (node.count <= excess) {
+                removed += node.count;
+                data.size -= node.count;
+                drop_front_node();
+                continue;
+            }
+            if (approximate) {
+                break;
+            }
+            StreamID id;
+            for (size_t i = 0; i < excess; ++i) {
+                node.begin = skip_entry(node, node.begin, id);
+            }
+            node.count -= static_cast<uint32_t>(excess);
+            removed += excess;
+            data.size -= excess;
+        }
+        return removed;
+    }
+
+    // Calls f(const StreamID& id, const std::vector<std::string_view>&
+    // fields_and_values) for the entries from start to end inclusive, oldest
+    // first, stopping after `count` of them (0 for no limit). The views are
+    // only valid during the call.
+    template <typename F>
+    void for_range(const StreamID& start, const StreamID& end, size_t count, F&& f) const {
+        const Data& data = *data_;
+        if (start > end || data.size == 0) {
+            return;
+        }
+        // The last node whose first ID is at most start holds it, if any
+        // does; its first entry may have been trimmed, which skipping
+        // entries below start takes care of
+        auto first_node = std::upper_bound(data.nodes.begin() + static_cast<std::ptrdiff_t>(data.head),
+                                           data.nodes.end(), start,
+                                           [](const StreamID& id, const Node& node) { return id < node.first; });
+        if (first_node != data.nodes.begin() + static_cast<std::ptrdiff_t>(data.head)) {
+            --first_node;
+        }
+        std::vector<std::string_view> fields;
+        size_t visited = 0;
+        for (auto node = first_node; node != data.nodes.end(); ++node) {
+            size_t offset = node->begin;
+            while (offset < node->bytes.size()) {
+                StreamID id;
+                size_t next = read_entry(*node, offset, id, fields);
+                if (id > end) {
+                    return;
+                }
+                if (id >= start) {
+                    f(id, fields);
+                    if (count != 0 && ++visited == count) {
+                        return;
+                    }
+                }
+                offset = next;
+            }
+        }
+    }
+
+    // Heap bytes owned by the stream
+    size_t memory_usage() const {
+        return heap_block_size(sizeof(Data)) + heap_block_size(data_->nodes.capacity() * sizeof(Node)) +
+               data_->memory;
+    }
+
+private:
+    struct Node {
+        // ID of the first entry ever appended, which the others are stored
+        // relative to
+        StreamID first;
+        std::string bytes;
+        // Offset of the first entry not trimmed, and how many are left
+        uint32_t begin;
+        uint32_t count;
+    };
+
+    struct Data {
+        // nodes[head] is the oldest node still holding entries; the ones
+        // before it were trimmed and are erased once they are half the
+        // vector, so trimming from the front stays O(1) per node
+        std::vector<Node> nodes;
+        size_t head = 0;
+        size_t size = 0;
+        StreamID last_id;
+        // Heap bytes of the nodes' buffers
+        size_t memory = 0;
+    };
+
+    void drop_front_node() {
+        Data& data = *data_;
+        data.memory -= heap_bytes(data.nodes[data.head].bytes);
+        data.nodes[data.head].bytes = std::string();
+        data.head++;
+        if (data.head == data.nodes.size()) {
+            data.nodes.clear();
+            data.head = 0;
+        } else if (data.head * 2 >= data.nodes.size()) {
+            data.nodes.erase(data.nodes.begin(), data.nodes.begin() + static_cast<std::ptrdiff_t>(data.head));
+            data.head = 0;
+        }
+    }
+
+    static size_t varint_size(uint64_t value) {
+        size_t size = 1;
+        while (value >= 0x80) {
+            value >>= 7;
+            size++;
+        }
+        return size;
+    }
+
+    static void write_varint(std::string& out, uint64_t value) {
+        while (value >= 0x80) {
+            out.push_back(static_cast<char>((value & 0x7F) | 0x80));
+            value >>= 7;
+        }
+        out.push_back(static_cast<char>(value));
+    }
+
+    static uint64_t read_varint(const std::string& in, size_t& offset) {
+        uint64_t value = 0;
+        unsigned shift = 0;
+        uint8_t byte;
+        do {
+            byte = static_cast<uint8_t>(in[offset++]);
+            value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+            shift += 7;
+        } while (byte & 0x80);
+        return value;
+    }
+
+    static StreamID read_id(const Node& node, size_t& offset) {
+        StreamID id;
+        id.ms = node.first.ms + read_varint(node.bytes, offset);
+        uint64_t seq = read_varint(node.bytes, offset);
+        id.seq = id.ms == node.first.ms ? node.first.seq + seq : seq;
+        return id;
+    }
+
+    // Decodes the entry at offset; returns the offset of the next one
+    static size_t read_entry(const Node& node, size_t offset, StreamID& id, std::vector<std::string_view>& fields) {
+        id = read_id(node, offset);
+        size_t strings = static_cast<size_t>(read_varint(node.bytes, offset));
+        fields.clear();
+        for (size_t i = 0; i < strings; ++i) {
+            size_t length = static_cast<size_t>(read_varint(node.bytes, offset));
+            fields.emplace_back(node.bytes.data() + offset, length);
+            offset += length;
+        }
+        return offset;
+    }
+
+    static size_t skip_entry(const Node& node, size_t offset, StreamID& id) {
+        id = read_id(node, offset);
+        size_t strings = static_cast<size_t>(read_varint(node.bytes, offset));
+        for (size_t i = 0; i < strings; ++i) {
+            offset += static_cast<size_t>(read_varint(node.bytes, offset));
+        }
+        return offset;
+    }
+
+    std::unique_ptr<Data> data_;
+};
+
+#endif // REDICRAFT_STREAM_H
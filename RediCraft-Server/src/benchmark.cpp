@@ -4,47 +4,106 @@
  */
 
 #include "../include/storage.h"
+#include "../include/parser.h"
+#include "../include/flat_hash_map.h"
+#include "../include/dict.h"
+#include "../include/read_biased_mutex.h"
+#include "../include/bitops.h"
+#include "../include/glob.h"
+#include "../include/pubsub.h"
 #include <iostream>
 #include <chrono>
 #include <string>
 #include <random>
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <functional>
+#include <algorithm>
+#include <unordered_map>
+#include <cstdint>
+#include <sstream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <shared_mutex>
+#include <mutex>
 
-int main() {
+// Live heap bytes, counted by the operator new/delete replacements below so
+// the memory suite can report what a dataset really costs
+static std::atomic<long long> g_heap_bytes(0);
+
+namespace {
+
+// Each block is prefixed with its size so delete knows how much to subtract
+constexpr size_t kAllocHeader = alignof(std::max_align_t);
+
+} // namespace
+
+void* operator new(size_t size) {
+    void* block = std::malloc(size + kAllocHeader);
+    if (!block) {
+        throw std::bad_alloc();
+    }
+    *static_cast<size_t*>(block) = size;
+    g_heap_bytes.fetch_add(static_cast<long long>(size), std::memory_order_relaxed);
+    return static_cast<char*>(block) + kAllocHeader;
+}
+
+void operator delete(void* ptr) noexcept {
+    if (!ptr) {
+        return;
+    }
+    // Integer arithmetic keeps GCC from flagging the step back as out of bounds
+    void* block = reinterpret_cast<void*>(reinterpret_cast<uintptr_t>(ptr) - kAllocHeader);
+    g_heap_bytes.fetch_sub(static_cast<long long>(*static_cast<size_t*>(block)), std::memory_order_relaxed);
+    std::free(block);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+    operator delete(ptr);
+}
+
+namespace {
+
+// Test parameters
+const int num_operations = 100000;
+const int key_range = 1000;
+
+void run_basic_benchmark() {
     Storage storage;
-    
-    // Test parameters
-    const int num_operations = 100000;
-    const int key_range = 1000;
-    
+
     std::cout << "Starting RediCraft benchmark...\n";
     std::cout << "Operations: " << num_operations << "\n";
     std::cout << "Key range: " << key_range << "\n\n";
-    
+
     // Generate random keys and values
     std::random_device rd;
     std::mt19937 gen(rd());
     std::uniform_int_distribution<> key_dist(0, key_range - 1);
     std::uniform_int_distribution<> value_dist(0, 1000000);
-    
+
     // Benchmark SET operations
     auto start = std::chrono::high_resolution_clock::now();
-    
+
     for (int i = 0; i < num_operations; ++i) {
         std::string key = "key:" + std::to_string(key_dist(gen));
         std::string value = std::to_string(value_dist(gen));
         storage.set(key, value);
     }
-    
+
     auto end = std::chrono::high_resolution_clock::now();
     auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
-    
+
     std::cout << "SET operations:\n";
     std::cout << "  Time: " << duration.count() << " ms\n";
     std::cout << "  Operations per second: " << (num_operations * 1000.0 / duration.count()) << "\n\n";
-    
+
     // Benchmark GET operations
     start = std::chrono::high_resolution_clock::now();
-    
+
     int found = 0;
     for (int i = 0; i < num_operations; ++i) {
         std::string key = "key:" + std::to_string(key_dist(gen));
@@ -53,31 +112,1347 @@ int main() {
             found++;
         }
     }
-    
+
     end = std::chrono::high_resolution_clock::now();
     duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
-    
+
     std::cout << "GET operations:\n";
     std::cout << "  Time: " << duration.count() << " ms\n";
     std::cout << "  Operations per second: " << (num_operations * 1000.0 / duration.count()) << "\n";
     std::cout << "  Hit rate: " << (found * 100.0 / num_operations) << "%\n\n";
-    
+
     // Benchmark INCR operations
     start = std::chrono::high_resolution_clock::now();
-    
+
     for (int i = 0; i < num_operations; ++i) {
         std::string key = "counter:" + std::to_string(key_dist(gen));
         storage.incr(key);
     }
-    
+
     end = std::chrono::high_resolution_clock::now();
     duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
-    
+
     std::cout << "INCR operations:\n";
     std::cout << "  Time: " << duration.count() << " ms\n";
     std::cout << "  Operations per second: " << (num_operations * 1000.0 / duration.count()) << "\n\n";
-    
+}
+
+// Runs op(thread_index, iteration) on num_threads threads and returns the
+// combined operations per second
+double run_threaded(unsigned num_threads, int ops_per_thread,
+                    const std::function<void(unsigned, int)>& op) {
+    std::vector<std::thread> threads;
+    std::atomic<bool> go(false);
+
+    for (unsigned t = 0; t < num_threads; ++t) {
+        threads.emplace_back([&, t]() {
+            while (!go.load()) {
+                std::this_thread::yield();
+            }
+            for (int i = 0; i < ops_per_thread; ++i) {
+                op(t, i);
+            }
+        });
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+    go = true;
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+
+    double seconds = std::chrono::duration<double>(end - start).count();
+    return (static_cast<double>(num_threads) * ops_per_thread) / seconds;
+}
+
+// Compares write throughput of a single-lock keyspace (the layout where every
+// SET/INCR serializes on one mutex) against the sharded keyspace
+void run_thread_scaling_benchmark() {
+    const int ops_per_thread = 200000;
+    const int scaling_key_range = 100000;
+
+    // Go past the core count on small machines so lock contention still shows
+    unsigned max_threads = std::max(4u, std::thread::hardware_concurrency());
+
+    // Pre-build keys so string formatting does not dominate the measurement
+    std::vector<std::string> keys;
+    keys.reserve(scaling_key_range);
+    for (int i = 0; i < scaling_key_range; ++i) {
+        keys.push_back("player:" + std::to_string(i) + ":coins");
+    }
+
+    std::cout << "Thread scaling (SET + INCR, " << ops_per_thread << " ops per thread):\n";
+    std::cout << "  threads    single-lock ops/s    sharded ops/s    speedup\n";
+
+    std::vector<unsigned> thread_counts;
+    for (unsigned threads = 1; threads < max_threads; threads *= 2) {
+        thread_counts.push_back(threads);
+    }
+    thread_counts.push_back(max_threads);
+
+    for (unsigned threads : thread_counts) {
+        auto workload = [&](Storage& storage) {
+            return run_threaded(threads, ops_per_thread, [&](unsigned t, int i) {
+                const std::string& key = keys[(static_cast<size_t>(i) * 7919 + t * 104729) % keys.size()];
+                if (i & 1) {
+                    storage.incr(key);
+                } else {
+                    storage.set(key, "100");
+                }
+            });
+        };
+
+        Storage single_lock(1);
+        Storage sharded;
+        double single_ops = workload(single_lock);
+        double sharded_ops = workload(sharded);
+
+        std::cout << "  " << threads
+                  << "          " << static_cast<long long>(single_ops)
+                  << "              " << static_cast<long long>(sharded_ops)
+                  << "          " << (sharded_ops / single_ops) << "x\n";
+    }
+    std::cout << "\n";
+}
+
+// Counter update the way Storage did it before integers were stored
+// natively: parse the text, add, format it back
+class TextCounters {
+public:
+    long long incrby(const std::string& key, long long increment) {
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        std::string& current = data_[key];
+        long long value = current.empty() ? 0 : std::stoll(current);
+        value += increment;
+        current = std::to_string(value);
+        return value;
+    }
+
+private:
+    Dict<std::string, std::string> data_;
+    std::shared_mutex mutex_;
+};
+
+// INCR throughput with text-encoded counters against the native int64
+// encoding, single-threaded so the difference is not hidden by locking
+void run_counter_benchmark() {
+    const int counter_ops = 2000000;
+    const int counter_keys = 10000;
+
+    std::vector<std::string> keys;
+    keys.reserve(counter_keys);
+    for (int i = 0; i < counter_keys; ++i) {
+        keys.push_back("player:" + std::to_string(i) + ":kills");
+    }
+
+    // Start from large values so the text form is a realistic length
+    TextCounters text;
+    Storage storage(1);
+    for (const auto& key : keys) {
+        text.incrby(key, 1000000000);
+        storage.incrby(key, 1000000000);
+    }
+
+    long long checksum = 0;
+    auto measure = [&](const std::function<long long(const std::string&)>& incr) {
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < counter_ops; ++i) {
+            checksum += incr(keys[(static_cast<size_t>(i) * 7919) % keys.size()]);
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+        return counter_ops / std::chrono::duration<double>(end - start).count();
+    };
+    double text_ops = measure([&](const std::string& key) { return text.incrby(key, 1); });
+    double native_ops = measure([&](const std::string& key) { return storage.incr(key); });
+
+    std::cout << "INCR encoding (" << counter_ops << " ops over " << counter_keys << " keys):\n";
+    std::cout << "  text (stoll/to_string) ops/s: " << static_cast<long long>(text_ops) << "\n";
+    std::cout << "  native int64 ops/s:           " << static_cast<long long>(native_ops) << "\n";
+    std::cout << "  speedup: " << (native_ops / text_ops) << "x  (checksum " << (checksum & 0xff) << ")\n\n";
+}
+
+// Builds a dataset in a fresh Storage and returns the heap bytes it holds
+// per key, table overhead included
+double bytes_per_key(const Storage::EncodingLimits& limits, size_t keys,
+                     const std::function<void(Storage&, size_t)>& fill) {
+    long long before = g_heap_bytes.load();
+    double per_key;
+    {
+        Storage storage(1, limits);
+        for (size_t i = 0; i < keys; ++i) {
+            fill(storage, i);
+        }
+        per_key = static_cast<double>(g_heap_bytes.load() - before) / keys;
+    }
+    return per_key;
+}
+
+// A player profile: 16 short fields, the shape of our typical hash
+const std::vector<std::string>& profile_fields() {
+    static const std::vector<std::string> fields = {
+        "name", "uuid", "rank", "level", "xp", "coins", "gems", "kills",
+        "deaths", "wins", "losses", "playtime", "last_login", "first_join", "clan", "title"};
+    return fields;
+}
+
+void fill_profile(Storage& storage, size_t i) {
+    const std::string key = "player:" + std::to_string(i);
+    const auto& fields = profile_fields();
+    for (size_t f = 0; f < fields.size(); ++f) {
+        storage.hset(key, fields[f], std::to_string((i + 1) * (f + 7) % 100000));
+    }
+}
+
+// Lookups in a small table guarded by LockType, the way a hot shard is
+// read: the lock is all the threads share
+template <typename LockType>
+double hot_lock_reads(unsigned threads, int ops_per_thread, const std::vector<std::string>& keys) {
+    FlatHashMap<std::string, long long> table;
+    for (size_t i = 0; i < keys.size(); ++i) {
+        table[keys[i]] = static_cast<long long>(i);
+    }
+    LockType lock;
+    std::atomic<long long> checksum(0);
+    double ops = run_threaded(threads, ops_per_thread, [&](unsigned t, int i) {
+        const std::string& key = keys[(static_cast<size_t>(i) * 7919 + t * 104729) % keys.size()];
+        std::shared_lock<LockType> guard(lock);
+        auto it = table.find(key);
+        if (it != table.end() && it->second == -1) {
+            checksum++; // never true; keeps the lookup from being optimized out
+        }
+    });
+    return ops;
+}
+
+// Read-heavy scaling at 8, 16 and 32 threads: first the bare shard lock
+// (std::shared_mutex against the read-biased lock Storage uses), then
+// GET/HGET/SISMEMBER/SCARD with 1% SETs on a Storage. Values fit the small
+// string buffer so the counting allocator does not become the bottleneck.
+void run_read_scaling_benchmark() {
+    const int ops_per_thread = 200000;
+    const int read_key_range = 100000;
+    const std::vector<unsigned> thread_counts = {1, 8, 16, 32};
+
+    std::vector<std::string> keys;
+    keys.reserve(read_key_range);
+    for (int i = 0; i < read_key_range; ++i) {
+        keys.push_back("player:" + std::to_string(i) + ":coins");
+    }
+    std::vector<std::string> hot_keys(keys.begin(), keys.begin() + 1000);
+
+    std::cout << "Read scaling, one hot lock (" << ops_per_thread << " lookups per thread):\n";
+    std::cout << "  threads    shared_mutex ops/s    read-biased ops/s    speedup\n";
+    for (unsigned threads : thread_counts) {
+        double shared_ops = hot_lock_reads<std::shared_mutex>(threads, ops_per_thread, hot_keys);
+        double biased_ops = hot_lock_reads<ReadBiasedMutex>(threads, ops_per_thread, hot_keys);
+        std::cout << "  " << threads
+                  << "          " << static_cast<long long>(shared_ops)
+                  << "              " << static_cast<long long>(biased_ops)
+                  << "          " << (biased_ops / shared_ops) << "x\n";
+    }
+
+    Storage storage;
+    const auto& fields = profile_fields();
+    for (size_t i = 0; i < keys.size(); ++i) {
+        storage.set(keys[i], std::to_string(i));
+        if (i % 10 == 0) {
+            fill_profile(storage, i);
+            storage.sadd("perms:" + std::to_string(i), {"build", "chat", "fly", std::to_string(i % 7)});
+        }
+    }
+    std::vector<std::string> profiles;
+    std::vector<std::string> perms;
+    for (size_t i = 0; i < keys.size(); i += 10) {
+        profiles.push_back("player:" + std::to_string(i));
+        perms.push_back("perms:" + std::to_string(i));
+    }
+
+    std::cout << "Read scaling, Storage (GET/HGET/SISMEMBER/SCARD, 1% SET):\n";
+    std::cout << "  threads    ops/s         per thread    vs 1 thread\n";
+    double single_thread_ops = 0;
+    for (unsigned threads : thread_counts) {
+        double ops = run_threaded(threads, ops_per_thread, [&](unsigned t, int i) {
+            size_t n = static_cast<size_t>(i) * 7919 + t * 104729;
+            std::string value;
+            if (i % 100 == 0) {
+                storage.set(keys[n % keys.size()], "1");
+                return;
+            }
+            switch (i & 3) {
+                case 0:
+                    storage.get(keys[n % keys.size()], value);
+                    break;
+                case 1:
+                    storage.hget(profiles[n % profiles.size()], fields[n % fields.size()], value);
+                    break;
+                case 2:
+                    storage.sismember(perms[n % perms.size()], "fly");
+                    break;
+                default:
+                    storage.scard(perms[n % perms.size()]);
+                    break;
+            }
+        });
+        if (threads == 1) {
+            single_thread_ops = ops;
+        }
+        std::cout << "  " << threads
+                  << "          " << static_cast<long long>(ops)
+                  << "      " << static_cast<long long>(ops / threads)
+                  << "       " << (ops / single_thread_ops) << "x\n";
+    }
+    std::cout << "\n";
+}
+
+// Keys per second read and written with one command per key against one
+// MGET/MSET per batch, for batches of 1 to 1000 keys. Every command is
+// parsed from its text as the server would, so the numbers include the
+// per-command cost a batch saves (not counting the network round trips).
+void run_batch_benchmark() {
+    const size_t keys_per_run = 1000000;
+    const size_t key_range = 100000;
+    const std::vector<size_t> batch_sizes = {1, 10, 30, 100, 1000};
+
+    std::vector<std::string> keys;
+    keys.reserve(key_range);
+    for (size_t i = 0; i < key_range; ++i) {
+        keys.push_back("player:" + std::to_string(i) + ":coins");
+    }
+    Storage storage;
+    for (size_t i = 0; i < keys.size(); ++i) {
+        storage.set(keys[i], std::to_string(i));
+    }
+
+    // Command lines are built up front and reused in turn so the timing
+    // covers only parsing and running them. `batch_command` builds one
+    // line for the whole batch, otherwise there is one line per key.
+    const size_t line_pool = 64;
+    size_t found = 0;
+    auto keys_per_second = [&](size_t batch_size, const char* single_command, const char* batch_command,
+                               bool values) {
+        std::vector<std::vector<std::string>> batches(line_pool);
+        size_t next = 0;
+        for (auto& lines : batches) {
+            std::string line = batch_command ? batch_command : "";
+            for (size_t j = 0; j < batch_size; ++j) {
+                next = (next + 7919) % keys.size();
+                if (!batch_command) {
+                    line = single_command;
+                }
+                line += " " + keys[next] + (values ? " 1" : "");
+                if (!batch_command) {
+                    lines.push_back(line);
+                }
+            }
+            if (batch_command) {
+                lines.push_back(line);
+            }
+        }
+
+        size_t round = 0;
+        std::string value;
+        auto start = std::chrono::high_resolution_clock::now();
+        for (size_t done = 0; done < keys_per_run; done += batch_size) {
+            for (const auto& line : batches[round++ % line_pool]) {
+                Command cmd = Parser::parse(line);
+                switch (cmd.type) {
+                    case CommandType::GET:
+                        found += storage.get(cmd.args[0], value);
+                        break;
+                    case CommandType::MGET:
+                        for (const auto& result : storage.mget(cmd.args)) {
+                            found += result.found;
+                        }
+                        break;
+                    case CommandType::SET:
+                        storage.set(cmd.args[0], cmd.args[1]);
+                        break;
+                    case CommandType::MSET:
+                        storage.mset(cmd.args);
+                        break;
+                    default:
+                        break;
+                }
+            }
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+        return keys_per_run / std::chrono::duration<double>(end - start).count();
+    };
+
+    std::cout << "Batches (" << keys_per_run << " keys per run, " << storage.getShardCount() << " shards):\n";
+    std::cout << "  batch    GET keys/s    MGET keys/s    SET keys/s    MSET keys/s\n";
+    for (size_t batch_size : batch_sizes) {
+        double get_keys = keys_per_second(batch_size, "GET", nullptr, false);
+        double mget_keys = keys_per_second(batch_size, nullptr, "MGET", false);
+        double set_keys = keys_per_second(batch_size, "SET", nullptr, true);
+        double mset_keys = keys_per_second(batch_size, nullptr, "MSET", true);
+        std::cout << "  " << batch_size
+                  << "        " << static_cast<long long>(get_keys)
+                  << "      " << static_cast<long long>(mget_keys)
+                  << "       " << static_cast<long long>(set_keys)
+                  << "      " << static_cast<long long>(mset_keys) << "\n";
+    }
+    std::cout << "  (found " << found << ")\n\n";
+}
+
+// HGET latency over the profile dataset for the given encoding limits
+double profile_hget_ns(const Storage::EncodingLimits& limits, size_t keys) {
+    const int lookups = 2000000;
+    Storage storage(1, limits);
+    for (size_t i = 0; i < keys; ++i) {
+        fill_profile(storage, i);
+    }
+    std::vector<std::string> names;
+    names.reserve(keys);
+    for (size_t i = 0; i < keys; ++i) {
+        names.push_back("player:" + std::to_string(i));
+    }
+
+    const auto& fields = profile_fields();
+    size_t found = 0;
+    std::string value;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < lookups; ++i) {
+        size_t n = static_cast<size_t>(i) * 7919;
+        found += storage.hget(names[n % keys], fields[n % fields.size()], value);
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    if (found != static_cast<size_t>(lookups)) {
+        std::cout << "  (unexpected HGET misses)\n";
+    }
+    return std::chrono::duration<double, std::nano>(end - start).count() / lookups;
+}
+
+// A leaderboard of 1M players in one sorted set: building it with ZADD,
+// then ZINCRBY score updates, ZREVRANK lookups and top-10 ZREVRANGE reads
+void run_zset_benchmark() {
+    const size_t members = 1000000;
+    const int ops = 1000000;
+    const int top_reads = 200000;
+
+    std::vector<std::string> names;
+    names.reserve(members);
+    for (size_t i = 0; i < members; ++i) {
+        names.push_back("player" + std::to_string(i));
+    }
+    auto score_of = [](size_t i) { return static_cast<double>((i * 2654435761u) % 100000); };
+    auto per_second = [](int count, std::chrono::high_resolution_clock::time_point start) {
+        auto end = std::chrono::high_resolution_clock::now();
+        return static_cast<long long>(count / std::chrono::duration<double>(end - start).count());
+    };
+
+    Storage storage(1);
+    long long heap_before = g_heap_bytes.load();
+    auto start = std::chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < members; ++i) {
+        storage.zadd("lb:kills", {{score_of(i), names[i]}});
+    }
+    long long zadd_ops = per_second(static_cast<int>(members), start);
+    double bytes_per_member = static_cast<double>(g_heap_bytes.load() - heap_before) / members;
+
+    start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < ops; ++i) {
+        storage.zincrby("lb:kills", names[(static_cast<size_t>(i) * 7919) % members], 1);
+    }
+    long long zincrby_ops = per_second(ops, start);
+
+    long long rank_sum = 0;
+    start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < ops; ++i) {
+        long long rank;
+        if (storage.zrank("lb:kills", names[(static_cast<size_t>(i) * 104729) % members], true, rank)) {
+            rank_sum += rank;
+        }
+    }
+    long long zrank_ops = per_second(ops, start);
+
+    size_t listed = 0;
+    start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < top_reads; ++i) {
+        storage.zrange("lb:kills", 0, 9, true, [&listed](std::string_view, double) { listed++; });
+    }
+    long long top_ops = per_second(top_reads, start);
+
+    std::cout << "Sorted set, " << members << " members in one key:\n";
+    std::cout << "  ZADD ops/s:               " << zadd_ops << "\n";
+    std::cout << "  bytes per member:         " << bytes_per_member << "\n";
+    std::cout << "  ZINCRBY ops/s:            " << zincrby_ops << "\n";
+    std::cout << "  ZREVRANK ops/s:           " << zrank_ops << "\n";
+    std::cout << "  ZREVRANGE 0 9 ops/s:      " << top_ops
+              << "  (checksum " << ((rank_sum + static_cast<long long>(listed)) & 0xff) << ")\n\n";
+}
+
+// Daily activity bitmaps: bit N of "active:<day>" is set when player N
+// logged in that day. A week of 10M-bit days, then the questions a
+// dashboard asks: how many played today (BITCOUNT), this week (BITOP OR,
+// then BITCOUNT), every day (BITOP AND) and who was first (BITPOS). The
+// counting kernel is also timed directly, portable against the one picked
+// for this CPU.
+void run_bitmap_benchmark() {
+    const uint64_t players = 10000000;
+    const int days = 7;
+    const int logins_per_day = 2000000;
+    const int queries = 200;
+
+    Storage storage(1);
+    std::vector<std::string> day_keys;
+    std::mt19937_64 rng(42);
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int day = 0; day < days; ++day) {
+        day_keys.push_back("active:" + std::to_string(day));
+        storage.setbit(day_keys.back(), players - 1, false);
+        for (int i = 0; i < logins_per_day; ++i) {
+            storage.setbit(day_keys.back(), rng() % players, true);
+        }
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    long long setbit_ops = static_cast<long long>(days * static_cast<double>(logins_per_day) /
+                                                  std::chrono::duration<double>(end - start).count());
+
+    auto micros_per_call = [queries](const std::function<void()>& query) {
+        auto begin = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < queries; ++i) {
+            query();
+        }
+        auto finish = std::chrono::high_resolution_clock::now();
+        return std::chrono::duration<double, std::micro>(finish - begin).count() / queries;
+    };
+
+    long long checksum = 0;
+    double bitcount_us = micros_per_call([&]() { checksum += storage.bitcount(day_keys[0], 0, -1, false); });
+    double week_us = micros_per_call([&]() {
+        storage.bitop(Storage::BitOp::OR, "active:week", day_keys);
+        checksum += storage.bitcount("active:week", 0, -1, false);
+    });
+    double every_day_us = micros_per_call([&]() {
+        storage.bitop(Storage::BitOp::AND, "active:every_day", day_keys);
+        checksum += storage.bitcount("active:every_day", 0, -1, false);
+    });
+    double bitpos_us = micros_per_call([&]() { checksum += storage.bitpos("active:every_day", true, 0, -1, false, false); });
+
+    std::string bytes;
+    storage.get(day_keys[0], bytes);
+    const unsigned char* data = reinterpret_cast<const unsigned char*>(bytes.data());
+    double portable_us = micros_per_call([&]() {
+        checksum += static_cast<long long>(bitops::portable_kernels().popcount(data, bytes.size()));
+    });
+    double chosen_us = micros_per_call([&]() {
+        checksum += static_cast<long long>(bitops::kernels().popcount(data, bytes.size()));
+    });
+
+    std::cout << "Bitmaps, " << days << " days of " << players << " players:\n";
+    std::cout << "  SETBIT ops/s:                    " << setbit_ops << "\n";
+    std::cout << "  BITCOUNT one day:                " << bitcount_us << " us\n";
+    std::cout << "  BITOP OR week + BITCOUNT:        " << week_us << " us\n";
+    std::cout << "  BITOP AND week + BITCOUNT:       " << every_day_us << " us\n";
+    std::cout << "  BITPOS 1 on the AND:             " << bitpos_us << " us\n";
+    std::cout << "  popcount 10M bits, portable:     " << portable_us << " us\n";
+    std::cout << "  popcount 10M bits, this CPU:     " << chosen_us << " us (" << bitops::kernels().name
+              << ", checksum " << (checksum & 0xff) << ")\n\n";
+}
+
+// Unique players per day, counted the old way with a set of UUIDs and with
+// a HyperLogLog: the memory each costs, the error of the estimate, and the
+// time to count one day and the union of a week.
+void run_hyperloglog_benchmark() {
+    const int players = 1000000;
+    const int days = 7;
+    const int queries = 1000;
+
+    std::vector<std::string> uuids;
+    uuids.reserve(players);
+    std::mt19937_64 rng(7);
+    for (int i = 0; i < players; ++i) {
+        char uuid[37];
+        std::snprintf(uuid, sizeof(uuid), "%08llx-%04llx-%04llx-%04llx-%012llx",
+                      static_cast<unsigned long long>(rng() & 0xffffffff), static_cast<unsigned long long>(rng() & 0xffff),
+                      static_cast<unsigned long long>(rng() & 0xffff), static_cast<unsigned long long>(rng() & 0xffff),
+                      static_cast<unsigned long long>(rng() & 0xffffffffffffULL));
+        uuids.push_back(uuid);
+    }
+
+    Storage storage(1);
+    long long heap_before = g_heap_bytes.load();
+    for (const auto& uuid : uuids) {
+        storage.sadd("visitors:set", {uuid});
+    }
+    long long set_bytes = g_heap_bytes.load() - heap_before;
+
+    heap_before = g_heap_bytes.load();
+    auto start = std::chrono::high_resolution_clock::now();
+    for (const auto& uuid : uuids) {
+        storage.pfadd("visitors:hll", {uuid});
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    long long hll_bytes = g_heap_bytes.load() - heap_before;
+    long long pfadd_ops = static_cast<long long>(players / std::chrono::duration<double>(end - start).count());
+    uint64_t estimate = storage.pfcount({"visitors:hll"});
+
+    // A week of days that overlap by half
+    std::vector<std::string> day_keys;
+    for (int day = 0; day < days; ++day) {
+        day_keys.push_back("visitors:day" + std::to_string(day));
+        std::vector<std::string> batch;
+        for (int i = day * players / 14; i < day * players / 14 + players / 7; ++i) {
+            batch.push_back(uuids[static_cast<size_t>(i)]);
+        }
+        storage.pfadd(day_keys.back(), batch);
+    }
+
+    auto micros_per_call = [queries](const std::function<void()>& query) {
+        auto begin = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < queries; ++i) {
+            query();
+        }
+        auto finish = std::chrono::high_resolution_clock::now();
+        return std::chrono::duration<double, std::micro>(finish - begin).count() / queries;
+    };
+    uint64_t checksum = 0;
+    double cached_us = micros_per_call([&]() { checksum += storage.pfcount({day_keys[0]}); });
+    double week_us = micros_per_call([&]() { checksum += storage.pfcount(day_keys); });
+    double merge_us = micros_per_call([&]() { storage.pfmerge("visitors:week", day_keys); });
+
+    std::cout << "HyperLogLog, " << players << " unique UUIDs:\n";
+    std::cout << "  set bytes:                 " << set_bytes << "\n";
+    std::cout << "  HyperLogLog bytes:         " << hll_bytes << "\n";
+    std::cout << "  PFADD ops/s:               " << pfadd_ops << "\n";
+    std::cout << "  PFCOUNT estimate:          " << estimate << " ("
+              << 100.0 * (static_cast<double>(estimate) - players) / players << "% off)\n";
+    std::cout << "  PFCOUNT one key (cached):  " << cached_us << " us\n";
+    std::cout << "  PFCOUNT " << days << " keys:            " << week_us << " us\n";
+    std::cout << "  PFMERGE " << days << " keys:            " << merge_us << " us  (checksum "
+              << (checksum & 0xff) << ")\n\n";
+}
+
+// An economy audit feed: purchases of three fields each appended to one
+// stream, with what they cost against keeping each field as a std::string,
+// then the reads a consumer makes as it follows the feed from its last ID,
+// and appends that keep the stream capped with MAXLEN.
+void run_stream_benchmark() {
+    const int events = 1000000;
+    const int batch = 100;
+    const int capped = 1000000;
+    const size_t cap = 10000;
+
+    std::vector<std::vector<std::string>> payloads;
+    payloads.reserve(events);
+    for (int i = 0; i < events; ++i) {
+        payloads.push_back({"player", "player" + std::to_string(i % 5000), "item", "diamond_sword", "price",
+                            std::to_string(100 + i % 900)});
+    }
+    long long heap_before = g_heap_bytes.load();
+    std::vector<std::vector<std::string>> copies(payloads);
+    double string_bytes = static_cast<double>(g_heap_bytes.load() - heap_before) / events;
+    copies.clear();
+    copies.shrink_to_fit();
+
+    Storage storage(1);
+    heap_before = g_heap_bytes.load();
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < events; ++i) {
+        StreamID id;
+        storage.xadd("audit", id, true, false, payloads[static_cast<size_t>(i)], -1, false);
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    long long xadd_ops = static_cast<long long>(events / std::chrono::duration<double>(end - start).count());
+    double stream_bytes = static_cast<double>(g_heap_bytes.load() - heap_before) / events;
+
+    // A consumer reading the whole feed in batches, each from the last ID
+    // it saw
+    size_t fields_read = 0;
+    int reads = 0;
+    StreamID last;
+    start = std::chrono::high_resolution_clock::now();
+    for (;;) {
+        size_t got = 0;
+        storage.xrange("audit", last.next(), StreamID{StreamID::kMax, StreamID::kMax}, batch,
+                       [&](const StreamID& id, const std::vector<std::string_view>& fields) {
+            last = id;
+            fields_read += fields.size();
+            got++;
+        });
+        reads++;
+        if (got < batch) {
+            break;
+        }
+    }
+    end = std::chrono::high_resolution_clock::now();
+    double read_us = std::chrono::duration<double, std::micro>(end - start).count() / reads;
+
+    start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < capped; ++i) {
+        StreamID id;
+        storage.xadd("audit:capped", id, true, false, payloads[static_cast<size_t>(i % events)],
+                     static_cast<long long>(cap), true);
+    }
+    end = std::chrono::high_resolution_clock::now();
+    long long capped_ops = static_cast<long long>(capped / std::chrono::duration<double>(end - start).count());
+
+    std::cout << "Stream, " << events << " events of 3 fields:\n";
+    std::cout << "  XADD ops/s:                    " << xadd_ops << "\n";
+    std::cout << "  bytes per entry:               " << stream_bytes << "\n";
+    std::cout << "  bytes as a std::string each:   " << string_bytes << "\n";
+    std::cout << "  XRANGE " << batch << " from last ID:       " << read_us << " us\n";
+    std::cout << "  XADD MAXLEN ~ " << cap << " ops/s:     " << capped_ops << " (length "
+              << storage.xlen("audit:capped") << ", checksum " << (fields_read & 0xff) << ")\n\n";
+}
+
+// A subscriber that queues messages the way a session does, under a lock,
+// and empties its queue every `flush_every` messages as the socket write
+// would
+class QueueSubscriber : public Subscriber {
+public:
+    void deliver(const SharedString& message) override {
+        std::lock_guard<std::mutex> lock(mutex_);
+        queue_.push_back(message);
+    }
+    void flush() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::vector<SharedString>().swap(queue_);
+    }
+
+private:
+    std::mutex mutex_;
+    std::vector<SharedString> queue_;
+};
+
+// One chat message fanned out to the 1000 players of a server: the publish
+// rate and heap per queued message with the shared buffer, against
+// formatting a copy into each subscriber's own output buffer; then 1000
+// players each on their own pattern, matched through the trie against
+// trying every pattern.
+void run_pubsub_benchmark() {
+    const int subscribers = 1000;
+    const int messages = 10000;
+    const int flush_every = 100;
+    const std::string payload(200, 'm');
+
+    PubSub pubsub;
+    std::vector<std::unique_ptr<QueueSubscriber>> sinks;
+    for (int i = 0; i < subscribers; ++i) {
+        sinks.push_back(std::make_unique<QueueSubscriber>());
+        pubsub.subscribe(sinks.back().get(), "chat:global");
+    }
+    size_t deliveries = 0;
+    long long queued_bytes = 0;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < messages; ++i) {
+        deliveries += pubsub.publish("chat:global", payload);
+        if ((i + 1) % flush_every == 0) {
+            if (i + 1 == flush_every) {
+                queued_bytes = g_heap_bytes.load();
+            }
+            for (auto& sink : sinks) {
+                sink->flush();
+            }
+            if (i + 1 == flush_every) {
+                queued_bytes -= g_heap_bytes.load();
+            }
+        }
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    double shared_rate = messages / std::chrono::duration<double>(end - start).count();
+
+    // The same messages formatted into each subscriber's buffer
+    std::vector<std::string> buffers(subscribers);
+    long long copied_bytes = 0;
+    start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < messages; ++i) {
+        for (auto& buffer : buffers) {
+            buffer.append("message chat:global ").append(payload).append("\r\n");
+        }
+        if ((i + 1) % flush_every == 0) {
+            if (i + 1 == flush_every) {
+                copied_bytes = g_heap_bytes.load();
+            }
+            for (auto& buffer : buffers) {
+                std::string().swap(buffer);
+            }
+            if (i + 1 == flush_every) {
+                copied_bytes -= g_heap_bytes.load();
+            }
+        }
+    }
+    end = std::chrono::high_resolution_clock::now();
+    double copied_rate = messages / std::chrono::duration<double>(end - start).count();
+
+    // Per-player patterns: "chat:player<i>:*"
+    PubSub patterned;
+    std::vector<std::string> patterns;
+    for (int i = 0; i < subscribers; ++i) {
+        patterns.push_back("chat:player" + std::to_string(i) + ":*");
+        patterned.psubscribe(sinks[static_cast<size_t>(i)].get(), patterns.back());
+    }
+    std::vector<std::string> channels;
+    for (int i = 0; i < messages; ++i) {
+        channels.push_back("chat:player" + std::to_string(i * 7919 % subscribers) + ":whisper");
+    }
+    size_t matched = 0;
+    start = std::chrono::high_resolution_clock::now();
+    for (const auto& channel : channels) {
+        matched += patterned.publish(channel, payload);
+    }
+    end = std::chrono::high_resolution_clock::now();
+    double trie_us = std::chrono::duration<double, std::micro>(end - start).count() / messages;
+    start = std::chrono::high_resolution_clock::now();
+    for (const auto& channel : channels) {
+        for (const auto& pattern : patterns) {
+            matched += glob_match(pattern, channel);
+        }
+    }
+    end = std::chrono::high_resolution_clock::now();
+    double scan_us = std::chrono::duration<double, std::micro>(end - start).count() / messages;
+
+    std::cout << "Pub/Sub, 1 publisher to " << subscribers << " subscribers, " << payload.size()
+              << "-byte messages:\n";
+    std::cout << "  PUBLISH msgs/s, shared buffer:   " << static_cast<long long>(shared_rate) << " ("
+              << static_cast<long long>(shared_rate * subscribers) << " deliveries/s)\n";
+    std::cout << "  PUBLISH msgs/s, copy per client: " << static_cast<long long>(copied_rate) << "\n";
+    std::cout << "  queued bytes per message, shared: " << queued_bytes / flush_every << "\n";
+    std::cout << "  queued bytes per message, copies: " << copied_bytes / flush_every << "\n";
+    std::cout << "  PUBLISH, " << subscribers << " patterns via trie:  " << trie_us << " us\n";
+    std::cout << "  matching every pattern:          " << scan_us << " us  (deliveries "
+              << deliveries << ", matched " << matched << ")\n\n";
+}
+
+// Entities spread over a 30000 x 30000 block world in one spatial key:
+// loading them, moving them, and the radius and box queries a plugin runs
+// around a player, against scanning every point as a plugin keeping its own
+// list would. Not run by default; 10M points take about 1.3 GB.
+void run_spatial_benchmark() {
+    const int points = 10000000;
+    const int world = 15000;
+    const int queries = 2000;
+    const int moves = 1000000;
+
+    std::mt19937 rng(11);
+    std::uniform_int_distribution<int> horizontal(-world, world);
+    std::uniform_int_distribution<int> height(-64, 319);
+    std::vector<Storage::Point> positions;
+    positions.reserve(points);
+    for (int i = 0; i < points; ++i) {
+        positions.push_back(Storage::Point{horizontal(rng), height(rng), horizontal(rng)});
+    }
+
+    Storage storage(1);
+    long long heap_before = g_heap_bytes.load();
+    auto start = std::chrono::high_resolution_clock::now();
+    std::vector<std::pair<Storage::Point, std::string>> batch;
+    for (int i = 0; i < points; ++i) {
+        batch.emplace_back(positions[static_cast<size_t>(i)], "entity:" + std::to_string(i));
+        if (batch.size() == 1000 || i == points - 1) {
+            storage.spadd("world", batch);
+            batch.clear();
+        }
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    long long index_bytes = g_heap_bytes.load() - heap_before;
+    long long spadd_ops = static_cast<long long>(points / std::chrono::duration<double>(end - start).count());
+
+    // Entities wandering a few blocks, one SPADD each
+    std::uniform_int_distribution<int> step(-4, 4);
+    std::uniform_int_distribution<int> entity(0, points - 1);
+    start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < moves; ++i) {
+        int moved = entity(rng);
+        Storage::Point& point = positions[static_cast<size_t>(moved)];
+        point.x += step(rng);
+        point.z += step(rng);
+        storage.spadd("world", {{point, "entity:" + std::to_string(moved)}});
+    }
+    end = std::chrono::high_resolution_clock::now();
+    long long move_ops = static_cast<long long>(moves / std::chrono::duration<double>(end - start).count());
+
+    std::vector<std::pair<int, int>> centers;
+    for (int i = 0; i < queries; ++i) {
+        centers.emplace_back(horizontal(rng), horizontal(rng));
+    }
+    size_t found = 0;
+    auto count_match = [&found](std::string_view, const Storage::Point&) { found++; };
+    auto radius_query = [&](uint32_t radius, size_t& per_query) {
+        found = 0;
+        auto begin = std::chrono::high_resolution_clock::now();
+        for (const auto& center : centers) {
+            storage.spradius("world", center.first, center.second, radius, 0, count_match);
+        }
+        auto finish = std::chrono::high_resolution_clock::now();
+        per_query = found / queries;
+        return std::chrono::duration<double, std::micro>(finish - begin).count() / queries;
+    };
+    size_t near_found, view_found, far_found;
+    double near_us = radius_query(16, near_found);
+    double view_us = radius_query(128, view_found);
+    double far_us = radius_query(512, far_found);
+
+    // One chunk column, 16 x 16 blocks from bedrock to the build limit
+    found = 0;
+    auto begin = std::chrono::high_resolution_clock::now();
+    for (const auto& center : centers) {
+        int chunk_x = center.first & ~15;
+        int chunk_z = center.second & ~15;
+        storage.spbox("world", Storage::Point{chunk_x, -64, chunk_z}, Storage::Point{chunk_x + 15, 319, chunk_z + 15}, 0,
+                      count_match);
+    }
+    auto finish = std::chrono::high_resolution_clock::now();
+    double chunk_us = std::chrono::duration<double, std::micro>(finish - begin).count() / queries;
+
+    // The same view-distance query by checking every point
+    const int scans = 10;
+    size_t scanned = 0;
+    begin = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < scans; ++i) {
+        int64_t x = centers[static_cast<size_t>(i)].first;
+        int64_t z = centers[static_cast<size_t>(i)].second;
+        for (const auto& point : positions) {
+            int64_t dx = point.x - x;
+            int64_t dz = point.z - z;
+            if (dx * dx + dz * dz <= 128 * 128) {
+                scanned++;
+            }
+        }
+    }
+    finish = std::chrono::high_resolution_clock::now();
+    double scan_us = std::chrono::duration<double, std::micro>(finish - begin).count() / scans;
+
+    std::cout << "Spatial index, " << points << " entities:\n";
+    std::cout << "  bytes per entity:          " << index_bytes / points << "\n";
+    std::cout << "  SPADD ops/s (batches):     " << spadd_ops << "\n";
+    std::cout << "  SPADD moves/s:             " << move_ops << "\n";
+    std::cout << "  SPRADIUS 16:               " << near_us << " us (" << near_found << " found)\n";
+    std::cout << "  SPRADIUS 128:              " << view_us << " us (" << view_found << " found)\n";
+    std::cout << "  SPRADIUS 512:              " << far_us << " us (" << far_found << " found)\n";
+    std::cout << "  SPBOX one chunk column:    " << chunk_us << " us\n";
+    std::cout << "  scan all for radius 128:   " << scan_us << " us (" << scanned / scans << " found)\n\n";
+}
+
+// Money transfers between player accounts on several threads. Each one
+// reads the payer's balance and, if it covers the amount, moves the coins
+// with two INCRBYs. "global lock" is what plugins do today, one lock around
+// the read and the writes; "WATCH/EXEC" watches both accounts and retries
+// when a transfer lost a race. Few accounts means most transfers collide.
+void run_transaction_benchmark() {
+    const int transfers_per_thread = 100000;
+    const long long initial_balance = 1000000;
+    const std::vector<size_t> account_counts = {10, 10000};
+    const std::vector<unsigned> thread_counts = {1, 8, 16};
+
+    std::cout << "Transfers (" << transfers_per_thread << " per thread):\n";
+    std::cout << "  accounts  threads    global lock/s    WATCH/EXEC/s    retries per transfer\n";
+    for (size_t accounts : account_counts) {
+        std::vector<std::string> keys;
+        for (size_t i = 0; i < accounts; ++i) {
+            keys.push_back("player:" + std::to_string(i) + ":coins");
+        }
+        for (unsigned threads : thread_counts) {
+            auto pick = [&keys](unsigned t, int i, size_t& from, size_t& to) {
+                size_t n = static_cast<size_t>(i) * 7919 + t * 104729;
+                from = n % keys.size();
+                to = (from + 1 + (n / keys.size()) % (keys.size() - 1)) % keys.size();
+            };
+            auto balance = [](Storage& storage, const std::string& key) {
+                std::string value;
+                storage.get(key, value);
+                return std::stoll(value);
+            };
+            auto total = [&keys, &balance](Storage& storage) {
+                long long sum = 0;
+                for (const auto& key : keys) {
+                    sum += balance(storage, key);
+                }
+                return sum;
+            };
+
+            Storage locked_storage;
+            for (const auto& key : keys) {
+                locked_storage.set(key, std::to_string(initial_balance));
+            }
+            std::mutex client_lock;
+            double locked_ops = run_threaded(threads, transfers_per_thread, [&](unsigned t, int i) {
+                size_t from, to;
+                pick(t, i, from, to);
+                std::lock_guard<std::mutex> guard(client_lock);
+                if (balance(locked_storage, keys[from]) >= 10) {
+                    locked_storage.incrby(keys[from], -10);
+                    locked_storage.incrby(keys[to], 10);
+                }
+            });
+
+            Storage storage;
+            for (const auto& key : keys) {
+                storage.set(key, std::to_string(initial_balance));
+            }
+            std::atomic<long long> retries(0);
+            double exec_ops = run_threaded(threads, transfers_per_thread, [&](unsigned t, int i) {
+                size_t from, to;
+                pick(t, i, from, to);
+                const std::vector<std::string> involved = {keys[from], keys[to]};
+                while (true) {
+                    std::vector<Storage::WatchedKey> watched = {storage.watch(keys[from]), storage.watch(keys[to])};
+                    if (balance(storage, keys[from]) < 10) {
+                        storage.unwatch(watched);
+                        return;
+                    }
+                    if (storage.exec(watched, involved, false, true, [&]() {
+                            storage.incrby(keys[from], -10);
+                            storage.incrby(keys[to], 10);
+                        })) {
+                        return;
+                    }
+                    retries++;
+                }
+            });
+
+            long long expected = initial_balance * static_cast<long long>(accounts);
+            if (total(locked_storage) != expected || total(storage) != expected) {
+                std::cout << "  ERROR: coins were created or lost\n";
+            }
+            std::cout << "  " << accounts << "        " << threads
+                      << "          " << static_cast<long long>(locked_ops)
+                      << "          " << static_cast<long long>(exec_ops)
+                      << "          " << (static_cast<double>(retries.load()) / (threads * transfers_per_thread))
+                      << "\n";
+        }
+    }
+    std::cout << "\n";
+}
+
+// Saving 1M player profiles while a writer keeps updating them: how long
+// the save takes, the longest a write waits meanwhile, and the heap the save
+// needs beyond the data, against copying the keyspace first as saving used
+// to.
+void run_snapshot_benchmark() {
+    const int keys = 1000000;
+
+    Storage storage(16);
+    long long heap_before = g_heap_bytes.load();
+    for (int i = 0; i < keys; ++i) {
+        storage.set("player:" + std::to_string(i), "{\"coins\":" + std::to_string(i % 5000) + ",\"level\":7}");
+    }
+    long long data_bytes = g_heap_bytes.load() - heap_before;
+
+    std::atomic<bool> saving(true);
+    std::atomic<long long> writes(0);
+    std::atomic<long long> worst_write_us(0);
+    auto write_until_done = [&]() {
+        std::mt19937 rng(3);
+        while (saving.load()) {
+            std::string key = "player:" + std::to_string(rng() % keys);
+            auto begin = std::chrono::high_resolution_clock::now();
+            storage.set(key, "{\"coins\":0,\"level\":8}");
+            auto took = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::high_resolution_clock::now() - begin).count();
+            if (took > worst_write_us.load()) {
+                worst_write_us.store(took);
+            }
+            writes++;
+        }
+    };
+
+    // The same writer for a second with no save, for the scheduler's share
+    // of the longest write
+    std::thread idle_writer(write_until_done);
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+    saving = false;
+    idle_writer.join();
+    long long idle_worst_us = worst_write_us.load();
+    saving = true;
+    writes = 0;
+    worst_write_us = 0;
+    std::thread writer(write_until_done);
+
+    // What a save writes out, dropped after each batch as the file write
+    // would
+    std::string lines;
+    size_t saved = 0;
+    long long peak_extra = 0;
+    heap_before = g_heap_bytes.load();
+    auto start = std::chrono::high_resolution_clock::now();
+    storage.snapshot([&](const std::string& key, const Storage::Value& value) {
+        lines.append(key).append("=").append(Storage::stringValue(value)).append("\n");
+        saved++;
+    }, [&]() {
+        peak_extra = std::max(peak_extra, g_heap_bytes.load() - heap_before);
+        lines.clear();
+    });
+    auto end = std::chrono::high_resolution_clock::now();
+    saving = false;
+    writer.join();
+    double snapshot_ms = std::chrono::duration<double, std::milli>(end - start).count();
+
+    heap_before = g_heap_bytes.load();
+    auto copy = storage.getData();
+    long long copy_bytes = g_heap_bytes.load() - heap_before;
+
+    std::cout << "Snapshot, " << keys << " keys (" << data_bytes << " bytes) under a writer:\n";
+    std::cout << "  snapshot time:                 " << snapshot_ms << " ms (" << saved << " keys)\n";
+    std::cout << "  writes during it:              " << writes.load() << "\n";
+    std::cout << "  longest write:                 " << worst_write_us.load() << " us (" << idle_worst_us
+              << " us with no save)\n";
+    std::cout << "  peak extra heap:               " << peak_extra << "\n";
+    std::cout << "  extra heap copying keyspace:   " << copy_bytes << " (" << copy.size() << " keys)\n\n";
+}
+
+// Memory per key for typical sets and hashes, with the compact encodings
+// against every value forced into a hash table
+void run_memory_benchmark() {
+    const size_t keys = 100000;
+
+    Storage::EncodingLimits compact;
+    Storage::EncodingLimits tables;
+    tables.set.max_intset_entries = 0;
+    tables.set.max_listpack_entries = 0;
+    tables.hash.max_listpack_entries = 0;
+    tables.zset.max_listpack_entries = 0;
+
+    struct Dataset {
+        const char* name;
+        std::function<void(Storage&, size_t)> fill;
+    };
+    std::vector<Dataset> datasets = {
+        {"player profiles (16 fields)", fill_profile},
+        {"permission sets (12 nodes)", [](Storage& storage, size_t i) {
+            static const std::vector<std::string> nodes = {
+                "essentials.home", "essentials.sethome", "essentials.tpa", "essentials.spawn",
+                "essentials.warp", "essentials.kit", "worldedit.wand", "chat.color",
+                "shop.buy", "shop.sell", "plots.claim", "plots.visit"};
+            storage.sadd("perms:" + std::to_string(i), nodes);
+        }},
+        {"clan leaderboards (25 members)", [](Storage& storage, size_t i) {
+            std::vector<std::pair<double, std::string>> scores;
+            for (size_t m = 0; m < 25; ++m) {
+                scores.emplace_back(static_cast<double>((i * 131 + m * 977) % 5000), "player" + std::to_string(i * 25 + m));
+            }
+            storage.zadd("clan:" + std::to_string(i) + ":kills", scores);
+        }},
+        {"friend lists (20 player ids)", [](Storage& storage, size_t i) {
+            std::vector<std::string> friends;
+            for (size_t f = 0; f < 20; ++f) {
+                friends.push_back(std::to_string(100000 + (i * 31 + f * 977) % 900000));
+            }
+            storage.sadd("friends:" + std::to_string(i), friends);
+        }},
+        {"friend lists (20 UUIDs)", [](Storage& storage, size_t i) {
+            std::vector<std::string> friends;
+            for (size_t f = 0; f < 20; ++f) {
+                char uuid[40];
+                std::snprintf(uuid, sizeof(uuid), "%08zx-0000-4000-8000-%012zx", i, f * 7919);
+                friends.push_back(uuid);
+            }
+            storage.sadd("friends:" + std::to_string(i), friends);
+        }},
+    };
+
+    std::cout << "Memory per key (" << keys << " keys):\n";
+    for (const auto& dataset : datasets) {
+        double table_bytes = bytes_per_key(tables, keys, dataset.fill);
+        double compact_bytes = bytes_per_key(compact, keys, dataset.fill);
+        std::cout << "  " << dataset.name << ":  hash table " << static_cast<long long>(table_bytes)
+                  << " B   compact " << static_cast<long long>(compact_bytes)
+                  << " B   (" << (table_bytes / compact_bytes) << "x smaller)\n";
+    }
+
+    std::cout << "  HGET on player profiles:  hash table " << profile_hget_ns(tables, keys)
+              << " ns   compact " << profile_hget_ns(compact, keys) << " ns\n\n";
+}
+
+// Times one pass of op over all keys and returns nanoseconds per operation
+template <typename Op>
+double time_per_key(const std::vector<uint64_t>& keys, Op op) {
+    auto start = std::chrono::high_resolution_clock::now();
+    for (uint64_t key : keys) {
+        op(key);
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count() / keys.size();
+}
+
+template <typename Map>
+void run_table_workload(const char* name, const std::vector<uint64_t>& keys,
+                        const std::vector<uint64_t>& lookups, const std::vector<uint64_t>& misses) {
+    uint64_t checksum = 0;
+    double insert_ns;
+    double hit_ns;
+    double miss_ns;
+    double erase_ns;
+    {
+        Map map;
+        insert_ns = time_per_key(keys, [&](uint64_t key) { map[key] = key; });
+        hit_ns = time_per_key(lookups, [&](uint64_t key) {
+            auto it = map.find(key);
+            checksum += it->second;
+        });
+        miss_ns = time_per_key(misses, [&](uint64_t key) {
+            checksum += map.find(key) == map.end() ? 0 : 1;
+        });
+        erase_ns = time_per_key(lookups, [&](uint64_t key) { checksum += map.erase(key); });
+    }
+
+    std::cout << "    " << name
+              << "  insert " << insert_ns << " ns"
+              << "  hit " << hit_ns << " ns"
+              << "  miss " << miss_ns << " ns"
+              << "  erase " << erase_ns << " ns"
+              << "  (checksum " << (checksum & 0xff) << ")\n";
+}
+
+// Raw table microbenchmark: FlatHashMap against std::unordered_map with
+// 64-bit keys, looked up in an order unrelated to insertion
+void run_hashtable_benchmark(const std::vector<size_t>& sizes) {
+    std::cout << "Hash table microbenchmark (uint64 -> uint64):\n";
+
+    for (size_t size : sizes) {
+        std::vector<uint64_t> keys(size);
+        std::vector<uint64_t> misses(size);
+        for (size_t i = 0; i < size; ++i) {
+            keys[i] = flat_hash_detail::mix_hash(i * 2);
+            misses[i] = flat_hash_detail::mix_hash(i * 2 + 1);
+        }
+        std::vector<uint64_t> lookups(keys);
+        std::shuffle(lookups.begin(), lookups.end(), std::mt19937_64(42));
+
+        std::cout << "  " << size << " keys:\n";
+        run_table_workload<FlatHashMap<uint64_t, uint64_t>>("FlatHashMap       ", keys, lookups, misses);
+        run_table_workload<std::unordered_map<uint64_t, uint64_t>>("std::unordered_map", keys, lookups, misses);
+    }
+    std::cout << "\n";
+}
+
+// Times every single insert while the table grows from empty, so the cost
+// of each resize shows up in the tail instead of being averaged away
+template <typename Map>
+void run_growth_workload(const char* name, const std::vector<uint64_t>& keys) {
+    std::vector<uint32_t> latencies(keys.size());
+    {
+        Map map;
+        for (size_t i = 0; i < keys.size(); ++i) {
+            auto start = std::chrono::steady_clock::now();
+            map[keys[i]] = keys[i];
+            auto end = std::chrono::steady_clock::now();
+            auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+            latencies[i] = static_cast<uint32_t>(std::min<long long>(ns, UINT32_MAX));
+        }
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&latencies](double p) {
+        return latencies[static_cast<size_t>(p * (latencies.size() - 1))];
+    };
+    std::cout << "    " << name
+              << "  p50 " << percentile(0.5) << " ns"
+              << "  p99 " << percentile(0.99) << " ns"
+              << "  p99.9 " << percentile(0.999) << " ns"
+              << "  p99.99 " << percentile(0.9999) << " ns"
+              << "  max " << latencies.back() / 1000 << " us\n";
+}
+
+// Insert latency while growing: a table that rehashes everything at once
+// against Dict, which spreads each resize over the following operations
+void run_growth_benchmark(const std::vector<size_t>& sizes) {
+    std::cout << "Insert latency during growth (uint64 -> uint64):\n";
+
+    for (size_t size : sizes) {
+        std::vector<uint64_t> keys(size);
+        for (size_t i = 0; i < size; ++i) {
+            keys[i] = flat_hash_detail::mix_hash(i);
+        }
+
+        std::cout << "  " << size << " keys:\n";
+        run_growth_workload<FlatHashMap<uint64_t, uint64_t>>("FlatHashMap       ", keys);
+        run_growth_workload<Dict<uint64_t, uint64_t>>("Dict              ", keys);
+        run_growth_workload<std::unordered_map<uint64_t, uint64_t>>("std::unordered_map", keys);
+    }
+    std::cout << "\n";
+}
+
+std::vector<size_t> parse_sizes(const std::string& list) {
+    std::vector<size_t> sizes;
+    std::istringstream iss(list);
+    std::string item;
+    while (std::getline(iss, item, ',')) {
+        sizes.push_back(static_cast<size_t>(std::stoull(item)));
+    }
+    return sizes;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    // Run the quick suites by default, or only the ones named on the command
+    // line. --keys=N,M,... sets the table sizes for the hashtable and
+    // growth suites.
+    std::vector<std::string> suites;
+    std::vector<size_t> table_sizes = {1000000, 10000000, 50000000};
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.rfind("--keys=", 0) == 0) {
+            table_sizes = parse_sizes(arg.substr(7));
+        } else {
+            suites.push_back(arg);
+        }
+    }
+    auto wanted = [&suites](const std::string& name, bool by_default = true) {
+        if (suites.empty()) {
+            return by_default;
+        }
+        for (const auto& suite : suites) {
+            if (suite == name) {
+                return true;
+            }
+        }
+        return false;
+    };
+
+    if (wanted("basic")) {
+        run_basic_benchmark();
+    }
+    if (wanted("scaling")) {
+        run_thread_scaling_benchmark();
+    }
+    if (wanted("reads")) {
+        run_read_scaling_benchmark();
+    }
+    if (wanted("counters")) {
+        run_counter_benchmark();
+    }
+    if (wanted("batch")) {
+        run_batch_benchmark();
+    }
+    if (wanted("zset")) {
+        run_zset_benchmark();
+    }
+    if (wanted("transactions")) {
+        run_transaction_benchmark();
+    }
+    if (wanted("bitmap")) {
+        run_bitmap_benchmark();
+    }
+    if (wanted("hyperloglog")) {
+        run_hyperloglog_benchmark();
+    }
+    if (wanted("stream")) {
+        run_stream_benchmark();
+    }
+    if (wanted("pubsub")) {
+        run_pubsub_benchmark();
+    }
+    if (wanted("memory")) {
+        run_memory_benchmark();
+    }
+    if (wanted("snapshot")) {
+        run_snapshot_benchmark();
+    }
+    if (wanted("spatial", false)) {
+        run_spatial_benchmark();
+    }
+    if (wanted("hashtable", false)) {
+        run_hashtable_benchmark(table_sizes);
+    }
+    if (wanted("growth", false)) {
+        run_growth_benchmark(table_sizes);
+    }
+
     std::cout << "Benchmark completed!\n";
-    
+
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,232 @@
+/*
+ * bitops.cpp
+ * author: Андрій Будильников
+ */
+
+#include "../include/bitops.h"
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define REDICRAFT_BITOPS_AVX2 1
+#define REDICRAFT_TARGET_AVX2 __attribute__((target("avx2")))
+#include <immintrin.h>
+#elif defined(_MSC_VER) && defined(_M_X64)
+#define REDICRAFT_BITOPS_AVX2 1
+#define REDICRAFT_TARGET_AVX2
+#include <immintrin.h>
+#include <intrin.h>
+#endif
+
+namespace bitops {
+
+namespace {
+
+uint64_t load_word(const unsigned char* p) {
+    uint64_t word;
+    std::memcpy(&word, p, sizeof(word));
+    return word;
+}
+
+void store_word(unsigned char* p, uint64_t word) {
+    std::memcpy(p, &word, sizeof(word));
+}
+
+unsigned popcount_word(uint64_t x) {
+    // Without the popcnt instruction the builtin is a library call, slower
+    // than this
+#if defined(__GNUC__) && defined(__POPCNT__)
+    return static_cast<unsigned>(__builtin_popcountll(x));
+#else
+    x = x - ((x >> 1) & 0x5555555555555555ULL);
+    x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+    x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    return static_cast<unsigned>((x * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
+unsigned char apply(Op op, unsigned char a, unsigned char b) {
+    switch (op) {
+        case Op::AND: return a & b;
+        case Op::OR:  return a | b;
+        default:      return a ^ b;
+    }
+}
+
+// Portable kernels: eight bytes at a time, then byte by byte
+
+uint64_t popcount_portable(const unsigned char* data, size_t size) {
+    uint64_t count = 0;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        count += popcount_word(load_word(data + i));
+    }
+    for (; i < size; ++i) {
+        count += popcount_word(data[i]);
+    }
+    return count;
+}
+
+void combine_portable(Op op, unsigned char* dst, const unsigned char* src, size_t size) {
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t a = load_word(dst + i);
+        uint64_t b = load_word(src + i);
+        store_word(dst + i, op == Op::AND ? a & b : op == Op::OR ? a | b : a ^ b);
+    }
+    for (; i < size; ++i) {
+        dst[i] = apply(op, dst[i], src[i]);
+    }
+}
+
+void invert_portable(unsigned char* dst, const unsigned char* src, size_t size) {
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        store_word(dst + i, ~load_word(src + i));
+    }
+    for (; i < size; ++i) {
+        dst[i] = static_cast<unsigned char>(~src[i]);
+    }
+}
+
+size_t find_other_byte_portable(const unsigned char* data, size_t size, unsigned char skip) {
+    uint64_t pattern = 0x0101010101010101ULL * skip;
+    size_t i = 0;
+    for (; i + 8 <= size && load_word(data + i) == pattern; i += 8) {
+    }
+    for (; i < size && data[i] == skip; ++i) {
+    }
+    return i;
+}
+
+void max_bytes_portable(unsigned char* dst, const unsigned char* src, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+        dst[i] = dst[i] < src[i] ? src[i] : dst[i];
+    }
+}
+
+#if defined(REDICRAFT_BITOPS_AVX2)
+
+// AVX2 kernels: 32 bytes per step, the tail left to the portable ones
+
+REDICRAFT_TARGET_AVX2
+uint64_t popcount_avx2(const unsigned char* data, size_t size) {
+    // Bits per nibble looked up 32 at a time; the byte counts are summed
+    // into four 64-bit lanes by vpsadbw before they can overflow
+    const __m256i table = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                           0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i low_mask = _mm256_set1_epi8(0x0F);
+    __m256i total = _mm256_setzero_si256();
+    size_t i = 0;
+    while (i + 32 <= size) {
+        // Each step adds at most 8 per byte, so 31 steps fit in a byte
+        __m256i bytes = _mm256_setzero_si256();
+        for (int step = 0; step < 31 && i + 32 <= size; ++step, i += 32) {
+            __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+            __m256i low = _mm256_and_si256(v, low_mask);
+            __m256i high = _mm256_and_si256(_mm256_srli_epi16(v, 4), low_mask);
+            bytes = _mm256_add_epi8(bytes, _mm256_add_epi8(_mm256_shuffle_epi8(table, low),
+                                                           _mm256_shuffle_epi8(table, high)));
+        }
+        total = _mm256_add_epi64(total, _mm256_sad_epu8(bytes, _mm256_setzero_si256()));
+    }
+    uint64_t lanes[4];
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), total);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + popcount_portable(data + i, size - i);
+}
+
+REDICRAFT_TARGET_AVX2
+void combine_avx2(Op op, unsigned char* dst, const unsigned char* src, size_t size) {
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        __m256i r = op == Op::AND ? _mm256_and_si256(a, b)
+                  : op == Op::OR  ? _mm256_or_si256(a, b)
+                                  : _mm256_xor_si256(a, b);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), r);
+    }
+    combine_portable(op, dst + i, src + i, size - i);
+}
+
+REDICRAFT_TARGET_AVX2
+void invert_avx2(unsigned char* dst, const unsigned char* src, size_t size) {
+    const __m256i ones = _mm256_set1_epi8(-1);
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_xor_si256(v, ones));
+    }
+    invert_portable(dst + i, src + i, size - i);
+}
+
+REDICRAFT_TARGET_AVX2
+size_t find_other_byte_avx2(const unsigned char* data, size_t size, unsigned char skip) {
+    const __m256i pattern = _mm256_set1_epi8(static_cast<char>(skip));
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        uint32_t same = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, pattern)));
+        if (same != 0xFFFFFFFFu) {
+            break;
+        }
+    }
+    return i + find_other_byte_portable(data + i, size - i, skip);
+}
+
+REDICRAFT_TARGET_AVX2
+void max_bytes_avx2(unsigned char* dst, const unsigned char* src, size_t size) {
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_max_epu8(a, b));
+    }
+    max_bytes_portable(dst + i, src + i, size - i);
+}
+
+bool cpu_has_avx2() {
+#if defined(__GNUC__)
+    return __builtin_cpu_supports("avx2");
+#else
+    // Leaf 7 reports AVX2; the OS must also save the YMM registers
+    int info[4];
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx = (info[2] & (1 << 28)) != 0;
+    if (!osxsave || !avx || (_xgetbv(0) & 6) != 6) {
+        return false;
+    }
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#endif
+}
+
+const Kernels avx2_set = {"avx2", popcount_avx2, combine_avx2, invert_avx2, find_other_byte_avx2,
+                          max_bytes_avx2};
+
+#endif
+
+const Kernels portable_set = {"portable", popcount_portable, combine_portable, invert_portable,
+                              find_other_byte_portable, max_bytes_portable};
+
+const Kernels& detect() {
+#if defined(REDICRAFT_BITOPS_AVX2)
+    if (cpu_has_avx2()) {
+        return avx2_set;
+    }
+#endif
+    return portable_set;
+}
+
+} // namespace
+
+const Kernels& portable_kernels() {
+    return portable_set;
+}
+
+const Kernels& kernels() {
+    static const Kernels& chosen = detect();
+    return chosen;
+}
+
+} // namespace bitops
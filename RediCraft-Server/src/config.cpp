@@ -8,6 +8,31 @@
 #include <sstream>
 #include <algorithm>
 #include <cctype>
+#include <stdexcept>
+
+namespace {
+
+// Parses a byte count with an optional kb/mb/gb suffix ("100mb")
+long long parseMemorySize(const std::string& value) {
+    size_t digits = 0;
+    long long bytes = std::stoll(value, &digits);
+    std::string unit = value.substr(digits);
+    unit.erase(0, unit.find_first_not_of(" \t"));
+    std::transform(unit.begin(), unit.end(), unit.begin(),
+                   [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    if (unit.empty() || unit == "b") {
+        return bytes;
+    } else if (unit == "k" || unit == "kb") {
+        return bytes * 1024;
+    } else if (unit == "m" || unit == "mb") {
+        return bytes * 1024 * 1024;
+    } else if (unit == "g" || unit == "gb") {
+        return bytes * 1024 * 1024 * 1024;
+    }
+    throw std::invalid_argument("unknown memory unit");
+}
+
+} // namespace
 
 Config::Config() 
     : port_(7379)
@@ -15,6 +40,17 @@ Config::Config()
     , persistence_enabled_(false)
     , persistence_file_("redicraft.rdb")
     , persistence_interval_(60)
+    , storage_shards_(0)
+    , set_max_intset_entries_(512)
+    , set_max_listpack_entries_(128)
+    , set_max_listpack_value_(64)
+    , hash_max_listpack_entries_(128)
+    , hash_max_listpack_value_(64)
+    , zset_max_listpack_entries_(128)
+    , zset_max_listpack_value_(64)
+    , hll_sparse_max_bytes_(3000)
+    , max_memory_(0)
+    , max_memory_policy_("noeviction")
     , replication_enabled_(false)
     , replication_role_("master")
     , replication_port_(7380)
@@ -75,6 +111,68 @@ bool Config::load(const std::string& filename) {
             } catch (const std::exception&) {
                 // Keep default value
             }
+        } else if (key == "storage_shards") {
+            try {
+                storage_shards_ = std::max(0, std::stoi(value));
+            } catch (const std::exception&) {
+                // Keep default value
+            }
+        } else if (key == "set_max_intset_entries") {
+            try {
+                set_max_intset_entries_ = std::max(0, std::stoi(value));
+            } catch (const std::exception&) {
+                // Keep default value
+            }
+        } else if (key == "set_max_listpack_entries") {
+            try {
+                set_max_listpack_entries_ = std::max(0, std::stoi(value));
+            } catch (const std::exception&) {
+                // Keep default value
+            }
+        } else if (key == "set_max_listpack_value") {
+            try {
+                set_max_listpack_value_ = std::max(0, std::stoi(value));
+            } catch (const std::exception&) {
+                // Keep default value
+            }
+        } else if (key == "hash_max_listpack_entries") {
+            try {
+                hash_max_listpack_entries_ = std::max(0, std::stoi(value));
+            } catch (const std::exception&) {
+                // Keep default value
+            }
+        } else if (key == "hash_max_listpack_value") {
+            try {
+                hash_max_listpack_value_ = std::max(0, std::stoi(value));
+            } catch (const std::exception&) {
+                // Keep default value
+            }
+        } else if (key == "zset_max_listpack_entries") {
+            try {
+                zset_max_listpack_entries_ = std::max(0, std::stoi(value));
+            } catch (const std::exception&) {
+                // Keep default value
+            }
+        } else if (key == "zset_max_listpack_value") {
+            try {
+                zset_max_listpack_value_ = std::max(0, std::stoi(value));
+            } catch (const std::exception&) {
+                // Keep default value
+            }
+        } else if (key == "hll_sparse_max_bytes") {
+            try {
+                hll_sparse_max_bytes_ = std::max(0, std::stoi(value));
+            } catch (const std::exception&) {
+                // Keep default value
+            }
+        } else if (key == "maxmemory") {
+            try {
+                max_memory_ = std::max(0LL, parseMemorySize(value));
+            } catch (const std::exception&) {
+                // Keep default value
+            }
+        } else if (key == "maxmemory_policy") {
+            max_memory_policy_ = value;
         } else if (key == "replication_enabled") {
             replication_enabled_ = (value == "true" || value == "1");
         } else if (key == "replication_role") {
@@ -146,6 +244,50 @@ int Config::getPersistenceInterval() const {
     return persistence_interval_;
 }
 
+int Config::getStorageShards() const {
+    return storage_shards_;
+}
+
+int Config::getSetMaxIntsetEntries() const {
+    return set_max_intset_entries_;
+}
+
+int Config::getSetMaxListpackEntries() const {
+    return set_max_listpack_entries_;
+}
+
+int Config::getSetMaxListpackValue() const {
+    return set_max_listpack_value_;
+}
+
+int Config::getHashMaxListpackEntries() const {
+    return hash_max_listpack_entries_;
+}
+
+int Config::getHashMaxListpackValue() const {
+    return hash_max_listpack_value_;
+}
+
+int Config::getZsetMaxListpackEntries() const {
+    return zset_max_listpack_entries_;
+}
+
+int Config::getZsetMaxListpackValue() const {
+    return zset_max_listpack_value_;
+}
+
+int Config::getHllSparseMaxBytes() const {
+    return hll_sparse_max_bytes_;
+}
+
+long long Config::getMaxMemory() const {
+    return max_memory_;
+}
+
+std::string Config::getMaxMemoryPolicy() const {
+    return max_memory_policy_;
+}
+
 bool Config::isReplicationEnabled() const {
     return replication_enabled_;
 }
@@ -198,6 +340,50 @@ void Config::setPersistenceInterval(int interval) {
     persistence_interval_ = interval;
 }
 
+void Config::setStorageShards(int shards) {
+    storage_shards_ = shards;
+}
+
+void Config::setSetMaxIntsetEntries(int entries) {
+    set_max_intset_entries_ = entries;
+}
+
+void Config::setSetMaxListpackEntries(int entries) {
+    set_max_listpack_entries_ = entries;
+}
+
+void Config::setSetMaxListpackValue(int bytes) {
+    set_max_listpack_value_ = bytes;
+}
+
+void Config::setHashMaxListpackEntries(int entries) {
+    hash_max_listpack_entries_ = entries;
+}
+
+void Config::setHashMaxListpackValue(int bytes) {
+    hash_max_listpack_value_ = bytes;
+}
+
+void Config::setZsetMaxListpackEntries(int entries) {
+    zset_max_listpack_entries_ = entries;
+}
+
+void Config::setZsetMaxListpackValue(int bytes) {
+    zset_max_listpack_value_ = bytes;
+}
+
+void Config::setHllSparseMaxBytes(int bytes) {
+    hll_sparse_max_bytes_ = bytes;
+}
+
+void Config::setMaxMemory(long long bytes) {
+    max_memory_ = bytes;
+}
+
+void Config::setMaxMemoryPolicy(const std::string& policy) {
+    max_memory_policy_ = policy;
+}
+
 void Config::setReplicationEnabled(bool enabled) {
     replication_enabled_ = enabled;
 }
@@ -22,7 +22,7 @@ int main(int argc, char* argv[]) {
         }
         
         asio::io_context io_context;
-        Server server(io_context, config.getPort());
+        Server server(io_context, config);
         
         std::cout << "RediCraft server starting on port " << config.getPort() << "..." << std::endl;
         
@@ -39,6 +39,18 @@ Command Parser::parse(const std::string& input) {
     } else if (command == "GET" && tokens.size() >= 2) {
         cmd.type = CommandType::GET;
         cmd.args.push_back(tokens[1]);  // key
+    } else if (command == "MGET" && tokens.size() >= 2) {
+        cmd.type = CommandType::MGET;
+        // All remaining tokens are keys
+        for (size_t i = 1; i < tokens.size(); ++i) {
+            cmd.args.push_back(tokens[i]);
+        }
+    } else if ((command == "MSET" || command == "MSETNX") && tokens.size() >= 3) {
+        cmd.type = command == "MSET" ? CommandType::MSET : CommandType::MSETNX;
+        // Alternating keys and values
+        for (size_t i = 1; i < tokens.size(); ++i) {
+            cmd.args.push_back(tokens[i]);
+        }
     } else if (command == "INCR" && tokens.size() >= 2) {
         cmd.type = CommandType::INCR;
         cmd.args.push_back(tokens[1]);  // key
@@ -49,6 +61,28 @@ Command Parser::parse(const std::string& input) {
         cmd.type = CommandType::INCRBY;
         cmd.args.push_back(tokens[1]);  // key
         cmd.args.push_back(tokens[2]);  // increment
+    } else if (command == "SETBIT" && tokens.size() >= 4) {
+        cmd.type = CommandType::SETBIT;
+        cmd.args.push_back(tokens[1]);  // key
+        cmd.args.push_back(tokens[2]);  // bit offset
+        cmd.args.push_back(tokens[3]);  // 0 or 1
+    } else if (command == "GETBIT" && tokens.size() >= 3) {
+        cmd.type = CommandType::GETBIT;
+        cmd.args.push_back(tokens[1]);  // key
+        cmd.args.push_back(tokens[2]);  // bit offset
+    } else if ((command == "BITCOUNT" && tokens.size() >= 2) || (command == "BITPOS" && tokens.size() >= 3)) {
+        cmd.type = command == "BITCOUNT" ? CommandType::BITCOUNT : CommandType::BITPOS;
+        // Key (and for BITPOS the bit), then an optional start, end and
+        // BYTE or BIT
+        for (size_t i = 1; i < tokens.size(); ++i) {
+            cmd.args.push_back(tokens[i]);
+        }
+    } else if (command == "BITOP" && tokens.size() >= 4) {
+        cmd.type = CommandType::BITOP;
+        // Operation, destination key, then the source keys
+        for (size_t i = 1; i < tokens.size(); ++i) {
+            cmd.args.push_back(tokens[i]);
+        }
     } else if (command == "HSET" && tokens.size() >= 4) {
         cmd.type = CommandType::HSET;
         cmd.args.push_back(tokens[1]);  // hash key
@@ -61,6 +95,36 @@ Command Parser::parse(const std::string& input) {
     } else if (command == "HGETALL" && tokens.size() >= 2) {
         cmd.type = CommandType::HGETALL;
         cmd.args.push_back(tokens[1]);  // hash key
+    } else if (command == "HMGET" && tokens.size() >= 3) {
+        cmd.type = CommandType::HMGET;
+        // Hash key, then the fields
+        for (size_t i = 1; i < tokens.size(); ++i) {
+            cmd.args.push_back(tokens[i]);
+        }
+    } else if (command == "HMSET" && tokens.size() >= 4) {
+        cmd.type = CommandType::HMSET;
+        // Hash key, then alternating fields and values
+        for (size_t i = 1; i < tokens.size(); ++i) {
+            cmd.args.push_back(tokens[i]);
+        }
+    } else if ((command == "HINCRBY" || command == "HINCRBYFLOAT") && tokens.size() >= 4) {
+        cmd.type = command == "HINCRBY" ? CommandType::HINCRBY : CommandType::HINCRBYFLOAT;
+        cmd.args.push_back(tokens[1]);  // hash key
+        cmd.args.push_back(tokens[2]);  // field
+        cmd.args.push_back(tokens[3]);  // increment
+    } else if (command == "HDEL" && tokens.size() >= 3) {
+        cmd.type = CommandType::HDEL;
+        // Hash key, then the fields
+        for (size_t i = 1; i < tokens.size(); ++i) {
+            cmd.args.push_back(tokens[i]);
+        }
+    } else if (command == "HLEN" && tokens.size() >= 2) {
+        cmd.type = CommandType::HLEN;
+        cmd.args.push_back(tokens[1]);  // hash key
+    } else if (command == "HEXISTS" && tokens.size() >= 3) {
+        cmd.type = CommandType::HEXISTS;
+        cmd.args.push_back(tokens[1]);  // hash key
+        cmd.args.push_back(tokens[2]);  // field
     } else if (command == "LPUSH" && tokens.size() >= 3) {
         cmd.type = CommandType::LPUSH;
         cmd.args.push_back(tokens[1]);  // list key
@@ -68,9 +132,28 @@ Command Parser::parse(const std::string& input) {
         for (size_t i = 2; i < tokens.size(); ++i) {
             cmd.args.push_back(tokens[i]);
         }
+    } else if (command == "RPUSH" && tokens.size() >= 3) {
+        cmd.type = CommandType::RPUSH;
+        cmd.args.push_back(tokens[1]);  // list key
+        // Add all remaining tokens as values
+        for (size_t i = 2; i < tokens.size(); ++i) {
+            cmd.args.push_back(tokens[i]);
+        }
+    } else if (command == "LPOP" && tokens.size() >= 2) {
+        cmd.type = CommandType::LPOP;
+        cmd.args.push_back(tokens[1]);  // list key
     } else if (command == "RPOP" && tokens.size() >= 2) {
         cmd.type = CommandType::RPOP;
         cmd.args.push_back(tokens[1]);  // list key
+    } else if ((command == "BLPOP" || command == "BRPOP") && tokens.size() >= 3) {
+        cmd.type = command == "BLPOP" ? CommandType::BLPOP : CommandType::BRPOP;
+        // List keys, then the timeout in seconds
+        for (size_t i = 1; i < tokens.size(); ++i) {
+            cmd.args.push_back(tokens[i]);
+        }
+    } else if (command == "LLEN" && tokens.size() >= 2) {
+        cmd.type = CommandType::LLEN;
+        cmd.args.push_back(tokens[1]);  // list key
     } else if (command == "LRANGE" && tokens.size() >= 4) {
         cmd.type = CommandType::LRANGE;
         cmd.args.push_back(tokens[1]);  // list key
@@ -83,6 +166,13 @@ Command Parser::parse(const std::string& input) {
     } else if (command == "TTL" && tokens.size() >= 2) {
         cmd.type = CommandType::TTL;
         cmd.args.push_back(tokens[1]);  // key
+    } else if (command == "PEXPIRE" && tokens.size() >= 3) {
+        cmd.type = CommandType::PEXPIRE;
+        cmd.args.push_back(tokens[1]);  // key
+        cmd.args.push_back(tokens[2]);  // milliseconds
+    } else if (command == "PTTL" && tokens.size() >= 2) {
+        cmd.type = CommandType::PTTL;
+        cmd.args.push_back(tokens[1]);  // key
     } else if (command == "SADD" && tokens.size() >= 3) {
         cmd.type = CommandType::SADD;
         cmd.args.push_back(tokens[1]);  // set key
@@ -107,6 +197,115 @@ Command Parser::parse(const std::string& input) {
     } else if (command == "SCARD" && tokens.size() >= 2) {
         cmd.type = CommandType::SCARD;
         cmd.args.push_back(tokens[1]);  // set key
+    } else if (command == "ZADD" && tokens.size() >= 4) {
+        cmd.type = CommandType::ZADD;
+        // Sorted set key, then alternating scores and members
+        for (size_t i = 1; i < tokens.size(); ++i) {
+            cmd.args.push_back(tokens[i]);
+        }
+    } else if (command == "ZINCRBY" && tokens.size() >= 4) {
+        cmd.type = CommandType::ZINCRBY;
+        cmd.args.push_back(tokens[1]);  // sorted set key
+        cmd.args.push_back(tokens[2]);  // increment
+        cmd.args.push_back(tokens[3]);  // member
+    } else if ((command == "ZSCORE" || command == "ZRANK" || command == "ZREVRANK") && tokens.size() >= 3) {
+        cmd.type = command == "ZSCORE" ? CommandType::ZSCORE
+                 : command == "ZRANK" ? CommandType::ZRANK : CommandType::ZREVRANK;
+        cmd.args.push_back(tokens[1]);  // sorted set key
+        cmd.args.push_back(tokens[2]);  // member
+    } else if ((command == "ZRANGE" || command == "ZREVRANGE") && tokens.size() >= 4) {
+        cmd.type = command == "ZRANGE" ? CommandType::ZRANGE : CommandType::ZREVRANGE;
+        cmd.args.push_back(tokens[1]);  // sorted set key
+        cmd.args.push_back(tokens[2]);  // start index
+        cmd.args.push_back(tokens[3]);  // end index
+        if (tokens.size() >= 5) {
+            cmd.args.push_back(tokens[4]);  // WITHSCORES
+        }
+    } else if (command == "ZREM" && tokens.size() >= 3) {
+        cmd.type = CommandType::ZREM;
+        // Sorted set key, then the members
+        for (size_t i = 1; i < tokens.size(); ++i) {
+            cmd.args.push_back(tokens[i]);
+        }
+    } else if (command == "ZCARD" && tokens.size() >= 2) {
+        cmd.type = CommandType::ZCARD;
+        cmd.args.push_back(tokens[1]);  // sorted set key
+    } else if ((command == "PFADD" || command == "PFCOUNT" || command == "PFMERGE") && tokens.size() >= 2) {
+        cmd.type = command == "PFADD" ? CommandType::PFADD
+                 : command == "PFCOUNT" ? CommandType::PFCOUNT : CommandType::PFMERGE;
+        // PFADD: key, then the elements; PFCOUNT: the keys; PFMERGE: the
+        // destination, then the sources
+        for (size_t i = 1; i < tokens.size(); ++i) {
+            cmd.args.push_back(tokens[i]);
+        }
+    } else if ((command == "SPADD" && tokens.size() >= 6) ||
+               ((command == "SPREM" || command == "SPPOS") && tokens.size() >= 3) ||
+               (command == "SPCARD" && tokens.size() >= 2) || (command == "SPRADIUS" && tokens.size() >= 5) ||
+               (command == "SPBOX" && tokens.size() >= 8)) {
+        cmd.type = command == "SPADD" ? CommandType::SPADD
+                 : command == "SPREM" ? CommandType::SPREM
+                 : command == "SPPOS" ? CommandType::SPPOS
+                 : command == "SPCARD" ? CommandType::SPCARD
+                 : command == "SPRADIUS" ? CommandType::SPRADIUS : CommandType::SPBOX;
+        // Spatial key, then x y z member groups (SPADD), members (SPREM,
+        // SPPOS), x z radius (SPRADIUS) or two corners (SPBOX), and an
+        // optional COUNT for the queries
+        for (size_t i = 1; i < tokens.size(); ++i) {
+            cmd.args.push_back(tokens[i]);
+        }
+    } else if ((command == "XADD" && tokens.size() >= 5) || (command == "XLEN" && tokens.size() >= 2) ||
+               (command == "XRANGE" && tokens.size() >= 4) || (command == "XREAD" && tokens.size() >= 4)) {
+        cmd.type = command == "XADD" ? CommandType::XADD
+                 : command == "XLEN" ? CommandType::XLEN
+                 : command == "XRANGE" ? CommandType::XRANGE : CommandType::XREAD;
+        // XADD: key, [MAXLEN [~|=] count], ID, then fields and values;
+        // XRANGE: key, start, end, [COUNT count]; XREAD: [COUNT count]
+        // [BLOCK milliseconds] STREAMS, the keys, then one ID per key
+        for (size_t i = 1; i < tokens.size(); ++i) {
+            cmd.args.push_back(tokens[i]);
+        }
+    } else if (((command == "SUBSCRIBE" || command == "PSUBSCRIBE") && tokens.size() >= 2) ||
+               command == "UNSUBSCRIBE" || command == "PUNSUBSCRIBE" ||
+               (command == "PUBLISH" && tokens.size() >= 3)) {
+        cmd.type = command == "SUBSCRIBE" ? CommandType::SUBSCRIBE
+                 : command == "UNSUBSCRIBE" ? CommandType::UNSUBSCRIBE
+                 : command == "PSUBSCRIBE" ? CommandType::PSUBSCRIBE
+                 : command == "PUNSUBSCRIBE" ? CommandType::PUNSUBSCRIBE : CommandType::PUBLISH;
+        // Channels or patterns (none unsubscribes from all), or PUBLISH's
+        // channel and message
+        for (size_t i = 1; i < tokens.size(); ++i) {
+            cmd.args.push_back(tokens[i]);
+        }
+    } else if ((command == "SCAN" && tokens.size() >= 2) ||
+               ((command == "HSCAN" || command == "SSCAN") && tokens.size() >= 3)) {
+        cmd.type = command == "SCAN" ? CommandType::SCAN
+                 : command == "HSCAN" ? CommandType::HSCAN : CommandType::SSCAN;
+        // [key] cursor, then MATCH pattern and COUNT count in any order
+        for (size_t i = 1; i < tokens.size(); ++i) {
+            cmd.args.push_back(tokens[i]);
+        }
+    } else if (command == "MULTI") {
+        cmd.type = CommandType::MULTI;
+    } else if (command == "EXEC") {
+        cmd.type = CommandType::EXEC;
+    } else if (command == "DISCARD") {
+        cmd.type = CommandType::DISCARD;
+    } else if (command == "WATCH" && tokens.size() >= 2) {
+        cmd.type = CommandType::WATCH;
+        // All remaining tokens are keys
+        for (size_t i = 1; i < tokens.size(); ++i) {
+            cmd.args.push_back(tokens[i]);
+        }
+    } else if (command == "UNWATCH") {
+        cmd.type = CommandType::UNWATCH;
+    } else if (command == "INFO") {
+        cmd.type = CommandType::INFO;
+    } else if (command == "MEMORY" && tokens.size() >= 2) {
+        cmd.type = CommandType::MEMORY;
+        // Subcommand and its arguments
+        for (size_t i = 1; i < tokens.size(); ++i) {
+            cmd.args.push_back(tokens[i]);
+        }
     }
     
     return cmd;
@@ -13,7 +13,18 @@
 #include <condition_variable>
 #include <functional>
 #include <thread>
+#include <string_view>
 #include <future>
+#include <cstring>
+#include <vector>
+
+namespace {
+
+// HyperLogLog registers are saved one character each, in the base64
+// alphabet, which has a character for every value a register can hold
+const char kRegisterDigits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+} // namespace
 
 PersistenceManager::PersistenceManager(Storage& storage)
     : storage_(storage)
@@ -89,6 +100,48 @@ bool PersistenceManager::loadFromFile(const std::string& filename) {
         // Process based on section
         if (section == "STRINGS") {
             storage_.set(key, value);
+        } else if (section == "ZSETS") {
+            // "score member"; members never contain spaces
+            size_t space = value.find(' ');
+            double score;
+            if (space != std::string::npos && Storage::parseScore(std::string_view(value).substr(0, space), score)) {
+                storage_.zadd(key, {{score, value.substr(space + 1)}});
+            }
+        } else if (section == "HYPERLOGLOGS" && value.size() == HyperLogLog::kRegisters) {
+            std::vector<unsigned char> registers(HyperLogLog::kRegisters);
+            bool valid = true;
+            for (size_t i = 0; i < registers.size() && valid; ++i) {
+                const char* digit = std::strchr(kRegisterDigits, value[i]);
+                valid = value[i] != '\0' && digit != nullptr;
+                registers[i] = valid ? static_cast<unsigned char>(digit - kRegisterDigits) : 0;
+            }
+            if (valid) {
+                storage_.pfrestore(key, registers.data());
+            }
+        } else if (section == "SPATIAL") {
+            // "x y z member"; members never contain spaces
+            std::istringstream fields(value);
+            long long x, y, z;
+            std::string member;
+            if (fields >> x >> y >> z >> member && x >= INT32_MIN && x <= INT32_MAX && y >= INT32_MIN &&
+                y <= INT32_MAX && z >= INT32_MIN && z <= INT32_MAX) {
+                Storage::Point point{static_cast<int32_t>(x), static_cast<int32_t>(y), static_cast<int32_t>(z)};
+                storage_.spadd(key, {{point, member}});
+            }
+        } else if (section == "STREAMS") {
+            // "id field value ..."; fields and values never contain spaces
+            std::istringstream fields(value);
+            std::string id_text;
+            std::string text;
+            std::vector<std::string> fields_and_values;
+            StreamID id;
+            fields >> id_text;
+            while (fields >> text) {
+                fields_and_values.push_back(text);
+            }
+            if (StreamID::parse(id_text, 0, id) && !fields_and_values.empty() && fields_and_values.size() % 2 == 0) {
+                storage_.xadd(key, id, false, false, fields_and_values, -1, false);
+            }
         }
         // For hashes and lists, we would need more complex parsing
         // This is a simplified implementation
@@ -97,73 +150,78 @@ bool PersistenceManager::loadFromFile(const std::string& filename) {
     return true;
 }
 
-// Create a snapshot of the current data without holding locks during file I/O
-std::tuple<
-    std::unordered_map<std::string, Storage::DataItem>,
-    std::unordered_map<std::string, Storage::HashItem>,
-    std::unordered_map<std::string, Storage::ListItem>,
-    std::unordered_map<std::string, Storage::SetItem>
-> PersistenceManager::createSnapshot() {
-    // Create copies of all data structures
-    auto stringData = storage_.getStringData();
-    auto hashData = storage_.getHashData();
-    auto listData = storage_.getListData();
-    auto setData = storage_.getSetData();
-    
-    return std::make_tuple(std::move(stringData), std::move(hashData), std::move(listData), std::move(setData));
+// A copy of the keyspace as it stood at one moment; saving does not need one
+std::unordered_map<std::string, Storage::Value> PersistenceManager::createSnapshot() {
+    return storage_.getData();
 }
 
 bool PersistenceManager::saveToFile(const std::string& filename) {
-    // Create a snapshot of the current data
-    // This avoids holding locks during the file I/O operation
-    auto [stringData, hashData, listData, setData] = createSnapshot();
-    
     std::ofstream file(filename, std::ios::binary);
     if (!file.is_open()) {
         std::cerr << "Could not open file for writing: " << filename << std::endl;
         return false;
     }
     
-    // Write string data
-    file << "[STRINGS]\n";
-    for (const auto& pair : stringData) {
-        // Only save non-expired items
-        if (!pair.second.has_expiry || pair.second.expiry > std::chrono::steady_clock::now()) {
-            file << pair.first << "=" << pair.second.value << "\n";
-        }
-    }
-    
-    file << "[HASHES]\n";
-    for (const auto& pair : hashData) {
-        // Only save non-expired items
-        if (!pair.second.has_expiry || pair.second.expiry > std::chrono::steady_clock::now()) {
-            for (const auto& field : pair.second.fields) {
-                file << pair.first << "." << field.first << "=" << field.second << "\n";
-            }
-        }
-    }
+    // The keyspace as it was when the save began, written out a batch of
+    // keys at a time while clients keep writing. Each batch adds its lines
+    // under their section's header, so a section may appear many times,
+    // which loading does not mind.
+    enum Section { STRINGS, HASHES, LISTS, SETS, ZSETS, HYPERLOGLOGS, SPATIAL, STREAMS, SECTION_COUNT };
+    static const char* const kSectionNames[SECTION_COUNT] = {
+        "STRINGS", "HASHES", "LISTS", "SETS", "ZSETS", "HYPERLOGLOGS", "SPATIAL", "STREAMS"};
+    std::ostringstream sections[SECTION_COUNT];
     
-    file << "[LISTS]\n";
-    for (const auto& pair : listData) {
-        // Only save non-expired items
-        if (!pair.second.has_expiry || pair.second.expiry > std::chrono::steady_clock::now()) {
-            for (size_t i = 0; i < pair.second.values.size(); ++i) {
-                file << pair.first << "[" << i << "]=" << pair.second.values[i] << "\n";
+    storage_.snapshot([&](const std::string& key, const Storage::Value& value) {
+        if (value.type() == Storage::ValueType::STRING) {
+            sections[STRINGS] << key << "=" << Storage::stringValue(value) << "\n";
+        } else if (const auto* fields = std::get_if<Storage::HashFields>(&value.data)) {
+            fields->for_each([&](std::string_view field, std::string_view text) {
+                sections[HASHES] << key << "." << field << "=" << text << "\n";
+            });
+        } else if (const auto* values = std::get_if<Storage::ListValues>(&value.data)) {
+            size_t i = 0;
+            for (std::string_view text : *values) {
+                sections[LISTS] << key << "[" << i++ << "]=" << text << "\n";
             }
+        } else if (const auto* members = std::get_if<Storage::SetMembers>(&value.data)) {
+            members->for_each([&](std::string_view member) {
+                sections[SETS] << key << "." << member << "=1\n";
+            });
+        } else if (const auto* scored = std::get_if<Storage::ZSetMembers>(&value.data)) {
+            scored->for_each([&](std::string_view member, double score) {
+                sections[ZSETS] << key << "=" << Storage::formatScore(score) << " " << member << "\n";
+            });
+        } else if (const auto* hll = std::get_if<HyperLogLog>(&value.data)) {
+            std::string registers(HyperLogLog::kRegisters, kRegisterDigits[0]);
+            hll->for_each_register([&registers](size_t index, uint8_t reg) {
+                registers[index] = kRegisterDigits[reg];
+            });
+            sections[HYPERLOGLOGS] << key << "=" << registers << "\n";
+        } else if (const auto* index = std::get_if<SpatialIndex>(&value.data)) {
+            index->for_each([&](std::string_view member, const SpatialIndex::Point& point) {
+                sections[SPATIAL] << key << "=" << point.x << " " << point.y << " " << point.z << " " << member
+                                  << "\n";
+            });
+        } else if (const auto* stream = std::get_if<Stream>(&value.data)) {
+            stream->for_range(StreamID(), StreamID{StreamID::kMax, StreamID::kMax}, 0,
+                              [&](const StreamID& id, const std::vector<std::string_view>& fields_and_values) {
+                sections[STREAMS] << key << "=" << id.to_string();
+                for (std::string_view text : fields_and_values) {
+                    sections[STREAMS] << " " << text;
+                }
+                sections[STREAMS] << "\n";
+            });
         }
-    }
-    
-    file << "[SETS]\n";
-    for (const auto& pair : setData) {
-        // Only save non-expired items
-        if (!pair.second.has_expiry || pair.second.expiry > std::chrono::steady_clock::now()) {
-            for (const auto& member : pair.second.members) {
-                file << pair.first << "." << member.first << "=1\n";
+    }, [&]() {
+        for (int i = 0; i < SECTION_COUNT; ++i) {
+            if (sections[i].tellp() > 0) {
+                file << "[" << kSectionNames[i] << "]\n" << sections[i].str();
+                sections[i].str(std::string());
             }
         }
-    }
+    });
     
-    return true;
+    return static_cast<bool>(file);
 }
 
 std::future<bool> PersistenceManager::saveToFileAsync(const std::string& filename) {
@@ -221,17 +279,17 @@ void PersistenceManager::autoPersistenceLoop(const std::string& filename, int in
     }
 }
 
-std::string PersistenceManager::serializeStringData(const std::unordered_map<std::string, Storage::DataItem>& data) {
+std::string PersistenceManager::serializeStringData(const std::unordered_map<std::string, Storage::Value>& data) {
     // Placeholder implementation
     return "";
 }
 
-std::string PersistenceManager::serializeHashData(const std::unordered_map<std::string, Storage::HashItem>& data) {
+std::string PersistenceManager::serializeHashData(const std::unordered_map<std::string, Storage::Value>& data) {
     // Placeholder implementation
     return "";
 }
 
-std::string PersistenceManager::serializeListData(const std::unordered_map<std::string, Storage::ListItem>& data) {
+std::string PersistenceManager::serializeListData(const std::unordered_map<std::string, Storage::Value>& data) {
     // Placeholder implementation
     return "";
 }
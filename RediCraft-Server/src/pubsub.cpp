@@ -0,0 +1,166 @@
+/*
+ * pubsub.cpp
+ * author: Андрій Будильников
+ */
+
+#include "../include/pubsub.h"
+#include "../include/glob.h"
+#include <algorithm>
+#include <mutex>
+#include <shared_mutex>
+
+namespace {
+
+// Builds "<parts...> <message>\r\n" in one shared buffer
+SharedString format_message(std::initializer_list<std::string_view> parts) {
+    std::string line;
+    size_t size = 2;
+    for (std::string_view part : parts) {
+        size += part.size() + 1;
+    }
+    line.reserve(size);
+    for (std::string_view part : parts) {
+        if (!line.empty()) {
+            line += ' ';
+        }
+        line.append(part);
+    }
+    line += "\r\n";
+    return SharedString(line);
+}
+
+bool remove_subscriber(std::vector<Subscriber*>& subscribers, Subscriber* subscriber) {
+    auto it = std::find(subscribers.begin(), subscribers.end(), subscriber);
+    if (it == subscribers.end()) {
+        return false;
+    }
+    subscribers.erase(it);
+    return true;
+}
+
+} // namespace
+
+bool PubSub::subscribe(Subscriber* subscriber, const std::string& channel) {
+    std::unique_lock<ReadBiasedMutex> lock(mutex_);
+    std::vector<Subscriber*>& subscribers = channels_[channel];
+    if (std::find(subscribers.begin(), subscribers.end(), subscriber) != subscribers.end()) {
+        return false;
+    }
+    subscribers.push_back(subscriber);
+    return true;
+}
+
+bool PubSub::unsubscribe(Subscriber* subscriber, const std::string& channel) {
+    std::unique_lock<ReadBiasedMutex> lock(mutex_);
+    auto it = channels_.find(channel);
+    if (it == channels_.end() || !remove_subscriber(it->second, subscriber)) {
+        return false;
+    }
+    if (it->second.empty()) {
+        channels_.erase(it);
+    }
+    return true;
+}
+
+bool PubSub::psubscribe(Subscriber* subscriber, const std::string& pattern) {
+    std::unique_lock<ReadBiasedMutex> lock(mutex_);
+    PatternNode* node = &patterns_;
+    size_t prefix = literal_prefix(pattern);
+    for (size_t i = 0; i < prefix; ++i) {
+        auto& children = node->children;
+        auto it = std::lower_bound(children.begin(), children.end(), pattern[i],
+                                   [](const auto& child, char c) { return child.first < c; });
+        if (it == children.end() || it->first != pattern[i]) {
+            it = children.emplace(it, pattern[i], std::make_unique<PatternNode>());
+        }
+        node = it->second.get();
+    }
+    auto entry = std::find_if(node->patterns.begin(), node->patterns.end(),
+                              [&pattern](const auto& p) { return p.first == pattern; });
+    if (entry == node->patterns.end()) {
+        node->patterns.emplace_back(pattern, std::vector<Subscriber*>{subscriber});
+        return true;
+    }
+    if (std::find(entry->second.begin(), entry->second.end(), subscriber) != entry->second.end()) {
+        return false;
+    }
+    entry->second.push_back(subscriber);
+    return true;
+}
+
+bool PubSub::punsubscribe(Subscriber* subscriber, const std::string& pattern) {
+    std::unique_lock<ReadBiasedMutex> lock(mutex_);
+    return remove_pattern(patterns_, pattern, 0, literal_prefix(pattern), subscriber);
+}
+
+size_t PubSub::publish(const std::string& channel, const std::string& message) {
+    std::shared_lock<ReadBiasedMutex> lock(mutex_);
+    size_t deliveries = 0;
+    auto it = channels_.find(channel);
+    if (it != channels_.end()) {
+        SharedString line = format_message({"message", channel, message});
+        for (Subscriber* subscriber : it->second) {
+            subscriber->deliver(line);
+        }
+        deliveries += it->second.size();
+    }
+
+    // Every node on the channel's path holds patterns whose literal prefix
+    // the channel starts with; only those can match
+    const PatternNode* node = &patterns_;
+    for (size_t depth = 0;; ++depth) {
+        for (const auto& entry : node->patterns) {
+            if (!glob_match(entry.first, channel)) {
+                continue;
+            }
+            SharedString line = format_message({"pmessage", entry.first, channel, message});
+            for (Subscriber* subscriber : entry.second) {
+                subscriber->deliver(line);
+            }
+            deliveries += entry.second.size();
+        }
+        if (depth == channel.size()) {
+            break;
+        }
+        const auto& children = node->children;
+        auto child = std::lower_bound(children.begin(), children.end(), channel[depth],
+                                      [](const auto& c, char byte) { return c.first < byte; });
+        if (child == children.end() || child->first != channel[depth]) {
+            break;
+        }
+        node = child->second.get();
+    }
+    return deliveries;
+}
+
+size_t PubSub::literal_prefix(std::string_view pattern) {
+    size_t end = pattern.find_first_of("*?[\\");
+    return end == std::string_view::npos ? pattern.size() : end;
+}
+
+bool PubSub::remove_pattern(PatternNode& node, const std::string& pattern, size_t depth, size_t prefix,
+                            Subscriber* subscriber) {
+    if (depth == prefix) {
+        auto entry = std::find_if(node.patterns.begin(), node.patterns.end(),
+                                  [&pattern](const auto& p) { return p.first == pattern; });
+        if (entry == node.patterns.end() || !remove_subscriber(entry->second, subscriber)) {
+            return false;
+        }
+        if (entry->second.empty()) {
+            node.patterns.erase(entry);
+        }
+        return true;
+    }
+    auto& children = node.children;
+    auto child = std::lower_bound(children.begin(), children.end(), pattern[depth],
+                                  [](const auto& c, char byte) { return c.first < byte; });
+    if (child == children.end() || child->first != pattern[depth] ||
+        !remove_pattern(*child->second, pattern, depth + 1, prefix, subscriber)) {
+        return false;
+    }
+    // Nodes left with no patterns below them go too
+    if (child->second->patterns.empty() && child->second->children.empty()) {
+        children.erase(child);
+    }
+    return true;
+}
@@ -12,6 +12,7 @@
 #include <iostream>
 #include <functional>
 #include <memory>
+#include <chrono>
 
 #ifdef ASIO_STANDALONE
 using asio::ip::tcp;
@@ -19,19 +20,46 @@ using asio::ip::tcp;
 using asio::ip::tcp;
 #endif
 
-Server::Server(asio::io_context& io_context, short port)
-    : acceptor_(io_context, tcp::endpoint(tcp::v4(), port)),
-      storage_(std::make_unique<Storage>()),
+namespace {
+
+Storage::EncodingLimits storageLimits(const Config& config) {
+    Storage::EncodingLimits limits;
+    limits.set.max_intset_entries = static_cast<size_t>(config.getSetMaxIntsetEntries());
+    limits.set.max_listpack_entries = static_cast<size_t>(config.getSetMaxListpackEntries());
+    limits.set.max_listpack_value = static_cast<size_t>(config.getSetMaxListpackValue());
+    limits.hash.max_listpack_entries = static_cast<size_t>(config.getHashMaxListpackEntries());
+    limits.hash.max_listpack_value = static_cast<size_t>(config.getHashMaxListpackValue());
+    limits.zset.max_listpack_entries = static_cast<size_t>(config.getZsetMaxListpackEntries());
+    limits.zset.max_listpack_value = static_cast<size_t>(config.getZsetMaxListpackValue());
+    limits.hll.max_sparse_bytes = static_cast<size_t>(config.getHllSparseMaxBytes());
+    return limits;
+}
+
+} // namespace
+
+Server::Server(asio::io_context& io_context, const Config& config)
+    : acceptor_(io_context, tcp::endpoint(tcp::v4(), static_cast<unsigned short>(config.getPort()))),
+      cron_timer_(io_context),
+      storage_(std::make_unique<Storage>(static_cast<size_t>(config.getStorageShards()),
+                                         storageLimits(config))),
       replication_enabled_(false),
       clustering_enabled_(false) {
+    EvictionPolicy policy = EvictionPolicy::NOEVICTION;
+    if (!parse_eviction_policy(config.getMaxMemoryPolicy(), policy)) {
+        std::cerr << "Unknown maxmemory_policy '" << config.getMaxMemoryPolicy()
+                  << "', using noeviction" << std::endl;
+    }
+    storage_->setMaxMemory(static_cast<size_t>(config.getMaxMemory()), policy);
 }
 
 void Server::start() {
     do_accept();
+    schedule_cron();
 }
 
 void Server::stop() {
     acceptor_.close();
+    cron_timer_.cancel();
     if (replication_manager_) {
         if (replication_manager_->getReplicationRole() == ReplicationRole::MASTER) {
             replication_manager_->stopMaster();
@@ -50,7 +78,7 @@ void Server::do_accept() {
         [this](std::error_code ec, tcp::socket socket) {
             if (!ec) {
                 // Create a new session for the client
-                std::make_shared<Session>(std::move(socket), *storage_)->start();
+                std::make_shared<Session>(std::move(socket), *storage_, pubsub_)->start();
             }
             
             // Continue accepting new connections
@@ -58,6 +86,19 @@ void Server::do_accept() {
         });
 }
 
+void Server::schedule_cron(std::chrono::milliseconds delay) {
+    // Storage housekeeping (active expiry, incremental rehashing, the
+    // eviction clock) runs ten times a second, and every 10 ms while it has a backlog
+    cron_timer_.expires_after(delay);
+    cron_timer_.async_wait([this](std::error_code ec) {
+        if (ec) {
+            return;
+        }
+        bool backlog = storage_->cron();
+        schedule_cron(std::chrono::milliseconds(backlog ? 10 : 100));
+    });
+}
+
 void Server::enableReplication(ReplicationRole role, const std::string& master_host, int master_port) {
     if (!replication_manager_) {
         replication_manager_ = std::make_unique<ReplicationManager>(*storage_, role);
@@ -8,11 +8,253 @@
 #include "parser.h"
 #include <iostream>
 #include <sstream>
+#include <stdexcept>
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <string_view>
 
 using asio::ip::tcp;
 
-Session::Session(tcp::socket socket, Storage& storage)
-    : socket_(std::move(socket)), storage_(storage), strand_(asio::make_strand(socket_.get_executor())) {
+namespace {
+
+// Adds the keys a command reads or writes, so EXEC locks only their
+// shards; returns false for commands that look at the whole keyspace
+bool command_keys(const Command& cmd, std::vector<std::string>& keys) {
+    switch (cmd.type) {
+        case CommandType::PING:
+        case CommandType::SUBSCRIBE:
+        case CommandType::UNSUBSCRIBE:
+        case CommandType::PSUBSCRIBE:
+        case CommandType::PUNSUBSCRIBE:
+        case CommandType::PUBLISH:
+            return true;
+        case CommandType::INFO:
+        case CommandType::SCAN:
+            return false;
+        case CommandType::MEMORY:
+            // Only USAGE looks at a key; STATS and BIGKEYS read the report
+            if (cmd.args.size() >= 2) {
+                keys.push_back(cmd.args[1]);
+            }
+            return true;
+        case CommandType::MGET:
+        case CommandType::PFCOUNT:
+        case CommandType::PFMERGE:
+            keys.insert(keys.end(), cmd.args.begin(), cmd.args.end());
+            return true;
+        case CommandType::BITOP:
+            // The destination and the sources, after the operation
+            keys.insert(keys.end(), cmd.args.begin() + 1, cmd.args.end());
+            return true;
+        case CommandType::BLPOP:
+        case CommandType::BRPOP:
+            // Every argument but the timeout
+            keys.insert(keys.end(), cmd.args.begin(), cmd.args.end() - 1);
+            return true;
+        case CommandType::XREAD: {
+            // The keys are the first half of what follows STREAMS
+            size_t first = cmd.args.size();
+            for (size_t i = 0; i < cmd.args.size(); ++i) {
+                std::string option = cmd.args[i];
+                std::transform(option.begin(), option.end(), option.begin(),
+                               [](unsigned char c) { return std::toupper(c); });
+                if (option == "STREAMS") {
+                    first = i + 1;
+                    break;
+                }
+            }
+            size_t streams = (cmd.args.size() - first) / 2;
+            keys.insert(keys.end(), cmd.args.begin() + first, cmd.args.begin() + first + streams);
+            return true;
+        }
+        case CommandType::MSET:
+        case CommandType::MSETNX:
+            for (size_t i = 0; i < cmd.args.size(); i += 2) {
+                keys.push_back(cmd.args[i]);
+            }
+            return true;
+        default:
+            // Every other command works on the key in its first argument
+            if (!cmd.args.empty()) {
+                keys.push_back(cmd.args[0]);
+            }
+            return true;
+    }
+}
+
+// Whether a command may need more memory, so it is refused, or keys are
+// evicted first, when the store is over maxmemory
+bool command_uses_memory(const Command& cmd) {
+    switch (cmd.type) {
+        case CommandType::SET:
+        case CommandType::MSET:
+        case CommandType::MSETNX:
+        case CommandType::INCR:
+        case CommandType::DECR:
+        case CommandType::INCRBY:
+        case CommandType::SETBIT:
+        case CommandType::BITOP:
+        case CommandType::HSET:
+        case CommandType::HMSET:
+        case CommandType::HINCRBY:
+        case CommandType::HINCRBYFLOAT:
+        case CommandType::LPUSH:
+        case CommandType::RPUSH:
+        case CommandType::SADD:
+        case CommandType::ZADD:
+        case CommandType::ZINCRBY:
+        case CommandType::PFADD:
+        case CommandType::PFMERGE:
+        case CommandType::SPADD:
+        case CommandType::XADD:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Reads "[MATCH pattern] [COUNT count]" from args[first] on; returns an
+// error reply for anything else
+std::string parse_scan_options(const std::vector<std::string>& args, size_t first,
+                               std::string& pattern, size_t& count) {
+    for (size_t i = first; i < args.size(); i += 2) {
+        std::string option = args[i];
+        std::transform(option.begin(), option.end(), option.begin(),
+                       [](unsigned char c) { return std::toupper(c); });
+        if (i + 1 >= args.size() || (option != "MATCH" && option != "COUNT")) {
+            return "ERROR: SCAN options are MATCH pattern and COUNT count\r\n";
+        }
+        if (option == "MATCH") {
+            // "*" matches everything, which an empty pattern does faster
+            pattern = args[i + 1] == "*" ? "" : args[i + 1];
+            continue;
+        }
+        long long value;
+        if (!Storage::parseInteger(args[i + 1], value) || value < 1) {
+            return "ERROR: Invalid COUNT value\r\n";
+        }
+        count = static_cast<size_t>(value);
+    }
+    return "";
+}
+
+// Reads the optional "start end [BYTE|BIT]" of BITCOUNT and "start [end
+// [BYTE|BIT]]" of BITPOS from args[first] on; returns an error reply if
+// they do not parse
+std::string parse_bit_range(const std::vector<std::string>& args, size_t first, bool end_required,
+                            long long& start, long long& end, bool& end_given, bool& bits) {
+    size_t given = args.size() - first;
+    if (given == 0) {
+        return "";
+    }
+    if (given > 3 || (end_required && given == 1)) {
+        return "ERROR: Syntax error\r\n";
+    }
+    if (!Storage::parseInteger(args[first], start) ||
+        (given >= 2 && !Storage::parseInteger(args[first + 1], end))) {
+        return "ERROR: Invalid range values\r\n";
+    }
+    end_given = given >= 2;
+    if (given == 3) {
+        std::string unit = args[first + 2];
+        std::transform(unit.begin(), unit.end(), unit.begin(),
+                       [](unsigned char c) { return std::toupper(c); });
+        if (unit != "BYTE" && unit != "BIT") {
+            return "ERROR: Syntax error\r\n";
+        }
+        bits = unit == "BIT";
+    }
+    return "";
+}
+
+// Reads a coordinate, any 32-bit integer
+bool parse_coordinate(const std::string& arg, int32_t& coordinate) {
+    long long value;
+    if (!Storage::parseInteger(arg, value) || value < INT32_MIN || value > INT32_MAX) {
+        return false;
+    }
+    coordinate = static_cast<int32_t>(value);
+    return true;
+}
+
+// Reads the optional "COUNT count" of SPRADIUS, SPBOX and XRANGE from
+// args[first] on; returns an error reply if it does not parse
+std::string parse_count_option(const std::vector<std::string>& args, size_t first, size_t& count) {
+    if (args.size() == first) {
+        return "";
+    }
+    std::string option = args[first];
+    std::transform(option.begin(), option.end(), option.begin(),
+                   [](unsigned char c) { return std::toupper(c); });
+    if (args.size() != first + 2 || option != "COUNT") {
+        return "ERROR: Syntax error\r\n";
+    }
+    long long value;
+    if (!Storage::parseInteger(args[first + 1], value) || value < 1) {
+        return "ERROR: Invalid COUNT value\r\n";
+    }
+    count = static_cast<size_t>(value);
+    return "";
+}
+
+// Reads an XRANGE bound: "-" and "+" for the lowest and highest IDs, "ms"
+// for the whole millisecond, "ms-seq", and either of the last two after
+// "(" to leave the ID itself out
+bool parse_range_id(const std::string& arg, bool start, StreamID& id) {
+    if (arg == "-" || arg == "+") {
+        id = arg == "-" ? StreamID{0, 0} : StreamID{StreamID::kMax, StreamID::kMax};
+        return true;
+    }
+    bool exclusive = !arg.empty() && arg[0] == '(';
+    if (!StreamID::parse(std::string_view(arg).substr(exclusive ? 1 : 0), start ? 0 : StreamID::kMax, id)) {
+        return false;
+    }
+    if (exclusive) {
+        // Nothing lies beyond the extremes
+        if ((start && id.is_max()) || (!start && id == StreamID())) {
+            return false;
+        }
+        id = start ? id.next() : id.prev();
+    }
+    return true;
+}
+
+// Appends one stream entry as "id: field value field value ..."
+void append_entry(std::string& out, const StreamID& id, const std::vector<std::string_view>& fields_and_values) {
+    out.append(id.to_string()).append(":");
+    for (std::string_view text : fields_and_values) {
+        out.append(" ").append(text);
+    }
+    out.append("\r\n");
+}
+
+// BLPOP and BRPOP reply "key: value" with the element and the list it came
+// from
+std::string popped_reply(const std::string& key, const std::string& value) {
+    return key + ": " + value + "\r\n";
+}
+
+} // namespace
+
+Session::Session(tcp::socket socket, Storage& storage, PubSub& pubsub)
+    : socket_(std::move(socket)), storage_(storage), pubsub_(pubsub),
+      strand_(asio::make_strand(socket_.get_executor())), block_timer_(socket_.get_executor()) {
+}
+
+Session::~Session() {
+    storage_.unwatch(watched_);
+    if (blocked_) {
+        storage_.unblock(blocked_);
+    }
+    // Publishers still delivering to this session finish before these
+    // return; they find it expiring and post nothing
+    for (const auto& channel : channels_) {
+        pubsub_.unsubscribe(this, channel);
+    }
+    for (const auto& pattern : patterns_) {
+        pubsub_.punsubscribe(this, pattern);
+    }
 }
 
 void Session::start() {
@@ -20,37 +262,462 @@ void Session::start() {
 }
 
 void Session::do_read() {
+    // What the client sent while a command was blocked goes first, one read
+    // at a time as it came in
+    if (!blocked_input_.empty()) {
+        std::string command = std::move(blocked_input_.front());
+        blocked_input_.pop_front();
+        blocked_input_bytes_ -= command.size();
+        handle_input(std::move(command));
+        return;
+    }
     auto self(shared_from_this());
     socket_.async_read_some(asio::buffer(data_, 1024),
         asio::bind_executor(strand_,
             [this, self](std::error_code ec, std::size_t length) {
                 if (!ec) {
-                    std::string command(data_.data(), length);
-                    // Remove any trailing newlines or carriage returns
-                    command.erase(std::remove(command.begin(), command.end(), '\n'), command.end());
-                    command.erase(std::remove(command.begin(), command.end(), '\r'), command.end());
-                    
-                    handle_command(command);
-                    do_write();
+                    handle_input(std::string(data_.data(), length));
                 }
             }));
 }
 
+void Session::handle_input(std::string command) {
+    // Remove any trailing newlines or carriage returns
+    command.erase(std::remove(command.begin(), command.end(), '\n'), command.end());
+    command.erase(std::remove(command.begin(), command.end(), '\r'), command.end());
+
+    handle_command(command);
+    // A blocked command replies once it is woken
+    if (!blocked_) {
+        do_write();
+    }
+}
+
 void Session::do_write() {
+    if (writing_) {
+        reply_waiting_ = true;
+        return;
+    }
+    writing_ = true;
+    // One gather write sends the reply text and the stored values between
+    // its pieces, so long values go from the store to the socket uncopied
+    write_buffers_.clear();
+    size_t offset = 0;
+    for (const auto& value : response_values_) {
+        if (value.first > offset) {
+            write_buffers_.push_back(asio::buffer(response_.data() + offset, value.first - offset));
+        }
+        write_buffers_.push_back(asio::buffer(value.second.data(), value.second.size()));
+        offset = value.first;
+    }
+    write_buffers_.push_back(asio::buffer(response_.data() + offset, response_.size() - offset));
+
     auto self(shared_from_this());
-    asio::async_write(socket_, asio::buffer(response_),
+    asio::async_write(socket_, write_buffers_,
         asio::bind_executor(strand_,
             [this, self](std::error_code ec, std::size_t /*length*/) {
+                writing_ = false;
+                std::shared_ptr<Storage::BlockedClient> popped = std::move(sending_popped_);
+                sending_popped_.reset();
+                if (ec && popped) {
+                    // The client never got the element
+                    give_back(*popped);
+                }
                 if (!ec) {
                     response_.clear();
+                    response_values_.clear();
+                    flush_messages();
                     do_read();
                 }
             }));
 }
 
+void Session::deliver(const SharedString& message) {
+    {
+        std::lock_guard<std::mutex> lock(messages_mutex_);
+        if (messages_overflowed_) {
+            return;
+        }
+        if (messages_bytes_ + message.size() > kMaxPendingMessageBytes) {
+            messages_overflowed_ = true;
+            messages_.clear();
+            messages_bytes_ = 0;
+        } else {
+            messages_.push_back(message);
+            messages_bytes_ += message.size();
+        }
+        if (flush_posted_) {
+            return;
+        }
+        flush_posted_ = true;
+    }
+    // The reference moves into the handler, so this thread, which holds
+    // the registry's lock, is never the one to drop the last of them
+    if (auto self = weak_from_this().lock()) {
+        asio::post(strand_, [self = std::move(self)]() { self->flush_messages(); });
+    }
+}
+
+void Session::flush_messages() {
+    bool overflowed;
+    {
+        std::lock_guard<std::mutex> lock(messages_mutex_);
+        flush_posted_ = false;
+        overflowed = messages_overflowed_;
+        if (!overflowed && (writing_ || messages_.empty())) {
+            return;
+        }
+        sending_.swap(messages_);
+        messages_bytes_ = 0;
+    }
+    if (overflowed) {
+        asio::error_code ec;
+        socket_.close(ec);
+        return;
+    }
+
+    // Each message goes out of the buffer every subscriber shares
+    writing_ = true;
+    write_buffers_.clear();
+    for (const SharedString& message : sending_) {
+        write_buffers_.push_back(asio::buffer(message.data(), message.size()));
+    }
+    auto self(shared_from_this());
+    asio::async_write(socket_, write_buffers_,
+        asio::bind_executor(strand_,
+            [this, self](std::error_code ec, std::size_t /*length*/) {
+                writing_ = false;
+                sending_.clear();
+                if (ec) {
+                    return;
+                }
+                if (reply_waiting_) {
+                    reply_waiting_ = false;
+                    do_write();
+                } else {
+                    flush_messages();
+                }
+            }));
+}
+
 void Session::handle_command(const std::string& commandStr) {
     Command cmd = Parser::parse(commandStr);
     
+    if (!channels_.empty() || !patterns_.empty()) {
+        switch (cmd.type) {
+            case CommandType::SUBSCRIBE:
+            case CommandType::UNSUBSCRIBE:
+            case CommandType::PSUBSCRIBE:
+            case CommandType::PUNSUBSCRIBE:
+            case CommandType::PING:
+                break;
+            default:
+                response_ = "ERROR: Only SUBSCRIBE, UNSUBSCRIBE, PSUBSCRIBE, PUNSUBSCRIBE and PING "
+                            "are allowed while subscribed\r\n";
+                return;
+        }
+    }
+    switch (cmd.type) {
+        case CommandType::MULTI:
+        case CommandType::EXEC:
+        case CommandType::DISCARD:
+        case CommandType::WATCH:
+        case CommandType::UNWATCH:
+            execute_transaction_command(cmd);
+            return;
+        default:
+            break;
+    }
+    if (in_multi_) {
+        if (cmd.type == CommandType::UNKNOWN) {
+            multi_failed_ = true;
+            response_ = "ERROR: Unknown command\r\n";
+        } else {
+            queued_.push_back(std::move(cmd));
+            response_ = "QUEUED\r\n";
+        }
+        return;
+    }
+    run_command(cmd);
+}
+
+void Session::run_command(const Command& cmd) {
+    try {
+        execute_command(cmd);
+    } catch (const WrongTypeError& e) {
+        response_values_.clear();
+        response_ = std::string("ERROR: ") + e.what() + "\r\n";
+    } catch (const std::overflow_error& e) {
+        response_values_.clear();
+        response_ = std::string("ERROR: ") + e.what() + "\r\n";
+    } catch (const OutOfMemoryError& e) {
+        response_values_.clear();
+        response_ = std::string("ERROR: ") + e.what() + "\r\n";
+    }
+}
+
+void Session::execute_transaction_command(const Command& cmd) {
+    switch (cmd.type) {
+        case CommandType::MULTI:
+            if (in_multi_) {
+                response_ = "ERROR: MULTI calls can not be nested\r\n";
+            } else {
+                in_multi_ = true;
+                response_ = "OK\r\n";
+            }
+            break;
+            
+        case CommandType::EXEC:
+            if (in_multi_) {
+                exec_transaction();
+            } else {
+                response_ = "ERROR: EXEC without MULTI\r\n";
+            }
+            break;
+            
+        case CommandType::DISCARD:
+            if (in_multi_) {
+                in_multi_ = false;
+                multi_failed_ = false;
+                queued_.clear();
+                storage_.unwatch(watched_);
+                watched_.clear();
+                response_ = "OK\r\n";
+            } else {
+                response_ = "ERROR: DISCARD without MULTI\r\n";
+            }
+            break;
+            
+        case CommandType::WATCH:
+            if (in_multi_) {
+                response_ = "ERROR: WATCH inside MULTI is not allowed\r\n";
+                break;
+            }
+            for (const auto& key : cmd.args) {
+                watched_.push_back(storage_.watch(key));
+            }
+            response_ = "OK\r\n";
+            break;
+            
+        case CommandType::UNWATCH:
+            storage_.unwatch(watched_);
+            watched_.clear();
+            response_ = "OK\r\n";
+            break;
+            
+        default:
+            break;
+    }
+}
+
+void Session::exec_transaction() {
+    std::vector<Command> queued = std::move(queued_);
+    std::vector<Storage::WatchedKey> watched = std::move(watched_);
+    bool failed = multi_failed_;
+    queued_.clear();
+    watched_.clear();
+    in_multi_ = false;
+    multi_failed_ = false;
+    if (failed) {
+        storage_.unwatch(watched);
+        response_ = "ERROR: EXECABORT Transaction discarded because of previous errors\r\n";
+        return;
+    }
+
+    std::vector<std::string> keys;
+    bool all_shards = false;
+    bool writes = false;
+    for (const Command& queued_cmd : queued) {
+        all_shards = !command_keys(queued_cmd, keys) || all_shards;
+        writes = writes || command_uses_memory(queued_cmd);
+    }
+
+    // The replies of the queued commands, one after another, as if they
+    // had been sent one by one
+    std::string replies;
+    std::vector<std::pair<size_t, SharedString>> values;
+    can_block_ = false;
+    bool committed;
+    try {
+        committed = storage_.exec(watched, keys, all_shards, writes, [&]() {
+            for (const Command& queued_cmd : queued) {
+                response_.clear();
+                response_values_.clear();
+                run_command(queued_cmd);
+                for (auto& value : response_values_) {
+                    values.emplace_back(replies.size() + value.first, std::move(value.second));
+                }
+                replies += response_;
+            }
+        });
+    } catch (const OutOfMemoryError& e) {
+        // Over maxmemory with nothing to evict; none of it ran
+        can_block_ = true;
+        response_ = std::string("ERROR: ") + e.what() + "\r\n";
+        return;
+    }
+    can_block_ = true;
+    if (!committed) {
+        // A watched key changed; nothing was run
+        response_ = "(nil)\r\n";
+    } else if (queued.empty()) {
+        response_ = "(empty list)\r\n";
+    } else {
+        response_ = std::move(replies);
+        response_values_ = std::move(values);
+    }
+}
+
+void Session::block_on(const Command& cmd, const std::vector<std::string>& keys, long long timeout_ms,
+                       Storage::BlockedPop pop) {
+    blocked_cmd_ = cmd;
+    // The storage calls this under a shard lock; it only queues the retry
+    std::weak_ptr<Session> weak = shared_from_this();
+    blocked_ = storage_.block(keys, [weak]() {
+        if (auto self = weak.lock()) {
+            asio::post(self->strand_, [self]() { self->resume_blocked(); });
+        }
+    }, pop);
+    if (resuming_) {
+        // Woken without finding anything; the deadline stays
+        return;
+    }
+
+    uint64_t generation = ++block_generation_;
+    auto self(shared_from_this());
+    if (timeout_ms > 0) {
+        block_timer_.expires_after(std::chrono::milliseconds(timeout_ms));
+    } else {
+        block_timer_.expires_at(asio::steady_timer::time_point::max());
+    }
+    block_timer_.async_wait(asio::bind_executor(strand_, [this, self, generation](std::error_code ec) {
+        if (ec || !blocked_ || generation != block_generation_) {
+            return;
+        }
+        auto client = stop_blocking();
+        // A push may have popped for it just before the deadline
+        if (client->popped) {
+            response_ = popped_reply(client->popped_key, client->popped_value);
+            sending_popped_ = std::move(client);
+        } else {
+            response_ = "(nil)\r\n";
+        }
+        do_write();
+    }));
+    watch_while_blocked(generation);
+}
+
+void Session::watch_while_blocked(uint64_t generation) {
+    // A client that hangs up while blocked is let go at once instead of
+    // when a key is written. Data it sends meanwhile is read and kept for
+    // after the reply, so a hangup behind it is still seen.
+    auto self(shared_from_this());
+    socket_.async_wait(tcp::socket::wait_read, asio::bind_executor(strand_,
+        [this, self, generation](std::error_code ec) {
+            if (!blocked_ || generation != block_generation_) {
+                return;
+            }
+            asio::error_code read_ec;
+            if (!ec && socket_.available(read_ec) > 0 && !read_ec) {
+                size_t length = socket_.read_some(asio::buffer(data_, 1024), read_ec);
+                if (!read_ec && blocked_input_bytes_ + length <= kMaxBlockedInputBytes) {
+                    blocked_input_.emplace_back(data_.data(), length);
+                    blocked_input_bytes_ += length;
+                    watch_while_blocked(generation);
+                    return;
+                }
+            }
+            auto client = stop_blocking();
+            socket_.close(read_ec);
+            if (client->popped) {
+                give_back(*client);
+            }
+        }));
+}
+
+void Session::give_back(const Storage::BlockedClient& client) {
+    // It goes back to the end it was popped from, or is lost if that fails
+    std::vector<std::string> value{client.popped_value};
+    try {
+        if (client.pop == Storage::BlockedPop::LEFT) {
+            storage_.lpush(client.popped_key, value);
+        } else {
+            storage_.rpush(client.popped_key, value);
+        }
+    } catch (const WrongTypeError&) {
+    } catch (const OutOfMemoryError&) {
+    }
+}
+
+void Session::resume_blocked() {
+    if (!blocked_) {
+        return;
+    }
+    storage_.unblock(blocked_);
+    std::shared_ptr<Storage::BlockedClient> client = std::move(blocked_);
+    blocked_.reset();
+    if (client->popped) {
+        response_ = popped_reply(client->popped_key, client->popped_value);
+        sending_popped_ = std::move(client);
+    } else {
+        resuming_ = true;
+        run_command(blocked_cmd_);
+        resuming_ = false;
+    }
+    if (!blocked_) {
+        block_timer_.cancel();
+        do_write();
+    }
+}
+
+std::shared_ptr<Storage::BlockedClient> Session::stop_blocking() {
+    storage_.unblock(blocked_);
+    std::shared_ptr<Storage::BlockedClient> client = std::move(blocked_);
+    blocked_.reset();
+    // A command run again by resume_blocked() may park again under the
+    // same deadline; resume_blocked() cancels it if not
+    if (!resuming_) {
+        block_timer_.cancel();
+    }
+    return client;
+}
+
+void Session::execute_subscription_command(const Command& cmd) {
+    bool pattern = cmd.type == CommandType::PSUBSCRIBE || cmd.type == CommandType::PUNSUBSCRIBE;
+    bool subscribe = cmd.type == CommandType::SUBSCRIBE || cmd.type == CommandType::PSUBSCRIBE;
+    std::set<std::string>& subscribed = pattern ? patterns_ : channels_;
+    std::string kind = std::string(pattern ? "p" : "") + (subscribe ? "subscribe" : "unsubscribe");
+
+    // Unsubscribing from nothing in particular drops every subscription of
+    // that kind
+    std::vector<std::string> names = cmd.args;
+    if (names.empty()) {
+        names.assign(subscribed.begin(), subscribed.end());
+    }
+    if (names.empty()) {
+        response_ = kind + " (nil) " + std::to_string(channels_.size() + patterns_.size()) + "\r\n";
+        return;
+    }
+    // One line per name with the number of subscriptions left after it
+    for (const auto& name : names) {
+        if (subscribe && subscribed.insert(name).second) {
+            if (pattern) {
+                pubsub_.psubscribe(this, name);
+            } else {
+                pubsub_.subscribe(this, name);
+            }
+        } else if (!subscribe && subscribed.erase(name)) {
+            if (pattern) {
+                pubsub_.punsubscribe(this, name);
+            } else {
+                pubsub_.unsubscribe(this, name);
+            }
+        }
+        response_ += kind + " " + name + " " + std::to_string(channels_.size() + patterns_.size()) + "\r\n";
+    }
+}
+
+void Session::execute_command(const Command& cmd) {
     switch (cmd.type) {
         case CommandType::PING:
             response_ = "PONG\r\n";
@@ -68,16 +735,54 @@ void Session::handle_command(const std::string& commandStr) {
         case CommandType::GET:
             if (cmd.args.size() >= 1) {
                 std::string value;
-                if (storage_.get(cmd.args[0], value)) {
-                    response_ = value + "\r\n";
-                } else {
+                SharedString shared;
+                if (!storage_.get(cmd.args[0], value, shared)) {
                     response_ = "(nil)\r\n";
+                } else if (shared) {
+                    response_values_.emplace_back(0, std::move(shared));
+                    response_ = "\r\n";
+                } else {
+                    value += "\r\n";
+                    response_ = std::move(value);
                 }
             } else {
                 response_ = "ERROR: GET requires key\r\n";
             }
             break;
             
+        case CommandType::MGET:
+            // One line per key, as GET would reply
+            for (auto& result : storage_.mget(cmd.args)) {
+                if (!result.found) {
+                    response_ += "(nil)\r\n";
+                    continue;
+                }
+                if (result.shared) {
+                    response_values_.emplace_back(response_.size(), std::move(result.shared));
+                } else {
+                    response_ += result.value;
+                }
+                response_ += "\r\n";
+            }
+            break;
+            
+        case CommandType::MSET:
+            if (cmd.args.size() % 2 == 0) {
+                storage_.mset(cmd.args);
+                response_ = "OK\r\n";
+            } else {
+                response_ = "ERROR: MSET requires key value pairs\r\n";
+            }
+            break;
+            
+        case CommandType::MSETNX:
+            if (cmd.args.size() % 2 == 0) {
+                response_ = storage_.msetnx(cmd.args) ? "1\r\n" : "0\r\n";
+            } else {
+                response_ = "ERROR: MSETNX requires key value pairs\r\n";
+            }
+            break;
+            
         case CommandType::INCR:
             if (cmd.args.size() >= 1) {
                 long long value = storage_.incr(cmd.args[0]);
@@ -98,11 +803,11 @@ void Session::handle_command(const std::string& commandStr) {
             
         case CommandType::INCRBY:
             if (cmd.args.size() >= 2) {
-                try {
-                    long long increment = std::stoll(cmd.args[1]);
+                long long increment;
+                if (Storage::parseInteger(cmd.args[1], increment)) {
                     long long value = storage_.incrby(cmd.args[0], increment);
                     response_ = std::to_string(value) + "\r\n";
-                } catch (const std::exception&) {
+                } else {
                     response_ = "ERROR: Invalid increment value\r\n";
                 }
             } else {
@@ -110,6 +815,74 @@ void Session::handle_command(const std::string& commandStr) {
             }
             break;
             
+        case CommandType::SETBIT:
+        case CommandType::GETBIT: {
+            long long offset;
+            if (!Storage::parseInteger(cmd.args[1], offset) || offset < 0 ||
+                static_cast<unsigned long long>(offset) > Storage::kMaxBitOffset) {
+                response_ = "ERROR: bit offset is not an integer or out of range\r\n";
+                break;
+            }
+            if (cmd.type == CommandType::GETBIT) {
+                response_ = std::to_string(storage_.getbit(cmd.args[0], static_cast<uint64_t>(offset))) + "\r\n";
+                break;
+            }
+            if (cmd.args[2] != "0" && cmd.args[2] != "1") {
+                response_ = "ERROR: bit is not an integer or out of range\r\n";
+                break;
+            }
+            int old = storage_.setbit(cmd.args[0], static_cast<uint64_t>(offset), cmd.args[2] == "1");
+            response_ = std::to_string(old) + "\r\n";
+            break;
+        }
+            
+        case CommandType::BITCOUNT:
+        case CommandType::BITPOS: {
+            bool is_count = cmd.type == CommandType::BITCOUNT;
+            if (!is_count && cmd.args[1] != "0" && cmd.args[1] != "1") {
+                response_ = "ERROR: The bit argument must be 1 or 0\r\n";
+                break;
+            }
+            long long start = 0;
+            long long end = -1;
+            bool end_given = false;
+            bool bits = false;
+            std::string error = parse_bit_range(cmd.args, is_count ? 1 : 2, is_count, start, end, end_given, bits);
+            if (!error.empty()) {
+                response_ = error;
+                break;
+            }
+            long long result = is_count ? storage_.bitcount(cmd.args[0], start, end, bits)
+                                        : storage_.bitpos(cmd.args[0], cmd.args[1] == "1", start, end, end_given, bits);
+            response_ = std::to_string(result) + "\r\n";
+            break;
+        }
+            
+        case CommandType::BITOP: {
+            std::string operation = cmd.args[0];
+            std::transform(operation.begin(), operation.end(), operation.begin(),
+                           [](unsigned char c) { return std::toupper(c); });
+            Storage::BitOp op;
+            if (operation == "AND") {
+                op = Storage::BitOp::AND;
+            } else if (operation == "OR") {
+                op = Storage::BitOp::OR;
+            } else if (operation == "XOR") {
+                op = Storage::BitOp::XOR;
+            } else if (operation == "NOT" && cmd.args.size() == 3) {
+                op = Storage::BitOp::NOT;
+            } else if (operation == "NOT") {
+                response_ = "ERROR: BITOP NOT must be called with a single source key\r\n";
+                break;
+            } else {
+                response_ = "ERROR: Syntax error\r\n";
+                break;
+            }
+            std::vector<std::string> sources(cmd.args.begin() + 2, cmd.args.end());
+            response_ = std::to_string(storage_.bitop(op, cmd.args[1], sources)) + "\r\n";
+            break;
+        }
+            
         case CommandType::HSET:
             if (cmd.args.size() >= 3) {
                 storage_.hset(cmd.args[0], cmd.args[1], cmd.args[2]);
@@ -134,21 +907,78 @@ void Session::handle_command(const std::string& commandStr) {
             
         case CommandType::HGETALL:
             if (cmd.args.size() >= 1) {
-                auto fields = storage_.hgetall(cmd.args[0]);
-                if (fields.empty()) {
+                // Written straight into the reply while the hash is locked,
+                // instead of copying it out first
+                storage_.hgetall(cmd.args[0], [this](std::string_view field, std::string_view value) {
+                    response_.append(field).append(": ").append(value).append("\r\n");
+                });
+                if (response_.empty()) {
                     response_ = "(empty hash)\r\n";
-                } else {
-                    std::ostringstream oss;
-                    for (const auto& pair : fields) {
-                        oss << pair.first << ": " << pair.second << "\r\n";
-                    }
-                    response_ = oss.str();
                 }
             } else {
                 response_ = "ERROR: HGETALL requires hash key\r\n";
             }
             break;
             
+        case CommandType::HMGET: {
+            // One line per field, as HGET would reply
+            std::vector<std::string> fields(cmd.args.begin() + 1, cmd.args.end());
+            storage_.hmget(cmd.args[0], fields, [this](bool found, std::string_view value) {
+                if (found) {
+                    response_.append(value).append("\r\n");
+                } else {
+                    response_ += "(nil)\r\n";
+                }
+            });
+            break;
+        }
+            
+        case CommandType::HMSET:
+            if (cmd.args.size() % 2 == 1) {
+                std::vector<std::string> fields_and_values(cmd.args.begin() + 1, cmd.args.end());
+                storage_.hmset(cmd.args[0], fields_and_values);
+                response_ = "OK\r\n";
+            } else {
+                response_ = "ERROR: HMSET requires hash key and field value pairs\r\n";
+            }
+            break;
+            
+        case CommandType::HINCRBY: {
+            long long increment;
+            if (Storage::parseInteger(cmd.args[2], increment)) {
+                long long value = storage_.hincrby(cmd.args[0], cmd.args[1], increment);
+                response_ = std::to_string(value) + "\r\n";
+            } else {
+                response_ = "ERROR: Invalid increment value\r\n";
+            }
+            break;
+        }
+            
+        case CommandType::HINCRBYFLOAT: {
+            long double increment;
+            if (Storage::parseFloat(cmd.args[2], increment)) {
+                response_ = storage_.hincrbyfloat(cmd.args[0], cmd.args[1], increment) + "\r\n";
+            } else {
+                response_ = "ERROR: Invalid increment value\r\n";
+            }
+            break;
+        }
+            
+        case CommandType::HDEL: {
+            std::vector<std::string> fields(cmd.args.begin() + 1, cmd.args.end());
+            long long removed = storage_.hdel(cmd.args[0], fields);
+            response_ = std::to_string(removed) + "\r\n";
+            break;
+        }
+            
+        case CommandType::HLEN:
+            response_ = std::to_string(storage_.hlen(cmd.args[0])) + "\r\n";
+            break;
+            
+        case CommandType::HEXISTS:
+            response_ = storage_.hexists(cmd.args[0], cmd.args[1]) ? "1\r\n" : "0\r\n";
+            break;
+            
         case CommandType::LPUSH:
             if (cmd.args.size() >= 2) {
                 std::vector<std::string> values(cmd.args.begin() + 1, cmd.args.end());
@@ -159,6 +989,29 @@ void Session::handle_command(const std::string& commandStr) {
             }
             break;
             
+        case CommandType::RPUSH:
+            if (cmd.args.size() >= 2) {
+                std::vector<std::string> values(cmd.args.begin() + 1, cmd.args.end());
+                long long new_length = storage_.rpush(cmd.args[0], values);
+                response_ = std::to_string(new_length) + "\r\n";
+            } else {
+                response_ = "ERROR: RPUSH requires list key and at least one value\r\n";
+            }
+            break;
+            
+        case CommandType::LPOP:
+            if (cmd.args.size() >= 1) {
+                std::string value;
+                if (storage_.lpop(cmd.args[0], value)) {
+                    response_ = value + "\r\n";
+                } else {
+                    response_ = "(nil)\r\n";
+                }
+            } else {
+                response_ = "ERROR: LPOP requires list key\r\n";
+            }
+            break;
+            
         case CommandType::RPOP:
             if (cmd.args.size() >= 1) {
                 std::string value;
@@ -172,24 +1025,92 @@ void Session::handle_command(const std::string& commandStr) {
             }
             break;
             
-        case CommandType::LRANGE:
-            if (cmd.args.size() >= 3) {
+        case CommandType::BLPOP:
+        case CommandType::BRPOP: {
+            long double timeout;
+            if (!Storage::parseFloat(cmd.args.back(), timeout) || timeout < 0) {
+                response_ = "ERROR: timeout is not a float or out of range\r\n";
+                break;
+            }
+            if (timeout > 1e12L) {
+                response_ = "ERROR: timeout is out of range\r\n";
+                break;
+            }
+            // Rounded up, so a timeout below a millisecond does not become 0,
+            // which waits for ever
+            long long timeout_ms = static_cast<long long>(std::ceil(timeout * 1000));
+            std::vector<std::string> keys(cmd.args.begin(), cmd.args.end() - 1);
+            bool left = cmd.type == CommandType::BLPOP;
+            auto pop_first = [&]() {
+                std::string value;
+                for (const auto& key : keys) {
+                    if (left ? storage_.lpop(key, value) : storage_.rpop(key, value)) {
+                        response_ = popped_reply(key, value);
+                        return true;
+                    }
+                }
+                return false;
+            };
+            for (;;) {
+                if (pop_first()) {
+                    break;
+                }
+                if (!can_block_) {
+                    response_ = "(nil)\r\n";
+                    break;
+                }
+                block_on(cmd, keys, timeout_ms, left ? Storage::BlockedPop::LEFT : Storage::BlockedPop::RIGHT);
+                // A push between the pops and the registration found nobody
+                // to hand its elements to; take one, unless a later push has
+                // popped for this client already
+                bool missed = false;
                 try {
-                    long long start = std::stoll(cmd.args[1]);
-                    long long end = std::stoll(cmd.args[2]);
-                    auto values = storage_.lrange(cmd.args[0], start, end);
-                    
-                    if (values.empty()) {
-                        response_ = "(empty list)\r\n";
-                    } else {
-                        std::ostringstream oss;
-                        for (size_t i = 0; i < values.size(); ++i) {
-                            oss << i << ") " << values[i] << "\r\n";
-                        }
-                        response_ = oss.str();
+                    for (const auto& key : keys) {
+                        missed = missed || storage_.llen(key) > 0;
                     }
-                } catch (const std::exception&) {
+                } catch (const WrongTypeError&) {
+                    stop_blocking();
+                    throw;
+                }
+                if (!missed) {
+                    break;
+                }
+                auto client = stop_blocking();
+                if (client->popped) {
+                    response_ = popped_reply(client->popped_key, client->popped_value);
+                    break;
+                }
+            }
+            break;
+        }
+            
+        case CommandType::LLEN:
+            if (cmd.args.size() >= 1) {
+                long long length = storage_.llen(cmd.args[0]);
+                response_ = std::to_string(length) + "\r\n";
+            } else {
+                response_ = "ERROR: LLEN requires list key\r\n";
+            }
+            break;
+            
+        case CommandType::LRANGE:
+            if (cmd.args.size() >= 3) {
+                long long start;
+                long long end;
+                if (!Storage::parseInteger(cmd.args[1], start) || !Storage::parseInteger(cmd.args[2], end)) {
                     response_ = "ERROR: Invalid range values\r\n";
+                    break;
+                }
+                auto values = storage_.lrange(cmd.args[0], start, end);
+
+                if (values.empty()) {
+                    response_ = "(empty list)\r\n";
+                } else {
+                    std::ostringstream oss;
+                    for (size_t i = 0; i < values.size(); ++i) {
+                        oss << i << ") " << values[i] << "\r\n";
+                    }
+                    response_ = oss.str();
                 }
             } else {
                 response_ = "ERROR: LRANGE requires list key, start index, and end index\r\n";
@@ -208,15 +1129,11 @@ void Session::handle_command(const std::string& commandStr) {
             
         case CommandType::SMEMBERS:
             if (cmd.args.size() >= 1) {
-                auto members = storage_.smembers(cmd.args[0]);
-                if (members.empty()) {
+                storage_.smembers(cmd.args[0], [this](std::string_view member) {
+                    response_.append(member).append("\r\n");
+                });
+                if (response_.empty()) {
                     response_ = "(empty set)\r\n";
-                } else {
-                    std::ostringstream oss;
-                    for (const auto& pair : members) {
-                        oss << pair.first << "\r\n";
-                    }
-                    response_ = oss.str();
                 }
             } else {
                 response_ = "ERROR: SMEMBERS requires set key\r\n";
@@ -253,16 +1170,12 @@ void Session::handle_command(const std::string& commandStr) {
             
         case CommandType::EXPIRE:
             if (cmd.args.size() >= 2) {
-                try {
-                    long long seconds = std::stoll(cmd.args[1]);
-                    if (storage_.expire(cmd.args[0], seconds)) {
-                        response_ = "1\r\n";
-                    } else {
-                        response_ = "0\r\n";
-                    }
-                } catch (const std::exception&) {
+                long long seconds;
+                if (!Storage::parseInteger(cmd.args[1], seconds)) {
                     response_ = "ERROR: Invalid seconds value\r\n";
+                    break;
                 }
+                response_ = storage_.expire(cmd.args[0], seconds) ? "1\r\n" : "0\r\n";
             } else {
                 response_ = "ERROR: EXPIRE requires key and seconds\r\n";
             }
@@ -277,6 +1190,509 @@ void Session::handle_command(const std::string& commandStr) {
             }
             break;
             
+        case CommandType::PEXPIRE:
+            if (cmd.args.size() >= 2) {
+                long long milliseconds;
+                if (!Storage::parseInteger(cmd.args[1], milliseconds)) {
+                    response_ = "ERROR: Invalid milliseconds value\r\n";
+                    break;
+                }
+                response_ = storage_.pexpire(cmd.args[0], milliseconds) ? "1\r\n" : "0\r\n";
+            } else {
+                response_ = "ERROR: PEXPIRE requires key and milliseconds\r\n";
+            }
+            break;
+            
+        case CommandType::PTTL:
+            if (cmd.args.size() >= 1) {
+                long long remaining = storage_.pttl(cmd.args[0]);
+                response_ = std::to_string(remaining) + "\r\n";
+            } else {
+                response_ = "ERROR: PTTL requires key\r\n";
+            }
+            break;
+            
+        case CommandType::ZADD: {
+            if (cmd.args.size() % 2 == 0) {
+                response_ = "ERROR: ZADD requires sorted set key and score member pairs\r\n";
+                break;
+            }
+            std::vector<std::pair<double, std::string>> members;
+            members.reserve(cmd.args.size() / 2);
+            for (size_t i = 1; i + 1 < cmd.args.size(); i += 2) {
+                double score;
+                if (!Storage::parseScore(cmd.args[i], score)) {
+                    members.clear();
+                    break;
+                }
+                members.emplace_back(score, cmd.args[i + 1]);
+            }
+            if (members.empty()) {
+                response_ = "ERROR: Invalid score value\r\n";
+            } else {
+                response_ = std::to_string(storage_.zadd(cmd.args[0], members)) + "\r\n";
+            }
+            break;
+        }
+            
+        case CommandType::ZINCRBY: {
+            double increment;
+            if (Storage::parseScore(cmd.args[1], increment)) {
+                double score = storage_.zincrby(cmd.args[0], cmd.args[2], increment);
+                response_ = Storage::formatScore(score) + "\r\n";
+            } else {
+                response_ = "ERROR: Invalid increment value\r\n";
+            }
+            break;
+        }
+            
+        case CommandType::ZSCORE: {
+            double score;
+            if (storage_.zscore(cmd.args[0], cmd.args[1], score)) {
+                response_ = Storage::formatScore(score) + "\r\n";
+            } else {
+                response_ = "(nil)\r\n";
+            }
+            break;
+        }
+            
+        case CommandType::ZRANK:
+        case CommandType::ZREVRANK: {
+            long long rank;
+            if (storage_.zrank(cmd.args[0], cmd.args[1], cmd.type == CommandType::ZREVRANK, rank)) {
+                response_ = std::to_string(rank) + "\r\n";
+            } else {
+                response_ = "(nil)\r\n";
+            }
+            break;
+        }
+            
+        case CommandType::ZRANGE:
+        case CommandType::ZREVRANGE: {
+            long long start;
+            long long end;
+            std::string option = cmd.args.size() >= 4 ? cmd.args[3] : "";
+            std::transform(option.begin(), option.end(), option.begin(),
+                           [](unsigned char c) { return std::toupper(c); });
+            if (!Storage::parseInteger(cmd.args[1], start) || !Storage::parseInteger(cmd.args[2], end)) {
+                response_ = "ERROR: Invalid range values\r\n";
+                break;
+            }
+            if (!option.empty() && option != "WITHSCORES") {
+                response_ = "ERROR: Unknown option " + cmd.args[3] + "\r\n";
+                break;
+            }
+            // "i) member", or "i) member: score" with WITHSCORES, numbered
+            // like LRANGE
+            bool with_scores = !option.empty();
+            size_t index = 0;
+            storage_.zrange(cmd.args[0], start, end, cmd.type == CommandType::ZREVRANGE,
+                            [this, with_scores, &index](std::string_view member, double score) {
+                response_.append(std::to_string(index++)).append(") ").append(member);
+                if (with_scores) {
+                    response_.append(": ").append(Storage::formatScore(score));
+                }
+                response_.append("\r\n");
+            });
+            if (response_.empty()) {
+                response_ = "(empty list)\r\n";
+            }
+            break;
+        }
+            
+        case CommandType::ZREM: {
+            std::vector<std::string> members(cmd.args.begin() + 1, cmd.args.end());
+            response_ = std::to_string(storage_.zrem(cmd.args[0], members)) + "\r\n";
+            break;
+        }
+            
+        case CommandType::ZCARD:
+            response_ = std::to_string(storage_.zcard(cmd.args[0])) + "\r\n";
+            break;
+            
+        case CommandType::PFADD: {
+            std::vector<std::string> elements(cmd.args.begin() + 1, cmd.args.end());
+            response_ = storage_.pfadd(cmd.args[0], elements) ? "1\r\n" : "0\r\n";
+            break;
+        }
+            
+        case CommandType::PFCOUNT:
+            response_ = std::to_string(storage_.pfcount(cmd.args)) + "\r\n";
+            break;
+            
+        case CommandType::PFMERGE: {
+            std::vector<std::string> sources(cmd.args.begin() + 1, cmd.args.end());
+            storage_.pfmerge(cmd.args[0], sources);
+            response_ = "OK\r\n";
+            break;
+        }
+            
+        case CommandType::SPADD: {
+            if (cmd.args.size() % 4 != 1) {
+                response_ = "ERROR: SPADD requires spatial key and x y z member groups\r\n";
+                break;
+            }
+            std::vector<std::pair<Storage::Point, std::string>> members;
+            members.reserve(cmd.args.size() / 4);
+            for (size_t i = 1; i + 3 < cmd.args.size(); i += 4) {
+                Storage::Point point;
+                if (!parse_coordinate(cmd.args[i], point.x) || !parse_coordinate(cmd.args[i + 1], point.y) ||
+                    !parse_coordinate(cmd.args[i + 2], point.z)) {
+                    members.clear();
+                    break;
+                }
+                members.emplace_back(point, cmd.args[i + 3]);
+            }
+            if (members.empty()) {
+                response_ = "ERROR: Invalid coordinate value\r\n";
+            } else {
+                response_ = std::to_string(storage_.spadd(cmd.args[0], members)) + "\r\n";
+            }
+            break;
+        }
+            
+        case CommandType::SPREM: {
+            std::vector<std::string> members(cmd.args.begin() + 1, cmd.args.end());
+            response_ = std::to_string(storage_.sprem(cmd.args[0], members)) + "\r\n";
+            break;
+        }
+            
+        case CommandType::SPPOS: {
+            Storage::Point point;
+            if (storage_.sppos(cmd.args[0], cmd.args[1], point)) {
+                response_ = std::to_string(point.x) + " " + std::to_string(point.y) + " " +
+                            std::to_string(point.z) + "\r\n";
+            } else {
+                response_ = "(nil)\r\n";
+            }
+            break;
+        }
+            
+        case CommandType::SPCARD:
+            response_ = std::to_string(storage_.spcard(cmd.args[0])) + "\r\n";
+            break;
+            
+        case CommandType::SPRADIUS:
+        case CommandType::SPBOX: {
+            bool radius_query = cmd.type == CommandType::SPRADIUS;
+            size_t corner_args = radius_query ? 3 : 6;
+            int32_t coordinates[6];
+            bool valid = true;
+            for (size_t i = 0; i < corner_args - (radius_query ? 1 : 0) && valid; ++i) {
+                valid = parse_coordinate(cmd.args[1 + i], coordinates[i]);
+            }
+            if (!valid) {
+                response_ = "ERROR: Invalid coordinate value\r\n";
+                break;
+            }
+            long long radius = 0;
+            if (radius_query && (!Storage::parseInteger(cmd.args[3], radius) || radius < 0 || radius > UINT32_MAX)) {
+                response_ = "ERROR: Invalid radius value\r\n";
+                break;
+            }
+            size_t count = 0;
+            std::string error = parse_count_option(cmd.args, 1 + corner_args, count);
+            if (!error.empty()) {
+                response_ = error;
+                break;
+            }
+            // "i) member: x y z", numbered like ZRANGE, in Z-order of (x, z)
+            // rather than by distance
+            size_t index = 0;
+            auto visit = [this, &index](std::string_view member, const Storage::Point& point) {
+                response_.append(std::to_string(index++)).append(") ").append(member).append(": ");
+                response_.append(std::to_string(point.x)).append(" ").append(std::to_string(point.y));
+                response_.append(" ").append(std::to_string(point.z)).append("\r\n");
+            };
+            if (radius_query) {
+                storage_.spradius(cmd.args[0], coordinates[0], coordinates[1], static_cast<uint32_t>(radius), count,
+                                  visit);
+            } else {
+                // Either pair of opposite corners will do
+                Storage::Point min{std::min(coordinates[0], coordinates[3]), std::min(coordinates[1], coordinates[4]),
+                                   std::min(coordinates[2], coordinates[5])};
+                Storage::Point max{std::max(coordinates[0], coordinates[3]), std::max(coordinates[1], coordinates[4]),
+                                   std::max(coordinates[2], coordinates[5])};
+                storage_.spbox(cmd.args[0], min, max, count, visit);
+            }
+            if (response_.empty()) {
+                response_ = "(empty list)\r\n";
+            }
+            break;
+        }
+            
+        case CommandType::XADD: {
+            // Options come before the ID
+            size_t i = 1;
+            long long maxlen = -1;
+            bool approximate = false;
+            std::string option = cmd.args[i];
+            std::transform(option.begin(), option.end(), option.begin(),
+                           [](unsigned char c) { return std::toupper(c); });
+            if (option == "MAXLEN") {
+                i++;
+                if (i < cmd.args.size() && (cmd.args[i] == "~" || cmd.args[i] == "=")) {
+                    approximate = cmd.args[i] == "~";
+                    i++;
+                }
+                if (i >= cmd.args.size() || !Storage::parseInteger(cmd.args[i], maxlen) || maxlen < 0) {
+                    response_ = "ERROR: Invalid MAXLEN value\r\n";
+                    break;
+                }
+                i++;
+            }
+            if (i + 1 >= cmd.args.size() || (cmd.args.size() - i - 1) % 2 != 0) {
+                response_ = "ERROR: XADD requires stream key, ID and field value pairs\r\n";
+                break;
+            }
+            // "*" for an ID from the clock, "ms-*" for the next sequence
+            const std::string& id_arg = cmd.args[i];
+            StreamID id;
+            bool auto_ms = id_arg == "*";
+            bool auto_seq = id_arg.size() > 2 && id_arg.compare(id_arg.size() - 2, 2, "-*") == 0;
+            if (!auto_ms && !(auto_seq ? StreamID::parse_number(std::string_view(id_arg).substr(0, id_arg.size() - 2), id.ms)
+                                       : StreamID::parse(id_arg, 0, id))) {
+                response_ = "ERROR: Invalid stream ID specified as stream command argument\r\n";
+                break;
+            }
+            if (!auto_ms && !auto_seq && id == StreamID()) {
+                response_ = "ERROR: The ID specified in XADD must be greater than 0-0\r\n";
+                break;
+            }
+            std::vector<std::string> fields(cmd.args.begin() + static_cast<std::ptrdiff_t>(i) + 1, cmd.args.end());
+            if (storage_.xadd(cmd.args[0], id, auto_ms, auto_seq, fields, maxlen, approximate)) {
+                response_ = id.to_string() + "\r\n";
+            } else {
+                response_ = "ERROR: The ID specified in XADD is equal or smaller than the target stream top item\r\n";
+            }
+            break;
+        }
+            
+        case CommandType::XLEN:
+            response_ = std::to_string(storage_.xlen(cmd.args[0])) + "\r\n";
+            break;
+            
+        case CommandType::XRANGE: {
+            StreamID start;
+            StreamID end;
+            if (!parse_range_id(cmd.args[1], true, start) || !parse_range_id(cmd.args[2], false, end)) {
+                response_ = "ERROR: Invalid stream ID specified as stream command argument\r\n";
+                break;
+            }
+            size_t count = 0;
+            std::string error = parse_count_option(cmd.args, 3, count);
+            if (!error.empty()) {
+                response_ = error;
+                break;
+            }
+            storage_.xrange(cmd.args[0], start, end, count,
+                            [this](const StreamID& id, const std::vector<std::string_view>& fields) {
+                append_entry(response_, id, fields);
+            });
+            if (response_.empty()) {
+                response_ = "(empty list)\r\n";
+            }
+            break;
+        }
+            
+        case CommandType::XREAD: {
+            size_t count = 0;
+            long long block_ms = -1;
+            size_t first = cmd.args.size();
+            std::string error;
+            for (size_t i = 0; i < cmd.args.size() && error.empty(); i += 2) {
+                std::string option = cmd.args[i];
+                std::transform(option.begin(), option.end(), option.begin(),
+                               [](unsigned char c) { return std::toupper(c); });
+                if (option == "STREAMS") {
+                    first = i + 1;
+                    break;
+                }
+                long long value;
+                if (i + 1 >= cmd.args.size() || (option != "COUNT" && option != "BLOCK")) {
+                    error = "ERROR: Syntax error\r\n";
+                } else if (!Storage::parseInteger(cmd.args[i + 1], value) || value < (option == "COUNT" ? 1 : 0)) {
+                    error = option == "COUNT" ? "ERROR: Invalid COUNT value\r\n" : "ERROR: Invalid BLOCK timeout\r\n";
+                } else if (option == "COUNT") {
+                    count = static_cast<size_t>(value);
+                } else {
+                    block_ms = value;
+                }
+            }
+            if (error.empty() && (first == cmd.args.size() || (cmd.args.size() - first) % 2 != 0)) {
+                error = "ERROR: Unbalanced XREAD list of streams: for each stream key an ID or '$' must be "
+                        "specified\r\n";
+            }
+            if (!error.empty()) {
+                response_ = error;
+                break;
+            }
+
+            // Entries after each ID; "$" is the stream's last ID now, so
+            // only entries added from here on are read
+            size_t streams = (cmd.args.size() - first) / 2;
+            std::vector<std::string> keys(cmd.args.begin() + static_cast<std::ptrdiff_t>(first),
+                                          cmd.args.begin() + static_cast<std::ptrdiff_t>(first + streams));
+            std::vector<StreamID> after(streams);
+            bool valid = true;
+            for (size_t k = 0; k < streams && valid; ++k) {
+                const std::string& id_arg = cmd.args[first + streams + k];
+                if (id_arg == "$") {
+                    after[k] = storage_.xlastid(keys[k]);
+                } else {
+                    valid = StreamID::parse(id_arg, 0, after[k]);
+                }
+            }
+            if (!valid) {
+                response_ = "ERROR: Invalid stream ID specified as stream command argument\r\n";
+                break;
+            }
+            // "key id: field value ..." per entry, up to COUNT per stream
+            auto read_streams = [&]() {
+                for (size_t k = 0; k < streams; ++k) {
+                    if (after[k].is_max()) {
+                        continue;
+                    }
+                    const std::string& key = keys[k];
+                    storage_.xrange(key, after[k].next(), StreamID{StreamID::kMax, StreamID::kMax}, count,
+                                    [this, &key](const StreamID& id, const std::vector<std::string_view>& fields) {
+                        response_.append(key).append(" ");
+                        append_entry(response_, id, fields);
+                    });
+                }
+            };
+            read_streams();
+            if (!response_.empty()) {
+                break;
+            }
+            if (block_ms < 0 || !can_block_) {
+                response_ = "(nil)\r\n";
+                break;
+            }
+            // Check again once registered, in case an entry came in between
+            Command waiting = cmd;
+            for (size_t k = 0; k < streams; ++k) {
+                waiting.args[first + streams + k] = after[k].to_string();
+            }
+            block_on(waiting, keys, block_ms);
+            read_streams();
+            if (!response_.empty()) {
+                stop_blocking();
+            }
+            break;
+        }
+            
+        case CommandType::SCAN:
+        case CommandType::HSCAN:
+        case CommandType::SSCAN: {
+            // The next cursor on the first line, then one line per key,
+            // "field: value" pair or member; cursor 0 ends the walk
+            size_t cursor_arg = cmd.type == CommandType::SCAN ? 0 : 1;
+            long long cursor;
+            if (!Storage::parseInteger(cmd.args[cursor_arg], cursor) || cursor < 0) {
+                response_ = "ERROR: Invalid cursor\r\n";
+                break;
+            }
+            std::string pattern;
+            size_t count = 10;
+            std::string error = parse_scan_options(cmd.args, cursor_arg + 1, pattern, count);
+            if (!error.empty()) {
+                response_ = error;
+                break;
+            }
+            std::string lines;
+            uint64_t next;
+            if (cmd.type == CommandType::SCAN) {
+                std::vector<std::string> keys;
+                next = storage_.scan(static_cast<uint64_t>(cursor), pattern, count, keys);
+                for (const auto& key : keys) {
+                    lines.append(key).append("\r\n");
+                }
+            } else if (cmd.type == CommandType::HSCAN) {
+                next = storage_.hscan(cmd.args[0], static_cast<uint64_t>(cursor), pattern, count,
+                                      [&lines](std::string_view field, std::string_view value) {
+                    lines.append(field).append(": ").append(value).append("\r\n");
+                });
+            } else {
+                next = storage_.sscan(cmd.args[0], static_cast<uint64_t>(cursor), pattern, count,
+                                      [&lines](std::string_view member) {
+                    lines.append(member).append("\r\n");
+                });
+            }
+            response_ = std::to_string(next) + "\r\n" + lines;
+            break;
+        }
+            
+        case CommandType::INFO: {
+            Storage::ExpiryStats expiry = storage_.getExpiryStats();
+            std::ostringstream oss;
+            oss << "keys: " << storage_.size() << "\r\n";
+            oss << "expired_keys: " << (expiry.expired_lazy + expiry.expired_active) << "\r\n";
+            oss << "expired_keys_lazy: " << expiry.expired_lazy << "\r\n";
+            oss << "expired_keys_active: " << expiry.expired_active << "\r\n";
+            oss << "used_memory: " << storage_.usedMemory() << "\r\n";
+            oss << "maxmemory: " << storage_.getMaxMemory() << "\r\n";
+            oss << "maxmemory_policy: " << eviction_policy_name(storage_.getEvictionPolicy()) << "\r\n";
+            oss << "evicted_keys: " << storage_.getEvictedKeys() << "\r\n";
+            response_ = oss.str();
+            break;
+        }
+            
+        case CommandType::SUBSCRIBE:
+        case CommandType::UNSUBSCRIBE:
+        case CommandType::PSUBSCRIBE:
+        case CommandType::PUNSUBSCRIBE:
+            execute_subscription_command(cmd);
+            break;
+            
+        case CommandType::PUBLISH:
+            if (cmd.args.size() == 2) {
+                response_ = std::to_string(pubsub_.publish(cmd.args[0], cmd.args[1])) + "\r\n";
+            } else {
+                response_ = "ERROR: PUBLISH requires channel and message\r\n";
+            }
+            break;
+            
+        case CommandType::MEMORY: {
+            std::string subcommand = cmd.args[0];
+            std::transform(subcommand.begin(), subcommand.end(), subcommand.begin(),
+                           [](unsigned char c) { return std::toupper(c); });
+            if (subcommand == "USAGE" && cmd.args.size() >= 2) {
+                size_t bytes;
+                if (storage_.memoryUsage(cmd.args[1], bytes)) {
+                    response_ = std::to_string(bytes) + "\r\n";
+                } else {
+                    response_ = "(nil)\r\n";
+                }
+            } else if (subcommand == "STATS") {
+                // Sampled in the background, so this never walks the keyspace
+                MemoryReport report = storage_.getMemoryReport();
+                std::ostringstream oss;
+                oss << "used_memory: " << storage_.usedMemory() << "\r\n";
+                oss << "sampled_keys: " << report.samples << " of " << report.keys << "\r\n";
+                for (const auto& group : report.types) {
+                    oss << "type." << group.name << ": keys=" << group.estimated_keys
+                        << " bytes=" << group.estimated_bytes << "\r\n";
+                }
+                for (const auto& group : report.families) {
+                    oss << "family." << group.name << ": keys=" << group.estimated_keys
+                        << " bytes=" << group.estimated_bytes << "\r\n";
+                }
+                response_ = oss.str();
+            } else if (subcommand == "BIGKEYS") {
+                MemoryReport report = storage_.getMemoryReport();
+                std::ostringstream oss;
+                for (const auto& big : report.biggest) {
+                    oss << big.key << ": type=" << big.type << " bytes=" << big.bytes
+                        << " elements=" << big.elements << "\r\n";
+                }
+                response_ = report.biggest.empty() ? "(no keys sampled yet)\r\n" : oss.str();
+            } else {
+                response_ = "ERROR: MEMORY supports USAGE key, STATS and BIGKEYS\r\n";
+            }
+            break;
+        }
+            
         case CommandType::UNKNOWN:
         default:
             response_ = "ERROR: Unknown command\r\n";
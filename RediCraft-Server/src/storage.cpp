@@ -4,257 +4,1468 @@
  */
 
 #include "../include/storage.h"
+#include "../include/glob.h"
+#include "../include/bitops.h"
 #include <shared_mutex>
 #include <mutex>
 #include <cstdlib>
 #include <stdexcept>
 #include <algorithm>
 #include <chrono>
+#include <thread>
+#include <functional>
+#include <cstdint>
+#include <limits>
+#include <random>
+#include <cctype>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
 
-Storage::Storage() = default;
+namespace {
+
+// Longer timeouts, either way, are clamped so the expiry time point cannot
+// overflow
+const long long kMaxTimeoutMs = 100LL * 365 * 24 * 3600 * 1000;
+
+size_t round_up_to_power_of_two(size_t n) {
+    size_t result = 1;
+    while (result < n) {
+        result <<= 1;
+    }
+    return result;
+}
+
+// Source for eviction sampling and LFU counter increments
+uint64_t next_random() {
+    thread_local std::mt19937_64 rng(std::random_device{}());
+    return rng();
+}
+
+double random_unit() {
+    return static_cast<double>(next_random() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// Clamps an inclusive range with negative positions counting from the end
+// to [0, length); false if nothing is left
+bool clamp_range(long long& start, long long& end, long long length) {
+    if (start < 0) {
+        start = std::max(start + length, 0LL);
+    }
+    if (end < 0) {
+        end += length;
+    }
+    end = std::min(end, length - 1);
+    return length > 0 && start <= end;
+}
+
+// Set bits at bit positions first..last of data, inclusive
+uint64_t count_bits(const unsigned char* data, uint64_t first, uint64_t last) {
+    unsigned char head = static_cast<unsigned char>(0xFF >> (first & 7));
+    unsigned char tail = static_cast<unsigned char>(0xFF << (7 - (last & 7)));
+    uint64_t first_byte = first >> 3;
+    uint64_t last_byte = last >> 3;
+    if (first_byte == last_byte) {
+        unsigned char byte = data[first_byte] & head & tail;
+        return bitops::popcount(&byte, 1);
+    }
+    unsigned char edges[2] = {static_cast<unsigned char>(data[first_byte] & head),
+                              static_cast<unsigned char>(data[last_byte] & tail)};
+    return bitops::popcount(edges, 2) + bitops::popcount(data + first_byte + 1, last_byte - first_byte - 1);
+}
+
+// First bit position from first to last inclusive holding `bit`, or -1
+long long find_bit_in(const unsigned char* data, uint64_t first, uint64_t last, bool bit) {
+    auto bit_at = [data](uint64_t pos) { return ((data[pos >> 3] >> (7 - (pos & 7))) & 1) != 0; };
+    uint64_t pos = first;
+    // A partial first byte bit by bit, then whole bytes, then what is left
+    for (; pos <= last && (pos & 7) != 0; ++pos) {
+        if (bit_at(pos) == bit) {
+            return static_cast<long long>(pos);
+        }
+    }
+    uint64_t whole_end = (last + 1) >> 3;
+    if (pos <= last && whole_end > (pos >> 3)) {
+        long long found = bitops::find_bit(data + (pos >> 3), whole_end - (pos >> 3), bit);
+        if (found >= 0) {
+            return static_cast<long long>(pos) + found;
+        }
+        pos = whole_end << 3;
+    }
+    for (; pos <= last; ++pos) {
+        if (bit_at(pos) == bit) {
+            return static_cast<long long>(pos);
+        }
+    }
+    return -1;
+}
+
+uint32_t clock_seconds() {
+    auto since_epoch = std::chrono::steady_clock::now().time_since_epoch();
+    return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::seconds>(since_epoch).count());
+}
+
+} // namespace
+
+Storage::Value::Value(const std::string& val) {
+    long long integer;
+    if (parseInteger(val, integer)) {
+        data = integer;
+    } else if (val.size() >= kSharedStringBytes) {
+        data = SharedString(val);
+    } else {
+        data = val;
+    }
+}
+
+bool Storage::parseInteger(const std::string& s, long long& result) {
+    return string_to_int64(s, result);
+}
+
+bool Storage::parseFloat(std::string_view s, long double& result) {
+    // strtold skips leading spaces and needs a terminated string
+    if (s.empty() || s.size() > 64 || std::isspace(static_cast<unsigned char>(s[0]))) {
+        return false;
+    }
+    char buffer[65];
+    s.copy(buffer, s.size());
+    buffer[s.size()] = '\0';
+    char* end = nullptr;
+    errno = 0;
+    long double value = std::strtold(buffer, &end);
+    if (end != buffer + s.size() || errno == ERANGE || !std::isfinite(value)) {
+        return false;
+    }
+    result = value;
+    return true;
+}
+
+bool Storage::parseScore(std::string_view s, double& score) {
+    if (s.empty() || s.size() > 64 || std::isspace(static_cast<unsigned char>(s[0]))) {
+        return false;
+    }
+    char buffer[65];
+    s.copy(buffer, s.size());
+    buffer[s.size()] = '\0';
+    char* end = nullptr;
+    errno = 0;
+    double value = std::strtod(buffer, &end);
+    if (end != buffer + s.size() || std::isnan(value) || (errno == ERANGE && !std::isinf(value))) {
+        return false;
+    }
+    score = value;
+    return true;
+}
+
+std::string Storage::formatScore(double score) {
+    char buffer[32];
+    int length = 0;
+    for (int precision = 15; precision <= 17; ++precision) {
+        length = std::snprintf(buffer, sizeof(buffer), "%.*g", precision, score);
+        if (std::isinf(score) || std::strtod(buffer, nullptr) == score) {
+            break;
+        }
+    }
+    return std::string(buffer, static_cast<size_t>(length));
+}
+
+std::string Storage::formatFloat(long double value) {
+    // %g drops trailing zeros; 17 digits round away the noise long double
+    // arithmetic leaves in the last places (1.6 + 5000 is 5001.6)
+    char buffer[64];
+    int length = std::snprintf(buffer, sizeof(buffer), "%.17Lg", value);
+    if (length <= 0 || static_cast<size_t>(length) >= sizeof(buffer) || value == 0) {
+        return "0";
+    }
+    return std::string(buffer, static_cast<size_t>(length));
+}
+
+std::string Storage::stringValue(const Value& value) {
+    if (const long long* integer = std::get_if<long long>(&value.data)) {
+        return std::to_string(*integer);
+    }
+    if (const SharedString* shared = std::get_if<SharedString>(&value.data)) {
+        return std::string(shared->view());
+    }
+    return payload<std::string>(value);
+}
+
+Storage::Storage(size_t shard_count, const EncodingLimits& limits)
+    : shard_count_(round_up_to_power_of_two(shard_count == 0 ? defaultShardCount() : shard_count))
+    , shard_bits_(0)
+    , limits_(limits)
+    , shards_(new Shard[shard_count_])
+    , clock_(clock_seconds()) {
+    while ((size_t(1) << shard_bits_) < shard_count_) {
+        shard_bits_++;
+    }
+}
+
+size_t Storage::defaultShardCount() {
+    // A few shards per io thread keeps the chance of two threads hitting the
+    // same shard low without wasting memory on empty maps
+    unsigned int threads = std::thread::hardware_concurrency();
+    if (threads == 0) {
+        threads = 4;
+    }
+    return std::max<size_t>(16, round_up_to_power_of_two(threads * 4));
+}
+
+size_t Storage::shard_index(const std::string& key) const {
+    if (shard_bits_ == 0) {
+        return 0;
+    }
+    // Fibonacci hashing spreads the top bits so the shard choice does not
+    // correlate with the bucket the map picks from the low bits
+    uint64_t hash = static_cast<uint64_t>(std::hash<std::string>{}(key));
+    return static_cast<size_t>((hash * 0x9E3779B97F4A7C15ULL) >> (64 - shard_bits_));
+}
+
+void Storage::lock_shards(const std::vector<std::string>& keys, size_t exclusive_shard,
+                          std::vector<std::shared_lock<ShardMutex>>& shared_locks,
+                          std::unique_lock<ShardMutex>& exclusive_lock) const {
+    // Index order, as in MSETNX, so two commands sharing shards cannot
+    // deadlock
+    std::vector<size_t> indexes;
+    indexes.reserve(keys.size() + 1);
+    for (const std::string& key : keys) {
+        indexes.push_back(shard_index(key));
+    }
+    if (exclusive_shard < shard_count_) {
+        indexes.push_back(exclusive_shard);
+    }
+    std::sort(indexes.begin(), indexes.end());
+    indexes.erase(std::unique(indexes.begin(), indexes.end()), indexes.end());
+    shared_locks.reserve(indexes.size());
+    for (size_t index : indexes) {
+        if (index == exclusive_shard) {
+            exclusive_lock = std::unique_lock<ShardMutex>(shards_[index].mutex);
+        } else {
+            shared_locks.emplace_back(shards_[index].mutex);
+        }
+    }
+}
+
+std::vector<Storage::BatchKey> Storage::group_by_shard(const std::vector<std::string>& args,
+                                                       size_t stride) const {
+    std::vector<BatchKey> batch;
+    batch.reserve(args.size() / stride);
+    for (size_t i = 0; i + stride <= args.size(); i += stride) {
+        batch.push_back(BatchKey{shard_index(args[i]), i});
+    }
+    if (batch.size() <= kSmallBatch) {
+        // Insertion sort, stable and without allocating
+        for (size_t i = 1; i < batch.size(); ++i) {
+            BatchKey entry = batch[i];
+            size_t j = i;
+            for (; j > 0 && batch[j - 1].shard > entry.shard; --j) {
+                batch[j] = batch[j - 1];
+            }
+            batch[j] = entry;
+        }
+        return batch;
+    }
+    // Counting sort: two passes over the batch, however large it is
+    std::vector<size_t> starts(shard_count_ + 1, 0);
+    for (const BatchKey& entry : batch) {
+        starts[entry.shard + 1]++;
+    }
+    for (size_t shard = 0; shard < shard_count_; ++shard) {
+        starts[shard + 1] += starts[shard];
+    }
+    std::vector<BatchKey> sorted(batch.size());
+    for (const BatchKey& entry : batch) {
+        sorted[starts[entry.shard]++] = entry;
+    }
+    return sorted;
+}
 
 bool Storage::is_expired(const std::chrono::steady_clock::time_point& expiry) const {
     return expiry.time_since_epoch().count() > 0 && 
            std::chrono::steady_clock::now() > expiry;
 }
 
-void Storage::remove_expired(const std::string& key) {
-    // Check string data
-    {
-        std::shared_lock<std::shared_mutex> lock(string_mutex_);
-        auto string_it = string_data_.find(key);
-        if (string_it != string_data_.end() && 
-            string_it->second.has_expiry && 
-            is_expired(string_it->second.expiry)) {
-            string_mutex_.unlock();
-            std::unique_lock<std::shared_mutex> unique_lock(string_mutex_);
-            string_data_.erase(string_it);
+const Storage::Value* Storage::find_live(const Shard& shard, const std::string& key) const {
+    auto it = shard.data.find(key);
+    if (it != shard.data.end() && is_live(it->second)) {
+        touch(it->second);
+        return &it->second;
+    }
+    return nullptr;
+}
+
+Storage::Value* Storage::find_for_write(Shard& shard, const std::string& key) {
+    // Counted as a write even if the command then fails or changes
+    // nothing: a transaction may abort for nothing, never miss a change
+    key_written(shard, key);
+    auto it = shard.data.find(key);
+    if (it == shard.data.end()) {
+        return nullptr;
+    }
+    if (!is_live(it->second)) {
+        erase_key(shard, it);
+        shard.expired_lazy++;
+        return nullptr;
+    }
+    touch(it->second);
+    return &it->second;
+}
+
+void Storage::set_expiry(Shard& shard, const std::string& key, Value& value,
+                         std::chrono::steady_clock::time_point expiry) {
+    value.has_expiry = true;
+    value.expiry = expiry;
+
+    auto& queue = shard.expiry_queue;
+    queue.push_back(ExpiryEntry{expiry, key});
+    std::push_heap(queue.begin(), queue.end());
+
+    // Keys whose TTL keeps being reset leave stale entries behind; rebuild
+    // the heap from the live TTLs once those outnumber the keys
+    if (queue.size() > 2 * shard.data.size() + 64) {
+        queue.clear();
+        for (const auto& pair : shard.data) {
+            if (pair.second.has_expiry) {
+                queue.push_back(ExpiryEntry{pair.second.expiry, pair.first});
+            }
+        }
+        std::make_heap(queue.begin(), queue.end());
+    }
+}
+
+bool Storage::expire_due(Shard& shard, std::chrono::steady_clock::time_point now, size_t max_keys) {
+    auto& queue = shard.expiry_queue;
+    for (size_t checked = 0; checked < max_keys; ++checked) {
+        if (queue.empty() || queue.front().expiry >= now) {
+            return false;
+        }
+        std::pop_heap(queue.begin(), queue.end());
+        ExpiryEntry entry = std::move(queue.back());
+        queue.pop_back();
+
+        auto it = shard.data.find(entry.key);
+        if (it != shard.data.end() && it->second.has_expiry && it->second.expiry == entry.expiry) {
+            erase_key(shard, it);
+            shard.expired_active++;
         }
     }
+    return !queue.empty() && queue.front().expiry < now;
+}
+
+size_t Storage::key_memory(const std::string& key, const Value& value) {
+    // Keys are charged as the copy the map holds, whatever capacity the
+    // caller's string has, so adding and removing a key always balance
+    size_t bytes = string_heap_bytes(key.size());
+    if (const std::string* text = std::get_if<std::string>(&value.data)) {
+        bytes += heap_bytes(*text);
+    } else if (const SharedString* shared = std::get_if<SharedString>(&value.data)) {
+        // Replies still being written can hold the block a little longer
+        // than the key; they are not counted
+        bytes += shared->memory_usage();
+    } else if (const HashFields* fields = std::get_if<HashFields>(&value.data)) {
+        bytes += fields->memory_usage();
+    } else if (const ListValues* list = std::get_if<ListValues>(&value.data)) {
+        bytes += list->memory_usage();
+    } else if (const SetMembers* set = std::get_if<SetMembers>(&value.data)) {
+        bytes += set->memory_usage();
+    } else if (const ZSetMembers* zset = std::get_if<ZSetMembers>(&value.data)) {
+        bytes += zset->memory_usage();
+    } else if (const HyperLogLog* hll = std::get_if<HyperLogLog>(&value.data)) {
+        bytes += hll->memory_usage();
+    } else if (const SpatialIndex* index = std::get_if<SpatialIndex>(&value.data)) {
+        bytes += index->memory_usage();
+    } else if (const Stream* stream = std::get_if<Stream>(&value.data)) {
+        bytes += stream->memory_usage();
+    }
+    return bytes;
+}
+
+void Storage::charge(Shard& shard, size_t before, size_t after, bool publish) {
+    // The map's slots already hold each key and Value object, so only the
+    // tables' own allocations are added on top of the per-key bytes
+    size_t table_memory = heap_block_size(shard.data.allocated_bytes()) +
+                          heap_block_size(shard.expiry_queue.capacity() * sizeof(ExpiryEntry));
+    long long delta = static_cast<long long>(after) - static_cast<long long>(before) +
+                      static_cast<long long>(table_memory) - static_cast<long long>(shard.table_memory);
+    shard.table_memory = table_memory;
+    shard.used_memory += delta;
+    shard.unreported_memory += delta;
+    if (publish || shard.unreported_memory >= kMemoryReportBytes ||
+        shard.unreported_memory <= -kMemoryReportBytes) {
+        used_memory_.fetch_add(shard.unreported_memory, std::memory_order_relaxed);
+        shard.unreported_memory = 0;
+    }
+}
+
+void Storage::erase_key(Shard& shard, Dict<std::string, Value>::iterator it) {
+    key_written(shard, it->first);
+    size_t before = key_memory(it->first, it->second);
+    shard.data.erase(it);
+    charge(shard, before, 0);
+}
+
+void Storage::erase_key(Shard& shard, const std::string& key) {
+    auto it = shard.data.find(key);
+    if (it != shard.data.end()) {
+        erase_key(shard, it);
+    }
+}
+
+void Storage::touch(const Value& value) const {
+    uint32_t clock = clock_.load(std::memory_order_relaxed);
+    uint32_t stamp = value.access.load(std::memory_order_relaxed);
+    uint32_t updated;
+    if (policy_.load(std::memory_order_relaxed) == EvictionPolicy::ALLKEYS_LFU) {
+        uint32_t minutes = clock / 60;
+        updated = lfu::make(minutes, lfu::increment(lfu::decayed_counter(stamp, minutes), random_unit()));
+    } else {
+        updated = clock & lru::kClockMask;
+    }
+    // Hot keys are read far more often than the stamp changes; skipping
+    // the store keeps their cache line clean for the other readers
+    if (updated != stamp) {
+        value.access.store(updated, std::memory_order_relaxed);
+    }
+}
+
+uint32_t Storage::new_stamp() const {
+    uint32_t clock = clock_.load(std::memory_order_relaxed);
+    if (policy_.load(std::memory_order_relaxed) == EvictionPolicy::ALLKEYS_LFU) {
+        return lfu::make(clock / 60, lfu::kInitialCounter);
+    }
+    return clock & lru::kClockMask;
+}
+
+Storage::Value& Storage::create_key(Shard& shard, const std::string& key) {
+    Value& value = shard.data[key];
+    value.access.store(new_stamp(), std::memory_order_relaxed);
+    return value;
+}
+
+size_t Storage::slot_memory() {
+    // One slot and one control byte; empty slots are left to table_memory
+    return sizeof(Dict<std::string, Value>::value_type) + 1;
+}
+
+const char* Storage::type_name(ValueType type) {
+    switch (type) {
+        case ValueType::HASH:
+            return "hash";
+        case ValueType::LIST:
+            return "list";
+        case ValueType::SET:
+            return "set";
+        case ValueType::ZSET:
+            return "zset";
+        case ValueType::HYPERLOGLOG:
+            return "hyperloglog";
+        case ValueType::SPATIAL:
+            return "spatial";
+        case ValueType::STREAM:
+            return "stream";
+        default:
+            return "string";
+    }
+}
+
+size_t Storage::value_elements(const Value& value) {
+    switch (value.type()) {
+        case ValueType::HASH:
+            return payload<HashFields>(value).size();
+        case ValueType::LIST:
+            return payload<ListValues>(value).size();
+        case ValueType::SET:
+            return payload<SetMembers>(value).size();
+        case ValueType::ZSET:
+            return payload<ZSetMembers>(value).size();
+        case ValueType::HYPERLOGLOG:
+            // The estimate, usually cached
+            return static_cast<size_t>(payload<HyperLogLog>(value).count());
+        case ValueType::SPATIAL:
+            return payload<SpatialIndex>(value).size();
+        case ValueType::STREAM:
+            return payload<Stream>(value).size();
+        default:
+            if (const SharedString* shared = std::get_if<SharedString>(&value.data)) {
+                return shared->size();
+            }
+            return stringValue(value).size();
+    }
+}
+
+bool Storage::memoryUsage(const std::string& key, size_t& bytes) const {
+    Shard& shard = shard_for(key);
+    std::shared_lock<ShardMutex> lock(shard.mutex);
+
+    // Not find_live(), which would count as an access
+    auto it = shard.data.find(key);
+    if (it == shard.data.end() || !is_live(it->second)) {
+        return false;
+    }
+    bytes = slot_memory() + key_memory(it->first, it->second);
+    return true;
+}
+
+MemoryReport Storage::getMemoryReport() const {
+    std::lock_guard<std::mutex> lock(report_mutex_);
+    return memory_report_;
+}
+
+void Storage::sample_memory() {
+    for (size_t i = 0; i < shard_count_; ++i) {
+        const Shard& shard = shards_[i];
+        std::shared_lock<ShardMutex> lock(shard.mutex, std::try_to_lock);
+        if (!lock.owns_lock()) {
+            continue;
+        }
+        for (size_t n = 0; n < kSamplesPerLock; ++n) {
+            const auto* entry = shard.data.sample(static_cast<size_t>(next_random()));
+            if (!entry) {
+                break;
+            }
+            const Value& value = entry->second;
+            if (is_live(value)) {
+                sampler_.add(entry->first, type_name(value.type()),
+                             slot_memory() + key_memory(entry->first, value), value_elements(value));
+            }
+        }
+    }
+    if (sampler_.samples() >= kSamplesPerReport) {
+        MemoryReport report = sampler_.finish(size());
+        std::lock_guard<std::mutex> lock(report_mutex_);
+        memory_report_ = std::move(report);
+    }
+}
+
+void Storage::setMaxMemory(size_t max_bytes, EvictionPolicy policy) {
+    policy_.store(policy, std::memory_order_relaxed);
+    max_memory_.store(max_bytes, std::memory_order_relaxed);
+}
+
+size_t Storage::usedMemory() const {
+    long long used = used_memory_.load(std::memory_order_relaxed);
+    return used > 0 ? static_cast<size_t>(used) : 0;
+}
+
+void Storage::reserve_memory() {
+    size_t limit = max_memory_.load(std::memory_order_relaxed);
+    if (limit == 0) {
+        return;
+    }
+    // Like Redis, the check runs before the write, so one large write can
+    // still take memory somewhat past the limit
+    EvictionPolicy policy = policy_.load(std::memory_order_relaxed);
+    if (ShardMutex::exec_shards()) {
+        // exec() made room for the whole transaction before locking; this
+        // thread now holds shard locks, and evicting from other shards
+        // could deadlock with another transaction
+        return;
+    }
+    while (usedMemory() > limit) {
+        if (policy == EvictionPolicy::NOEVICTION || !evict_one(policy)) {
+            throw OutOfMemoryError();
+        }
+    }
+}
+
+bool Storage::evict_one(EvictionPolicy policy) {
+    // Spread evictions over the shards so no single one is drained first
+    size_t start = evict_cursor_.fetch_add(1, std::memory_order_relaxed);
+    for (size_t n = 0; n < shard_count_; ++n) {
+        Shard& shard = shards_[(start + n) & (shard_count_ - 1)];
+        std::unique_lock<ShardMutex> lock(shard.mutex);
+        bool evicted = policy == EvictionPolicy::VOLATILE_TTL ? evict_soonest_expiry(shard)
+                                                               : evict_sampled(shard, policy);
+        if (evicted) {
+            // Publish right away so the caller sees the memory come back
+            charge(shard, 0, 0, true);
+            evicted_keys_.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Storage::evict_sampled(Shard& shard, EvictionPolicy policy) {
+    uint32_t clock = clock_.load(std::memory_order_relaxed);
+    const std::string* victim = nullptr;
+    uint32_t victim_score = 0;
+    for (size_t i = 0; i < kEvictionSamples; ++i) {
+        const auto* entry = shard.data.sample(static_cast<size_t>(next_random()));
+        if (!entry) {
+            break;
+        }
+        uint32_t stamp = entry->second.access.load(std::memory_order_relaxed);
+        uint32_t score;
+        if (!is_live(entry->second)) {
+            score = std::numeric_limits<uint32_t>::max(); // already dead
+        } else if (policy == EvictionPolicy::ALLKEYS_LFU) {
+            score = 255 - lfu::decayed_counter(stamp, clock / 60);
+        } else {
+            score = lru::idle_time(stamp, clock & lru::kClockMask);
+        }
+        if (!victim || score > victim_score) {
+            victim = &entry->first;
+            victim_score = score;
+        }
+    }
+    if (!victim) {
+        return false;
+    }
+    // Copy the key: erasing may move the map's elements
+    std::string key = *victim;
+    erase_key(shard, key);
+    return true;
+}
+
+bool Storage::evict_soonest_expiry(Shard& shard) {
+    // The expiry heap already has the soonest TTL on top, so volatile-ttl
+    // needs no sampling; stale entries are dropped on the way
+    auto& queue = shard.expiry_queue;
+    while (!queue.empty()) {
+        std::pop_heap(queue.begin(), queue.end());
+        ExpiryEntry entry = std::move(queue.back());
+        queue.pop_back();
+
+        auto it = shard.data.find(entry.key);
+        if (it != shard.data.end() && it->second.has_expiry && it->second.expiry == entry.expiry) {
+            erase_key(shard, it);
+            return true;
+        }
+    }
+    return false;
+}
+
+template <typename T>
+T& Storage::payload(Value& value) {
+    T* result = std::get_if<T>(&value.data);
+    if (!result) {
+        throw WrongTypeError();
+    }
+    return *result;
+}
+
+template <typename T>
+const T& Storage::payload(const Value& value) {
+    const T* result = std::get_if<T>(&value.data);
+    if (!result) {
+        throw WrongTypeError();
+    }
+    return *result;
+}
+
+bool Storage::set(const std::string& key, const std::string& value) {
+    reserve_memory();
+    Shard& shard = shard_for(key);
+    std::unique_lock<ShardMutex> lock(shard.mutex);
     
-    // Check hash data
-    {
-        std::shared_lock<std::shared_mutex> lock(hash_mutex_);
-        auto hash_it = hash_data_.find(key);
-        if (hash_it != hash_data_.end() && 
-            hash_it->second.has_expiry && 
-            is_expired(hash_it->second.expiry)) {
-            hash_mutex_.unlock();
-            std::unique_lock<std::shared_mutex> unique_lock(hash_mutex_);
-            hash_data_.erase(hash_it);
+    set_locked(shard, key, value);
+    return true;
+}
+
+void Storage::set_locked(Shard& shard, const std::string& key, const std::string& value) {
+    // SET replaces whatever the key held before, including its expiry
+    key_written(shard, key);
+    auto result = shard.data.try_emplace(key);
+    Value& item = result.first->second;
+    size_t before = result.second ? 0 : key_memory(key, item);
+    item = Value(value);
+    item.access.store(new_stamp(), std::memory_order_relaxed);
+    charge(shard, before, key_memory(key, item));
+}
+
+bool Storage::read_string(const Value& value, std::string& text, SharedString& shared) {
+    if (value.type() != ValueType::STRING) {
+        return false;
+    }
+    if (const SharedString* stored = std::get_if<SharedString>(&value.data)) {
+        shared = *stored;
+    } else {
+        text = stringValue(value);
+    }
+    return true;
+}
+
+bool Storage::get(const std::string& key, std::string& value) {
+    Shard& shard = shard_for(key);
+    std::shared_lock<ShardMutex> lock(shard.mutex);
+    
+    const Value* item = find_live(shard, key);
+    if (item) {
+        value = stringValue(*item);
+        return true;
+    }
+    return false;
+}
+
+bool Storage::get(const std::string& key, std::string& value, SharedString& shared) {
+    Shard& shard = shard_for(key);
+    std::shared_lock<ShardMutex> lock(shard.mutex);
+    
+    const Value* item = find_live(shard, key);
+    if (!item) {
+        return false;
+    }
+    if (!read_string(*item, value, shared)) {
+        throw WrongTypeError();
+    }
+    return true;
+}
+
+std::vector<Storage::StringResult> Storage::mget(const std::vector<std::string>& keys) {
+    std::vector<StringResult> results(keys.size());
+    std::vector<BatchKey> batch = group_by_shard(keys, 1);
+    for (size_t i = 0; i < batch.size();) {
+        Shard& shard = shards_[batch[i].shard];
+        std::shared_lock<ShardMutex> lock(shard.mutex);
+        for (size_t current = batch[i].shard; i < batch.size() && batch[i].shard == current; ++i) {
+            StringResult& result = results[batch[i].index];
+            const Value* item = find_live(shard, keys[batch[i].index]);
+            result.found = item && read_string(*item, result.value, result.shared);
+        }
+    }
+    return results;
+}
+
+void Storage::mset(const std::vector<std::string>& keys_and_values) {
+    reserve_memory();
+    std::vector<BatchKey> batch = group_by_shard(keys_and_values, 2);
+    for (size_t i = 0; i < batch.size();) {
+        Shard& shard = shards_[batch[i].shard];
+        std::unique_lock<ShardMutex> lock(shard.mutex);
+        for (size_t current = batch[i].shard; i < batch.size() && batch[i].shard == current; ++i) {
+            set_locked(shard, keys_and_values[batch[i].index], keys_and_values[batch[i].index + 1]);
+        }
+    }
+}
+
+bool Storage::msetnx(const std::vector<std::string>& keys_and_values) {
+    reserve_memory();
+    std::vector<BatchKey> batch = group_by_shard(keys_and_values, 2);
+    // Shards are locked in index order, so two batches sharing shards
+    // always queue up on the lower one first and cannot deadlock
+    std::vector<std::unique_lock<ShardMutex>> locks;
+    for (size_t i = 0; i < batch.size(); ++i) {
+        if (i == 0 || batch[i].shard != batch[i - 1].shard) {
+            locks.emplace_back(shards_[batch[i].shard].mutex);
+        }
+    }
+    for (const BatchKey& entry : batch) {
+        if (find_for_write(shards_[entry.shard], keys_and_values[entry.index])) {
+            return false;
+        }
+    }
+    for (const BatchKey& entry : batch) {
+        set_locked(shards_[entry.shard], keys_and_values[entry.index], keys_and_values[entry.index + 1]);
+    }
+    return true;
+}
+
+void Storage::key_written(Shard& shard, const std::string& key) {
+    if (shard.snapshot_pending) {
+        keep_for_snapshot(shard, key);
+    }
+    if (shard.watched.empty()) {
+        return;
+    }
+    auto it = shard.watched.find(key);
+    if (it != shard.watched.end()) {
+        it->second.version++;
+    }
+}
+
+void Storage::drop_watch(Shard& shard, const std::string& key) {
+    auto it = shard.watched.find(key);
+    if (it != shard.watched.end() && --it->second.watchers == 0) {
+        shard.watched.erase(it);
+    }
+}
+
+void Storage::wake_blocked(Shard& shard, const std::string& key) {
+    if (shard.blocked.empty()) {
+        return;
+    }
+    auto it = shard.blocked.find(key);
+    if (it == shard.blocked.end()) {
+        return;
+    }
+    // Oldest first. A client waiting on several keys is woken by the first
+    // write only; a blocked pop stays parked once the list runs out, or if
+    // the key is not a list.
+    auto& clients = it->second;
+    size_t parked = 0;
+    for (auto& client : clients) {
+        if (client->pop != BlockedPop::NONE) {
+            Value* item = find_for_write(shard, key);
+            ListValues* list = item ? std::get_if<ListValues>(&item->data) : nullptr;
+            if (!list || list->empty()) {
+                if (!client->woken.load()) {
+                    clients[parked++] = std::move(client);
+                }
+                continue;
+            }
+            if (client->woken.exchange(true)) {
+                continue;
+            }
+            size_t before = key_memory(key, *item);
+            client->popped_value = client->pop == BlockedPop::LEFT ? list->pop_front() : list->pop_back();
+            client->popped_key = key;
+            client->popped = true;
+            charge(shard, before, key_memory(key, *item));
+            if (list->empty()) {
+                erase_key(shard, key);
+            }
+            client->wake();
+            continue;
+        }
+        if (!client->woken.exchange(true)) {
+            client->wake();
+        }
+    }
+    clients.resize(parked);
+    if (clients.empty()) {
+        shard.blocked.erase(it);
+    }
+}
+
+std::shared_ptr<Storage::BlockedClient> Storage::block(const std::vector<std::string>& keys,
+                                                       std::function<void()> wake, BlockedPop pop) {
+    auto client = std::make_shared<BlockedClient>();
+    client->keys = keys;
+    client->wake = std::move(wake);
+    client->pop = pop;
+    for (const std::string& key : keys) {
+        Shard& shard = shard_for(key);
+        std::unique_lock<ShardMutex> lock(shard.mutex);
+        shard.blocked[key].push_back(client);
+    }
+    return client;
+}
+
+void Storage::unblock(const std::shared_ptr<BlockedClient>& client) {
+    client->woken.store(true);
+    for (const std::string& key : client->keys) {
+        Shard& shard = shard_for(key);
+        std::unique_lock<ShardMutex> lock(shard.mutex);
+        auto it = shard.blocked.find(key);
+        if (it == shard.blocked.end()) {
+            continue;
+        }
+        auto& clients = it->second;
+        clients.erase(std::remove(clients.begin(), clients.end(), client), clients.end());
+        if (clients.empty()) {
+            shard.blocked.erase(it);
+        }
+    }
+}
+
+Storage::WatchedKey Storage::watch(const std::string& key) {
+    Shard& shard = shard_for(key);
+    std::unique_lock<ShardMutex> lock(shard.mutex);
+
+    // A key watched by several clients shares one entry, so all of them
+    // see the same version
+    WatchEntry& entry = shard.watched[key];
+    entry.watchers++;
+    return WatchedKey{key, entry.version};
+}
+
+void Storage::unwatch(const std::vector<WatchedKey>& watched) {
+    for (const WatchedKey& item : watched) {
+        Shard& shard = shard_for(item.key);
+        std::unique_lock<ShardMutex> lock(shard.mutex);
+        drop_watch(shard, item.key);
+    }
+}
+
+bool Storage::exec(const std::vector<WatchedKey>& watched, const std::vector<std::string>& keys,
+                   bool all_shards, bool writes, const std::function<void()>& body) {
+    if (writes) {
+        try {
+            reserve_memory();
+        } catch (const OutOfMemoryError&) {
+            unwatch(watched);
+            throw;
         }
     }
+
+    std::vector<size_t> indexes;
+    if (all_shards) {
+        indexes.resize(shard_count_);
+        for (size_t i = 0; i < shard_count_; ++i) {
+            indexes[i] = i;
+        }
+    } else {
+        indexes.reserve(keys.size() + watched.size());
+        for (const std::string& key : keys) {
+            indexes.push_back(shard_index(key));
+        }
+        for (const WatchedKey& item : watched) {
+            indexes.push_back(shard_index(item.key));
+        }
+        std::sort(indexes.begin(), indexes.end());
+        indexes.erase(std::unique(indexes.begin(), indexes.end()), indexes.end());
+    }
+
+    // Index order, as in msetnx(), so transactions sharing shards cannot
+    // deadlock; the shards array makes that address order too
+    std::vector<std::unique_lock<ShardMutex>> locks;
+    std::vector<const ShardMutex*> held;
+    locks.reserve(indexes.size());
+    held.reserve(indexes.size());
+    for (size_t index : indexes) {
+        locks.emplace_back(shards_[index].mutex);
+        held.push_back(&shards_[index].mutex);
+    }
+
+    bool unchanged = true;
+    for (const WatchedKey& item : watched) {
+        Shard& shard = shard_for(item.key);
+        auto it = shard.watched.find(item.key);
+        if (it == shard.watched.end() || it->second.version != item.version) {
+            unchanged = false;
+        }
+        drop_watch(shard, item.key);
+    }
+    if (!unchanged) {
+        return false;
+    }
+
+    struct ExecScope {
+        explicit ExecScope(const std::vector<const ShardMutex*>* shards) { ShardMutex::exec_shards() = shards; }
+        ~ExecScope() { ShardMutex::exec_shards() = nullptr; }
+    } scope(&held);
+    body();
+    return true;
+}
+
+bool Storage::ping() {
+    // Just return true to indicate we're alive
+    return true;
+}
+
+long long Storage::incr(const std::string& key) {
+    return incrby(key, 1);
+}
+
+long long Storage::decr(const std::string& key) {
+    return incrby(key, -1);
+}
+
+long long Storage::incrby(const std::string& key, long long increment) {
+    reserve_memory();
+    Shard& shard = shard_for(key);
+    std::unique_lock<ShardMutex> lock(shard.mutex);
     
-    // Check list data
-    {
-        std::shared_lock<std::shared_mutex> lock(list_mutex_);
-        auto list_it = list_data_.find(key);
-        if (list_it != list_data_.end() && 
-            list_it->second.has_expiry && 
-            is_expired(list_it->second.expiry)) {
-            list_mutex_.unlock();
-            std::unique_lock<std::shared_mutex> unique_lock(list_mutex_);
-            list_data_.erase(list_it);
+    Value* item = find_for_write(shard, key);
+    if (!item) {
+        // Key doesn't exist, create it with the increment value
+        create_key(shard, key).data = increment;
+        charge(shard, 0, string_heap_bytes(key.size()));
+        return increment;
+    }
+
+    long long* current = std::get_if<long long>(&item->data);
+    if (!current) {
+        // Strings that are not integers count as 0
+        if (item->type() != ValueType::STRING) {
+            throw WrongTypeError();
         }
+        size_t before = key_memory(key, *item);
+        item->data = increment;
+        charge(shard, before, key_memory(key, *item));
+        return increment;
     }
+    if ((increment > 0 && *current > std::numeric_limits<long long>::max() - increment) ||
+        (increment < 0 && *current < std::numeric_limits<long long>::min() - increment)) {
+        throw std::overflow_error("increment or decrement would overflow");
+    }
+    *current += increment;
+    return *current;
+}
+
+std::string_view Storage::string_bytes(const Value& value, std::string& scratch) {
+    if (const std::string* text = std::get_if<std::string>(&value.data)) {
+        return *text;
+    }
+    if (const SharedString* shared = std::get_if<SharedString>(&value.data)) {
+        return shared->view();
+    }
+    scratch = stringValue(value);
+    return scratch;
+}
+
+int Storage::setbit(const std::string& key, uint64_t offset, bool bit) {
+    reserve_memory();
+    Shard& shard = shard_for(key);
+    std::unique_lock<ShardMutex> lock(shard.mutex);
     
-    // Check set data
-    {
-        std::shared_lock<std::shared_mutex> lock(set_mutex_);
-        auto set_it = set_data_.find(key);
-        if (set_it != set_data_.end() && 
-            set_it->second.has_expiry && 
-            is_expired(set_it->second.expiry)) {
-            set_mutex_.unlock();
-            std::unique_lock<std::shared_mutex> unique_lock(set_mutex_);
-            set_data_.erase(set_it);
+    Value* item = find_for_write(shard, key);
+    size_t before = 0;
+    if (!item) {
+        item = &create_key(shard, key);
+        item->data = std::string();
+    } else {
+        if (item->type() != ValueType::STRING) {
+            throw WrongTypeError();
+        }
+        before = key_memory(key, *item);
+    }
+
+    // Other encodings are turned into a plain string once; later bits are
+    // set in place
+    if (!std::holds_alternative<std::string>(item->data)) {
+        std::string scratch;
+        std::string_view bytes = string_bytes(*item, scratch);
+        item->data = std::string(bytes);
+    }
+    std::string& bits = std::get<std::string>(item->data);
+    size_t byte = static_cast<size_t>(offset >> 3);
+    if (bits.size() <= byte) {
+        bits.resize(byte + 1, '\0');
+    }
+    unsigned char mask = static_cast<unsigned char>(0x80 >> (offset & 7));
+    unsigned char current = static_cast<unsigned char>(bits[byte]);
+    int old = (current & mask) != 0;
+    bits[byte] = static_cast<char>(bit ? current | mask : current & ~mask);
+
+    // Short strings that now read as an integer are stored as one, as SET
+    // would have
+    long long integer;
+    if (bits.size() <= 20 && parseInteger(bits, integer)) {
+        item->data = integer;
+    }
+    charge(shard, before, key_memory(key, *item));
+    return old;
+}
+
+int Storage::getbit(const std::string& key, uint64_t offset) {
+    Shard& shard = shard_for(key);
+    std::shared_lock<ShardMutex> lock(shard.mutex);
+    
+    const Value* item = find_live(shard, key);
+    if (!item) {
+        return 0;
+    }
+    std::string scratch;
+    std::string_view bytes = string_bytes(*item, scratch);
+    if ((offset >> 3) >= bytes.size()) {
+        return 0;
+    }
+    return (static_cast<unsigned char>(bytes[offset >> 3]) >> (7 - (offset & 7))) & 1;
+}
+
+long long Storage::bitcount(const std::string& key, long long start, long long end, bool bits) {
+    Shard& shard = shard_for(key);
+    std::shared_lock<ShardMutex> lock(shard.mutex);
+    
+    const Value* item = find_live(shard, key);
+    if (!item) {
+        return 0;
+    }
+    std::string scratch;
+    std::string_view bytes = string_bytes(*item, scratch);
+    long long length = static_cast<long long>(bytes.size()) * (bits ? 8 : 1);
+    if (!clamp_range(start, end, length)) {
+        return 0;
+    }
+    if (!bits) {
+        start *= 8;
+        end = end * 8 + 7;
+    }
+    return static_cast<long long>(count_bits(reinterpret_cast<const unsigned char*>(bytes.data()),
+                                             static_cast<uint64_t>(start), static_cast<uint64_t>(end)));
+}
+
+long long Storage::bitpos(const std::string& key, bool bit, long long start, long long end, bool end_given,
+                          bool bits) {
+    Shard& shard = shard_for(key);
+    std::shared_lock<ShardMutex> lock(shard.mutex);
+    
+    const Value* item = find_live(shard, key);
+    if (!item) {
+        return bit ? -1 : 0;
+    }
+    std::string scratch;
+    std::string_view bytes = string_bytes(*item, scratch);
+    long long length = static_cast<long long>(bytes.size()) * (bits ? 8 : 1);
+    if (!clamp_range(start, end, length)) {
+        return -1;
+    }
+    if (!bits) {
+        start *= 8;
+        end = end * 8 + 7;
+    }
+    long long found = find_bit_in(reinterpret_cast<const unsigned char*>(bytes.data()),
+                                  static_cast<uint64_t>(start), static_cast<uint64_t>(end), bit);
+    if (found < 0 && !bit && !end_given) {
+        return end + 1;
+    }
+    return found;
+}
+
+long long Storage::bitop(BitOp op, const std::string& dest, const std::vector<std::string>& sources) {
+    reserve_memory();
+
+    size_t dest_index = shard_index(dest);
+    std::vector<std::shared_lock<ShardMutex>> read_locks;
+    std::unique_lock<ShardMutex> write_lock;
+    lock_shards(sources, dest_index, read_locks, write_lock);
+
+    // The sources are read where they are stored; missing keys are empty
+    std::vector<std::string_view> inputs;
+    std::vector<std::string> scratch(sources.size());
+    inputs.reserve(sources.size());
+    size_t length = 0;
+    for (size_t i = 0; i < sources.size(); ++i) {
+        const Value* item = find_live(shard_for(sources[i]), sources[i]);
+        inputs.push_back(item ? string_bytes(*item, scratch[i]) : std::string_view());
+        length = std::max(length, inputs.back().size());
+    }
+
+    std::string result(length, '\0');
+    unsigned char* out = reinterpret_cast<unsigned char*>(&result[0]);
+    auto data = [](std::string_view input) { return reinterpret_cast<const unsigned char*>(input.data()); };
+    const bitops::Kernels& kernels = bitops::kernels();
+    if (op == BitOp::NOT) {
+        kernels.invert(out, data(inputs[0]), length);
+    } else {
+        std::copy(inputs[0].begin(), inputs[0].end(), result.begin());
+        bitops::Op kernel_op = op == BitOp::AND ? bitops::Op::AND : op == BitOp::OR ? bitops::Op::OR
+                                                                                    : bitops::Op::XOR;
+        for (size_t i = 1; i < inputs.size(); ++i) {
+            kernels.combine(kernel_op, out, data(inputs[i]), inputs[i].size());
+            if (op == BitOp::AND) {
+                // ANDed with the zero padding
+                std::fill(result.begin() + static_cast<std::ptrdiff_t>(inputs[i].size()), result.end(), '\0');
+            }
+        }
+    }
+
+    Shard& shard = shards_[dest_index];
+    if (result.empty()) {
+        erase_key(shard, dest);
+    } else {
+        set_locked(shard, dest, result);
+    }
+    return static_cast<long long>(length);
+}
+
+Storage::Value& Storage::hash_for_write(Shard& shard, const std::string& key, size_t& before) {
+    Value* item = find_for_write(shard, key);
+    if (item) {
+        if (item->type() != ValueType::HASH) {
+            throw WrongTypeError();
+        }
+        before = key_memory(key, *item);
+        return *item;
+    }
+    before = 0;
+    item = &create_key(shard, key);
+    item->data = HashFields();
+    return *item;
+}
+
+bool Storage::hset(const std::string& key, const std::string& field, const std::string& value) {
+    reserve_memory();
+    Shard& shard = shard_for(key);
+    std::unique_lock<ShardMutex> lock(shard.mutex);
+    
+    size_t before;
+    Value& item = hash_for_write(shard, key, before);
+    HashFields& fields = payload<HashFields>(item);
+    if (fields.set(field, value, limits_.hash)) {
+        fields.shrink_to_fit();
+    }
+    charge(shard, before, key_memory(key, item));
+    return true;
+}
+
+long long Storage::hmset(const std::string& key, const std::vector<std::string>& fields_and_values) {
+    reserve_memory();
+    Shard& shard = shard_for(key);
+    std::unique_lock<ShardMutex> lock(shard.mutex);
+    
+    size_t before;
+    Value& item = hash_for_write(shard, key, before);
+    HashFields& fields = payload<HashFields>(item);
+    long long added = 0;
+    for (size_t i = 0; i + 1 < fields_and_values.size(); i += 2) {
+        if (fields.set(fields_and_values[i], fields_and_values[i + 1], limits_.hash)) {
+            added++;
+        }
+    }
+    if (added > 0) {
+        fields.shrink_to_fit();
+    }
+    charge(shard, before, key_memory(key, item));
+    return added;
+}
+
+long long Storage::hincrby(const std::string& key, const std::string& field, long long increment) {
+    reserve_memory();
+    Shard& shard = shard_for(key);
+    std::unique_lock<ShardMutex> lock(shard.mutex);
+    
+    size_t before;
+    Value& item = hash_for_write(shard, key, before);
+    HashFields& fields = payload<HashFields>(item);
+    long long current = 0;
+    std::string_view text;
+    if (fields.find(field, text) && !string_to_int64(text, current)) {
+        current = 0;
+    }
+    if ((increment > 0 && current > std::numeric_limits<long long>::max() - increment) ||
+        (increment < 0 && current < std::numeric_limits<long long>::min() - increment)) {
+        throw std::overflow_error("increment or decrement would overflow");
+    }
+    current += increment;
+    if (fields.set(field, std::to_string(current), limits_.hash)) {
+        fields.shrink_to_fit();
+    }
+    charge(shard, before, key_memory(key, item));
+    return current;
+}
+
+std::string Storage::hincrbyfloat(const std::string& key, const std::string& field, long double increment) {
+    reserve_memory();
+    Shard& shard = shard_for(key);
+    std::unique_lock<ShardMutex> lock(shard.mutex);
+    
+    size_t before;
+    Value& item = hash_for_write(shard, key, before);
+    HashFields& fields = payload<HashFields>(item);
+    long double current = 0;
+    std::string_view text;
+    if (fields.find(field, text) && !parseFloat(text, current)) {
+        current = 0;
+    }
+    current += increment;
+    if (!std::isfinite(current)) {
+        throw std::overflow_error("increment would produce NaN or Infinity");
+    }
+    std::string result = formatFloat(current);
+    if (fields.set(field, result, limits_.hash)) {
+        fields.shrink_to_fit();
+    }
+    charge(shard, before, key_memory(key, item));
+    return result;
+}
+
+long long Storage::hdel(const std::string& key, const std::vector<std::string>& fields) {
+    Shard& shard = shard_for(key);
+    std::unique_lock<ShardMutex> lock(shard.mutex);
+    
+    long long removed = 0;
+    Value* item = find_for_write(shard, key);
+    if (item) {
+        HashFields& hash = payload<HashFields>(*item);
+        size_t before = key_memory(key, *item);
+        for (const auto& field : fields) {
+            if (hash.erase(field)) {
+                removed++;
+            }
+        }
+        charge(shard, before, key_memory(key, *item));
+        
+        // An empty hash is removed entirely
+        if (hash.empty()) {
+            erase_key(shard, key);
         }
     }
+    return removed;
 }
 
-bool Storage::set(const std::string& key, const std::string& value) {
-    std::unique_lock<std::shared_mutex> lock(string_mutex_);
-    remove_expired(key);
+long long Storage::hlen(const std::string& key) {
+    Shard& shard = shard_for(key);
+    std::shared_lock<ShardMutex> lock(shard.mutex);
     
-    DataItem item(value);
-    string_data_[key] = item;
-    return true;
+    const Value* item = find_live(shard, key);
+    if (item) {
+        return static_cast<long long>(payload<HashFields>(*item).size());
+    }
+    return 0;
 }
 
-bool Storage::get(const std::string& key, std::string& value) {
-    std::shared_lock<std::shared_mutex> lock(string_mutex_);
-    remove_expired(key);
+bool Storage::hexists(const std::string& key, const std::string& field) {
+    Shard& shard = shard_for(key);
+    std::shared_lock<ShardMutex> lock(shard.mutex);
     
-    auto it = string_data_.find(key);
-    if (it != string_data_.end()) {
-        value = it->second.value;
-        return true;
+    const Value* item = find_live(shard, key);
+    if (item) {
+        return payload<HashFields>(*item).contains(field);
     }
     return false;
 }
 
-bool Storage::ping() {
-    // Just return true to indicate we're alive
-    return true;
-}
-
-long long Storage::incr(const std::string& key) {
-    std::unique_lock<std::shared_mutex> lock(string_mutex_);
-    remove_expired(key);
+uint64_t Storage::hscan(const std::string& key, uint64_t cursor, const std::string& pattern, size_t count,
+                        const FieldVisitor& visit) {
+    Shard& shard = shard_for(key);
+    std::shared_lock<ShardMutex> lock(shard.mutex);
     
-    auto it = string_data_.find(key);
-    if (it != string_data_.end()) {
-        try {
-            long long value = std::stoll(it->second.value);
-            value++;
-            it->second.value = std::to_string(value);
-            return value;
-        } catch (const std::exception&) {
-            // If the value is not a valid number, treat it as 0
-            DataItem item("1");
-            string_data_[key] = item;
-            return 1;
-        }
-    } else {
-        // Key doesn't exist, create it with value 1
-        DataItem item("1");
-        string_data_[key] = item;
-        return 1;
+    const Value* item = find_live(shard, key);
+    if (!item) {
+        return 0;
     }
+    const HashFields& fields = payload<HashFields>(*item);
+    count = std::max<size_t>(count, 1);
+    size_t steps = count * kScanStepsPerCount;
+    size_t visited = 0;
+    do {
+        cursor = fields.scan(cursor, [&](std::string_view field, std::string_view value) {
+            visited++;
+            if (pattern.empty() || glob_match(pattern, field)) {
+                visit(field, value);
+            }
+        });
+    } while (cursor != 0 && visited < count && --steps > 0);
+    return cursor;
 }
 
-long long Storage::decr(const std::string& key) {
-    std::unique_lock<std::shared_mutex> lock(string_mutex_);
-    remove_expired(key);
+bool Storage::hget(const std::string& key, const std::string& field, std::string& value) {
+    Shard& shard = shard_for(key);
+    std::shared_lock<ShardMutex> lock(shard.mutex);
     
-    auto it = string_data_.find(key);
-    if (it != string_data_.end()) {
-        try {
-            long long value = std::stoll(it->second.value);
-            value--;
-            it->second.value = std::to_string(value);
-            return value;
-        } catch (const std::exception&) {
-            // If the value is not a valid number, treat it as 0
-            DataItem item("-1");
-            string_data_[key] = item;
-            return -1;
-        }
-    } else {
-        // Key doesn't exist, create it with value -1
-        DataItem item("-1");
-        string_data_[key] = item;
-        return -1;
+    const Value* item = find_live(shard, key);
+    if (item) {
+        return payload<HashFields>(*item).get(field, value);
     }
+    return false;
 }
 
-long long Storage::incrby(const std::string& key, long long increment) {
-    std::unique_lock<std::shared_mutex> lock(string_mutex_);
-    remove_expired(key);
+void Storage::hmget(const std::string& key, const std::vector<std::string>& fields, const LookupVisitor& visit) {
+    Shard& shard = shard_for(key);
+    std::shared_lock<ShardMutex> lock(shard.mutex);
     
-    auto it = string_data_.find(key);
-    if (it != string_data_.end()) {
-        try {
-            long long value = std::stoll(it->second.value);
-            value += increment;
-            it->second.value = std::to_string(value);
-            return value;
-        } catch (const std::exception&) {
-            // If the value is not a valid number, treat it as 0
-            long long newValue = increment;
-            DataItem item(std::to_string(newValue));
-            string_data_[key] = item;
-            return newValue;
-        }
-    } else {
-        // Key doesn't exist, create it with the increment value
-        DataItem item(std::to_string(increment));
-        string_data_[key] = item;
-        return increment;
+    const Value* item = find_live(shard, key);
+    const HashFields* hash = item ? &payload<HashFields>(*item) : nullptr;
+    for (const auto& field : fields) {
+        std::string_view value;
+        bool found = hash && hash->find(field, value);
+        visit(found, found ? value : std::string_view());
     }
 }
 
-bool Storage::hset(const std::string& key, const std::string& field, const std::string& value) {
-    std::unique_lock<std::shared_mutex> lock(hash_mutex_);
-    remove_expired(key);
+void Storage::hgetall(const std::string& key, const FieldVisitor& visit) {
+    Shard& shard = shard_for(key);
+    std::shared_lock<ShardMutex> lock(shard.mutex);
     
-    auto it = hash_data_.find(key);
-    if (it != hash_data_.end()) {
-        // Hash exists, update field
-        it->second.fields[field] = value;
-    } else {
-        // Create new hash
-        HashItem item;
-        item.fields[field] = value;
-        hash_data_[key] = item;
+    const Value* item = find_live(shard, key);
+    if (item) {
+        payload<HashFields>(*item).for_each(visit);
     }
-    return true;
 }
 
-bool Storage::hget(const std::string& key, const std::string& field, std::string& value) {
-    std::shared_lock<std::shared_mutex> lock(hash_mutex_);
-    remove_expired(key);
-    
-    auto it = hash_data_.find(key);
-    if (it != hash_data_.end()) {
-        auto field_it = it->second.fields.find(field);
-        if (field_it != it->second.fields.end()) {
-            value = field_it->second;
-            return true;
-        }
+long long Storage::lpush(const std::string& key, const std::vector<std::string>& values) {
+    reserve_memory();
+    Shard& shard = shard_for(key);
+    std::unique_lock<ShardMutex> lock(shard.mutex);
+    
+    Value* item = find_for_write(shard, key);
+    size_t before = item ? key_memory(key, *item) : 0;
+    if (!item) {
+        // Create new list
+        item = &create_key(shard, key);
+        item->data = ListValues();
     }
-    return false;
+    // The values go in as one block at the head, keeping their order
+    ListValues& list = payload<ListValues>(*item);
+    for (auto it = values.rbegin(); it != values.rend(); ++it) {
+        list.push_front(*it);
+    }
+    charge(shard, before, key_memory(key, *item));
+    // The length the push made, before blocked pops take their share
+    long long length = static_cast<long long>(list.size());
+    wake_blocked(shard, key);
+    return length;
 }
 
-std::unordered_map<std::string, std::string> Storage::hgetall(const std::string& key) {
-    std::shared_lock<std::shared_mutex> lock(hash_mutex_);
-    remove_expired(key);
+long long Storage::rpush(const std::string& key, const std::vector<std::string>& values) {
+    reserve_memory();
+    Shard& shard = shard_for(key);
+    std::unique_lock<ShardMutex> lock(shard.mutex);
     
-    auto it = hash_data_.find(key);
-    if (it != hash_data_.end()) {
-        return it->second.fields;
+    Value* item = find_for_write(shard, key);
+    size_t before = item ? key_memory(key, *item) : 0;
+    if (!item) {
+        // Create new list
+        item = &create_key(shard, key);
+        item->data = ListValues();
     }
-    return std::unordered_map<std::string, std::string>();
+    ListValues& list = payload<ListValues>(*item);
+    for (const auto& value : values) {
+        list.push_back(value);
+    }
+    charge(shard, before, key_memory(key, *item));
+    long long length = static_cast<long long>(list.size());
+    wake_blocked(shard, key);
+    return length;
 }
 
-long long Storage::lpush(const std::string& key, const std::vector<std::string>& values) {
-    std::unique_lock<std::shared_mutex> lock(list_mutex_);
-    remove_expired(key);
-    
-    auto it = list_data_.find(key);
-    if (it != list_data_.end()) {
-        // List exists, prepend values
-        it->second.values.insert(it->second.values.begin(), values.begin(), values.end());
-        return static_cast<long long>(it->second.values.size());
-    } else {
-        // Create new list
-        ListItem item;
-        item.values.insert(item.values.begin(), values.begin(), values.end());
-        list_data_[key] = item;
-        return static_cast<long long>(values.size());
+bool Storage::lpop(const std::string& key, std::string& value) {
+    Shard& shard = shard_for(key);
+    std::unique_lock<ShardMutex> lock(shard.mutex);
+    
+    Value* item = find_for_write(shard, key);
+    if (item) {
+        ListValues& list = payload<ListValues>(*item);
+        if (list.empty()) {
+            return false;
+        }
+        size_t before = key_memory(key, *item);
+        value = list.pop_front();
+        charge(shard, before, key_memory(key, *item));
+        
+        // If list is now empty, remove it entirely
+        if (list.empty()) {
+            erase_key(shard, key);
+        }
+        return true;
     }
+    return false;
 }
 
 bool Storage::rpop(const std::string& key, std::string& value) {
-    std::unique_lock<std::shared_mutex> lock(list_mutex_);
-    remove_expired(key);
+    Shard& shard = shard_for(key);
+    std::unique_lock<ShardMutex> lock(shard.mutex);
     
-    auto it = list_data_.find(key);
-    if (it != list_data_.end() && !it->second.values.empty()) {
-        value = it->second.values.back();
-        it->second.values.pop_back();
+    Value* item = find_for_write(shard, key);
+    if (item) {
+        ListValues& list = payload<ListValues>(*item);
+        if (list.empty()) {
+            return false;
+        }
+        size_t before = key_memory(key, *item);
+        value = list.pop_back();
+        charge(shard, before, key_memory(key, *item));
+        
+        // If list is now empty, remove it entirely
+        if (list.empty()) {
+            erase_key(shard, key);
+        }
         return true;
     }
     return false;
 }
 
+long long Storage::llen(const std::string& key) {
+    Shard& shard = shard_for(key);
+    std::shared_lock<ShardMutex> lock(shard.mutex);
+    
+    const Value* item = find_live(shard, key);
+    if (item) {
+        return static_cast<long long>(payload<ListValues>(*item).size());
+    }
+    return 0;
+}
+
 std::vector<std::string> Storage::lrange(const std::string& key, long long start, long long end) {
-    std::shared_lock<std::shared_mutex> lock(list_mutex_);
-    remove_expired(key);
+    Shard& shard = shard_for(key);
+    std::shared_lock<ShardMutex> lock(shard.mutex);
     
-    auto it = list_data_.find(key);
-    if (it != list_data_.end()) {
-        const auto& values = it->second.values;
+    const Value* item = find_live(shard, key);
+    if (item) {
+        const auto& values = payload<ListValues>(*item);
         if (values.empty()) {
             return {};
         }
@@ -274,57 +1485,59 @@ std::vector<std::string> Storage::lrange(const std::string& key, long long start
         }
         
         // Return the range
-        return std::vector<std::string>(values.begin() + start, values.begin() + end + 1);
+        return values.range(static_cast<size_t>(start), static_cast<size_t>(end));
     }
     return {};
 }
 
 long long Storage::sadd(const std::string& key, const std::vector<std::string>& members) {
-    std::unique_lock<std::shared_mutex> lock(set_mutex_);
-    remove_expired(key);
+    reserve_memory();
+    Shard& shard = shard_for(key);
+    std::unique_lock<ShardMutex> lock(shard.mutex);
     
-    long long added = 0;
-    auto it = set_data_.find(key);
-    
-    if (it != set_data_.end()) {
-        // Set exists, add members
-        for (const auto& member : members) {
-            if (it->second.members.find(member) == it->second.members.end()) {
-                it->second.members[member] = true;
-                added++;
-            }
-        }
-    } else {
+    Value* item = find_for_write(shard, key);
+    size_t before = item ? key_memory(key, *item) : 0;
+    if (!item) {
         // Create new set
-        SetItem item;
-        for (const auto& member : members) {
-            item.members[member] = true;
+        item = &create_key(shard, key);
+        item->data = SetMembers();
+    }
+    
+    long long added = 0;
+    SetMembers& set = payload<SetMembers>(*item);
+    for (const auto& member : members) {
+        if (set.insert(member, limits_.set)) {
             added++;
         }
-        set_data_[key] = item;
     }
-    
+    if (added > 0) {
+        set.shrink_to_fit();
+    }
+    charge(shard, before, key_memory(key, *item));
     return added;
 }
 
 long long Storage::srem(const std::string& key, const std::vector<std::string>& members) {
-    std::unique_lock<std::shared_mutex> lock(set_mutex_);
-    remove_expired(key);
+    Shard& shard = shard_for(key);
+    std::unique_lock<ShardMutex> lock(shard.mutex);
     
     long long removed = 0;
-    auto it = set_data_.find(key);
+    Value* item = find_for_write(shard, key);
     
-    if (it != set_data_.end()) {
+    if (item) {
         // Set exists, remove members
+        SetMembers& set = payload<SetMembers>(*item);
+        size_t before = key_memory(key, *item);
         for (const auto& member : members) {
-            if (it->second.members.erase(member)) {
+            if (set.erase(member)) {
                 removed++;
             }
         }
+        charge(shard, before, key_memory(key, *item));
         
         // If set is now empty, remove it entirely
-        if (it->second.members.empty()) {
-            set_data_.erase(it);
+        if (set.empty()) {
+            erase_key(shard, key);
         }
     }
     
@@ -332,164 +1545,671 @@ long long Storage::srem(const std::string& key, const std::vector<std::string>&
 }
 
 bool Storage::sismember(const std::string& key, const std::string& member) {
-    std::shared_lock<std::shared_mutex> lock(set_mutex_);
-    remove_expired(key);
+    Shard& shard = shard_for(key);
+    std::shared_lock<ShardMutex> lock(shard.mutex);
     
-    auto it = set_data_.find(key);
-    if (it != set_data_.end()) {
-        return it->second.members.find(member) != it->second.members.end();
+    const Value* item = find_live(shard, key);
+    if (item) {
+        return payload<SetMembers>(*item).contains(member);
     }
     return false;
 }
 
-std::unordered_map<std::string, bool> Storage::smembers(const std::string& key) {
-    std::shared_lock<std::shared_mutex> lock(set_mutex_);
-    remove_expired(key);
+void Storage::smembers(const std::string& key, const MemberVisitor& visit) {
+    Shard& shard = shard_for(key);
+    std::shared_lock<ShardMutex> lock(shard.mutex);
     
-    auto it = set_data_.find(key);
-    if (it != set_data_.end()) {
-        return it->second.members;
+    const Value* item = find_live(shard, key);
+    if (item) {
+        payload<SetMembers>(*item).for_each(visit);
     }
-    return std::unordered_map<std::string, bool>();
 }
 
 long long Storage::scard(const std::string& key) {
-    std::shared_lock<std::shared_mutex> lock(set_mutex_);
-    remove_expired(key);
+    Shard& shard = shard_for(key);
+    std::shared_lock<ShardMutex> lock(shard.mutex);
     
-    auto it = set_data_.find(key);
-    if (it != set_data_.end()) {
-        return static_cast<long long>(it->second.members.size());
+    const Value* item = find_live(shard, key);
+    if (item) {
+        return static_cast<long long>(payload<SetMembers>(*item).size());
     }
     return 0;
 }
 
-bool Storage::expire(const std::string& key, long long seconds) {
-    auto expiry_time = std::chrono::steady_clock::now() + std::chrono::seconds(seconds);
+uint64_t Storage::sscan(const std::string& key, uint64_t cursor, const std::string& pattern, size_t count,
+                        const MemberVisitor& visit) {
+    Shard& shard = shard_for(key);
+    std::shared_lock<ShardMutex> lock(shard.mutex);
     
-    // Check each data type
-    {
-        std::unique_lock<std::shared_mutex> lock(string_mutex_);
-        auto it = string_data_.find(key);
-        if (it != string_data_.end()) {
-            it->second.has_expiry = true;
-            it->second.expiry = expiry_time;
-            return true;
+    const Value* item = find_live(shard, key);
+    if (!item) {
+        return 0;
+    }
+    const SetMembers& members = payload<SetMembers>(*item);
+    count = std::max<size_t>(count, 1);
+    size_t steps = count * kScanStepsPerCount;
+    size_t visited = 0;
+    do {
+        cursor = members.scan(cursor, [&](std::string_view member) {
+            visited++;
+            if (pattern.empty() || glob_match(pattern, member)) {
+                visit(member);
+            }
+        });
+    } while (cursor != 0 && visited < count && --steps > 0);
+    return cursor;
+}
+
+long long Storage::zadd(const std::string& key, const std::vector<std::pair<double, std::string>>& members) {
+    reserve_memory();
+    Shard& shard = shard_for(key);
+    std::unique_lock<ShardMutex> lock(shard.mutex);
+    
+    Value* item = find_for_write(shard, key);
+    size_t before = item ? key_memory(key, *item) : 0;
+    if (!item) {
+        item = &create_key(shard, key);
+        item->data = ZSetMembers();
+    }
+    ZSetMembers& zset = payload<ZSetMembers>(*item);
+    long long added = 0;
+    for (const auto& member : members) {
+        if (zset.add(member.second, member.first, limits_.zset)) {
+            added++;
         }
     }
+    zset.shrink_to_fit();
+    charge(shard, before, key_memory(key, *item));
+    return added;
+}
+
+double Storage::zincrby(const std::string& key, const std::string& member, double increment) {
+    reserve_memory();
+    Shard& shard = shard_for(key);
+    std::unique_lock<ShardMutex> lock(shard.mutex);
     
-    {
-        std::unique_lock<std::shared_mutex> lock(hash_mutex_);
-        auto it = hash_data_.find(key);
-        if (it != hash_data_.end()) {
-            it->second.has_expiry = true;
-            it->second.expiry = expiry_time;
-            return true;
+    Value* item = find_for_write(shard, key);
+    double score = 0;
+    if (item) {
+        payload<ZSetMembers>(*item).score(member, score);
+    }
+    score += increment;
+    // inf + -inf
+    if (std::isnan(score)) {
+        throw std::overflow_error("resulting score is not a number (NaN)");
+    }
+    size_t before = item ? key_memory(key, *item) : 0;
+    if (!item) {
+        item = &create_key(shard, key);
+        item->data = ZSetMembers();
+    }
+    ZSetMembers& zset = payload<ZSetMembers>(*item);
+    zset.add(member, score, limits_.zset);
+    zset.shrink_to_fit();
+    charge(shard, before, key_memory(key, *item));
+    return score;
+}
+
+bool Storage::zscore(const std::string& key, const std::string& member, double& score) {
+    Shard& shard = shard_for(key);
+    std::shared_lock<ShardMutex> lock(shard.mutex);
+    
+    const Value* item = find_live(shard, key);
+    if (item) {
+        return payload<ZSetMembers>(*item).score(member, score);
+    }
+    return false;
+}
+
+bool Storage::zrank(const std::string& key, const std::string& member, bool reverse, long long& rank) {
+    Shard& shard = shard_for(key);
+    std::shared_lock<ShardMutex> lock(shard.mutex);
+    
+    const Value* item = find_live(shard, key);
+    if (item) {
+        rank = payload<ZSetMembers>(*item).rank(member, reverse);
+        return rank >= 0;
+    }
+    return false;
+}
+
+void Storage::zrange(const std::string& key, long long start, long long end, bool reverse,
+                     const ScoreVisitor& visit) {
+    Shard& shard = shard_for(key);
+    std::shared_lock<ShardMutex> lock(shard.mutex);
+    
+    const Value* item = find_live(shard, key);
+    if (!item) {
+        return;
+    }
+    const ZSetMembers& zset = payload<ZSetMembers>(*item);
+    long long size = static_cast<long long>(zset.size());
+    if (start < 0) start = std::max(0LL, size + start);
+    if (end < 0) end = size + end;
+    end = std::min(end, size - 1);
+    if (start > end || start >= size) {
+        return;
+    }
+    zset.for_range(static_cast<size_t>(start), static_cast<size_t>(end), reverse, visit);
+}
+
+long long Storage::zrem(const std::string& key, const std::vector<std::string>& members) {
+    Shard& shard = shard_for(key);
+    std::unique_lock<ShardMutex> lock(shard.mutex);
+    
+    long long removed = 0;
+    Value* item = find_for_write(shard, key);
+    if (item) {
+        ZSetMembers& zset = payload<ZSetMembers>(*item);
+        size_t before = key_memory(key, *item);
+        for (const auto& member : members) {
+            if (zset.erase(member)) {
+                removed++;
+            }
+        }
+        charge(shard, before, key_memory(key, *item));
+        
+        // An empty sorted set is removed entirely
+        if (zset.empty()) {
+            erase_key(shard, key);
         }
     }
+    return removed;
+}
+
+long long Storage::zcard(const std::string& key) {
+    Shard& shard = shard_for(key);
+    std::shared_lock<ShardMutex> lock(shard.mutex);
     
-    {
-        std::unique_lock<std::shared_mutex> lock(list_mutex_);
-        auto it = list_data_.find(key);
-        if (it != list_data_.end()) {
-            it->second.has_expiry = true;
-            it->second.expiry = expiry_time;
-            return true;
+    const Value* item = find_live(shard, key);
+    if (item) {
+        return static_cast<long long>(payload<ZSetMembers>(*item).size());
+    }
+    return 0;
+}
+
+bool Storage::pfadd(const std::string& key, const std::vector<std::string>& elements) {
+    reserve_memory();
+    Shard& shard = shard_for(key);
+    std::unique_lock<ShardMutex> lock(shard.mutex);
+    
+    Value* item = find_for_write(shard, key);
+    size_t before = item ? key_memory(key, *item) : 0;
+    bool changed = !item;
+    if (!item) {
+        item = &create_key(shard, key);
+        item->data = HyperLogLog();
+    }
+    HyperLogLog& hll = payload<HyperLogLog>(*item);
+    for (const auto& element : elements) {
+        if (hll.add(element, limits_.hll)) {
+            changed = true;
+        }
+    }
+    charge(shard, before, key_memory(key, *item));
+    return changed;
+}
+
+uint64_t Storage::pfcount(const std::vector<std::string>& keys) {
+    if (keys.size() == 1) {
+        Shard& shard = shard_for(keys[0]);
+        std::shared_lock<ShardMutex> lock(shard.mutex);
+
+        const Value* item = find_live(shard, keys[0]);
+        return item ? payload<HyperLogLog>(*item).count() : 0;
+    }
+
+    std::vector<std::shared_lock<ShardMutex>> read_locks;
+    std::unique_lock<ShardMutex> no_write_lock;
+    lock_shards(keys, shard_count_, read_locks, no_write_lock);
+    std::vector<unsigned char> registers(HyperLogLog::kRegisters, 0);
+    for (const std::string& key : keys) {
+        const Value* item = find_live(shard_for(key), key);
+        if (item) {
+            payload<HyperLogLog>(*item).max_into(registers.data());
+        }
+    }
+    return HyperLogLog::estimate(registers.data());
+}
+
+void Storage::pfmerge(const std::string& dest, const std::vector<std::string>& sources) {
+    reserve_memory();
+    size_t dest_index = shard_index(dest);
+    std::vector<std::shared_lock<ShardMutex>> read_locks;
+    std::unique_lock<ShardMutex> write_lock;
+    lock_shards(sources, dest_index, read_locks, write_lock);
+
+    // The registers of the union are the highest of each register
+    Shard& shard = shards_[dest_index];
+    std::vector<unsigned char> registers(HyperLogLog::kRegisters, 0);
+    const Value* existing = find_live(shard, dest);
+    if (existing) {
+        payload<HyperLogLog>(*existing).max_into(registers.data());
+    }
+    for (const std::string& source : sources) {
+        const Value* item = find_live(shard_for(source), source);
+        if (item) {
+            payload<HyperLogLog>(*item).max_into(registers.data());
+        }
+    }
+
+    Value* item = find_for_write(shard, dest);
+    size_t before = item ? key_memory(dest, *item) : 0;
+    if (!item) {
+        item = &create_key(shard, dest);
+        item->data = HyperLogLog();
+    }
+    payload<HyperLogLog>(*item).assign(registers.data(), limits_.hll);
+    charge(shard, before, key_memory(dest, *item));
+}
+
+void Storage::pfrestore(const std::string& key, const unsigned char* registers) {
+    reserve_memory();
+    Shard& shard = shard_for(key);
+    std::unique_lock<ShardMutex> lock(shard.mutex);
+
+    key_written(shard, key);
+    auto result = shard.data.try_emplace(key);
+    Value& item = result.first->second;
+    size_t before = result.second ? 0 : key_memory(key, item);
+    HyperLogLog hll;
+    hll.assign(registers, limits_.hll);
+    item = Value();
+    item.data = std::move(hll);
+    item.access.store(new_stamp(), std::memory_order_relaxed);
+    charge(shard, before, key_memory(key, item));
+}
+
+long long Storage::spadd(const std::string& key, const std::vector<std::pair<Point, std::string>>& members) {
+    reserve_memory();
+    Shard& shard = shard_for(key);
+    std::unique_lock<ShardMutex> lock(shard.mutex);
+    
+    Value* item = find_for_write(shard, key);
+    size_t before = item ? key_memory(key, *item) : 0;
+    if (!item) {
+        item = &create_key(shard, key);
+        item->data = SpatialIndex();
+    }
+    SpatialIndex& index = payload<SpatialIndex>(*item);
+    long long added = 0;
+    for (const auto& member : members) {
+        if (index.add(member.second, member.first)) {
+            added++;
         }
     }
+    charge(shard, before, key_memory(key, *item));
+    return added;
+}
+
+long long Storage::sprem(const std::string& key, const std::vector<std::string>& members) {
+    Shard& shard = shard_for(key);
+    std::unique_lock<ShardMutex> lock(shard.mutex);
     
-    {
-        std::unique_lock<std::shared_mutex> lock(set_mutex_);
-        auto it = set_data_.find(key);
-        if (it != set_data_.end()) {
-            it->second.has_expiry = true;
-            it->second.expiry = expiry_time;
-            return true;
+    long long removed = 0;
+    Value* item = find_for_write(shard, key);
+    if (item) {
+        SpatialIndex& index = payload<SpatialIndex>(*item);
+        size_t before = key_memory(key, *item);
+        for (const auto& member : members) {
+            if (index.erase(member)) {
+                removed++;
+            }
+        }
+        charge(shard, before, key_memory(key, *item));
+        
+        if (index.empty()) {
+            erase_key(shard, key);
         }
     }
+    return removed;
+}
+
+bool Storage::sppos(const std::string& key, const std::string& member, Point& point) {
+    Shard& shard = shard_for(key);
+    std::shared_lock<ShardMutex> lock(shard.mutex);
     
+    const Value* item = find_live(shard, key);
+    if (item) {
+        return payload<SpatialIndex>(*item).position(member, point);
+    }
     return false;
 }
 
+long long Storage::spcard(const std::string& key) {
+    Shard& shard = shard_for(key);
+    std::shared_lock<ShardMutex> lock(shard.mutex);
+    
+    const Value* item = find_live(shard, key);
+    if (item) {
+        return static_cast<long long>(payload<SpatialIndex>(*item).size());
+    }
+    return 0;
+}
+
+void Storage::spradius(const std::string& key, int32_t x, int32_t z, uint32_t radius, size_t count,
+                       const PointVisitor& visit) {
+    Shard& shard = shard_for(key);
+    std::shared_lock<ShardMutex> lock(shard.mutex);
+    
+    const Value* item = find_live(shard, key);
+    if (!item) {
+        return;
+    }
+    size_t visited = 0;
+    payload<SpatialIndex>(*item).for_each_in_radius(x, z, radius, [&](std::string_view member, const Point& point) {
+        visit(member, point);
+        return count == 0 || ++visited < count;
+    });
+}
+
+void Storage::spbox(const std::string& key, const Point& min, const Point& max, size_t count,
+                    const PointVisitor& visit) {
+    Shard& shard = shard_for(key);
+    std::shared_lock<ShardMutex> lock(shard.mutex);
+    
+    const Value* item = find_live(shard, key);
+    if (!item) {
+        return;
+    }
+    size_t visited = 0;
+    payload<SpatialIndex>(*item).for_each_in_box(min, max, [&](std::string_view member, const Point& point) {
+        visit(member, point);
+        return count == 0 || ++visited < count;
+    });
+}
+
+bool Storage::xadd(const std::string& key, StreamID& id, bool auto_ms, bool auto_seq,
+                   const std::vector<std::string>& fields_and_values, long long maxlen, bool approximate) {
+    reserve_memory();
+    Shard& shard = shard_for(key);
+    std::unique_lock<ShardMutex> lock(shard.mutex);
+    
+    Value* item = find_for_write(shard, key);
+    StreamID last = item ? payload<Stream>(*item).last_id() : StreamID();
+    if (auto_ms) {
+        uint64_t now = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count());
+        // The clock may step back; IDs never do
+        id = now > last.ms ? StreamID{now, 0} : last.next();
+    } else if (auto_seq) {
+        id.seq = id.ms == last.ms ? last.seq + 1 : 0;
+        if (id.ms == last.ms && last.seq == StreamID::kMax) {
+            return false;
+        }
+    }
+    if (id <= last) {
+        return false;
+    }
+
+    size_t before = item ? key_memory(key, *item) : 0;
+    if (!item) {
+        item = &create_key(shard, key);
+        item->data = Stream();
+    }
+    Stream& stream = payload<Stream>(*item);
+    stream.append(id, fields_and_values);
+    if (maxlen >= 0) {
+        stream.trim(static_cast<size_t>(maxlen), approximate);
+    }
+    charge(shard, before, key_memory(key, *item));
+    wake_blocked(shard, key);
+    return true;
+}
+
+long long Storage::xlen(const std::string& key) {
+    Shard& shard = shard_for(key);
+    std::shared_lock<ShardMutex> lock(shard.mutex);
+    
+    const Value* item = find_live(shard, key);
+    if (item) {
+        return static_cast<long long>(payload<Stream>(*item).size());
+    }
+    return 0;
+}
+
+void Storage::xrange(const std::string& key, const StreamID& start, const StreamID& end, size_t count,
+                     const EntryVisitor& visit) {
+    Shard& shard = shard_for(key);
+    std::shared_lock<ShardMutex> lock(shard.mutex);
+    
+    const Value* item = find_live(shard, key);
+    if (item) {
+        payload<Stream>(*item).for_range(start, end, count, visit);
+    }
+}
+
+StreamID Storage::xlastid(const std::string& key) {
+    Shard& shard = shard_for(key);
+    std::shared_lock<ShardMutex> lock(shard.mutex);
+    
+    const Value* item = find_live(shard, key);
+    return item ? payload<Stream>(*item).last_id() : StreamID();
+}
+
+bool Storage::expire(const std::string& key, long long seconds) {
+    return pexpire(key, std::clamp(seconds, -kMaxTimeoutMs / 1000, kMaxTimeoutMs / 1000) * 1000);
+}
+
+bool Storage::pexpire(const std::string& key, long long milliseconds) {
+    milliseconds = std::clamp(milliseconds, -kMaxTimeoutMs, kMaxTimeoutMs);
+    auto expiry_time = std::chrono::steady_clock::now() + std::chrono::milliseconds(milliseconds);
+    Shard& shard = shard_for(key);
+    std::unique_lock<ShardMutex> lock(shard.mutex);
+    
+    Value* item = find_for_write(shard, key);
+    if (!item) {
+        return false;
+    }
+    if (milliseconds <= 0) {
+        erase_key(shard, key);
+        return true;
+    }
+    set_expiry(shard, key, *item, expiry_time);
+    // Only the expiry heap can have grown
+    charge(shard, 0, 0);
+    return true;
+}
+
 long long Storage::ttl(const std::string& key) {
+    long long remaining = pttl(key);
+    return remaining < 0 ? remaining : remaining / 1000;
+}
+
+long long Storage::pttl(const std::string& key) {
     auto now = std::chrono::steady_clock::now();
+    Shard& shard = shard_for(key);
+    std::shared_lock<ShardMutex> lock(shard.mutex);
     
-    // Check each data type
-    {
-        std::shared_lock<std::shared_mutex> lock(string_mutex_);
-        auto it = string_data_.find(key);
-        if (it != string_data_.end()) {
-            if (!it->second.has_expiry) {
-                return -1; // No expiry set
-            }
-            if (is_expired(it->second.expiry)) {
-                string_mutex_.unlock();
-                std::unique_lock<std::shared_mutex> unique_lock(string_mutex_);
-                string_data_.erase(it);
-                return -2; // Key expired
-            }
-            auto remaining = std::chrono::duration_cast<std::chrono::seconds>(
-                it->second.expiry - now).count();
-            return remaining;
+    const Value* item = find_live(shard, key);
+    if (!item) {
+        return -2; // Key doesn't exist (or has expired)
+    }
+    if (!item->has_expiry) {
+        return -1; // No expiry set
+    }
+    return std::chrono::duration_cast<std::chrono::milliseconds>(item->expiry - now).count();
+}
+
+Storage::ExpiryStats Storage::getExpiryStats() const {
+    ExpiryStats stats;
+    for (size_t i = 0; i < shard_count_; ++i) {
+        std::shared_lock<ShardMutex> lock(shards_[i].mutex);
+        stats.expired_lazy += shards_[i].expired_lazy;
+        stats.expired_active += shards_[i].expired_active;
+    }
+    return stats;
+}
+
+size_t Storage::size() const {
+    // Counts keys not yet reclaimed, including expired ones still in memory
+    size_t total = 0;
+    for (size_t i = 0; i < shard_count_; ++i) {
+        std::shared_lock<ShardMutex> lock(shards_[i].mutex);
+        total += shards_[i].data.size();
+    }
+    return total;
+}
+
+uint64_t Storage::scan(uint64_t cursor, const std::string& pattern, size_t count, std::vector<std::string>& keys) {
+    // The shard is in the low bits of the cursor and the position in its
+    // table above them, so the walk goes through the shards in order
+    size_t current = static_cast<size_t>(cursor) & (shard_count_ - 1);
+    uint64_t table_cursor = cursor >> shard_bits_;
+    count = std::max<size_t>(count, 1);
+    size_t steps = count * kScanStepsPerCount;
+    size_t visited = 0;
+    while (visited < count && steps > 0) {
+        Shard& shard = shards_[current];
+        {
+            std::shared_lock<ShardMutex> lock(shard.mutex);
+            do {
+                table_cursor = shard.data.scan(table_cursor, [&](const std::pair<std::string, Value>& entry) {
+                    if (!is_live(entry.second)) {
+                        return;
+                    }
+                    visited++;
+                    if (pattern.empty() || glob_match(pattern, entry.first)) {
+                        keys.push_back(entry.first);
+                    }
+                });
+                steps--;
+            } while (table_cursor != 0 && visited < count && steps > 0);
+        }
+        if (table_cursor == 0 && ++current == shard_count_) {
+            return 0;
         }
     }
-    
-    {
-        std::shared_lock<std::shared_mutex> lock(hash_mutex_);
-        auto it = hash_data_.find(key);
-        if (it != hash_data_.end()) {
-            if (!it->second.has_expiry) {
-                return -1; // No expiry set
+    return (table_cursor << shard_bits_) | current;
+}
+
+bool Storage::cron(std::chrono::microseconds budget) {
+    // Work done per lock acquisition, small enough that a client waiting on
+    // the shard barely notices
+    const size_t keys_per_step = 64;
+    const size_t slots_per_step = 1024;
+
+    // One clock read serves the whole run: a key that falls due while the
+    // sweep is running is left for the next one (or for a reader to drop)
+    auto now = std::chrono::steady_clock::now();
+    auto deadline = now + budget;
+    clock_.store(clock_seconds(), std::memory_order_relaxed);
+    sample_memory();
+
+    for (size_t n = 0; n < shard_count_; ++n) {
+        size_t index = (cron_cursor_ + n) & (shard_count_ - 1);
+        Shard& shard = shards_[index];
+        bool more = true;
+        while (more) {
+            std::unique_lock<ShardMutex> lock(shard.mutex, std::try_to_lock);
+            if (!lock.owns_lock()) {
+                break;
             }
-            if (is_expired(it->second.expiry)) {
-                hash_mutex_.unlock();
-                std::unique_lock<std::shared_mutex> unique_lock(hash_mutex_);
-                hash_data_.erase(it);
-                return -2; // Key expired
+            bool more_expired = expire_due(shard, now, keys_per_step);
+            bool more_rehash = shard.data.rehash_step(slots_per_step);
+            // Also flushes the shard's pending memory changes
+            charge(shard, 0, 0, true);
+            more = more_expired || more_rehash;
+            lock.unlock();
+            if (std::chrono::steady_clock::now() >= deadline) {
+                // Resume from this shard next time
+                cron_cursor_ = index;
+                return more;
             }
-            auto remaining = std::chrono::duration_cast<std::chrono::seconds>(
-                it->second.expiry - now).count();
-            return remaining;
         }
     }
-    
+    return false;
+}
+
+void Storage::keep_for_snapshot(Shard& shard, const std::string& key) {
+    // Only the first write since the snapshot began has the value to keep
+    auto kept = shard.snapshot_before.try_emplace(key);
+    if (!kept.second) {
+        return;
+    }
+    const auto& data = shard.data;
+    auto it = data.find(key);
+    if (it != data.end() && (!it->second.has_expiry || it->second.expiry > snapshot_time_)) {
+        kept.first->second = std::make_unique<Value>(it->second);
+    }
+}
+
+void Storage::snapshot(const SnapshotVisitor& visit, const std::function<void()>& after_batch) {
+    std::lock_guard<std::mutex> one_at_a_time(snapshot_mutex_);
     {
-        std::shared_lock<std::shared_mutex> lock(list_mutex_);
-        auto it = list_data_.find(key);
-        if (it != list_data_.end()) {
-            if (!it->second.has_expiry) {
-                return -1; // No expiry set
-            }
-            if (is_expired(it->second.expiry)) {
-                list_mutex_.unlock();
-                std::unique_lock<std::shared_mutex> unique_lock(list_mutex_);
-                list_data_.erase(it);
-                return -2; // Key expired
-            }
-            auto remaining = std::chrono::duration_cast<std::chrono::seconds>(
-                it->second.expiry - now).count();
-            return remaining;
+        std::vector<std::unique_lock<ShardMutex>> locks;
+        locks.reserve(shard_count_);
+        for (size_t i = 0; i < shard_count_; ++i) {
+            locks.emplace_back(shards_[i].mutex);
+        }
+        snapshot_time_ = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < shard_count_; ++i) {
+            shards_[i].snapshot_pending = true;
         }
     }
-    
-    {
-        std::shared_lock<std::shared_mutex> lock(set_mutex_);
-        auto it = set_data_.find(key);
-        if (it != set_data_.end()) {
-            if (!it->second.has_expiry) {
-                return -1; // No expiry set
+    auto live_then = [this](const Value& value) {
+        return !value.has_expiry || value.expiry > snapshot_time_;
+    };
+
+    for (size_t i = 0; i < shard_count_; ++i) {
+        Shard& shard = shards_[i];
+        // A key now in the shard either was not written since the start and
+        // has the value it had then, or has that value kept. The walk may
+        // meet a key twice if the table is resized between batches, so the
+        // keys visited are remembered; they are added after each batch, so
+        // growing that set never holds the lock.
+        const auto& before = shard.snapshot_before;
+        FlatHashSet<std::string> visited;
+        std::vector<std::string> batch;
+        batch.reserve(kSnapshotBatch);
+        uint64_t cursor = 0;
+        do {
+            batch.clear();
+            {
+                std::shared_lock<ShardMutex> lock(shard.mutex);
+                do {
+                    cursor = shard.data.scan(cursor, [&](const std::pair<std::string, Value>& entry) {
+                        if (visited.contains(entry.first)) {
+                            return;
+                        }
+                        batch.push_back(entry.first);
+                        auto kept = before.find(entry.first);
+                        if (kept != before.end()) {
+                            if (kept->second) {
+                                visit(entry.first, *kept->second);
+                            }
+                        } else if (live_then(entry.second)) {
+                            visit(entry.first, entry.second);
+                        }
+                    });
+                } while (cursor != 0 && batch.size() < kSnapshotBatch);
+            }
+            for (auto& key : batch) {
+                visited.insert(std::move(key));
             }
-            if (is_expired(it->second.expiry)) {
-                set_mutex_.unlock();
-                std::unique_lock<std::shared_mutex> unique_lock(set_mutex_);
-                set_data_.erase(it);
-                return -2; // Key expired
+            after_batch();
+        } while (cursor != 0);
+
+        // Done with the shard, writers stop keeping values. The keys deleted
+        // before the walk reached them are only left in what was kept, which
+        // is taken out of the shard to be sent and freed with no lock held.
+        Dict<std::string, std::unique_ptr<Value>> kept;
+        {
+            std::unique_lock<ShardMutex> lock(shard.mutex);
+            shard.snapshot_pending = false;
+            std::swap(kept, shard.snapshot_before);
+        }
+        for (const auto& entry : kept) {
+            if (entry.second && !visited.contains(entry.first)) {
+                visit(entry.first, *entry.second);
             }
-            auto remaining = std::chrono::duration_cast<std::chrono::seconds>(
-                it->second.expiry - now).count();
-            return remaining;
         }
+        after_batch();
     }
-    
-    return -2; // Key doesn't exist
-}
\ No newline at end of file
+}
+
+std::unordered_map<std::string, Storage::Value> Storage::getData() {
+    std::unordered_map<std::string, Value> result;
+    snapshot([&result](const std::string& key, const Value& value) { result.emplace(key, value); }, []() {});
+    return result;
+}